@@ -39,8 +39,14 @@ The RRR Allocator (RRRA)
    For messages, different allocation groups exist for different allocation
    types. Allocations are not put into different groups according to size.
 
+   Group allocations up to RRR_SLAB_OBJECT_MAX bytes are served from size
+   class slabs with per-thread caches, see rrr_slab.c. Larger allocations
+   and allocations done when the slab region is full use the mmaps.
+
    The function rrr_free() is used for all frees, regardless of how memory
-   was allocated. The correct method of freeing will be detected.
+   was allocated. The correct method of freeing will be detected by range
+   checking the slab region and by looking up the mmap in a radix map,
+   neither of which takes the index lock.
 
    A limited amount of memory is available for message. The program will
    restart if this limit is reached.
@@ -53,6 +59,7 @@ The RRR Allocator (RRRA)
 #include "log.h"
 #include "rrr_mmap.h"
 #include "rrr_mmap_stats.h"
+#include "rrr_slab.h"
 
 /* Size for new MMAPs. A collection contains multiple MMAPs. */
 #define RRR_DEFAULT_ALLOCATOR_MMAP_SIZE 16 * 1024 * 1024 /* 16 MB */
@@ -61,7 +68,13 @@ static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
 static struct rrr_mmap_collection rrr_allocator_collections[RRR_ALLOCATOR_GROUP_MAX + 1] = {0};
 
 static void *__rrr_allocate (size_t bytes, int group_num) {
-	void *ptr = rrr_mmap_collection_allocate (
+	void *ptr = rrr_slab_allocate(bytes, group_num);
+
+	if (ptr != NULL) {
+		return ptr;
+	}
+
+	ptr = rrr_mmap_collection_allocate (
 			&rrr_allocator_collections[group_num],
 			bytes,
 			bytes > RRR_DEFAULT_ALLOCATOR_MMAP_SIZE
@@ -86,12 +99,12 @@ void *rrr_allocate_group (size_t bytes, int group) {
 
 /* Frees both allocations done by OS allocator and group allocator */
 void rrr_free (void *ptr) {
-	if (rrr_mmap_collections_free (
-			rrr_allocator_collections,
-			RRR_ALLOCATOR_GROUP_MAX + 1,
-			&index_lock,
-			ptr
-	) == 0) {
+	if (rrr_slab_owns(ptr)) {
+		rrr_slab_free(ptr);
+		return;
+	}
+
+	if (rrr_mmap_collections_free(ptr) == 0) {
 		return;
 	}
 
@@ -102,18 +115,17 @@ void rrr_free (void *ptr) {
 static void *__rrr_reallocate (void *ptr_old, size_t bytes_old, size_t bytes_new, int group_num) {
 	void *ptr_new = NULL;
 
+	// Size classes often leave room to grow
+	if (ptr_old != NULL && bytes_new > 0 && rrr_slab_owns(ptr_old) && rrr_slab_usable_size(ptr_old) >= bytes_new) {
+		return ptr_old;
+	}
+
 	if (bytes_new > 0) {
-		ptr_new = rrr_mmap_collection_allocate (
-				&rrr_allocator_collections[group_num],
-				bytes_new,
-				RRR_DEFAULT_ALLOCATOR_MMAP_SIZE,
-				&index_lock,
-				0 // Not shared
-		);
+		ptr_new = __rrr_allocate(bytes_new, group_num);
 	}
 
 	if (ptr_old != NULL && ptr_new != NULL) {
-		memcpy(ptr_new, ptr_old, bytes_old);
+		memcpy(ptr_new, ptr_old, bytes_old < bytes_new ? bytes_old : bytes_new);
 		rrr_free(ptr_old);
 	}
 
@@ -146,8 +158,9 @@ char *rrr_strdup (const char *str) {
 	return result;
 }
 
-/* Free all mmaps, caller must ensure that users are no longer active */
+/* Free all mmaps and slabs, caller must ensure that users are no longer active */
 void rrr_allocator_cleanup (void) {
+	rrr_slab_cleanup();
 	rrr_mmap_collections_clear (
 			rrr_allocator_collections,
 			RRR_ALLOCATOR_GROUP_MAX + 1,
@@ -155,7 +168,7 @@ void rrr_allocator_cleanup (void) {
 	);
 }
 
-/* Free unused mmaps */
+/* Free unused mmaps and give empty slabs back to the OS */
 void rrr_allocator_maintenance (struct rrr_mmap_stats *stats) {
 	rrr_mmap_collections_maintenance (
 			stats,
@@ -163,6 +176,8 @@ void rrr_allocator_maintenance (struct rrr_mmap_stats *stats) {
 			RRR_ALLOCATOR_GROUP_MAX + 1,
 			&index_lock
 	);
+
+	rrr_slab_maintenance(stats);
 }
 
 void rrr_allocator_maintenance_nostats (void) {
@@ -38,6 +38,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "util/rrr_time.h"
 #include "util/gnu.h"
 #include "util/rrr_endian.h"
+#include "util/arena.h"
+#include "array_tag_index.h"
 #include "helpers/nullsafe_str.h"
 #include "parse.h"
 
@@ -52,6 +54,8 @@ static int __rrr_array_clone (
 		RRR_BUG("BUG: Target was not empty in rrr_array_clone\n");
 	}
 
+	// Clones are always heap allocated, release any arena left over
+	rrr_array_clear(target);
 	memset(target, '\0', sizeof(*target));
 
 	RRR_LL_ITERATE_BEGIN(source, const struct rrr_type_value);
@@ -406,6 +410,7 @@ void rrr_array_strip_type (
 		struct rrr_array *collection,
 		const struct rrr_type_definition *definition
 ) {
+	rrr_array_tag_index_invalidate(collection);
 	RRR_LL_ITERATE_BEGIN(collection, struct rrr_type_value);
 		if (node->definition == definition) {
 			RRR_LL_ITERATE_SET_DESTROY();
@@ -415,6 +420,43 @@ void rrr_array_strip_type (
 
 void rrr_array_clear (struct rrr_array *collection) {
 	RRR_LL_DESTROY(collection,struct rrr_type_value,rrr_type_value_destroy(node));
+	rrr_array_tag_index_invalidate(collection);
+	if (collection->arena != NULL) {
+		rrr_arena_destroy(collection->arena);
+		collection->arena = NULL;
+	}
+}
+
+void rrr_array_arena_enable (
+		struct rrr_array *array
+) {
+	array->do_arena = 1;
+}
+
+void rrr_array_tag_index_enable (
+		struct rrr_array *array
+) {
+	array->do_tag_index = 1;
+}
+
+void rrr_array_tag_index_invalidate (
+		struct rrr_array *array
+) {
+	if (array->tag_index != NULL) {
+		rrr_array_tag_index_destroy(array->tag_index);
+		array->tag_index = NULL;
+	}
+}
+
+void rrr_array_move (
+		struct rrr_array *target,
+		struct rrr_array *source
+) {
+	rrr_array_clear(target);
+	rrr_array_tag_index_invalidate(source);
+	RRR_LL_MERGE_AND_CLEAR_SOURCE_HEAD(target, source);
+	target->arena = source->arena;
+	source->arena = NULL;
 }
 
 void rrr_array_clear_void (void *collection) {
@@ -422,6 +464,7 @@ void rrr_array_clear_void (void *collection) {
 }
 
 void rrr_array_clear_by_tag (struct rrr_array *collection, const char *tag) {
+	rrr_array_tag_index_invalidate(collection);
 	RRR_LL_ITERATE_BEGIN(collection, struct rrr_type_value);
 		if (node->tag == NULL) {
 			RRR_LL_ITERATE_NEXT();
@@ -452,6 +495,15 @@ struct rrr_type_value *rrr_array_value_get_by_tag (
 		struct rrr_array *definition,
 		const char *tag
 ) {
+	struct rrr_type_value *value = NULL;
+	if (definition->do_tag_index &&
+	    RRR_LL_COUNT(definition) >= RRR_ARRAY_TAG_INDEX_MIN_VALUES &&
+	    rrr_array_tag_index_get(&value, definition, tag) == 0
+	) {
+		return value;
+	}
+
+	// Fall back to walking the list if the index could not be built
 	RRR_LL_ITERATE_BEGIN(definition, struct rrr_type_value);
 		if (node->tag != NULL) {
 			if (strcmp(node->tag, tag) == 0) {
@@ -467,6 +519,11 @@ const struct rrr_type_value *rrr_array_value_get_by_tag_const (
 		const struct rrr_array *definition,
 		const char *tag
 ) {
+	if (definition->do_tag_index) {
+		// Building the index does not modify the values, cast away const OK
+		return rrr_array_value_get_by_tag((struct rrr_array *) definition, tag);
+	}
+
 	RRR_LL_ITERATE_BEGIN(definition, const struct rrr_type_value);
 		if (node->tag != NULL) {
 			if (strcmp(node->tag, tag) == 0) {
@@ -780,6 +837,28 @@ int rrr_array_selected_tags_export (
 	return ret;
 }
 
+static struct rrr_msg_msg *__rrr_array_new_message (
+		uint64_t time,
+		const char *topic,
+		rrr_u16 topic_length,
+		rrr_length total_data_length
+) {
+	struct rrr_msg_msg *message = rrr_msg_msg_new_array(time, topic_length, total_data_length);
+	if (message == NULL) {
+		RRR_MSG_0("Could not create message for data collection\n");
+		return NULL;
+	}
+
+	message->version = RRR_ARRAY_VERSION;
+
+	if (topic_length > 0) {
+		char *topic_pos = MSG_TOPIC_PTR(message);
+		memcpy(topic_pos, topic, topic_length);
+	}
+
+	return message;
+}
+
 int rrr_array_new_message_from_collection (
 		struct rrr_msg_msg **final_message,
 		const struct rrr_array *definition,
@@ -793,20 +872,12 @@ int rrr_array_new_message_from_collection (
 
 	rrr_length total_data_length = rrr_array_get_packed_length(definition);
 
-	struct rrr_msg_msg *message = rrr_msg_msg_new_array(time, topic_length, total_data_length);
+	struct rrr_msg_msg *message = __rrr_array_new_message(time, topic, topic_length, total_data_length);
 	if (message == NULL) {
-		RRR_MSG_0("Could not create message for data collection\n");
 		ret = RRR_ARRAY_HARD_ERROR;
 		goto out;
 	}
 
-	message->version = RRR_ARRAY_VERSION;
-
-	if (topic_length > 0) {
-		char *topic_pos = MSG_TOPIC_PTR(message);
-		memcpy(topic_pos, topic, topic_length);
-	}
-
 	ssize_t written_bytes_total = 0;
 	int found_tags = 0;
 
@@ -836,6 +907,49 @@ int rrr_array_new_message_from_collection (
 	return ret;
 }
 
+// Produces the same message as rrr_array_new_message_from_collection would
+// for an array holding only the given value, without building the array
+int rrr_array_new_message_from_value (
+		struct rrr_msg_msg **final_message,
+		const struct rrr_type_value *value,
+		uint64_t time,
+		const char *topic,
+		rrr_u16 topic_length
+) {
+	int ret = 0;
+
+	*final_message = NULL;
+
+	rrr_length total_data_length = value->total_stored_length + value->tag_length + sizeof(struct rrr_array_value_packed) - 1;
+
+	struct rrr_msg_msg *message = __rrr_array_new_message(time, topic, topic_length, total_data_length);
+	if (message == NULL) {
+		ret = RRR_ARRAY_HARD_ERROR;
+		goto out;
+	}
+
+	struct pack_callback_data callback_data = {0};
+
+	callback_data.write_pos = MSG_DATA_PTR(message);
+
+	if ((ret = __rrr_array_collection_pack_callback(value, &callback_data)) != 0) {
+		RRR_MSG_0("Error while packing value in rrr_array_new_message_from_value return was %i\n", ret);
+		goto out;
+	}
+
+	if (callback_data.written_bytes_total != (ssize_t) total_data_length) {
+		RRR_BUG("Length mismatch after assembling message in rrr_array_new_message_from_value %li<>%lu\n",
+				callback_data.written_bytes_total, MSG_DATA_LENGTH(message));
+	}
+
+	*final_message = message;
+	message = NULL;
+
+	out:
+	RRR_ALLOCATOR_FREE_IF_NOT_NULL(message);
+	return ret;
+}
+
 int rrr_array_message_iterate (
 		const struct rrr_msg_msg *message_orig,
 		int (*callback)(RRR_TYPE_RAW_FIELDS, void *arg),
@@ -1043,6 +1157,7 @@ int rrr_array_message_clone_value_by_tag (
 
 struct rrr_array_message_append_to_collection_callback_data {
 	struct rrr_array *target_tmp;
+	struct rrr_arena *arena;
 };
 
 static int __rrr_array_message_append_to_collection_callback (
@@ -1058,16 +1173,14 @@ static int __rrr_array_message_append_to_collection_callback (
 	int ret = 0;
 
 	struct rrr_type_value *template = NULL;
-	if ((ret = rrr_type_value_new (
+	if ((ret = rrr_type_value_new_arena (
 			&template,
+			callback_data->arena,
 			type,
 			flags,
 			tag_length,
 			data_start,
-			total_length,
-			NULL,
 			element_count,
-			NULL,
 			total_length
 	)) != 0) {
 		RRR_MSG_0("Could not allocate value in __rrr_array_message_append_to_collection_callbackn\n");
@@ -1089,6 +1202,58 @@ static int __rrr_array_message_append_to_collection_callback (
 	return ret;
 }
 
+static int __rrr_array_message_arena_size_callback (
+		const char *data_start,
+		const struct rrr_type_definition *type,
+		rrr_type_flags flags,
+		rrr_length tag_length,
+		rrr_length total_length,
+		rrr_length element_count,
+		void *arg
+) {
+	size_t *size = arg;
+
+	(void)(data_start);
+	(void)(type);
+	(void)(flags);
+	(void)(element_count);
+
+	*size += RRR_ARENA_ALIGNED(sizeof(struct rrr_type_value)) +
+	         RRR_ARENA_ALIGNED((size_t) tag_length + 1) +
+	         RRR_ARENA_ALIGNED((size_t) total_length);
+
+	return 0;
+}
+
+static int __rrr_array_message_arena_prepare (
+		struct rrr_array *target,
+		const struct rrr_msg_msg *message_orig
+) {
+	int ret = 0;
+
+	if (target->arena != NULL) {
+		// Appending to array already having an arena, values will go
+		// into the remaining space or into overflow blocks
+		goto out;
+	}
+
+	size_t size = 0;
+	if ((ret = rrr_array_message_iterate (
+			message_orig,
+			__rrr_array_message_arena_size_callback,
+			&size
+	)) != 0) {
+		goto out;
+	}
+
+	if ((ret = rrr_arena_new(&target->arena, size)) != 0) {
+		goto out;
+	}
+
+	out:
+	return ret;
+}
+
 int rrr_array_message_append_to_collection (
 		uint16_t *array_version,
 		struct rrr_array *target,
@@ -1098,8 +1263,13 @@ int rrr_array_message_append_to_collection (
 
 	struct rrr_array target_tmp = {0};
 
+	if (target->do_arena && (ret = __rrr_array_message_arena_prepare(target, message_orig)) != 0) {
+		goto out;
+	}
+
 	struct rrr_array_message_append_to_collection_callback_data callback_data = {
-			&target_tmp
+			&target_tmp,
+			target->arena
 	};
 
 	if ((ret =  rrr_array_message_iterate (
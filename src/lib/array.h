@@ -41,6 +41,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_ARRAY_ITERATE_STOP	RRR_READ_EOF
 
 struct rrr_map;
+struct rrr_arena;
+struct rrr_array_tag_index;
 struct rrr_msg_msg;
 struct rrr_nullsafe_str;
 
@@ -53,11 +55,36 @@ struct rrr_array_value_packed {
 	char data[1];
 } __attribute((packed));
 
+// When do_arena is set, values parsed from messages are allocated in
+// an arena which is freed when the array is cleared. Such values must
+// not be moved to other arrays, clone them instead.
+//
+// When do_tag_index is set, lookups by tag use a hash index built on
+// first use. Values added or removed are detected, but the index must
+// be invalidated if a value changes its tag.
 struct rrr_array {
 	RRR_LL_HEAD(struct rrr_type_value);
 	uint16_t version;
+	uint8_t do_arena;
+	uint8_t do_tag_index;
+	struct rrr_arena *arena;
+	struct rrr_array_tag_index *tag_index;
 };
 
+void rrr_array_arena_enable (
+		struct rrr_array *array
+);
+void rrr_array_tag_index_enable (
+		struct rrr_array *array
+);
+void rrr_array_tag_index_invalidate (
+		struct rrr_array *array
+);
+void rrr_array_move (
+		struct rrr_array *target,
+		struct rrr_array *source
+);
+
 int rrr_array_clone_without_data (
 		struct rrr_array *target,
 		const struct rrr_array *source
@@ -168,6 +195,13 @@ int rrr_array_new_message_from_collection (
 		const char *topic,
 		rrr_u16 topic_length
 );
+int rrr_array_new_message_from_value (
+		struct rrr_msg_msg **final_message,
+		const struct rrr_type_value *value,
+		uint64_t time,
+		const char *topic,
+		rrr_u16 topic_length
+);
 int rrr_array_message_iterate (
 		const struct rrr_msg_msg *message_orig,
 		int (*callback)(RRR_TYPE_RAW_FIELDS, void *arg),
@@ -0,0 +1,508 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "allocator.h"
+#include "array.h"
+#include "array_flat.h"
+#include "messages/msg_msg_struct.h"
+#include "messages/msg_msg.h"
+#include "util/rrr_endian.h"
+#include "util/macro_utils.h"
+
+#define RRR_ARRAY_FLAT_ALIGNED(size) \
+	(((rrr_biglength) (size) + RRR_ARRAY_FLAT_ALIGN - 1) & ~((rrr_biglength) RRR_ARRAY_FLAT_ALIGN - 1))
+
+#define RRR_ARRAY_FLAT_VALUES_MIN 16
+#define RRR_ARRAY_FLAT_DATA_MIN   256
+
+void rrr_array_flat_reset (
+		struct rrr_array_flat *flat
+) {
+	flat->value_count = 0;
+	flat->data_size = 0;
+}
+
+void rrr_array_flat_clear (
+		struct rrr_array_flat *flat
+) {
+	RRR_FREE_IF_NOT_NULL(flat->values);
+	RRR_FREE_IF_NOT_NULL(flat->data);
+	memset(flat, '\0', sizeof(*flat));
+}
+
+static int __rrr_array_flat_reserve (
+		struct rrr_array_flat *flat,
+		rrr_biglength value_count,
+		rrr_biglength data_size
+) {
+	if (value_count > flat->value_capacity) {
+		rrr_biglength capacity = flat->value_capacity > 0 ? flat->value_capacity : RRR_ARRAY_FLAT_VALUES_MIN;
+		while (capacity < value_count) {
+			capacity *= 2;
+		}
+		if (capacity > RRR_LENGTH_MAX) {
+			RRR_MSG_0("Too many values in __rrr_array_flat_reserve\n");
+			return 1;
+		}
+		struct rrr_array_flat_value *values_new = rrr_reallocate(flat->values, sizeof(*values_new) * flat->value_capacity, sizeof(*values_new) * capacity);
+		if (values_new == NULL) {
+			RRR_MSG_0("Could not allocate memory for values in __rrr_array_flat_reserve\n");
+			return 1;
+		}
+		flat->values = values_new;
+		flat->value_capacity = (rrr_length) capacity;
+	}
+
+	if (data_size > flat->data_capacity) {
+		rrr_biglength capacity = flat->data_capacity > 0 ? flat->data_capacity : RRR_ARRAY_FLAT_DATA_MIN;
+		while (capacity < data_size) {
+			capacity *= 2;
+		}
+		if (capacity > RRR_LENGTH_MAX) {
+			RRR_MSG_0("Data too long in __rrr_array_flat_reserve\n");
+			return 1;
+		}
+		char *data_new = rrr_reallocate(flat->data, flat->data_capacity, capacity);
+		if (data_new == NULL) {
+			RRR_MSG_0("Could not allocate memory for data in __rrr_array_flat_reserve\n");
+			return 1;
+		}
+		flat->data = data_new;
+		flat->data_capacity = (rrr_length) capacity;
+	}
+
+	return 0;
+}
+
+static int __rrr_array_flat_push_value (
+		struct rrr_array_flat_value **result,
+		struct rrr_array_flat *flat,
+		const struct rrr_type_definition *definition,
+		rrr_type_flags flags,
+		const char *tag,
+		rrr_length tag_length,
+		const char *data,
+		rrr_length total_stored_length,
+		rrr_length element_count
+) {
+	const rrr_biglength tag_offset = flat->data_size;
+	const rrr_biglength data_offset = tag_offset + RRR_ARRAY_FLAT_ALIGNED(tag_length + (rrr_biglength) 1);
+	const rrr_biglength data_end = data_offset + RRR_ARRAY_FLAT_ALIGNED(total_stored_length);
+
+	if (__rrr_array_flat_reserve(flat, flat->value_count + (rrr_biglength) 1, data_end) != 0) {
+		return 1;
+	}
+
+	struct rrr_array_flat_value *value = &flat->values[flat->value_count];
+
+	value->definition = definition;
+	value->flags = flags;
+	value->tag_offset = (rrr_length) tag_offset;
+	value->tag_length = tag_length;
+	value->data_offset = (rrr_length) data_offset;
+	value->total_stored_length = total_stored_length;
+	value->element_count = element_count;
+
+	// Padding is zeroed to keep the buffer contents reproducible
+	if (tag_length > 0) {
+		memcpy(flat->data + tag_offset, tag, tag_length);
+	}
+	memset(flat->data + tag_offset + tag_length, '\0', data_offset - tag_offset - tag_length);
+
+	if (total_stored_length > 0) {
+		memcpy(flat->data + data_offset, data, total_stored_length);
+	}
+	memset(flat->data + data_offset + total_stored_length, '\0', data_end - data_offset - total_stored_length);
+
+	flat->value_count++;
+	flat->data_size = (rrr_length) data_end;
+
+	*result = value;
+
+	return 0;
+}
+
+int rrr_array_flat_push_value (
+		struct rrr_array_flat *flat,
+		const struct rrr_type_definition *definition,
+		rrr_type_flags flags,
+		const char *tag,
+		rrr_length tag_length,
+		const char *data,
+		rrr_length total_stored_length,
+		rrr_length element_count
+) {
+	struct rrr_array_flat_value *value_dummy;
+	return __rrr_array_flat_push_value (
+			&value_dummy,
+			flat,
+			definition,
+			flags,
+			tag,
+			tag_length,
+			data,
+			total_stored_length,
+			element_count
+	);
+}
+
+const struct rrr_array_flat_value *rrr_array_flat_value_get_by_tag (
+		const struct rrr_array_flat *flat,
+		const char *tag
+) {
+	for (rrr_length i = 0; i < flat->value_count; i++) {
+		const struct rrr_array_flat_value *value = &flat->values[i];
+		if (value->tag_length > 0 && strcmp(rrr_array_flat_value_tag(flat, value), tag) == 0) {
+			return value;
+		}
+	}
+	return NULL;
+}
+
+// The view points into the flat array and is only valid until it is
+// modified. Type functions which read values may be used on the view.
+void rrr_array_flat_value_view (
+		struct rrr_type_value *target,
+		const struct rrr_array_flat *flat,
+		const struct rrr_array_flat_value *value
+) {
+	memset(target, '\0', sizeof(*target));
+
+	target->definition = value->definition;
+	target->flags = value->flags;
+	target->tag_length = value->tag_length;
+	target->import_length = value->total_stored_length;
+	target->total_stored_length = value->total_stored_length;
+	target->element_count = value->element_count;
+	target->tag = (value->tag_length > 0 ? flat->data + value->tag_offset : NULL);
+	target->data = flat->data + value->data_offset;
+}
+
+rrr_length rrr_array_flat_get_packed_length (
+		const struct rrr_array_flat *flat
+) {
+	rrr_biglength result = 0;
+
+	for (rrr_length i = 0; i < flat->value_count; i++) {
+		const struct rrr_array_flat_value *value = &flat->values[i];
+		result += value->total_stored_length + sizeof(struct rrr_array_value_packed) - 1;
+		result += value->tag_length;
+	}
+
+	RRR_TYPES_BUG_IF_LENGTH_EXCEEDED(result, "rrr_array_flat_get_packed_length");
+
+	return (rrr_length) result;
+}
+
+static int __rrr_array_flat_message_append_callback (
+		const char *data_start,
+		const struct rrr_type_definition *type,
+		rrr_type_flags flags,
+		rrr_length tag_length,
+		rrr_length total_length,
+		rrr_length element_count,
+		void *arg
+) {
+	struct rrr_array_flat *target = arg;
+
+	int ret = 0;
+
+	struct rrr_array_flat_value *value = NULL;
+	if ((ret = __rrr_array_flat_push_value (
+			&value,
+			target,
+			type,
+			flags,
+			data_start,
+			tag_length,
+			data_start + tag_length,
+			total_length,
+			element_count
+	)) != 0) {
+		goto out;
+	}
+
+	// Convert endianess in place, the type may change the definition
+	// and element count
+	struct rrr_type_value view;
+	rrr_array_flat_value_view(&view, target, value);
+
+	if (view.definition->unpack(&view) != 0) {
+		RRR_MSG_0("Error while converting endianess for type '%s' index %" PRIrrrl " of array message\n",
+				type->identifier, target->value_count - 1);
+		ret = 1;
+		goto out;
+	}
+
+	value->definition = view.definition;
+	value->element_count = view.element_count;
+
+	out:
+	return ret;
+}
+
+int rrr_array_flat_message_append (
+		uint16_t *array_version,
+		struct rrr_array_flat *target,
+		const struct rrr_msg_msg *message_orig
+) {
+	int ret = 0;
+
+	const rrr_length value_count_orig = target->value_count;
+	const rrr_length data_size_orig = target->data_size;
+
+	// Tags and data take up about the same space as in the message, the
+	// packed value headers make up for the alignment padding
+	if ((ret = __rrr_array_flat_reserve (
+			target,
+			value_count_orig,
+			(rrr_biglength) data_size_orig + MSG_DATA_LENGTH(message_orig)
+	)) != 0) {
+		goto out;
+	}
+
+	if ((ret = rrr_array_message_iterate (
+			message_orig,
+			__rrr_array_flat_message_append_callback,
+			target
+	)) != 0) {
+		// Drop any values added from this message
+		target->value_count = value_count_orig;
+		target->data_size = data_size_orig;
+		goto out;
+	}
+
+	*array_version = message_orig->version;
+	target->version = message_orig->version;
+
+	out:
+	return ret;
+}
+
+// The stored data is copied directly for types which are packed as they are
+// stored, 64-bit types are converted to big endian while copying. Other
+// types use the pack function of the type.
+static int __rrr_array_flat_value_pack (
+		char *target,
+		rrr_length *written_bytes,
+		uint8_t *new_type,
+		const struct rrr_array_flat *flat,
+		const struct rrr_array_flat_value *value
+) {
+	const char *data = rrr_array_flat_value_data(flat, value);
+
+	switch (value->definition->type) {
+		case RRR_TYPE_BLOB:
+		case RRR_TYPE_SEP:
+		case RRR_TYPE_NSEP:
+		case RRR_TYPE_STX:
+			if (value->total_stored_length == 0) {
+				RRR_MSG_0("Length of type %u was 0 in rrr_array_flat_new_message\n", value->definition->type);
+				return RRR_ARRAY_SOFT_ERROR;
+			}
+			/* Fallthrough */
+		case RRR_TYPE_STR:
+			memcpy(target, data, value->total_stored_length);
+			*new_type = value->definition->type;
+			break;
+		case RRR_TYPE_H:
+		case RRR_TYPE_FIXP:
+			if (value->total_stored_length % sizeof(uint64_t) != 0) {
+				RRR_MSG_0("Size of 64 type was not 8 bytes in rrr_array_flat_new_message\n");
+				return RRR_ARRAY_SOFT_ERROR;
+			}
+			for (rrr_length pos = 0; pos < value->total_stored_length; pos += (rrr_length) sizeof(uint64_t)) {
+				uint64_t tmp;
+				memcpy(&tmp, data + pos, sizeof(tmp));
+				tmp = rrr_htobe64(tmp);
+				memcpy(target + pos, &tmp, sizeof(tmp));
+			}
+			*new_type = (value->definition->type == RRR_TYPE_H ? RRR_TYPE_BE : RRR_TYPE_FIXP);
+			break;
+		case RRR_TYPE_VAIN:
+			*new_type = RRR_TYPE_VAIN;
+			break;
+		default: {
+			if (value->definition->pack == NULL) {
+				RRR_BUG("No pack function defined for type %u in rrr_array_flat_new_message\n", value->definition->type);
+			}
+
+			struct rrr_type_value view;
+			rrr_array_flat_value_view(&view, flat, value);
+
+			if (value->definition->pack(target, written_bytes, new_type, &view) != 0) {
+				RRR_MSG_0("Error while packing data of type %u in rrr_array_flat_new_message\n", value->definition->type);
+				return RRR_ARRAY_SOFT_ERROR;
+			}
+
+			return 0;
+		}
+	};
+
+	*written_bytes = (value->definition->type == RRR_TYPE_VAIN ? 0 : value->total_stored_length);
+
+	return 0;
+}
+
+int rrr_array_flat_new_message (
+		struct rrr_msg_msg **final_message,
+		const struct rrr_array_flat *flat,
+		uint64_t time,
+		const char *topic,
+		rrr_u16 topic_length
+) {
+	int ret = 0;
+
+	*final_message = NULL;
+
+	rrr_length total_data_length = rrr_array_flat_get_packed_length(flat);
+
+	struct rrr_msg_msg *message = rrr_msg_msg_new_array(time, topic_length, total_data_length);
+	if (message == NULL) {
+		RRR_MSG_0("Could not create message in rrr_array_flat_new_message\n");
+		ret = RRR_ARRAY_HARD_ERROR;
+		goto out;
+	}
+
+	message->version = RRR_ARRAY_VERSION;
+
+	if (topic_length > 0) {
+		memcpy(MSG_TOPIC_PTR(message), topic, topic_length);
+	}
+
+	char *write_pos = MSG_DATA_PTR(message);
+
+	for (rrr_length i = 0; i < flat->value_count; i++) {
+		const struct rrr_array_flat_value *value = &flat->values[i];
+
+		struct rrr_array_value_packed *head = (struct rrr_array_value_packed *) write_pos;
+		write_pos += sizeof(*head) - 1;
+
+		if (value->tag_length > 0) {
+			memcpy(write_pos, rrr_array_flat_value_tag(flat, value), value->tag_length);
+			write_pos += value->tag_length;
+		}
+
+		uint8_t new_type = 0;
+		rrr_length written_bytes = 0;
+		if ((ret = __rrr_array_flat_value_pack(write_pos, &written_bytes, &new_type, flat, value)) != 0) {
+			goto out;
+		}
+
+		if (written_bytes != value->total_stored_length) {
+			RRR_BUG("Size mismatch in rrr_array_flat_new_message, %" PRIrrrl "<>%" PRIrrrl " bytes written\n",
+					written_bytes, value->total_stored_length);
+		}
+
+		write_pos += written_bytes;
+
+		head->type = new_type;
+		head->flags = value->flags;
+		head->tag_length = rrr_htobe32(value->tag_length);
+		head->elements = rrr_htobe32(value->element_count);
+		head->total_length = rrr_htobe32(written_bytes);
+	}
+
+	if (write_pos != MSG_DATA_PTR(message) + total_data_length) {
+		RRR_BUG("Length mismatch after assembling message in rrr_array_flat_new_message\n");
+	}
+
+	*final_message = message;
+	message = NULL;
+
+	out:
+	RRR_FREE_IF_NOT_NULL(message);
+	return ret;
+}
+
+int rrr_array_flat_append_from_array (
+		struct rrr_array_flat *target,
+		const struct rrr_array *source
+) {
+	int ret = 0;
+
+	RRR_LL_ITERATE_BEGIN(source, const struct rrr_type_value);
+		if ((ret = rrr_array_flat_push_value (
+				target,
+				node->definition,
+				node->flags,
+				node->tag,
+				node->tag_length,
+				node->data,
+				node->total_stored_length,
+				node->element_count
+		)) != 0) {
+			goto out;
+		}
+	RRR_LL_ITERATE_END();
+
+	target->version = source->version;
+
+	out:
+	return ret;
+}
+
+int rrr_array_flat_append_to_array (
+		struct rrr_array *target,
+		const struct rrr_array_flat *source
+) {
+	int ret = 0;
+
+	struct rrr_array target_tmp = {0};
+
+	for (rrr_length i = 0; i < source->value_count; i++) {
+		const struct rrr_array_flat_value *value = &source->values[i];
+
+		struct rrr_type_value *new_value = NULL;
+		if ((ret = rrr_type_value_new (
+				&new_value,
+				value->definition,
+				value->flags,
+				value->tag_length,
+				rrr_array_flat_value_tag(source, value),
+				value->total_stored_length,
+				NULL,
+				value->element_count,
+				NULL,
+				value->total_stored_length
+		)) != 0) {
+			RRR_MSG_0("Could not allocate value in rrr_array_flat_append_to_array\n");
+			goto out;
+		}
+
+		RRR_LL_APPEND(&target_tmp, new_value);
+
+		if (value->total_stored_length > 0) {
+			memcpy(new_value->data, rrr_array_flat_value_data(source, value), value->total_stored_length);
+		}
+	}
+
+	target->version = source->version;
+	RRR_LL_MERGE_AND_CLEAR_SOURCE_HEAD(target, &target_tmp);
+
+	out:
+	rrr_array_clear(&target_tmp);
+	return ret;
+}
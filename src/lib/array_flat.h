@@ -0,0 +1,128 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_ARRAY_FLAT_H
+#define RRR_ARRAY_FLAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rrr_types.h"
+#include "rrr_inttypes.h"
+#include "type.h"
+
+// Tags and data of every value are stored in one buffer, each part
+// aligned to RRR_ARRAY_FLAT_ALIGN. Tags are always zero terminated.
+#define RRR_ARRAY_FLAT_ALIGN 8
+
+struct rrr_array;
+struct rrr_msg_msg;
+
+struct rrr_array_flat_value {
+	const struct rrr_type_definition *definition;
+	rrr_length tag_offset;
+	rrr_length tag_length;
+	rrr_length data_offset;
+	rrr_length total_stored_length;
+	rrr_length element_count;
+	rrr_type_flags flags;
+};
+
+// Alternative to the linked list in struct rrr_array for users which
+// parse, read and pack messages without modifying single values. The
+// buffers are kept when the array is reset and reused by the next message.
+struct rrr_array_flat {
+	struct rrr_array_flat_value *values;
+	rrr_length value_count;
+	rrr_length value_capacity;
+	char *data;
+	rrr_length data_size;
+	rrr_length data_capacity;
+	uint16_t version;
+};
+
+#define RRR_ARRAY_FLAT_COUNT(flat) \
+	((flat)->value_count)
+
+static inline const char *rrr_array_flat_value_tag (
+		const struct rrr_array_flat *flat,
+		const struct rrr_array_flat_value *value
+) {
+	return flat->data + value->tag_offset;
+}
+
+static inline const char *rrr_array_flat_value_data (
+		const struct rrr_array_flat *flat,
+		const struct rrr_array_flat_value *value
+) {
+	return flat->data + value->data_offset;
+}
+
+void rrr_array_flat_reset (
+		struct rrr_array_flat *flat
+);
+void rrr_array_flat_clear (
+		struct rrr_array_flat *flat
+);
+int rrr_array_flat_push_value (
+		struct rrr_array_flat *flat,
+		const struct rrr_type_definition *definition,
+		rrr_type_flags flags,
+		const char *tag,
+		rrr_length tag_length,
+		const char *data,
+		rrr_length total_stored_length,
+		rrr_length element_count
+);
+const struct rrr_array_flat_value *rrr_array_flat_value_get_by_tag (
+		const struct rrr_array_flat *flat,
+		const char *tag
+);
+void rrr_array_flat_value_view (
+		struct rrr_type_value *target,
+		const struct rrr_array_flat *flat,
+		const struct rrr_array_flat_value *value
+);
+rrr_length rrr_array_flat_get_packed_length (
+		const struct rrr_array_flat *flat
+);
+int rrr_array_flat_message_append (
+		uint16_t *array_version,
+		struct rrr_array_flat *target,
+		const struct rrr_msg_msg *message_orig
+);
+int rrr_array_flat_new_message (
+		struct rrr_msg_msg **final_message,
+		const struct rrr_array_flat *flat,
+		uint64_t time,
+		const char *topic,
+		rrr_u16 topic_length
+);
+int rrr_array_flat_append_from_array (
+		struct rrr_array_flat *target,
+		const struct rrr_array *source
+);
+int rrr_array_flat_append_to_array (
+		struct rrr_array *target,
+		const struct rrr_array_flat *source
+);
+
+#endif /* RRR_ARRAY_FLAT_H */
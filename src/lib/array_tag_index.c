@@ -0,0 +1,288 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "allocator.h"
+#include "array.h"
+#include "array_tag_index.h"
+#include "map.h"
+#include "util/macro_utils.h"
+
+#define RRR_ARRAY_TAG_PLAN_NOT_FOUND ((rrr_length) -1)
+
+struct rrr_array_tag_index_entry {
+	uint64_t hash;
+	struct rrr_type_value *value;
+};
+
+// Open addressing with linear probing. Values are inserted in array order,
+// the first match when probing is therefore the first value with the tag.
+struct rrr_array_tag_index {
+	int node_count;
+	const struct rrr_type_value *first;
+	const struct rrr_type_value *last;
+	uint64_t mask;
+	struct rrr_array_tag_index_entry entries[];
+};
+
+struct rrr_array_tag_plan {
+	char **tags;
+	rrr_length tag_count;
+
+	// Positions found for the array layout with the given fingerprint
+	uint64_t fingerprint;
+	int node_count;
+	rrr_length *positions;
+
+	const struct rrr_type_value **values;
+	const struct rrr_type_value **nodes;
+	int nodes_capacity;
+};
+
+static uint64_t __rrr_array_tag_hash (
+		const char *tag
+) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (const unsigned char *pos = (const unsigned char *) tag; *pos != '\0'; pos++) {
+		hash ^= *pos;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+void rrr_array_tag_index_destroy (
+		struct rrr_array_tag_index *index
+) {
+	rrr_free(index);
+}
+
+static int __rrr_array_tag_index_build (
+		struct rrr_array *array
+) {
+	uint64_t capacity = 16;
+	while (capacity < (uint64_t) RRR_LL_COUNT(array) * 2) {
+		capacity *= 2;
+	}
+
+	struct rrr_array_tag_index *index = rrr_allocate(sizeof(*index) + sizeof(index->entries[0]) * capacity);
+	if (index == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_array_tag_index_build\n");
+		return 1;
+	}
+
+	memset(index->entries, '\0', sizeof(index->entries[0]) * capacity);
+
+	index->node_count = RRR_LL_COUNT(array);
+	index->first = RRR_LL_FIRST(array);
+	index->last = RRR_LL_LAST(array);
+	index->mask = capacity - 1;
+
+	RRR_LL_ITERATE_BEGIN(array, struct rrr_type_value);
+		if (node->tag == NULL || node->tag_length == 0) {
+			RRR_LL_ITERATE_NEXT();
+		}
+		const uint64_t hash = __rrr_array_tag_hash(node->tag);
+		uint64_t pos = hash & index->mask;
+		while (index->entries[pos].value != NULL) {
+			pos = (pos + 1) & index->mask;
+		}
+		index->entries[pos].hash = hash;
+		index->entries[pos].value = node;
+	RRR_LL_ITERATE_END();
+
+	rrr_array_tag_index_destroy(array->tag_index);
+	array->tag_index = index;
+
+	return 0;
+}
+
+// The index is rebuilt if values have been added or removed since it was
+// built. Values changing their tag must invalidate the index explicitly.
+int rrr_array_tag_index_get (
+		struct rrr_type_value **result,
+		struct rrr_array *array,
+		const char *tag
+) {
+	*result = NULL;
+
+	const struct rrr_array_tag_index *index = array->tag_index;
+	if (index == NULL ||
+	    index->node_count != RRR_LL_COUNT(array) ||
+	    index->first != RRR_LL_FIRST(array) ||
+	    index->last != RRR_LL_LAST(array)
+	) {
+		if (__rrr_array_tag_index_build(array) != 0) {
+			return 1;
+		}
+		index = array->tag_index;
+	}
+
+	const uint64_t hash = __rrr_array_tag_hash(tag);
+	for (uint64_t pos = hash & index->mask; index->entries[pos].value != NULL; pos = (pos + 1) & index->mask) {
+		const struct rrr_array_tag_index_entry *entry = &index->entries[pos];
+		if (entry->hash == hash && strcmp(entry->value->tag, tag) == 0) {
+			*result = entry->value;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int rrr_array_tag_plan_new (
+		struct rrr_array_tag_plan **target,
+		const struct rrr_map *tags
+) {
+	int ret = 0;
+
+	*target = NULL;
+
+	struct rrr_array_tag_plan *plan = rrr_allocate(sizeof(*plan));
+	if (plan == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_array_tag_plan_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(plan, '\0', sizeof(*plan));
+
+	plan->node_count = -1;
+
+	const size_t count = (size_t) RRR_MAP_COUNT(tags);
+
+	if ((plan->tags = rrr_allocate(sizeof(*plan->tags) * (count + 1))) == NULL ||
+	    (plan->positions = rrr_allocate(sizeof(*plan->positions) * (count + 1))) == NULL ||
+	    (plan->values = rrr_allocate(sizeof(*plan->values) * (count + 1))) == NULL
+	) {
+		RRR_MSG_0("Could not allocate memory for tags in rrr_array_tag_plan_new\n");
+		ret = 1;
+		goto out_destroy;
+	}
+
+	RRR_MAP_ITERATE_BEGIN_CONST(tags);
+		if ((plan->tags[plan->tag_count] = rrr_strdup(node_tag)) == NULL) {
+			RRR_MSG_0("Could not allocate memory for tag in rrr_array_tag_plan_new\n");
+			ret = 1;
+			goto out_destroy;
+		}
+		plan->tag_count++;
+	RRR_MAP_ITERATE_END();
+
+	*target = plan;
+
+	goto out;
+	out_destroy:
+		rrr_array_tag_plan_destroy(plan);
+	out:
+		return ret;
+}
+
+void rrr_array_tag_plan_destroy (
+		struct rrr_array_tag_plan *plan
+) {
+	if (plan->tags != NULL) {
+		for (rrr_length i = 0; i < plan->tag_count; i++) {
+			rrr_free(plan->tags[i]);
+		}
+	}
+	RRR_FREE_IF_NOT_NULL(plan->tags);
+	RRR_FREE_IF_NOT_NULL(plan->positions);
+	RRR_FREE_IF_NOT_NULL(plan->values);
+	RRR_FREE_IF_NOT_NULL(plan->nodes);
+	rrr_free(plan);
+}
+
+static void __rrr_array_tag_plan_compile (
+		struct rrr_array_tag_plan *plan,
+		int node_count,
+		uint64_t fingerprint
+) {
+	for (rrr_length i = 0; i < plan->tag_count; i++) {
+		plan->positions[i] = RRR_ARRAY_TAG_PLAN_NOT_FOUND;
+		for (int j = 0; j < node_count; j++) {
+			const struct rrr_type_value *node = plan->nodes[j];
+			if (node->tag != NULL && strcmp(node->tag, plan->tags[i]) == 0) {
+				plan->positions[i] = (rrr_length) j;
+				break;
+			}
+		}
+	}
+
+	plan->node_count = node_count;
+	plan->fingerprint = fingerprint;
+}
+
+// Resolves the tags of the plan to values in the array, values not found
+// are set to NULL. The positions of the values are kept and reused as long
+// as following arrays have the same layout of tags. The returned value list
+// is valid until the next call.
+int rrr_array_tag_plan_resolve (
+		const struct rrr_type_value ***values,
+		struct rrr_array_tag_plan *plan,
+		const struct rrr_array *array
+) {
+	*values = NULL;
+
+	const int node_count = RRR_LL_COUNT(array);
+
+	if (node_count > plan->nodes_capacity) {
+		const struct rrr_type_value **nodes_new = rrr_reallocate (
+				plan->nodes,
+				sizeof(*plan->nodes) * (size_t) plan->nodes_capacity,
+				sizeof(*plan->nodes) * (size_t) node_count
+		);
+		if (nodes_new == NULL) {
+			RRR_MSG_0("Could not allocate memory in rrr_array_tag_plan_resolve\n");
+			return 1;
+		}
+		plan->nodes = nodes_new;
+		plan->nodes_capacity = node_count;
+	}
+
+	uint64_t fingerprint = 0;
+	int i = 0;
+	RRR_LL_ITERATE_BEGIN(array, const struct rrr_type_value);
+		plan->nodes[i++] = node;
+		fingerprint = (fingerprint * 31) + (node->tag != NULL ? __rrr_array_tag_hash(node->tag) : 0);
+	RRR_LL_ITERATE_END();
+
+	if (plan->node_count != node_count || plan->fingerprint != fingerprint) {
+		__rrr_array_tag_plan_compile(plan, node_count, fingerprint);
+	}
+
+	for (rrr_length j = 0; j < plan->tag_count; j++) {
+		const rrr_length pos = plan->positions[j];
+		plan->values[j] = (pos != RRR_ARRAY_TAG_PLAN_NOT_FOUND ? plan->nodes[pos] : NULL);
+
+		// Guard against different layouts having the same fingerprint
+		if (plan->values[j] != NULL && strcmp(plan->values[j]->tag, plan->tags[j]) != 0) {
+			__rrr_array_tag_plan_compile(plan, node_count, fingerprint);
+			j = (rrr_length) -1;
+		}
+	}
+
+	*values = plan->values;
+
+	return 0;
+}
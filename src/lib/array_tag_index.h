@@ -0,0 +1,57 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_ARRAY_TAG_INDEX_H
+#define RRR_ARRAY_TAG_INDEX_H
+
+#include "rrr_types.h"
+
+// Arrays with fewer values than this are searched by walking the list
+#define RRR_ARRAY_TAG_INDEX_MIN_VALUES 24
+
+struct rrr_array;
+struct rrr_type_value;
+struct rrr_map;
+struct rrr_array_tag_index;
+struct rrr_array_tag_plan;
+
+void rrr_array_tag_index_destroy (
+		struct rrr_array_tag_index *index
+);
+int rrr_array_tag_index_get (
+		struct rrr_type_value **result,
+		struct rrr_array *array,
+		const char *tag
+);
+int rrr_array_tag_plan_new (
+		struct rrr_array_tag_plan **target,
+		const struct rrr_map *tags
+);
+void rrr_array_tag_plan_destroy (
+		struct rrr_array_tag_plan *plan
+);
+int rrr_array_tag_plan_resolve (
+		const struct rrr_type_value ***values,
+		struct rrr_array_tag_plan *plan,
+		const struct rrr_array *array
+);
+
+#endif /* RRR_ARRAY_TAG_INDEX_H */
@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "log.h"
 #include "array_tree.h"
+#include "array_tree_program.h"
 #include "array.h"
 #include "type.h"
 #include "parse.h"
@@ -33,6 +34,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "allocator.h"
 #include "util/linked_list.h"
 #include "util/rrr_time.h"
+#include "util/arena.h"
+
+// Initial arena size when importing, larger arrays get overflow blocks
+#define RRR_ARRAY_TREE_IMPORT_ARENA_SIZE 4096
 
 static void __rrr_array_branch_destroy (
 		struct rrr_array_branch *branch
@@ -63,6 +68,10 @@ void rrr_array_tree_clear (
 ) {
 	RRR_LL_DESTROY(tree, struct rrr_array_node, __rrr_array_node_destroy(node));
 	RRR_FREE_IF_NOT_NULL(tree->name);
+	if (tree->program != NULL) {
+		rrr_array_tree_program_destroy(tree->program);
+		tree->program = NULL;
+	}
 }
 
 void rrr_array_tree_destroy (
@@ -141,6 +150,11 @@ static struct rrr_array_node *__rrr_array_node_allocate (void) {
 	return node;
 }
 
+static int __rrr_array_tree_clone_without_data (
+		struct rrr_array_tree **target,
+		const struct rrr_array_tree *source
+);
+
 static int __rrr_array_branch_clone_without_data (
 		struct rrr_array_branch **target,
 		const struct rrr_array_branch *source
@@ -158,7 +172,7 @@ static int __rrr_array_branch_clone_without_data (
 	}
 
 	if (source->array_tree != NULL) {
-		if ((ret = rrr_array_tree_clone_without_data(&new_branch->array_tree, source->array_tree)) != 0) {
+		if ((ret = __rrr_array_tree_clone_without_data(&new_branch->array_tree, source->array_tree)) != 0) {
 			goto out;
 		}
 	}
@@ -172,7 +186,7 @@ static int __rrr_array_branch_clone_without_data (
 	RRR_LL_ITERATE_END();
 
 	if (source->tree_else != NULL) {
-		if ((ret = rrr_array_tree_clone_without_data(&new_branch->tree_else, source->tree_else)) != 0) {
+		if ((ret = __rrr_array_tree_clone_without_data(&new_branch->tree_else, source->tree_else)) != 0) {
 			goto out;
 		}
 	}
@@ -994,6 +1008,10 @@ int rrr_array_tree_interpret_raw (
 		goto out;
 	}
 
+	if ((ret = rrr_array_tree_program_new(&new_tree->program, new_tree)) != 0) {
+		goto out;
+	}
+
 	*target = new_tree;
 	new_tree = NULL;
 
@@ -1322,7 +1340,7 @@ int __rrr_array_tree_import_value_callback (
 	int ret = 0;
 
 	struct rrr_type_value *new_value = NULL;
-	if ((ret = rrr_type_value_clone(&new_value, value, 0)) != 0) {
+	if ((ret = rrr_type_value_clone_arena(&new_value, target_array->arena, value, 0)) != 0) {
 		goto out;
 	}
 
@@ -1400,6 +1418,8 @@ int __rrr_array_tree_import_value_callback (
 static int __rrr_array_tree_import_condition_name_evaluate_callback (
 		RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS
 ) {
+	(void)(name_index);
+
 	*result = 0;
 
 	struct rrr_array *array_tmp = arg;
@@ -1456,7 +1476,7 @@ int __rrr_array_tree_import_leaf_callback (
 	return 0;
 }
 
-int rrr_array_tree_clone_without_data (
+static int __rrr_array_tree_clone_without_data (
 		struct rrr_array_tree **target,
 		const struct rrr_array_tree *source
 ) {
@@ -1487,6 +1507,32 @@ int rrr_array_tree_clone_without_data (
 	return ret;
 }
 
+int rrr_array_tree_clone_without_data (
+		struct rrr_array_tree **target,
+		const struct rrr_array_tree *source
+) {
+	int ret = 0;
+
+	struct rrr_array_tree *new_tree = NULL;
+
+	if ((ret = __rrr_array_tree_clone_without_data(&new_tree, source)) != 0) {
+		goto out;
+	}
+
+	if ((ret = rrr_array_tree_program_new(&new_tree->program, new_tree)) != 0) {
+		goto out;
+	}
+
+	*target = new_tree;
+	new_tree = NULL;
+
+	out:
+	if (new_tree != NULL) {
+		rrr_array_tree_destroy(new_tree);
+	}
+	return ret;
+}
+
 int rrr_array_tree_import_from_buffer (
 		ssize_t *parsed_bytes,
 		const char *buf,
@@ -1499,12 +1545,31 @@ int rrr_array_tree_import_from_buffer (
 
 	*parsed_bytes = 0;
 
+	if (tree->program != NULL) {
+		return rrr_array_tree_program_import_from_buffer (
+				parsed_bytes,
+				buf,
+				buf_len,
+				tree->program,
+				callback,
+				callback_arg
+		);
+	}
+
 	struct rrr_array_tree_import_callback_data callback_data = {0};
 
 	callback_data.start = buf;
 	callback_data.pos = buf;
 	callback_data.end = buf + buf_len;
 
+	// Values and their data are freed all at once after the callback. The
+	// callback may keep the values by moving them to an array of its own.
+	if ((ret = rrr_arena_new(&callback_data.array.arena, RRR_ARRAY_TREE_IMPORT_ARENA_SIZE)) != 0) {
+		ret = RRR_ARRAY_TREE_HARD_ERROR;
+		goto out;
+	}
+	rrr_array_arena_enable(&callback_data.array);
+
 	if ((ret = __rrr_array_tree_iterate (
 			tree,
 			0,
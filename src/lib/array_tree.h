@@ -40,6 +40,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 struct rrr_array_branch;
 struct rrr_array_node;
+struct rrr_array_tree_program;
 
 struct rrr_array_branch_collection {
 	RRR_LL_HEAD(struct rrr_array_branch);
@@ -65,6 +66,9 @@ struct rrr_array_tree {
 	RRR_LL_HEAD(struct rrr_array_node);
 	RRR_LL_NODE(struct rrr_array_tree);
 	char *name;
+	// Compiled form used when importing, only set for complete trees
+	// returned from interpret_raw and clone_without_data
+	struct rrr_array_tree_program *program;
 };
 
 struct rrr_array_tree_list {
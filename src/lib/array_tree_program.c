@@ -0,0 +1,861 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "allocator.h"
+#include "array.h"
+#include "array_tree.h"
+#include "array_tree_program.h"
+#include "condition.h"
+#include "type.h"
+#include "util/arena.h"
+#include "util/macro_utils.h"
+
+// The array tree is compiled into a flat list of instructions which is
+// executed without recursion. Every VALUE instruction adds one value to
+// the result and REWIND removes values, which makes the values on the
+// top of the stack known at compile time for most positions. References
+// to tags in conditions and lengths are resolved to stack offsets where
+// possible, others are looked up by name when the program runs.
+
+// Initial arena size when importing, larger arrays get overflow blocks
+#define RRR_ARRAY_TREE_PROGRAM_ARENA_SIZE 4096
+
+// Offset used for tags which must be looked up by name
+#define RRR_ARRAY_TREE_PROGRAM_OFFSET_DYNAMIC -1
+
+enum rrr_array_tree_program_op {
+	RRR_ARRAY_TREE_PROGRAM_OP_REWIND,
+	RRR_ARRAY_TREE_PROGRAM_OP_CHECK_LENGTH,
+	RRR_ARRAY_TREE_PROGRAM_OP_VALUE,
+	RRR_ARRAY_TREE_PROGRAM_OP_BRANCH,
+	RRR_ARRAY_TREE_PROGRAM_OP_JUMP
+};
+
+struct rrr_array_tree_program_name {
+	char *name;
+	int offset;
+};
+
+struct rrr_array_tree_program_instruction {
+	enum rrr_array_tree_program_op op;
+
+	// Rewind count, minimum length of a fixed size run of values or
+	// jump target for JUMP and false conditions of BRANCH
+	rrr_length arg;
+
+	// VALUE: Template without references, references are resolved
+	// separately and the lengths are set after cloning.
+	struct rrr_type_value value;
+	const char *import_length_ref;
+	const char *element_count_ref;
+	int import_length_offset;
+	int element_count_offset;
+	int is_checked;
+
+	// BRANCH: Names used in the condition
+	const struct rrr_condition *condition;
+	struct rrr_array_tree_program_name *names;
+	int name_count;
+};
+
+struct rrr_array_tree_program {
+	struct rrr_array_tree_program_instruction *instructions;
+	rrr_length instruction_count;
+	rrr_length instruction_capacity;
+	rrr_length value_count;
+};
+
+// Values known to be on top of the stack at compile time, the first
+// value is the bottom of the known part
+struct rrr_array_tree_program_stack {
+	const struct rrr_type_value **values;
+	rrr_length count;
+	rrr_length capacity;
+};
+
+static void __rrr_array_tree_program_stack_clear (
+		struct rrr_array_tree_program_stack *stack
+) {
+	RRR_FREE_IF_NOT_NULL(stack->values);
+	memset(stack, '\0', sizeof(*stack));
+}
+
+static int __rrr_array_tree_program_stack_push (
+		struct rrr_array_tree_program_stack *stack,
+		const struct rrr_type_value *value
+) {
+	if (stack->count == stack->capacity) {
+		rrr_length capacity_new = stack->capacity == 0 ? 16 : stack->capacity * 2;
+		const struct rrr_type_value **values_new = rrr_reallocate (
+				stack->values,
+				sizeof(*values_new) * stack->capacity,
+				sizeof(*values_new) * capacity_new
+		);
+		if (values_new == NULL) {
+			RRR_MSG_0("Could not allocate memory in __rrr_array_tree_program_stack_push\n");
+			return 1;
+		}
+		stack->values = values_new;
+		stack->capacity = capacity_new;
+	}
+	stack->values[stack->count++] = value;
+	return 0;
+}
+
+static int __rrr_array_tree_program_stack_copy (
+		struct rrr_array_tree_program_stack *target,
+		const struct rrr_array_tree_program_stack *source
+) {
+	for (rrr_length i = 0; i < source->count; i++) {
+		if (__rrr_array_tree_program_stack_push(target, source->values[i]) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void __rrr_array_tree_program_stack_rewind (
+		struct rrr_array_tree_program_stack *stack,
+		rrr_length count
+) {
+	// Rewinding past the known values makes the whole stack unknown
+	stack->count = count > stack->count ? 0 : stack->count - count;
+}
+
+// Keep only the top values which are equal in both stacks
+static void __rrr_array_tree_program_stack_merge (
+		struct rrr_array_tree_program_stack *target,
+		const struct rrr_array_tree_program_stack *source
+) {
+	rrr_length common = 0;
+	while (common < target->count && common < source->count &&
+	       target->values[target->count - 1 - common] == source->values[source->count - 1 - common]
+	) {
+		common++;
+	}
+
+	memmove(target->values, target->values + target->count - common, sizeof(*(target->values)) * common);
+	target->count = common;
+}
+
+// Same matching as when tags are looked up while importing
+static int __rrr_array_tree_program_stack_resolve (
+		const struct rrr_array_tree_program_stack *stack,
+		const char *name
+) {
+	for (rrr_length i = stack->count; i > 0; i--) {
+		const struct rrr_type_value *value = stack->values[i - 1];
+		if (value->tag != NULL && strncmp(name, value->tag, value->tag_length) == 0) {
+			return (int) (stack->count - i);
+		}
+	}
+	return RRR_ARRAY_TREE_PROGRAM_OFFSET_DYNAMIC;
+}
+
+void rrr_array_tree_program_destroy (
+		struct rrr_array_tree_program *program
+) {
+	for (rrr_length i = 0; i < program->instruction_count; i++) {
+		struct rrr_array_tree_program_instruction *instruction = &program->instructions[i];
+		for (int j = 0; j < instruction->name_count; j++) {
+			rrr_free(instruction->names[j].name);
+		}
+		RRR_FREE_IF_NOT_NULL(instruction->names);
+	}
+	RRR_FREE_IF_NOT_NULL(program->instructions);
+	rrr_free(program);
+}
+
+static int __rrr_array_tree_program_instruction_push (
+		struct rrr_array_tree_program_instruction **result,
+		struct rrr_array_tree_program *program,
+		enum rrr_array_tree_program_op op
+) {
+	if (program->instruction_count == program->instruction_capacity) {
+		rrr_length capacity_new = program->instruction_capacity == 0 ? 16 : program->instruction_capacity * 2;
+		struct rrr_array_tree_program_instruction *instructions_new = rrr_reallocate (
+				program->instructions,
+				sizeof(*instructions_new) * program->instruction_capacity,
+				sizeof(*instructions_new) * capacity_new
+		);
+		if (instructions_new == NULL) {
+			RRR_MSG_0("Could not allocate memory in __rrr_array_tree_program_instruction_push\n");
+			return 1;
+		}
+		program->instructions = instructions_new;
+		program->instruction_capacity = capacity_new;
+	}
+
+	struct rrr_array_tree_program_instruction *instruction = &program->instructions[program->instruction_count++];
+	memset(instruction, '\0', sizeof(*instruction));
+	instruction->op = op;
+
+	*result = instruction;
+
+	return 0;
+}
+
+// Checks done while importing which may be done at compile time for
+// values without references
+static int __rrr_array_tree_program_value_is_valid (
+		const struct rrr_type_value *value
+) {
+	return value->import_length_ref == NULL &&
+	       value->element_count_ref == NULL &&
+	       (value->import_length != 0 || value->definition->max_length == 0) &&
+	       value->element_count != 0 &&
+	       value->import_length <= value->definition->max_length;
+}
+
+// Fixed size types which only fail to import when data is missing
+static int __rrr_array_tree_program_value_is_fixed (
+		const struct rrr_type_value *value
+) {
+	const rrr_type type = value->definition->type;
+	return __rrr_array_tree_program_value_is_valid(value) && (
+	       type == RRR_TYPE_LE ||
+	       type == RRR_TYPE_BE ||
+	       type == RRR_TYPE_H ||
+	       type == RRR_TYPE_BLOB
+	);
+}
+
+static int __rrr_array_tree_program_compile_value (
+		struct rrr_array_tree_program *program,
+		struct rrr_array_tree_program_stack *stack,
+		const struct rrr_type_value *value
+) {
+	struct rrr_array_tree_program_instruction *instruction;
+
+	if (__rrr_array_tree_program_instruction_push(&instruction, program, RRR_ARRAY_TREE_PROGRAM_OP_VALUE) != 0) {
+		return 1;
+	}
+
+	if (value->definition->import == NULL) {
+		RRR_BUG("BUG: No convert function found for type %d\n", value->definition->type);
+	}
+
+	instruction->value = *value;
+	instruction->value.import_length_ref = NULL;
+	instruction->value.element_count_ref = NULL;
+	instruction->value.data = NULL;
+	instruction->import_length_ref = value->import_length_ref;
+	instruction->element_count_ref = value->element_count_ref;
+	instruction->import_length_offset = value->import_length_ref != NULL
+		? __rrr_array_tree_program_stack_resolve(stack, value->import_length_ref)
+		: RRR_ARRAY_TREE_PROGRAM_OFFSET_DYNAMIC;
+	instruction->element_count_offset = value->element_count_ref != NULL
+		? __rrr_array_tree_program_stack_resolve(stack, value->element_count_ref)
+		: RRR_ARRAY_TREE_PROGRAM_OFFSET_DYNAMIC;
+	instruction->is_checked = __rrr_array_tree_program_value_is_valid(value);
+
+	program->value_count++;
+
+	return __rrr_array_tree_program_stack_push(stack, value);
+}
+
+static int __rrr_array_tree_program_compile_values (
+		struct rrr_array_tree_program *program,
+		struct rrr_array_tree_program_stack *stack,
+		const struct rrr_array *array
+) {
+	const struct rrr_type_value *run_end = NULL;
+
+	RRR_LL_ITERATE_BEGIN(array, const struct rrr_type_value);
+		if (node == run_end) {
+			run_end = NULL;
+		}
+
+		// Check once for all data of consecutive fixed size values
+		if (run_end == NULL && __rrr_array_tree_program_value_is_fixed(node)) {
+			uint64_t run_length = 0;
+			int run_count = 0;
+			for (run_end = node; run_end != NULL && __rrr_array_tree_program_value_is_fixed(run_end); run_end = run_end->ptr_next) {
+				run_length += (uint64_t) run_end->import_length * run_end->element_count;
+				run_count++;
+			}
+
+			if (run_count > 1 && run_length <= RRR_LENGTH_MAX) {
+				struct rrr_array_tree_program_instruction *instruction;
+				if (__rrr_array_tree_program_instruction_push(&instruction, program, RRR_ARRAY_TREE_PROGRAM_OP_CHECK_LENGTH) != 0) {
+					return 1;
+				}
+				instruction->arg = (rrr_length) run_length;
+			}
+		}
+
+		if (__rrr_array_tree_program_compile_value(program, stack, node) != 0) {
+			return 1;
+		}
+	RRR_LL_ITERATE_END();
+
+	return 0;
+}
+
+// Names are stored in the same order as in the condition allowing
+// lookup by the index passed during evaluation
+static int __rrr_array_tree_program_condition_names_resolve (
+		struct rrr_array_tree_program_instruction *instruction,
+		const struct rrr_array_tree_program_stack *stack,
+		const struct rrr_condition *condition
+) {
+	const int name_count = rrr_condition_name_count(condition);
+
+	if (name_count == 0) {
+		return 0;
+	}
+
+	if ((instruction->names = rrr_allocate(sizeof(*(instruction->names)) * (size_t) name_count)) == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_array_tree_program_condition_names_resolve\n");
+		return 1;
+	}
+
+	for (int i = 0; i < name_count; i++) {
+		struct rrr_array_tree_program_name *name = &instruction->names[i];
+		if ((name->name = rrr_strdup(rrr_condition_name_get(condition, i))) == NULL) {
+			RRR_MSG_0("Could not allocate memory in __rrr_array_tree_program_condition_names_resolve\n");
+			return 1;
+		}
+		name->offset = __rrr_array_tree_program_stack_resolve(stack, name->name);
+		instruction->name_count++;
+	}
+
+	return 0;
+}
+
+static int __rrr_array_tree_program_compile_tree (
+		struct rrr_array_tree_program *program,
+		struct rrr_array_tree_program_stack *stack,
+		const struct rrr_array_tree *tree
+);
+
+static int __rrr_array_tree_program_compile_branch (
+		struct rrr_array_tree_program *program,
+		struct rrr_array_tree_program_stack *stack,
+		const struct rrr_array_branch *branch_if
+) {
+	int ret = 0;
+
+	struct rrr_array_tree_program_stack stack_result = {0};
+	struct rrr_array_tree_program_stack stack_branch = {0};
+	rrr_length *jumps = NULL;
+	rrr_length jump_count = 0;
+
+	const struct rrr_array_branch *branches[1 + RRR_LL_COUNT(&branch_if->branches_elsif)];
+	int branch_count = 0;
+
+	branches[branch_count++] = branch_if;
+	RRR_LL_ITERATE_BEGIN(&branch_if->branches_elsif, const struct rrr_array_branch);
+		branches[branch_count++] = node;
+	RRR_LL_ITERATE_END();
+
+	if ((jumps = rrr_allocate(sizeof(*jumps) * (size_t) branch_count)) == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_array_tree_program_compile_branch\n");
+		ret = 1;
+		goto out;
+	}
+
+	int have_result = 0;
+
+	// Each condition jumps to the next one when false, and each branch
+	// jumps past the remaining branches when done.
+	for (int i = 0; i < branch_count; i++) {
+		const struct rrr_array_branch *branch = branches[i];
+		struct rrr_array_tree_program_instruction *instruction;
+
+		if ((ret = __rrr_array_tree_program_instruction_push(&instruction, program, RRR_ARRAY_TREE_PROGRAM_OP_BRANCH)) != 0) {
+			goto out;
+		}
+
+		const rrr_length branch_pos = program->instruction_count - 1;
+
+		instruction->condition = &branch->condition;
+
+		if ((ret = __rrr_array_tree_program_condition_names_resolve(instruction, stack, &branch->condition)) != 0) {
+			goto out;
+		}
+
+		__rrr_array_tree_program_stack_clear(&stack_branch);
+		if ((ret = __rrr_array_tree_program_stack_copy(&stack_branch, stack)) != 0) {
+			goto out;
+		}
+
+		if (branch->array_tree != NULL) {
+			if ((ret = __rrr_array_tree_program_compile_tree(program, &stack_branch, branch->array_tree)) != 0) {
+				goto out;
+			}
+		}
+
+		if ((ret = __rrr_array_tree_program_instruction_push(&instruction, program, RRR_ARRAY_TREE_PROGRAM_OP_JUMP)) != 0) {
+			goto out;
+		}
+
+		jumps[jump_count++] = program->instruction_count - 1;
+		program->instructions[branch_pos].arg = program->instruction_count;
+
+		if (have_result) {
+			__rrr_array_tree_program_stack_merge(&stack_result, &stack_branch);
+		}
+		else {
+			if ((ret = __rrr_array_tree_program_stack_copy(&stack_result, &stack_branch)) != 0) {
+				goto out;
+			}
+			have_result = 1;
+		}
+	}
+
+	// Without ELSE, the stack is left unchanged when all conditions are false
+	__rrr_array_tree_program_stack_clear(&stack_branch);
+	if ((ret = __rrr_array_tree_program_stack_copy(&stack_branch, stack)) != 0) {
+		goto out;
+	}
+
+	if (branch_if->tree_else != NULL) {
+		if ((ret = __rrr_array_tree_program_compile_tree(program, &stack_branch, branch_if->tree_else)) != 0) {
+			goto out;
+		}
+	}
+
+	__rrr_array_tree_program_stack_merge(&stack_result, &stack_branch);
+
+	for (rrr_length i = 0; i < jump_count; i++) {
+		program->instructions[jumps[i]].arg = program->instruction_count;
+	}
+
+	__rrr_array_tree_program_stack_clear(stack);
+	*stack = stack_result;
+	memset(&stack_result, '\0', sizeof(stack_result));
+
+	out:
+	__rrr_array_tree_program_stack_clear(&stack_result);
+	__rrr_array_tree_program_stack_clear(&stack_branch);
+	RRR_FREE_IF_NOT_NULL(jumps);
+	return ret;
+}
+
+static int __rrr_array_tree_program_compile_tree (
+		struct rrr_array_tree_program *program,
+		struct rrr_array_tree_program_stack *stack,
+		const struct rrr_array_tree *tree
+) {
+	RRR_LL_ITERATE_BEGIN(tree, const struct rrr_array_node);
+		if (node->rewind_count > 0) {
+			struct rrr_array_tree_program_instruction *instruction;
+			if (__rrr_array_tree_program_instruction_push(&instruction, program, RRR_ARRAY_TREE_PROGRAM_OP_REWIND) != 0) {
+				return 1;
+			}
+			instruction->arg = node->rewind_count;
+			__rrr_array_tree_program_stack_rewind(stack, node->rewind_count);
+		}
+
+		if (__rrr_array_tree_program_compile_values(program, stack, &node->array) != 0) {
+			return 1;
+		}
+
+		if (node->branch_if != NULL) {
+			if (__rrr_array_tree_program_compile_branch(program, stack, node->branch_if) != 0) {
+				return 1;
+			}
+		}
+	RRR_LL_ITERATE_END();
+
+	return 0;
+}
+
+int rrr_array_tree_program_new (
+		struct rrr_array_tree_program **target,
+		const struct rrr_array_tree *tree
+) {
+	int ret = 0;
+
+	*target = NULL;
+
+	struct rrr_array_tree_program_stack stack = {0};
+	struct rrr_array_tree_program *program = NULL;
+
+	if ((program = rrr_allocate(sizeof(*program))) == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_array_tree_program_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(program, '\0', sizeof(*program));
+
+	if ((ret = __rrr_array_tree_program_compile_tree(program, &stack, tree)) != 0) {
+		goto out;
+	}
+
+	RRR_DBG_3("Array tree '%s' compiled into %" PRIrrrl " instructions\n",
+			tree->name, program->instruction_count);
+
+	*target = program;
+	program = NULL;
+
+	out:
+	if (program != NULL) {
+		rrr_array_tree_program_destroy(program);
+	}
+	__rrr_array_tree_program_stack_clear(&stack);
+	return ret;
+}
+
+struct rrr_array_tree_program_state {
+	struct rrr_array array;
+	struct rrr_type_value **stack;
+	rrr_length depth;
+	const char *start; // Only for bug-check when rewinding
+	const char *pos;
+	const char *end;
+	const struct rrr_array_tree_program_instruction *instruction;
+};
+
+static const struct rrr_type_value *__rrr_array_tree_program_state_find (
+		const struct rrr_array_tree_program_state *state,
+		int offset,
+		const char *name
+) {
+	if (offset != RRR_ARRAY_TREE_PROGRAM_OFFSET_DYNAMIC) {
+		return state->stack[state->depth - 1 - (rrr_length) offset];
+	}
+
+	for (rrr_length i = state->depth; i > 0; i--) {
+		const struct rrr_type_value *value = state->stack[i - 1];
+		if (value->tag != NULL && strncmp(name, value->tag, value->tag_length) == 0) {
+			return value;
+		}
+	}
+
+	return NULL;
+}
+
+static int __rrr_array_tree_program_rewind (
+		struct rrr_array_tree_program_state *state,
+		rrr_length count
+) {
+	if (count > state->depth) {
+		RRR_MSG_0("Attempt to REWIND %" PRIrrrl " positions past beginning of array which currently has %i elements, check configuration\n",
+				count, RRR_LL_COUNT(&state->array));
+		return RRR_ARRAY_TREE_SOFT_ERROR;
+	}
+
+	rrr_length total_length = 0;
+	for (rrr_length i = 0; i < count; i++) {
+		struct rrr_type_value *value = RRR_LL_POP(&state->array);
+
+		state->pos -= value->import_length * value->element_count;
+		total_length += value->import_length * value->element_count;
+		state->depth--;
+
+		if (state->pos < state->start) {
+			RRR_BUG("BUG: REWIND past beginning of buffer occured in __rrr_array_tree_program_rewind\n");
+		}
+
+		rrr_type_value_destroy(value);
+	}
+
+	RRR_DBG_3("REWIND %" PRIrrrl " array positions and %" PRIrrrl " bytes while parsing array tree\n",
+			count, total_length);
+
+	return RRR_ARRAY_TREE_OK;
+}
+
+static int __rrr_array_tree_program_resolve_ref (
+		rrr_length *result,
+		const struct rrr_array_tree_program_state *state,
+		int offset,
+		const char *name,
+		const char *target_name
+) {
+	const struct rrr_type_value *value = __rrr_array_tree_program_state_find(state, offset, name);
+
+	if (value == NULL) {
+		RRR_MSG_0("Failed to find tag '%s' while resolving reference in array tree\n", name);
+		return RRR_ARRAY_TREE_SOFT_ERROR;
+	}
+
+	uint64_t result_tmp = value->definition->to_64(value);
+	if (result_tmp > RRR_LENGTH_MAX) {
+		RRR_MSG_0("Evaluation of reference '%s' resulted in a value of %" PRIu64 " while maximum value is %" PRIrrrl "\n",
+				name, result_tmp, RRR_LENGTH_MAX);
+		return RRR_ARRAY_TREE_SOFT_ERROR;
+	}
+
+	if (result_tmp == 0) {
+		RRR_MSG_0("Resolve of reference '%s' to use as %s had 0 result\n",
+				name, target_name);
+		return RRR_ARRAY_TREE_SOFT_ERROR;
+	}
+
+	*result = (rrr_length) result_tmp;
+
+	return RRR_ARRAY_TREE_OK;
+}
+
+static int __rrr_array_tree_program_value (
+		struct rrr_array_tree_program_state *state,
+		const struct rrr_array_tree_program_instruction *instruction
+) {
+	int ret = 0;
+
+	// The value and its tag are placed in one arena allocation. The template
+	// has no references or data, it is copied as is.
+	const rrr_length tag_length = instruction->value.tag_length;
+	struct rrr_type_value *new_value = rrr_arena_allocate (
+			state->array.arena,
+			sizeof(*new_value) + (tag_length > 0 ? tag_length + 1 : 0)
+	);
+	if (new_value == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_array_tree_program_value\n");
+		ret = RRR_ARRAY_TREE_HARD_ERROR;
+		goto out;
+	}
+
+	*new_value = instruction->value;
+	new_value->arena = state->array.arena;
+
+	if (tag_length > 0) {
+		new_value->tag = (char *) (new_value + 1);
+		memcpy(new_value->tag, instruction->value.tag, tag_length);
+		new_value->tag[tag_length] = '\0';
+	}
+
+	if (instruction->import_length_ref != NULL) {
+		if ((ret = __rrr_array_tree_program_resolve_ref (
+				&new_value->import_length,
+				state,
+				instruction->import_length_offset,
+				instruction->import_length_ref,
+				"import_length"
+		)) != 0) {
+			goto out;
+		}
+	}
+
+	if (instruction->element_count_ref != NULL) {
+		if ((ret = __rrr_array_tree_program_resolve_ref (
+				&new_value->element_count,
+				state,
+				instruction->element_count_offset,
+				instruction->element_count_ref,
+				"element_count"
+		)) != 0) {
+			goto out;
+		}
+	}
+
+	if (!instruction->is_checked) {
+		if (new_value->import_length == 0 && new_value->definition->max_length != 0) {
+			RRR_MSG_0("Import length was %" PRIrrrl " while importing array value of type %s, must be non-zero\n",
+					new_value->import_length, new_value->definition->identifier);
+			ret = RRR_ARRAY_TREE_SOFT_ERROR;
+			goto out;
+		}
+
+		if (new_value->element_count == 0) {
+			RRR_MSG_0("Element count was %" PRIrrrl " while importing array value of type %s, must be non-zero\n",
+					new_value->element_count, new_value->definition->identifier);
+			ret = RRR_ARRAY_TREE_SOFT_ERROR;
+			goto out;
+		}
+
+		if (new_value->import_length > new_value->definition->max_length) {
+			RRR_MSG_0("Import length was %" PRIrrrl " while maximum is %" PRIrrrl " while importing array value of type %s\n",
+					new_value->import_length, new_value->definition->max_length, new_value->definition->identifier);
+			ret = RRR_ARRAY_TREE_SOFT_ERROR;
+			goto out;
+		}
+	}
+
+	rrr_length parsed_bytes = 0;
+	if ((ret = new_value->definition->import (
+			new_value,
+			&parsed_bytes,
+			state->pos,
+			state->end
+	)) != 0) {
+		if (ret == RRR_TYPE_PARSE_INCOMPLETE) {
+			goto out;
+		}
+		else if (ret == RRR_TYPE_PARSE_SOFT_ERR) {
+			RRR_MSG_0("Type conversion in array tree failed for type '%s'\n", new_value->definition->identifier);
+		}
+		else {
+			RRR_MSG_0("Hard error while importing data in __rrr_array_tree_program_value, return was %i\n", ret);
+			ret = RRR_ARRAY_TREE_HARD_ERROR;
+		}
+		goto out;
+	}
+
+	if (parsed_bytes == 0 && !RRR_TYPE_IS_VAIN(new_value->definition->type)) {
+		RRR_BUG("Parsed bytes was zero in __rrr_array_tree_program_value\n");
+	}
+
+	RRR_DBG_3("Imported a value of type %s size %" PRIrrrl "x%" PRIrrrl "\n",
+			new_value->definition->identifier, parsed_bytes, new_value->element_count);
+
+	state->pos += parsed_bytes;
+
+	RRR_LL_APPEND(&state->array, new_value);
+	state->stack[state->depth++] = new_value;
+	new_value = NULL;
+
+	out:
+	if (new_value != NULL) {
+		rrr_type_value_destroy(new_value);
+	}
+	return ret;
+}
+
+static int __rrr_array_tree_program_condition_name_evaluate_callback (
+		RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS
+) {
+	const struct rrr_array_tree_program_state *state = arg;
+	const struct rrr_array_tree_program_instruction *instruction = state->instruction;
+
+	*result = 0;
+
+	const int offset = (name_index >= 0 && name_index < instruction->name_count
+		? instruction->names[name_index].offset
+		: RRR_ARRAY_TREE_PROGRAM_OFFSET_DYNAMIC
+	);
+
+	const struct rrr_type_value *value = __rrr_array_tree_program_state_find(state, offset, name);
+	if (value == NULL) {
+		RRR_MSG_0("Array tag '%s' could not be resolved while parsing input data. Check configuration and REWIND usage.\n", name);
+		return RRR_ARRAY_TREE_SOFT_ERROR;
+	}
+
+	*result = value->definition->to_64(value);
+	*is_signed = RRR_TYPE_FLAG_IS_SIGNED(value->flags);
+
+	return RRR_ARRAY_TREE_OK;
+}
+
+static int __rrr_array_tree_program_run (
+		struct rrr_array_tree_program_state *state,
+		const struct rrr_array_tree_program *program
+) {
+	int ret = 0;
+
+	rrr_length pc = 0;
+	while (pc < program->instruction_count) {
+		const struct rrr_array_tree_program_instruction *instruction = &program->instructions[pc];
+
+		switch (instruction->op) {
+			case RRR_ARRAY_TREE_PROGRAM_OP_REWIND:
+				if ((ret = __rrr_array_tree_program_rewind(state, instruction->arg)) != 0) {
+					goto out;
+				}
+				pc++;
+				break;
+			case RRR_ARRAY_TREE_PROGRAM_OP_CHECK_LENGTH:
+				if (state->end - state->pos < (rrr_slength) instruction->arg) {
+					ret = RRR_TYPE_PARSE_INCOMPLETE;
+					goto out;
+				}
+				pc++;
+				break;
+			case RRR_ARRAY_TREE_PROGRAM_OP_VALUE:
+				if ((ret = __rrr_array_tree_program_value(state, instruction)) != 0) {
+					goto out;
+				}
+				pc++;
+				break;
+			case RRR_ARRAY_TREE_PROGRAM_OP_BRANCH: {
+				uint64_t result = 0;
+				state->instruction = instruction;
+				if ((ret = rrr_condition_evaluate (
+						&result,
+						instruction->condition,
+						__rrr_array_tree_program_condition_name_evaluate_callback,
+						state
+				)) != 0) {
+					goto out;
+				}
+				pc = result ? pc + 1 : instruction->arg;
+			} break;
+			case RRR_ARRAY_TREE_PROGRAM_OP_JUMP:
+				pc = instruction->arg;
+				break;
+			default:
+				RRR_BUG("BUG: Unknown instruction %i in __rrr_array_tree_program_run\n", instruction->op);
+		};
+	}
+
+	out:
+	return ret;
+}
+
+int rrr_array_tree_program_import_from_buffer (
+		ssize_t *parsed_bytes,
+		const char *buf,
+		ssize_t buf_len,
+		const struct rrr_array_tree_program *program,
+		int (*callback)(struct rrr_array *array, void *arg),
+		void *callback_arg
+) {
+	int ret = 0;
+
+	*parsed_bytes = 0;
+
+	struct rrr_array_tree_program_state state = {0};
+
+	state.start = buf;
+	state.pos = buf;
+	state.end = buf + buf_len;
+
+	// Values, their data and the stack are freed all at once after the
+	// callback. The callback may keep the values by moving them to an
+	// array of its own.
+	if ((ret = rrr_arena_new(&state.array.arena, RRR_ARRAY_TREE_PROGRAM_ARENA_SIZE)) != 0) {
+		ret = RRR_ARRAY_TREE_HARD_ERROR;
+		goto out;
+	}
+	rrr_array_arena_enable(&state.array);
+
+	// The number of values in the program is the maximum stack depth
+	if (program->value_count > 0 &&
+	    (state.stack = rrr_arena_allocate(state.array.arena, sizeof(*(state.stack)) * program->value_count)) == NULL
+	) {
+		RRR_MSG_0("Could not allocate memory in rrr_array_tree_program_import_from_buffer\n");
+		ret = RRR_ARRAY_TREE_HARD_ERROR;
+		goto out;
+	}
+
+	if ((ret = __rrr_array_tree_program_run(&state, program)) != 0) {
+		goto out;
+	}
+
+	if ((ret = callback(&state.array, callback_arg)) != 0) {
+		goto out;
+	}
+
+	*parsed_bytes = state.pos - buf;
+
+	out:
+	rrr_array_clear(&state.array);
+	return ret;
+}
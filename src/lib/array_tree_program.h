@@ -0,0 +1,48 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef RRR_ARRAY_TREE_PROGRAM_H
+#define RRR_ARRAY_TREE_PROGRAM_H
+
+#include <sys/types.h>
+
+struct rrr_array;
+struct rrr_array_tree;
+struct rrr_array_tree_program;
+
+int rrr_array_tree_program_new (
+		struct rrr_array_tree_program **target,
+		const struct rrr_array_tree *tree
+);
+void rrr_array_tree_program_destroy (
+		struct rrr_array_tree_program *program
+);
+int rrr_array_tree_program_import_from_buffer (
+		ssize_t *parsed_bytes,
+		const char *buf,
+		ssize_t buf_len,
+		const struct rrr_array_tree_program *program,
+		int (*callback)(struct rrr_array *array, void *arg),
+		void *callback_arg
+);
+
+#endif /* RRR_ARRAY_TREE_PROGRAM_H */
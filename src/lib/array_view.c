@@ -0,0 +1,349 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "allocator.h"
+#include "array.h"
+#include "array_view.h"
+#include "util/rrr_endian.h"
+#include "util/macro_utils.h"
+
+// Tags and data up to this size are converted on the stack
+#define RRR_ARRAY_VIEW_STACK_SIZE 256
+
+struct rrr_array_view_iterate_callback_data {
+	int (*callback)(const struct rrr_array_view_value *value, void *arg);
+	void *callback_arg;
+};
+
+static int __rrr_array_view_iterate_callback (
+		const char *data_start,
+		const struct rrr_type_definition *type,
+		rrr_type_flags flags,
+		rrr_length tag_length,
+		rrr_length total_length,
+		rrr_length element_count,
+		void *arg
+) {
+	struct rrr_array_view_iterate_callback_data *callback_data = arg;
+
+	const struct rrr_array_view_value value = {
+		(type->type == RRR_TYPE_BE ? rrr_type_get_from_id(RRR_TYPE_H) : type),
+		type,
+		flags,
+		data_start,
+		tag_length,
+		data_start + tag_length,
+		total_length,
+		element_count
+	};
+
+	return callback_data->callback(&value, callback_data->callback_arg);
+}
+
+int rrr_array_view_iterate (
+		const struct rrr_msg_msg *message,
+		int (*callback)(const struct rrr_array_view_value *value, void *arg),
+		void *callback_arg
+) {
+	struct rrr_array_view_iterate_callback_data callback_data = {
+		callback,
+		callback_arg
+	};
+
+	return rrr_array_message_iterate (
+			message,
+			__rrr_array_view_iterate_callback,
+			&callback_data
+	);
+}
+
+static int __rrr_array_view_validate_callback (
+		const struct rrr_array_view_value *value,
+		void *arg
+) {
+	(void)(value);
+	(void)(arg);
+	return 0;
+}
+
+// Walks all value headers of the message, which verifies that the
+// message may later be iterated without errors
+int rrr_array_view_validate (
+		const struct rrr_msg_msg *message
+) {
+	return rrr_array_view_iterate (
+			message,
+			__rrr_array_view_validate_callback,
+			NULL
+	);
+}
+
+struct rrr_array_view_get_by_tags_callback_data {
+	struct rrr_array_view_value *values;
+	const char * const *tags;
+	int tag_count;
+	int found_count;
+};
+
+static int __rrr_array_view_get_by_tags_callback (
+		const struct rrr_array_view_value *value,
+		void *arg
+) {
+	struct rrr_array_view_get_by_tags_callback_data *callback_data = arg;
+
+	if (value->tag_length == 0) {
+		return 0;
+	}
+
+	for (int i = 0; i < callback_data->tag_count; i++) {
+		if (callback_data->values[i].definition == NULL && rrr_array_view_value_tag_equals(value, callback_data->tags[i])) {
+			callback_data->values[i] = *value;
+			callback_data->found_count++;
+		}
+	}
+
+	return (callback_data->found_count == callback_data->tag_count ? RRR_ARRAY_ITERATE_STOP : 0);
+}
+
+// Finds the first value with each of the given tags in one pass over the
+// message. The definition of values not found is set to NULL.
+int rrr_array_view_get_by_tags (
+		struct rrr_array_view_value *values,
+		const struct rrr_msg_msg *message,
+		const char * const *tags,
+		int tag_count
+) {
+	memset(values, '\0', sizeof(*values) * (size_t) tag_count);
+
+	struct rrr_array_view_get_by_tags_callback_data callback_data = {
+		values,
+		tags,
+		tag_count,
+		0
+	};
+
+	return rrr_array_view_iterate (
+			message,
+			__rrr_array_view_get_by_tags_callback,
+			&callback_data
+	);
+}
+
+int rrr_array_view_get_by_tag (
+		struct rrr_array_view_value *value,
+		const struct rrr_msg_msg *message,
+		const char *tag
+) {
+	return rrr_array_view_get_by_tags(value, message, &tag, 1);
+}
+
+int rrr_array_view_value_get_64 (
+		uint64_t *result,
+		const struct rrr_array_view_value *value,
+		rrr_length index
+) {
+	*result = 0;
+
+	if (!RRR_TYPE_IS_64(value->definition->type) && !RRR_TYPE_IS_FIXP(value->definition->type)) {
+		RRR_MSG_0("Value of type %s was not a 64 bit type in rrr_array_view_value_get_64\n",
+				value->definition->identifier);
+		return 1;
+	}
+
+	if (index >= value->element_count || value->total_length != value->element_count * sizeof(uint64_t)) {
+		RRR_MSG_0("Index %" PRIrrrl " out of range or invalid length in rrr_array_view_value_get_64\n", index);
+		return 1;
+	}
+
+	uint64_t tmp;
+	memcpy(&tmp, value->data + index * sizeof(tmp), sizeof(tmp));
+	*result = rrr_be64toh(tmp);
+
+	return 0;
+}
+
+static int __rrr_array_view_buffer_get (
+		char **target,
+		char **heap,
+		char *stack,
+		rrr_length size
+) {
+	if (size <= RRR_ARRAY_VIEW_STACK_SIZE) {
+		*target = stack;
+		return 0;
+	}
+	if ((*heap = rrr_allocate(size)) == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_array_view_buffer_get\n");
+		return 1;
+	}
+	*target = *heap;
+	return 0;
+}
+
+// Creates a temporary type value for use with the type functions. Data
+// which needs endian conversion is copied, other data is used in place.
+int rrr_array_view_value_with_type_value (
+		const struct rrr_array_view_value *value,
+		int (*callback)(const struct rrr_type_value *value, void *arg),
+		void *callback_arg
+) {
+	int ret = 0;
+
+	char tag_stack[RRR_ARRAY_VIEW_STACK_SIZE];
+	char data_stack[RRR_ARRAY_VIEW_STACK_SIZE];
+	char *tag_heap = NULL;
+	char *data_heap = NULL;
+
+	struct rrr_type_value tmp = {0};
+
+	tmp.definition = value->definition;
+	tmp.flags = value->flags;
+	tmp.tag_length = value->tag_length;
+	tmp.import_length = value->total_length;
+	tmp.total_stored_length = value->total_length;
+	tmp.element_count = value->element_count;
+
+	if (value->tag_length > 0) {
+		if ((ret = __rrr_array_view_buffer_get(&tmp.tag, &tag_heap, tag_stack, value->tag_length + 1)) != 0) {
+			goto out;
+		}
+		memcpy(tmp.tag, value->tag, value->tag_length);
+		tmp.tag[value->tag_length] = '\0';
+	}
+
+	if (RRR_TYPE_IS_64(value->definition_packed->type) ||
+	    RRR_TYPE_IS_FIXP(value->definition_packed->type) ||
+	    RRR_TYPE_IS_MSG(value->definition_packed->type)
+	) {
+		if ((ret = __rrr_array_view_buffer_get(&tmp.data, &data_heap, data_stack, value->total_length)) != 0) {
+			goto out;
+		}
+		memcpy(tmp.data, value->data, value->total_length);
+		tmp.definition = value->definition_packed;
+		if ((ret = tmp.definition->unpack(&tmp)) != 0) {
+			RRR_MSG_0("Failed to convert value of type %s in rrr_array_view_value_with_type_value\n",
+					value->definition_packed->identifier);
+			goto out;
+		}
+	}
+	else {
+		// Value is passed as const to the callback, cast away const OK
+		tmp.data = (char *) value->data;
+	}
+
+	ret = callback(&tmp, callback_arg);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(tag_heap);
+	RRR_FREE_IF_NOT_NULL(data_heap);
+	return ret;
+}
+
+struct rrr_array_view_dump_callback_data {
+	int i;
+};
+
+static int __rrr_array_view_dump_type_value_callback (
+		const struct rrr_type_value *node,
+		void *arg
+) {
+	struct rrr_array_view_dump_callback_data *callback_data = arg;
+
+	int ret = 0;
+
+	char *tmp = NULL;
+	const char *tag = "-";
+	const char *to_str = "-";
+
+	if (node->tag != NULL && *(node->tag) != '\0') {
+		tag = node->tag;
+	}
+
+	if (node->definition->to_str != NULL) {
+		if (node->definition->to_str(&tmp, node) != 0) {
+			RRR_MSG_0("Error when stringifying value in rrr_array_view_dump\n");
+			ret = 1;
+			goto out;
+		}
+		to_str = tmp;
+	}
+
+	RRR_DBG_2 ("%i - %s - %s - (%i/%i = %i) - %s\n",
+			callback_data->i,
+			node->definition->identifier,
+			tag,
+			node->total_stored_length,
+			node->element_count,
+			node->total_stored_length / node->element_count,
+			to_str
+	);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(tmp);
+	return ret;
+}
+
+static int __rrr_array_view_dump_callback (
+		const struct rrr_array_view_value *value,
+		void *arg
+) {
+	struct rrr_array_view_dump_callback_data *callback_data = arg;
+
+	int ret = rrr_array_view_value_with_type_value (
+			value,
+			__rrr_array_view_dump_type_value_callback,
+			callback_data
+	);
+
+	callback_data->i++;
+
+	return ret;
+}
+
+// Same output as rrr_array_dump without unpacking the message
+int rrr_array_view_dump (
+		const struct rrr_msg_msg *message
+) {
+	int ret = 0;
+
+	struct rrr_array_view_dump_callback_data callback_data = {0};
+
+	// Use high debuglevel to force suppression of messages in journal module
+
+	RRR_DBG_2 ("== ARRAY DUMP ========================================================\n");
+
+	if ((ret = rrr_array_view_iterate (
+			message,
+			__rrr_array_view_dump_callback,
+			&callback_data
+	)) != 0) {
+		goto out;
+	}
+
+	RRR_DBG_2 ("== ARRAY DUMP END ====================================================\n");
+
+	out:
+	return ret;
+}
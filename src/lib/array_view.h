@@ -0,0 +1,87 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_ARRAY_VIEW_H
+#define RRR_ARRAY_VIEW_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rrr_types.h"
+#include "type.h"
+
+struct rrr_msg_msg;
+
+// Value read directly from a packed array message. The tag is not zero
+// terminated, and data of 64 bit and message types is in network byte
+// order. The definition is the one the value gets when unpacked.
+struct rrr_array_view_value {
+	const struct rrr_type_definition *definition;
+	const struct rrr_type_definition *definition_packed;
+	rrr_type_flags flags;
+	const char *tag;
+	rrr_length tag_length;
+	const char *data;
+	rrr_length total_length;
+	rrr_length element_count;
+};
+
+static inline int rrr_array_view_value_tag_equals (
+		const struct rrr_array_view_value *value,
+		const char *tag
+) {
+	return strncmp(value->tag, tag, value->tag_length) == 0 && tag[value->tag_length] == '\0';
+}
+
+int rrr_array_view_iterate (
+		const struct rrr_msg_msg *message,
+		int (*callback)(const struct rrr_array_view_value *value, void *arg),
+		void *callback_arg
+);
+int rrr_array_view_validate (
+		const struct rrr_msg_msg *message
+);
+int rrr_array_view_get_by_tags (
+		struct rrr_array_view_value *values,
+		const struct rrr_msg_msg *message,
+		const char * const *tags,
+		int tag_count
+);
+int rrr_array_view_get_by_tag (
+		struct rrr_array_view_value *value,
+		const struct rrr_msg_msg *message,
+		const char *tag
+);
+int rrr_array_view_value_get_64 (
+		uint64_t *result,
+		const struct rrr_array_view_value *value,
+		rrr_length index
+);
+int rrr_array_view_value_with_type_value (
+		const struct rrr_array_view_value *value,
+		int (*callback)(const struct rrr_type_value *value, void *arg),
+		void *callback_arg
+);
+int rrr_array_view_dump (
+		const struct rrr_msg_msg *message
+);
+
+#endif /* RRR_ARRAY_VIEW_H */
@@ -29,10 +29,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "log.h"
 #include "allocator.h"
 #include "util/posix.h"
-#include "util/slow_noop.h"
 #include "util/rrr_time.h"
 
-//#define RRR_FIFO_BUFFER_RATELIMIT_DEBUG 1
 //#define RRR_FIFO_BUFFER_DEBUG 1
 
 static inline void rrr_fifo_write_lock(struct rrr_fifo_buffer *buffer) {
@@ -146,6 +144,10 @@ int rrr_fifo_buffer_get_stats (
 		struct rrr_fifo_buffer *buffer
 ) {
 	RRR_FIFO_BUFFER_WITH_STATS_LOCK_DO(*stats = buffer->stats);
+	if (buffer->ring != NULL) {
+		// Entries moved from the ring into the list are not counted again
+		stats->total_entries_written += rrr_fifo_ring_total_pushed(buffer->ring);
+	}
 	return 0;
 }
 
@@ -236,6 +238,52 @@ static int __rrr_fifo_buffer_entry_new_unlocked (
 		return ret;
 }
 
+// Buffer write lock must be held. Readers of the ring also hold the buffer
+// lock, hence there are no other consumers while draining.
+static void __rrr_fifo_buffer_ring_drain_nolock (
+		struct rrr_fifo_buffer *buffer
+) {
+	uint64_t drained_count = 0;
+
+	// Only published cells are moved. A cell reserved by a producer which has
+	// not yet published it stops the draining, it and the cells after it are
+	// left for the next merge. Limit to the current count to not keep going
+	// while producers are active.
+	uint64_t drain_count = rrr_fifo_ring_count(buffer->ring);
+
+	while (drained_count < drain_count) {
+		struct rrr_fifo_buffer_entry *entry = NULL;
+
+		// Allocate before popping to not lose any data on failure
+		if (__rrr_fifo_buffer_entry_new_unlocked(&entry) != 0) {
+			RRR_MSG_0("Could not allocate entry in __rrr_fifo_buffer_ring_drain_nolock, entries remain in ring\n");
+			break;
+		}
+
+		if (rrr_fifo_ring_pop(&entry->data, &entry->size, &entry->order, buffer->ring) != RRR_FIFO_RING_OK) {
+			rrr_free(entry);
+			break;
+		}
+
+		if (buffer->gptr_last == NULL) {
+			buffer->gptr_first = entry;
+			buffer->gptr_last = entry;
+		}
+		else {
+			buffer->gptr_last->next = entry;
+			buffer->gptr_last = entry;
+		}
+
+		drained_count++;
+	}
+
+	if (drained_count > 0) {
+		pthread_mutex_lock(&buffer->entry_count_mutex);
+		buffer->entry_count += (int) drained_count;
+		pthread_mutex_unlock(&buffer->entry_count_mutex);
+	}
+}
+
 // Buffer write lock must be held
 static void __rrr_fifo_merge_write_queue_nolock (
 		struct rrr_fifo_buffer *buffer
@@ -244,6 +292,19 @@ static void __rrr_fifo_merge_write_queue_nolock (
 
 	pthread_mutex_lock(&buffer->write_queue_mutex);
 
+	if (buffer->ring != NULL) {
+		// The ring is bypassed while the write queue is non-empty, no cells
+		// can be reserved after the bypass flag is set. Entries in the ring
+		// are therefore always older than the entries in the write queue.
+		__rrr_fifo_buffer_ring_drain_nolock(buffer);
+
+		// Cells not yet published by their producer must be moved before
+		// the write queue, keep the write queue until the next merge
+		if (buffer->gptr_write_queue_first != NULL && rrr_fifo_ring_count(buffer->ring) > 0) {
+			goto out_unlock;
+		}
+	}
+
 	if (buffer->gptr_write_queue_first != NULL) {
 		struct rrr_fifo_buffer_entry *first = buffer->gptr_write_queue_first;
 
@@ -272,12 +333,17 @@ static void __rrr_fifo_merge_write_queue_nolock (
 
 		__rrr_fifo_buffer_stats_add_written(buffer, buffer->write_queue_entry_count);
 
-		pthread_mutex_lock(&buffer->ratelimit_mutex);
+		pthread_mutex_lock(&buffer->entry_count_mutex);
 		buffer->entry_count += buffer->write_queue_entry_count;
 		buffer->write_queue_entry_count = 0;
-		pthread_mutex_unlock(&buffer->ratelimit_mutex);
+		pthread_mutex_unlock(&buffer->entry_count_mutex);
+	}
+
+	if (buffer->ring != NULL) {
+		rrr_fifo_ring_bypass_set(buffer->ring, 0);
 	}
 
+	out_unlock:
 	pthread_mutex_unlock(&buffer->write_queue_mutex);
 }
 
@@ -285,9 +351,13 @@ void rrr_fifo_buffer_destroy (
 		struct rrr_fifo_buffer *buffer
 ) {
 	rrr_fifo_buffer_clear_with_callback(buffer, NULL, NULL);
+	if (buffer->ring != NULL) {
+		rrr_fifo_ring_destroy(buffer->ring, buffer->free_entry);
+		buffer->ring = NULL;
+	}
 	pthread_rwlock_destroy (&buffer->rwlock);
 	pthread_mutex_destroy (&buffer->write_queue_mutex);
-	pthread_mutex_destroy (&buffer->ratelimit_mutex);
+	pthread_mutex_destroy (&buffer->entry_count_mutex);
 	pthread_mutex_destroy (&buffer->stats_mutex);
 	sem_destroy(&buffer->new_data_available);
 }
@@ -315,21 +385,16 @@ int rrr_fifo_buffer_init (
 		goto out_destroy_write_queue_mutex;
 	}
 
-	ret = rrr_posix_mutex_init (&buffer->ratelimit_mutex, 0);
+	ret = rrr_posix_mutex_init (&buffer->entry_count_mutex, 0);
 	if (ret != 0) {
 		goto out_destroy_rwlock;
 	}
 
 	ret = rrr_posix_mutex_init (&buffer->stats_mutex, 0);
 	if (ret != 0) {
-		goto out_destroy_ratelimit_mutex;
+		goto out_destroy_entry_count_mutex;
 	}
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
-	buffer->buffer_do_ratelimit = 0;
-	buffer->ratelimit.sleep_spin_time = 2000000;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
-
 	if (sem_init(&buffer->new_data_available, 1, 0) != 0) {
 		goto out_destroy_stats_mutex;
 	}
@@ -343,8 +408,8 @@ int rrr_fifo_buffer_init (
 //		sem_destroy(&buffer->new_data_available);
 	out_destroy_stats_mutex:
 		pthread_mutex_destroy(&buffer->stats_mutex);
-	out_destroy_ratelimit_mutex:
-		pthread_mutex_destroy(&buffer->ratelimit_mutex);
+	out_destroy_entry_count_mutex:
+		pthread_mutex_destroy(&buffer->entry_count_mutex);
 	out_destroy_rwlock:
 		pthread_rwlock_destroy(&buffer->rwlock);
 	out_destroy_write_queue_mutex:
@@ -366,6 +431,37 @@ int rrr_fifo_buffer_init_custom_free (
 	return ret;
 }
 
+int rrr_fifo_buffer_init_custom_free_with_engine (
+		struct rrr_fifo_buffer *buffer,
+		void (*custom_free)(void *arg),
+		int engine
+) {
+	int ret = 0;
+
+	if ((ret = rrr_fifo_buffer_init_custom_free(buffer, custom_free)) != 0) {
+		goto out;
+	}
+
+	switch (engine) {
+		case RRR_FIFO_BUFFER_ENGINE_LIST:
+			break;
+		case RRR_FIFO_BUFFER_ENGINE_RING:
+			if ((ret = rrr_fifo_ring_new(&buffer->ring, RRR_FIFO_RING_DEFAULT_SIZE)) != 0) {
+				RRR_MSG_0("Could not create ring in rrr_fifo_buffer_init_custom_free_with_engine\n");
+				goto out_destroy;
+			}
+			break;
+		default:
+			RRR_BUG("BUG: Unknown engine %i to rrr_fifo_buffer_init_custom_free_with_engine\n", engine);
+	};
+
+	goto out;
+	out_destroy:
+		rrr_fifo_buffer_destroy(buffer);
+	out:
+		return ret;
+}
+
 static void __rrr_fifo_buffer_set_data_available (
 		struct rrr_fifo_buffer *buffer
 ) {
@@ -379,14 +475,16 @@ static void __rrr_fifo_buffer_set_data_available (
 static void __rrr_fifo_attempt_write_queue_merge (
 		struct rrr_fifo_buffer *buffer
 ) {
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
-	if (buffer->write_queue_entry_count == 0) {
-		pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	int ring_count = (buffer->ring != NULL ? (int) rrr_fifo_ring_count(buffer->ring) : 0);
+
+	pthread_mutex_lock(&buffer->entry_count_mutex);
+	if (buffer->write_queue_entry_count == 0 && ring_count == 0) {
+		pthread_mutex_unlock(&buffer->entry_count_mutex);
 		return;
 	}
 
 	int entry_count = buffer->entry_count;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
 	RRR_FIFO_BUFFER_CONSISTENCY_CHECK();
 
@@ -432,15 +530,6 @@ static inline int rrr_fifo_wait_for_data (
 	return res;
 }
 
-void rrr_fifo_buffer_set_do_ratelimit (
-		struct rrr_fifo_buffer *buffer,
-		int set
-) {
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
-	buffer->buffer_do_ratelimit = set;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
-}
-
 /*
  * Remove all entries from a buffer
  */
@@ -621,9 +710,9 @@ int rrr_fifo_buffer_search (
 
 	__rrr_fifo_buffer_stats_add_deleted(buffer, cleared_entries);
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	pthread_mutex_lock(&buffer->entry_count_mutex);
 	buffer->entry_count -= cleared_entries;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
 	if (buffer->gptr_first != NULL) {
 		__rrr_fifo_buffer_set_data_available(buffer);
@@ -922,10 +1011,10 @@ int rrr_fifo_buffer_search_and_replace (
 	__rrr_fifo_buffer_stats_add_written(buffer, new_entries);
 	__rrr_fifo_buffer_stats_add_deleted(buffer, cleared_entries);
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	pthread_mutex_lock(&buffer->entry_count_mutex);
 	buffer->entry_count -= cleared_entries;
 	buffer->entry_count += new_entries;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
 	if (buffer->gptr_first != NULL) {
 		__rrr_fifo_buffer_set_data_available(buffer);
@@ -936,6 +1025,159 @@ int rrr_fifo_buffer_search_and_replace (
 	return ret;
 }
 
+struct rrr_fifo_buffer_ring_value {
+	char *data;
+	unsigned long int size;
+	uint64_t order;
+};
+
+// Entries are put at the front of the list as they are older than
+// any entry which might have spilled over to the list in the meantime
+static int __rrr_fifo_buffer_ring_values_put_back (
+		struct rrr_fifo_buffer *buffer,
+		struct rrr_fifo_buffer_ring_value *values,
+		int count
+) {
+	int ret = RRR_FIFO_OK;
+
+	struct rrr_fifo_buffer_entry *first = NULL;
+	struct rrr_fifo_buffer_entry *last = NULL;
+	int put_back_count = 0;
+
+	rrr_fifo_write_lock(buffer);
+
+	for (int i = 0; i < count; i++) {
+		struct rrr_fifo_buffer_entry *entry = NULL;
+
+		if (__rrr_fifo_buffer_entry_new_unlocked(&entry) != 0) {
+			RRR_MSG_0("Could not allocate entry in __rrr_fifo_buffer_ring_values_put_back, dropping entry\n");
+			buffer->free_entry(values[i].data);
+			ret = RRR_FIFO_GLOBAL_ERR;
+			continue;
+		}
+
+		entry->data = values[i].data;
+		entry->size = values[i].size;
+		entry->order = values[i].order;
+
+		if (last == NULL) {
+			first = entry;
+		}
+		else {
+			last->next = entry;
+		}
+		last = entry;
+
+		put_back_count++;
+	}
+
+	if (first != NULL) {
+		last->next = buffer->gptr_first;
+		buffer->gptr_first = first;
+		if (buffer->gptr_last == NULL) {
+			buffer->gptr_last = last;
+		}
+
+		pthread_mutex_lock(&buffer->entry_count_mutex);
+		buffer->entry_count += put_back_count;
+		pthread_mutex_unlock(&buffer->entry_count_mutex);
+
+		__rrr_fifo_buffer_set_data_available(buffer);
+	}
+
+	RRR_FIFO_BUFFER_CONSISTENCY_CHECK();
+
+	rrr_fifo_unlock(buffer);
+
+	return ret;
+}
+
+/*
+ * Pops entries directly from the ring as long as the list is empty, no
+ * entries are allocated and the write lock is not used. The list is checked
+ * while holding the read lock which makes sure that entries spilled over
+ * to the list from a full ring are read before newer entries in the ring.
+ */
+static int __rrr_fifo_buffer_read_clear_forward_ring (
+		int *processed_entries_result,
+		int *list_active_result,
+		struct rrr_fifo_buffer *buffer,
+		int (*callback)(void *callback_data, char *data, unsigned long int size),
+		void *callback_data
+) {
+	int ret = RRR_FIFO_OK;
+
+	int processed_entries = 0;
+	int list_active = 0;
+
+	while (processed_entries < RRR_FIFO_MAX_READS) {
+		struct rrr_fifo_buffer_ring_value values[RRR_FIFO_RING_READ_CHUNK];
+		int count = 0;
+
+		rrr_fifo_read_lock(buffer);
+		if (buffer->gptr_first != NULL) {
+			list_active = 1;
+		}
+		else {
+			while (count < RRR_FIFO_RING_READ_CHUNK && processed_entries + count < RRR_FIFO_MAX_READS) {
+				struct rrr_fifo_buffer_ring_value *value = &values[count];
+				if (rrr_fifo_ring_pop(&value->data, &value->size, &value->order, buffer->ring) != RRR_FIFO_RING_OK) {
+					break;
+				}
+				count++;
+			}
+		}
+		rrr_fifo_unlock(buffer);
+
+		if (count == 0) {
+			break;
+		}
+
+		for (int i = 0; i < count; i++) {
+			int ret_tmp = callback(callback_data, values[i].data, values[i].size);
+
+			processed_entries++;
+
+			if (ret_tmp == 0) {
+				continue;
+			}
+
+			if ((ret_tmp & RRR_FIFO_SEARCH_FREE) != 0) {
+				// Callback wants us to free memory
+				ret_tmp = ret_tmp & ~(RRR_FIFO_SEARCH_FREE);
+				buffer->free_entry(values[i].data);
+			}
+			if ((ret_tmp & (RRR_FIFO_SEARCH_GIVE)) != 0) {
+				RRR_BUG("Bug: FIFO_SEARCH_GIVE returned to fifo_read_clear_forward, we always GIVE by default\n");
+			}
+			if ((ret_tmp & (RRR_FIFO_SEARCH_STOP|RRR_FIFO_CALLBACK_ERR|RRR_FIFO_GLOBAL_ERR)) != 0) {
+				// Stop processing and put the rest back into the buffer
+				ret = ret_tmp & ~(RRR_FIFO_SEARCH_STOP);
+				ret |= __rrr_fifo_buffer_ring_values_put_back(buffer, values + i + 1, count - i - 1);
+				goto out;
+			}
+			ret_tmp &= ~(RRR_FIFO_SEARCH_GIVE|RRR_FIFO_SEARCH_FREE|RRR_FIFO_SEARCH_STOP|RRR_FIFO_CALLBACK_ERR|RRR_FIFO_GLOBAL_ERR);
+			if (ret_tmp != 0) {
+				RRR_BUG("Unknown flags %i returned to fifo_read_clear_forward\n", ret_tmp);
+			}
+		}
+	}
+
+	out:
+	if (processed_entries > 0) {
+		__rrr_fifo_buffer_stats_add_deleted(buffer, processed_entries);
+	}
+
+	if (rrr_fifo_ring_count(buffer->ring) > 0) {
+		__rrr_fifo_buffer_set_data_available(buffer);
+	}
+
+	*processed_entries_result = processed_entries;
+	*list_active_result = list_active;
+
+	return ret;
+}
+
 static int __rrr_fifo_buffer_read_clear_forward (
 		struct rrr_fifo_buffer *buffer,
 		int (*callback)(void *callback_data, char *data, unsigned long int size),
@@ -949,6 +1191,32 @@ static int __rrr_fifo_buffer_read_clear_forward (
 
 	int ret = RRR_FIFO_OK;
 
+	if (buffer->ring != NULL) {
+		int processed_entries = 0;
+		int list_active = 0;
+
+		ret = __rrr_fifo_buffer_read_clear_forward_ring (
+				&processed_entries,
+				&list_active,
+				buffer,
+				callback,
+				callback_data
+		);
+
+		if (ret != RRR_FIFO_OK || processed_entries > 0) {
+			return ret;
+		}
+
+		pthread_mutex_lock(&buffer->entry_count_mutex);
+		int write_queue_entry_count = buffer->write_queue_entry_count;
+		pthread_mutex_unlock(&buffer->entry_count_mutex);
+
+		// Only continue to the list if there is something to do
+		if (!list_active && write_queue_entry_count == 0) {
+			return ret;
+		}
+	}
+
 	struct rrr_fifo_buffer_entry *last_element = NULL;
 	struct rrr_fifo_buffer_entry *current = NULL;
 	struct rrr_fifo_buffer_entry *stop = NULL;
@@ -1090,9 +1358,9 @@ static int __rrr_fifo_buffer_read_clear_forward (
 
 	__rrr_fifo_buffer_stats_add_deleted(buffer, processed_entries);
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	pthread_mutex_lock(&buffer->entry_count_mutex);
 	buffer->entry_count -= processed_entries;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
 #ifdef FIFO_DEBUG_COUNTER
 	if (fifo_verify_counter(buffer) != 0) {
@@ -1130,10 +1398,7 @@ int rrr_fifo_buffer_read_clear_forward_all (
 
 	do {
 		ret = __rrr_fifo_buffer_read_clear_forward(buffer, callback, callback_data, 0);
-		
-		pthread_mutex_lock(&buffer->ratelimit_mutex);
-		entry_count = buffer->entry_count;
-		pthread_mutex_unlock(&buffer->ratelimit_mutex);
+		entry_count = rrr_fifo_buffer_get_entry_count(buffer);
 	} while (ret == 0 && entry_count > 0);
 
 	return ret;
@@ -1276,163 +1541,197 @@ int rrr_fifo_buffer_read_minimum (
 	return (res != 0 ? res : RRR_FIFO_OK);
 }
 
-static void __rrr_fifo_buffer_do_ratelimit(struct rrr_fifo_buffer *buffer) {
-	if (!buffer->buffer_do_ratelimit) {
-		return;
-	}
+int rrr_fifo_buffer_with_write_lock_do (
+		struct rrr_fifo_buffer *buffer,
+		int (*callback)(void *arg1, void *arg2),
+		void *callback_arg1,
+		void *callback_arg2
+) {
+	int ret = 0;
 
-#ifdef RRR_FIFO_BUFFER_RATELIMIT_DEBUG
-	uint64_t ratelimit_in = rrr_time_get_64();
-#endif
+	rrr_fifo_write_lock(buffer);
+	pthread_cleanup_push(rrr_fifo_unlock_void, buffer);
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	ret = callback(callback_arg1, callback_arg2);
+	if (ret != RRR_FIFO_OK && ret != RRR_FIFO_GLOBAL_ERR) {
+		RRR_BUG("Bug: Unknown return value %i to rrr_fifo_buffer_with_write_lock_do\n", ret);
+	}
 
-	struct rrr_fifo_buffer_ratelimit *ratelimit = &buffer->ratelimit;
+	pthread_cleanup_pop(1);
 
-	// Use signed!!
-	long long int spin_time =
-			ratelimit->sleep_spin_time + (buffer->entry_count * buffer->entry_count * buffer->write_queue_entry_count * buffer->write_queue_entry_count);
-	/*
-	 * If the spin loop is longer than some time period we switch to sleeping instead. We then
-	 * sleep one time for 9 entries before we loop again and measure the time once more. The 10th
-	 * time (at the spin), we subtract the approximate number of spins we already did while sleeping
-	 * on the other 9.
-	 *
-	 * If the spin loop is longer than some time period, we only spin every 10 times.
-	 */
+	return ret;
+}
 
-	if (++(ratelimit->burst_counter) == 10) {
-		ratelimit->burst_counter = 0;
+// Write queue mutex must not be held. While the ring is bypassed, it must
+// be called after a failed push to make sure that no more cells are reserved.
+static void __rrr_fifo_buffer_write_queue_append (
+		struct rrr_fifo_buffer *buffer,
+		struct rrr_fifo_buffer_entry *entry
+) {
+	pthread_mutex_lock (&buffer->write_queue_mutex);
 
-		unsigned long int do_usleep = 0;
+	// Keep all writers out of the ring until the write queue has
+	// been merged to preserve ordering
+	rrr_fifo_ring_bypass_set(buffer->ring, 1);
 
-		/* If we know how long the spinlock lasts, sleep half the period */
-		if (ratelimit->spins_per_us > 0) {
-			do_usleep = spin_time / 2 / ratelimit->spins_per_us;
+	if (buffer->gptr_write_queue_first == NULL) {
+		buffer->gptr_write_queue_last = entry;
+		buffer->gptr_write_queue_first = entry;
+	}
+	else {
+		buffer->gptr_write_queue_last->next = entry;
+		buffer->gptr_write_queue_last = entry;
+	}
 
-			if (do_usleep < 50) {
-				do_usleep = 0;
-			}
-			else {
-				spin_time = spin_time / 2;
-			}
-		}
+	pthread_mutex_lock(&buffer->entry_count_mutex);
+	buffer->write_queue_entry_count++;
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
-		pthread_mutex_unlock(&buffer->ratelimit_mutex);
-		uint64_t time_start = rrr_time_get_64();
-		long long int spin_time_orig = spin_time;
+	pthread_mutex_unlock (&buffer->write_queue_mutex);
+}
 
-		// Make sure we don't wrap around
-		while (--spin_time > 0) {
-			rrr_slow_noop();
-		}
-		uint64_t time_end = rrr_time_get_64();
-		uint64_t time_diff = (time_end - time_start) + 1; // +1 to prevent division by zero
-		if (do_usleep) {
-			rrr_posix_usleep(do_usleep);
-		}
-		pthread_mutex_lock(&buffer->ratelimit_mutex);
+static int __rrr_fifo_buffer_write_queue_pending (
+		struct rrr_fifo_buffer *buffer
+) {
+	pthread_mutex_lock (&buffer->write_queue_mutex);
+	int pending = buffer->gptr_write_queue_first != NULL;
+	pthread_mutex_unlock (&buffer->write_queue_mutex);
+	return pending;
+}
 
-		long long int current_spins_per_us = spin_time_orig / time_diff;
+// Used by the ring engine for ordered writes and when the ring is full or bypassed
+static int __rrr_fifo_buffer_write_list_entry (
+		struct rrr_fifo_buffer *buffer,
+		char *data,
+		unsigned long int size,
+		uint64_t order,
+		int do_ordered_write
+) {
+	struct rrr_fifo_buffer_entry *entry = NULL;
 
-		if (ratelimit->spins_per_us == 0) {
-			ratelimit->spins_per_us = current_spins_per_us;
-		}
-		else {
-			// Give little weight to the new value when updating
-			ratelimit->spins_per_us = (ratelimit->spins_per_us * 9 + current_spins_per_us) / 10;
-		}
+	if (__rrr_fifo_buffer_entry_new_unlocked(&entry) != 0) {
+		RRR_MSG_0("Could not allocate entry in __rrr_fifo_buffer_write_list_entry\n");
+		return 1;
 	}
 
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	entry->data = data;
+	entry->size = size;
+	entry->order = order;
+
+	rrr_fifo_write_lock(buffer);
 
-#ifdef RRR_FIFO_BUFFER_RATELIMIT_DEBUG
-	uint64_t time = rrr_time_get_64() - ratelimit_in;
-	if (time > 0) {
-		printf("Ratelimit %p: %" PRIu64 "\tc: %i\n", buffer, time, buffer->entry_count);
+	// Entries already in the ring must come before the new entry
+	__rrr_fifo_merge_write_queue_nolock(buffer);
+
+	// If the ring could not be fully drained or the write queue could not
+	// be merged, the new entry must come after them. Adding it to the write
+	// queue also makes other writers bypass the ring until the next merge.
+	if (!do_ordered_write && (rrr_fifo_ring_count(buffer->ring) > 0 || __rrr_fifo_buffer_write_queue_pending(buffer))) {
+		__rrr_fifo_buffer_write_queue_append(buffer, entry);
+		rrr_fifo_unlock(buffer);
+		return 0;
 	}
-#endif
-}
 
-static void __rrr_fifo_buffer_update_ratelimit(struct rrr_fifo_buffer *buffer) {
-	struct rrr_fifo_buffer_ratelimit *ratelimit = &buffer->ratelimit;
+	RRR_FIFO_BUFFER_CONSISTENCY_CHECK();
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	__rrr_fifo_buffer_write_update_pointers (buffer, entry, order, do_ordered_write);
 
-	uint64_t time_now = rrr_time_get_64();
+	RRR_FIFO_BUFFER_CONSISTENCY_CHECK();
 
-	if (ratelimit->prev_time == 0) {
-		ratelimit->prev_time = time_now;
-		ratelimit->prev_entry_count = buffer->entry_count + buffer->write_queue_entry_count;
-		goto out_unlock;
-	}
+	pthread_mutex_lock(&buffer->entry_count_mutex);
+	buffer->entry_count++;
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
-	// Work every 250ms
-	if (time_now - ratelimit->prev_time < 250000) {
-		goto out_unlock;
-	}
+	rrr_fifo_unlock(buffer);
 
-	int entry_diff = ratelimit->prev_entry_count - buffer->entry_count - buffer->write_queue_entry_count;
+	__rrr_fifo_buffer_stats_add_written(buffer, 1);
 
-	if (entry_diff > 0) {
-		// Readers are faster
-		ratelimit->read_write_balance = (ratelimit->read_write_balance + entry_diff) / 2;
-	}
-	else if (entry_diff < 0) {
-		// Writers are faster
-		ratelimit->read_write_balance = (ratelimit->read_write_balance + entry_diff) / 2;
-		ratelimit->sleep_spin_time += 1000;
-	}
-	else {
-		ratelimit->sleep_spin_time -= (ratelimit->sleep_spin_time / 10);
-	}
+	return 0;
+}
 
-	ratelimit->sleep_spin_time = ratelimit->sleep_spin_time - (ratelimit->read_write_balance * 10);
+// Used by the ring engine when delayed writes cannot use the ring
+static int __rrr_fifo_buffer_write_queue_entry (
+		struct rrr_fifo_buffer *buffer,
+		char *data,
+		unsigned long int size,
+		uint64_t order
+) {
+	struct rrr_fifo_buffer_entry *entry = NULL;
 
-	if (ratelimit->sleep_spin_time < 1) {
-		ratelimit->sleep_spin_time = 1;
-	}
-	else if (ratelimit->sleep_spin_time > 10000000000) {
-		ratelimit->sleep_spin_time = 10000000000;
+	if (__rrr_fifo_buffer_entry_new_unlocked(&entry) != 0) {
+		RRR_MSG_0("Could not allocate entry in __rrr_fifo_buffer_write_queue_entry\n");
+		return 1;
 	}
 
-	unsigned long long int spintime_us = (ratelimit->sleep_spin_time / (ratelimit->spins_per_us + 1));
+	entry->data = data;
+	entry->size = size;
+	entry->order = order;
 
-	RRR_DBG_4("buffer %p read/write balance %f spins %llu (%llu us) spins/us %llu entries %i (do sleep = %i)\n",
-			buffer,
-			ratelimit->read_write_balance,
-			ratelimit->sleep_spin_time,
-			spintime_us,
-			ratelimit->spins_per_us,
-			buffer->entry_count,
-			buffer->buffer_do_ratelimit
-	);
+	__rrr_fifo_buffer_write_queue_append(buffer, entry);
 
-	ratelimit->prev_time = time_now;
-	ratelimit->prev_entry_count = buffer->entry_count + buffer->write_queue_entry_count;
-
-	out_unlock:
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	return 0;
 }
 
-int rrr_fifo_buffer_with_write_lock_do (
+/*
+ * Write function for the ring engine. Entries are pushed to the ring without
+ * any locking unless the ring is full or the callback asks for an ordered write,
+ * in which case the entry is placed in the list (or the write queue for delayed
+ * writes). The per-entry lock is not needed as the ring provides the memory fence.
+ */
+static int __rrr_fifo_buffer_write_ring (
 		struct rrr_fifo_buffer *buffer,
-		int (*callback)(void *arg1, void *arg2),
-		void *callback_arg1,
-		void *callback_arg2
+		int (*callback)(RRR_FIFO_WRITE_CALLBACK_ARGS),
+		void *callback_arg,
+		int is_delayed
 ) {
 	int ret = 0;
 
-	rrr_fifo_write_lock(buffer);
-	pthread_cleanup_push(rrr_fifo_unlock_void, buffer);
+	int write_again = 0;
 
-	ret = callback(callback_arg1, callback_arg2);
-	if (ret != RRR_FIFO_OK && ret != RRR_FIFO_GLOBAL_ERR) {
-		RRR_BUG("Bug: Unknown return value %i to rrr_fifo_buffer_with_write_lock_do\n", ret);
-	}
+	do {
+		char *data = NULL;
+		unsigned long int size = 0;
+		uint64_t order = 0;
 
-	pthread_cleanup_pop(1);
+		int do_ordered_write = 0;
+		int do_drop = 0;
+
+		ret = callback(&data, &size, &order, callback_arg);
 
+		if ((ret = __rrr_fifo_buffer_write_callback_return_check(&do_ordered_write, &write_again, &do_drop, ret)) != 0) {
+			goto out;
+		}
+
+		if (do_drop) {
+			continue;
+		}
+
+		if (data == NULL) {
+			RRR_BUG("Data from callback was NULL in __rrr_fifo_buffer_write_ring, must return DROP\n");
+		}
+
+		if (is_delayed) {
+			if (do_ordered_write) {
+				RRR_BUG("BUG: Callback returned WRITE_ORDERED to rrr_fifo_buffer_write_delayed\n");
+			}
+			// The push fails while the ring is bypassed
+			if (rrr_fifo_ring_push(buffer->ring, data, size, order) != RRR_FIFO_RING_OK) {
+				ret = __rrr_fifo_buffer_write_queue_entry(buffer, data, size, order);
+			}
+		}
+		else if (do_ordered_write || rrr_fifo_ring_push(buffer->ring, data, size, order) != RRR_FIFO_RING_OK) {
+			ret = __rrr_fifo_buffer_write_list_entry(buffer, data, size, order, do_ordered_write);
+		}
+
+		if (ret != 0) {
+			buffer->free_entry(data);
+			goto out;
+		}
+
+		__rrr_fifo_buffer_set_data_available(buffer);
+	} while (write_again);
+
+	out:
 	return ret;
 }
 
@@ -1446,6 +1745,10 @@ int rrr_fifo_buffer_write (
 		int (*callback)(char **data, unsigned long int *size, uint64_t *order, void *arg),
 		void *callback_arg
 ) {
+	if (buffer->ring != NULL) {
+		return __rrr_fifo_buffer_write_ring(buffer, callback, callback_arg, 0);
+	}
+
 	int ret = 0;
 
 	int write_again = 0;
@@ -1453,9 +1756,9 @@ int rrr_fifo_buffer_write (
 	int entry_count_before = 0;
 	int entry_count_after = 0;
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	pthread_mutex_lock(&buffer->entry_count_mutex);
 	entry_count_before = buffer->entry_count;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
 	do {
 		struct rrr_fifo_buffer_entry *entry = NULL;
@@ -1468,7 +1771,7 @@ int rrr_fifo_buffer_write (
 		if (ret != 0) {
 			RRR_MSG_0("Could not allocate entry in rrr_fifo_buffer_write\n");
 			ret = 1;
-			goto loop_out_no_entry_free;
+			continue;
 		}
 
 		pthread_cleanup_push(__rrr_fifo_buffer_entry_destroy_simple_void, entry);
@@ -1506,13 +1809,12 @@ int rrr_fifo_buffer_write (
 		RRR_FIFO_BUFFER_CONSISTENCY_CHECK();
 
 		__rrr_fifo_buffer_set_data_available(buffer);
-		__rrr_fifo_buffer_update_ratelimit(buffer);
 		__rrr_fifo_buffer_stats_add_written(buffer, 1);
 
-		pthread_mutex_lock(&buffer->ratelimit_mutex);
+		pthread_mutex_lock(&buffer->entry_count_mutex);
 		buffer->entry_count++;
 		entry_count_after = buffer->entry_count;
-		pthread_mutex_unlock(&buffer->ratelimit_mutex);
+		pthread_mutex_unlock(&buffer->entry_count_mutex);
 
 		do_free_entry = 0;
 
@@ -1522,8 +1824,6 @@ int rrr_fifo_buffer_write (
 		loop_out_no_drop:
 			pthread_cleanup_pop(1);
 			pthread_cleanup_pop(do_free_entry);
-		loop_out_no_entry_free:
-			__rrr_fifo_buffer_do_ratelimit(buffer);
 	} while (write_again);
 
 	if (entry_count_before != 0 || entry_count_after != 0) {
@@ -1534,6 +1834,104 @@ int rrr_fifo_buffer_write (
 	return ret;
 }
 
+/*
+ * Batch writing method. All entries produced by the callback (using WRITE_AGAIN)
+ * are first collected in a private chain without any locking and then linked into
+ * the buffer during a single write lock acquisition. Ordered writes are not
+ * supported. Entries produced before an error occurs are still written.
+ */
+int rrr_fifo_buffer_write_batch (
+		struct rrr_fifo_buffer *buffer,
+		int (*callback)(char **data, unsigned long int *size, uint64_t *order, void *arg),
+		void *callback_arg
+) {
+	if (buffer->ring != NULL) {
+		return __rrr_fifo_buffer_write_ring(buffer, callback, callback_arg, 0);
+	}
+
+	int ret = 0;
+
+	struct rrr_fifo_buffer_entry *first = NULL;
+	struct rrr_fifo_buffer_entry *last = NULL;
+	int count = 0;
+	int write_again = 0;
+
+	do {
+		struct rrr_fifo_buffer_entry *entry = NULL;
+
+		if (__rrr_fifo_buffer_entry_new_unlocked(&entry) != 0) {
+			RRR_MSG_0("Could not allocate entry in rrr_fifo_buffer_write_batch\n");
+			ret = 1;
+			goto out;
+		}
+
+		uint64_t order = 0;
+		int do_ordered_write = 0;
+		int do_drop = 0;
+
+		ret = callback(&entry->data, &entry->size, &order, callback_arg);
+
+		if ((ret = __rrr_fifo_buffer_write_callback_return_check(&do_ordered_write, &write_again, &do_drop, ret)) != 0) {
+			__rrr_fifo_buffer_entry_destroy_unlocked(buffer, entry);
+			goto out;
+		}
+
+		if (do_ordered_write) {
+			RRR_BUG("BUG: Callback returned WRITE_ORDERED to rrr_fifo_buffer_write_batch\n");
+		}
+
+		if (do_drop) {
+			__rrr_fifo_buffer_entry_destroy_unlocked(buffer, entry);
+			continue;
+		}
+
+		if (entry->data == NULL) {
+			RRR_BUG("Data from callback was NULL in rrr_fifo_buffer_write_batch, must return DROP\n");
+		}
+
+		entry->order = order;
+
+		if (last == NULL) {
+			first = entry;
+		}
+		else {
+			last->next = entry;
+		}
+		last = entry;
+		count++;
+	} while (write_again);
+
+	out:
+	if (count == 0) {
+		return ret;
+	}
+
+	rrr_fifo_write_lock(buffer);
+
+	RRR_FIFO_BUFFER_CONSISTENCY_CHECK();
+
+	if (buffer->gptr_first == NULL) {
+		buffer->gptr_first = first;
+	}
+	else {
+		buffer->gptr_last->next = first;
+	}
+	buffer->gptr_last = last;
+
+	RRR_FIFO_BUFFER_CONSISTENCY_CHECK();
+
+	pthread_mutex_lock(&buffer->entry_count_mutex);
+	buffer->entry_count += count;
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
+
+	rrr_fifo_unlock(buffer);
+
+	__rrr_fifo_buffer_stats_add_written(buffer, count);
+	__rrr_fifo_buffer_set_data_available(buffer);
+
+	return ret;
+}
+
 /*
  * This writing method will write entries to the temporary write queue. This will not block
  * if there are readers or an ordinary writer on the buffer. The read functions will, each time
@@ -1547,6 +1945,10 @@ int rrr_fifo_buffer_write_delayed (
 		int (*callback)(char **data, unsigned long int *size, uint64_t *order, void *arg),
 		void *callback_arg
 ) {
+	if (buffer->ring != NULL) {
+		return __rrr_fifo_buffer_write_ring(buffer, callback, callback_arg, 1);
+	}
+
 	int ret = 0;
 
 	pthread_mutex_lock (&buffer->write_queue_mutex);
@@ -1613,19 +2015,15 @@ int rrr_fifo_buffer_write_delayed (
 		}
 
 		{
-			pthread_mutex_lock(&buffer->ratelimit_mutex);
+			pthread_mutex_lock(&buffer->entry_count_mutex);
 			buffer->write_queue_entry_count++;
-			pthread_mutex_unlock(&buffer->ratelimit_mutex);
+			pthread_mutex_unlock(&buffer->entry_count_mutex);
 		}
 
 		// Can't do this here, might deadlock (many call delayed_write while holding)
 		// the write lock
 		// RRR_FIFO_BUFFER_CONSISTENCY_CHECK_WRITE_LOCK();
 
-		pthread_mutex_unlock (&buffer->write_queue_mutex);
-		__rrr_fifo_buffer_do_ratelimit(buffer);
-		pthread_mutex_lock (&buffer->write_queue_mutex);
-
 		entry = NULL;
 	} while (write_again);
 
@@ -26,10 +26,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <inttypes.h>
 #include <semaphore.h>
 
+#include "fifo_ring.h"
+
 //#define FIFO_DEBUG_COUNTER
 //#define FIFO_SPIN_DELAY 0 // microseconds
 #define RRR_FIFO_DEFAULT_RATELIMIT 100 // If this many entries has been inserted without a read, sleep a bit
 #define RRR_FIFO_MAX_READS 500 // Maximum number of reads per call to a read function
+#define RRR_FIFO_RING_READ_CHUNK 64 // Entries taken from the ring engine per lock-free read round
 
 #define RRR_FIFO_OK					0
 #define RRR_FIFO_GLOBAL_ERR			(1<<0)
@@ -45,6 +48,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_FIFO_WRITE_DROP		(1<<11)
 #define RRR_FIFO_WRITE_ORDERED	(1<<12)
 
+#define RRR_FIFO_BUFFER_ENGINE_LIST	0
+#define RRR_FIFO_BUFFER_ENGINE_RING	1
+
 #define RRR_FIFO_READ_CALLBACK_ARGS \
 	void *arg, char *data, unsigned long int size
 
@@ -67,15 +73,6 @@ struct rrr_fifo_buffer_entry {
 	pthread_mutex_t lock;
 };
 
-struct rrr_fifo_buffer_ratelimit {
-	double read_write_balance;
-	int prev_entry_count;
-	long long int sleep_spin_time;
-	uint64_t prev_time;
-	int burst_counter;
-	long long int spins_per_us;
-};
-
 struct rrr_fifo_buffer_stats {
 	uint64_t total_entries_written;
 	uint64_t total_entries_deleted;
@@ -94,6 +91,15 @@ struct rrr_fifo_buffer_stats {
  * - Writers increment the new_data_available semaphore to inform waiting readers
  *   that data is available. After waiting is completed, regardless of whether a
  *   timeout occurred or not, the readers will check the buffer for new data.
+ *
+ * Ring engine:
+ * - When the ring engine is selected, writers push entries to a bounded lock-free
+ *   ring instead of the linked list, and read_clear_forward pops directly from
+ *   the ring while the list is empty. No entry allocations or locks are then used.
+ * - Ordered writes and writes to a full ring go to the list (or the write queue
+ *   for delayed writes) like with the list engine.
+ * - Functions which traverse the list, like search, first move all entries from
+ *   the ring into the list while holding the write lock.
  */
 
 struct rrr_fifo_buffer {
@@ -105,16 +111,17 @@ struct rrr_fifo_buffer {
 
 	pthread_rwlock_t rwlock;
 	pthread_mutex_t write_queue_mutex;
-	pthread_mutex_t ratelimit_mutex;
+	pthread_mutex_t entry_count_mutex;
 	pthread_mutex_t stats_mutex;
 
-	int buffer_do_ratelimit;
 	int entry_count;
 	int write_queue_entry_count;
 
-	struct rrr_fifo_buffer_ratelimit ratelimit;
 	struct rrr_fifo_buffer_stats stats;
 
+	// NULL when the list engine is used
+	struct rrr_fifo_ring *ring;
+
 	void (*free_entry)(void *arg);
 
 	sem_t new_data_available;
@@ -142,9 +149,10 @@ int rrr_fifo_buffer_init_custom_free (
 		struct rrr_fifo_buffer *buffer,
 		void (*custom_free)(void *arg)
 );
-void rrr_fifo_buffer_set_do_ratelimit (
+int rrr_fifo_buffer_init_custom_free_with_engine (
 		struct rrr_fifo_buffer *buffer,
-		int set
+		void (*custom_free)(void *arg),
+		int engine
 );
 
 static inline int rrr_fifo_buffer_get_entry_count (
@@ -152,9 +160,13 @@ static inline int rrr_fifo_buffer_get_entry_count (
 ) {
 	int ret = 0;
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	pthread_mutex_lock(&buffer->entry_count_mutex);
 	ret = buffer->entry_count;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
+
+	if (buffer->ring != NULL) {
+		ret += (int) rrr_fifo_ring_count(buffer->ring);
+	}
 
 	return ret;
 }
@@ -164,21 +176,13 @@ static inline int rrr_fifo_buffer_get_entry_count_combined (
 ) {
 	int ret = 0;
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
+	pthread_mutex_lock(&buffer->entry_count_mutex);
 	ret = buffer->entry_count + buffer->write_queue_entry_count;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
-
-	return ret;
-}
-
-static inline int rrr_fifo_buffer_get_ratelimit_active (
-		struct rrr_fifo_buffer *buffer
-) {
-	int ret = 0;
+	pthread_mutex_unlock(&buffer->entry_count_mutex);
 
-	pthread_mutex_lock(&buffer->ratelimit_mutex);
-	ret = buffer->buffer_do_ratelimit;
-	pthread_mutex_unlock(&buffer->ratelimit_mutex);
+	if (buffer->ring != NULL) {
+		ret += (int) rrr_fifo_ring_count(buffer->ring);
+	}
 
 	return ret;
 }
@@ -269,6 +273,11 @@ int rrr_fifo_buffer_write (
 		int (*callback)(RRR_FIFO_WRITE_CALLBACK_ARGS),
 		void *callback_arg
 );
+int rrr_fifo_buffer_write_batch (
+		struct rrr_fifo_buffer *buffer,
+		int (*callback)(RRR_FIFO_WRITE_CALLBACK_ARGS),
+		void *callback_arg
+);
 int rrr_fifo_buffer_write_delayed (
 		struct rrr_fifo_buffer *buffer,
 		int (*callback)(RRR_FIFO_WRITE_CALLBACK_ARGS),
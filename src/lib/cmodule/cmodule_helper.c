@@ -83,14 +83,19 @@ static int __rrr_cmodule_helper_read_final_callback (struct rrr_msg_holder *entr
 		goto out;
 	}
 
-	rrr_msg_holder_set_unlocked (
+	if (rrr_msg_holder_set_unlocked (
 			entry,
 			message_new,
 			MSG_TOTAL_SIZE(message_new),
 			(struct sockaddr *) &callback_data->addr_message.addr,
 			RRR_MSG_ADDR_GET_ADDR_LEN(&callback_data->addr_message),
 			callback_data->addr_message.protocol
-	);
+	) != 0) {
+		RRR_MSG_0("Could not set message in __rrr_message_broker_cmodule_read_final_callback for instance %s\n",
+				INSTANCE_D_NAME(callback_data->thread_data));
+		ret = 1;
+		goto out;
+	}
 	message_new = NULL;
 
 	callback_data->count++;
@@ -183,7 +188,7 @@ static int __rrr_cmodule_helper_send_message_to_fork (
 	rrr_msg_addr_init(&addr_msg);
 
 	if (node->addr_len > 0) {
-		memcpy(&addr_msg.addr, &node->addr, sizeof(addr_msg.addr));
+		memcpy(&addr_msg.addr, node->addr, node->addr_len);
 		RRR_MSG_ADDR_SET_ADDR_LEN(&addr_msg, node->addr_len);
 		addr_msg.protocol = node->protocol;
 	}
@@ -547,14 +552,14 @@ static int __rrr_cmodule_helper_event_periodic (
 	}
 
 	int output_buffer_count = 0;
-	int output_buffer_ratelimit_active = 0;
+	int output_buffer_backpressure_active = 0;
 
-	if (rrr_instance_default_set_output_buffer_ratelimit_when_needed (
+	if (rrr_message_broker_get_entry_count_and_backpressure (
 			&output_buffer_count,
-			&output_buffer_ratelimit_active,
-			thread_data
+			&output_buffer_backpressure_active,
+			INSTANCE_D_BROKER_ARGS(thread_data)
 	) != 0) {
-		RRR_MSG_0("Error while setting ratelimit in instance %s\n",
+		RRR_MSG_0("Error while getting output buffer size in instance %s\n",
 			INSTANCE_D_NAME(thread_data));
 		return 1;
 	}
@@ -50,63 +50,78 @@ enum rrr_condition_priority {
 	RRR_CONDITION_PRIORITY_OR
 };
 
+enum rrr_condition_op_code {
+	RRR_CONDITION_OP_NONE,
+	RRR_CONDITION_OP_LTEQ,
+	RRR_CONDITION_OP_GTEQ,
+	RRR_CONDITION_OP_LT,
+	RRR_CONDITION_OP_GT,
+	RRR_CONDITION_OP_EQ,
+	RRR_CONDITION_OP_NE,
+	RRR_CONDITION_OP_AND,
+	RRR_CONDITION_OP_OR,
+	RRR_CONDITION_OP_BW_AND,
+	RRR_CONDITION_OP_BW_XOR,
+	RRR_CONDITION_OP_BW_OR,
+	RRR_CONDITION_OP_BW_LEFT,
+	RRR_CONDITION_OP_BW_RIGHT,
+	RRR_CONDITION_OP_BW_NOT,
+	RRR_CONDITION_OP_ADD,
+	RRR_CONDITION_OP_SUB,
+	RRR_CONDITION_OP_MUL,
+	RRR_CONDITION_OP_DIV
+};
+
 struct rrr_condition_op {
 	char op[4];
 	unsigned char prio;
+	unsigned char code;
 };
 
 // If operators have the same first character, the longest one
 // must be above
 static const struct rrr_condition_op operators[] = {
-		{"(", RRR_CONDITION_PRIORITY_NONE},
-		{")", RRR_CONDITION_PRIORITY_NONE},
-		{"<=", RRR_CONDITION_PRIORITY_CMP},
-		{">=", RRR_CONDITION_PRIORITY_CMP},
-		{"<<", RRR_CONDITION_PRIORITY_BW_SHIFT},
-		{">>", RRR_CONDITION_PRIORITY_BW_SHIFT},
-		{"<", RRR_CONDITION_PRIORITY_CMP},
-		{">", RRR_CONDITION_PRIORITY_CMP},
-		{"==", RRR_CONDITION_PRIORITY_EQUALITY},
-		{"!=", RRR_CONDITION_PRIORITY_EQUALITY},
-
-		{"&&", RRR_CONDITION_PRIORITY_AND},
-		{"||", RRR_CONDITION_PRIORITY_OR},
-		{"AND", RRR_CONDITION_PRIORITY_AND},
-		{"OR", RRR_CONDITION_PRIORITY_OR},
-
-		{"&", RRR_CONDITION_PRIORITY_BW_AND},
-		{"^", RRR_CONDITION_PRIORITY_BW_XOR},
-		{"|", RRR_CONDITION_PRIORITY_BW_OR},
-		{"+", RRR_CONDITION_PRIORITY_ADD},
-		{"-", RRR_CONDITION_PRIORITY_ADD},
-		{"*", RRR_CONDITION_PRIORITY_MUL},
-		{"/", RRR_CONDITION_PRIORITY_MUL},
-		{"~", RRR_CONDITION_PRIORITY_SINGULAR},
-		{"", 0}
+		{"(", RRR_CONDITION_PRIORITY_NONE, RRR_CONDITION_OP_NONE},
+		{")", RRR_CONDITION_PRIORITY_NONE, RRR_CONDITION_OP_NONE},
+		{"<=", RRR_CONDITION_PRIORITY_CMP, RRR_CONDITION_OP_LTEQ},
+		{">=", RRR_CONDITION_PRIORITY_CMP, RRR_CONDITION_OP_GTEQ},
+		{"<<", RRR_CONDITION_PRIORITY_BW_SHIFT, RRR_CONDITION_OP_BW_LEFT},
+		{">>", RRR_CONDITION_PRIORITY_BW_SHIFT, RRR_CONDITION_OP_BW_RIGHT},
+		{"<", RRR_CONDITION_PRIORITY_CMP, RRR_CONDITION_OP_LT},
+		{">", RRR_CONDITION_PRIORITY_CMP, RRR_CONDITION_OP_GT},
+		{"==", RRR_CONDITION_PRIORITY_EQUALITY, RRR_CONDITION_OP_EQ},
+		{"!=", RRR_CONDITION_PRIORITY_EQUALITY, RRR_CONDITION_OP_NE},
+
+		{"&&", RRR_CONDITION_PRIORITY_AND, RRR_CONDITION_OP_AND},
+		{"||", RRR_CONDITION_PRIORITY_OR, RRR_CONDITION_OP_OR},
+		{"AND", RRR_CONDITION_PRIORITY_AND, RRR_CONDITION_OP_AND},
+		{"OR", RRR_CONDITION_PRIORITY_OR, RRR_CONDITION_OP_OR},
+
+		{"&", RRR_CONDITION_PRIORITY_BW_AND, RRR_CONDITION_OP_BW_AND},
+		{"^", RRR_CONDITION_PRIORITY_BW_XOR, RRR_CONDITION_OP_BW_XOR},
+		{"|", RRR_CONDITION_PRIORITY_BW_OR, RRR_CONDITION_OP_BW_OR},
+		{"+", RRR_CONDITION_PRIORITY_ADD, RRR_CONDITION_OP_ADD},
+		{"-", RRR_CONDITION_PRIORITY_ADD, RRR_CONDITION_OP_SUB},
+		{"*", RRR_CONDITION_PRIORITY_MUL, RRR_CONDITION_OP_MUL},
+		{"/", RRR_CONDITION_PRIORITY_MUL, RRR_CONDITION_OP_DIV},
+		{"~", RRR_CONDITION_PRIORITY_SINGULAR, RRR_CONDITION_OP_BW_NOT},
+		{"", 0, 0}
 };
 
 // Count correctly!
 static const struct rrr_condition_op *operator_par_open =	&operators[0];
 static const struct rrr_condition_op *operator_par_close =	&operators[1];
-static const struct rrr_condition_op *operator_lteq =		&operators[2];
-static const struct rrr_condition_op *operator_gteq =		&operators[3];
-static const struct rrr_condition_op *operator_bw_left =	&operators[4];
-static const struct rrr_condition_op *operator_bw_right =	&operators[5];
-
-
-static const struct rrr_condition_op *operator_lt =			&operators[6];
-static const struct rrr_condition_op *operator_gt =			&operators[7];
-static const struct rrr_condition_op *operator_eq =			&operators[8];
-static const struct rrr_condition_op *operator_ne =			&operators[9];
-// Note : OR, ||, AND and && are identified by priority
-static const struct rrr_condition_op *operator_bw_and =		&operators[14];
-static const struct rrr_condition_op *operator_bw_xor =		&operators[15];
-static const struct rrr_condition_op *operator_bw_or =		&operators[16];
-static const struct rrr_condition_op *operator_add =		&operators[17];
 static const struct rrr_condition_op *operator_sub =		&operators[18];
-static const struct rrr_condition_op *operator_mul =		&operators[19];
-static const struct rrr_condition_op *operator_div =		&operators[20];
-static const struct rrr_condition_op *operator_bw_not =		&operators[21];
+
+struct rrr_condition_program;
+
+static void __rrr_condition_program_destroy (
+		struct rrr_condition_program *program
+);
+static int __rrr_condition_program_new (
+		struct rrr_condition_program **target,
+		const struct rrr_condition_shunting_yard *shunting_yard
+);
 
 int __rrr_condition_shunting_yard_carrier_allocate (
 		struct rrr_condition_shunting_yard_carrier **target
@@ -183,6 +198,10 @@ void rrr_condition_clear (
 		struct rrr_condition *target
 ) {
 	__rrr_condition_shunting_yard_clear(&target->shunting_yard);
+	if (target->program != NULL) {
+		__rrr_condition_program_destroy(target->program);
+		target->program = NULL;
+	}
 }
 
 static int __rrr_condition_shunting_yard_clone (
@@ -213,10 +232,21 @@ int rrr_condition_clone (
 		struct rrr_condition *target,
 		const struct rrr_condition *source
 ) {
-	return __rrr_condition_shunting_yard_clone (
+	int ret = 0;
+
+	if ((ret = __rrr_condition_shunting_yard_clone (
 			&target->shunting_yard,
 			&source->shunting_yard
-	);
+	)) != 0) {
+		goto out;
+	}
+
+	if (source->program != NULL) {
+		ret = __rrr_condition_program_new(&target->program, &target->shunting_yard);
+	}
+
+	out:
+	return ret;
 }
 
 static const struct rrr_condition_op *__rrr_condition_parse_op (struct rrr_parse_pos *pos) {
@@ -495,6 +525,10 @@ int rrr_condition_interpret (
 		goto out_clear;
 	}
 
+	if ((ret = __rrr_condition_program_new(&target->program, shunting_yard)) != 0) {
+		goto out_clear;
+	}
+
 	goto out;
 	out_clear:
 		rrr_condition_clear(target);
@@ -553,68 +587,83 @@ int rrr_condition_iterate (
 	return ret;
 }
 
+struct rrr_condition_value {
+	uint64_t result;
+	int is_signed;
+};
+
 struct rrr_condition_running_result {
 	// Set to NULL when evaluated
 	const struct rrr_condition_shunting_yard_carrier *carrier;
-	uint64_t result;
-	int is_signed;
+	struct rrr_condition_value value;
 	int is_evaluated;
 };
 
+enum rrr_condition_instruction_type {
+	RRR_CONDITION_INSTRUCTION_CONSTANT,
+	RRR_CONDITION_INSTRUCTION_NAME,
+	RRR_CONDITION_INSTRUCTION_OP
+};
+
+struct rrr_condition_instruction {
+	unsigned char type;
+	unsigned char is_signed;
+	int name_index;
+	uint64_t value;
+	const struct rrr_condition_op *op;
+};
+
+// Postfix expression with pre-parsed constants and names replaced by
+// indexes into the name table, evaluated using a value stack.
+struct rrr_condition_program {
+	struct rrr_condition_instruction *instructions;
+	int instruction_count;
+	int op_count;
+	int stack_size;
+	char **names;
+	int name_count;
+};
+
 #define EVALUATION 						\
-	do {if (op == operator_lteq) {		\
-		return (a <= b);				\
-	}									\
-	else if (op == operator_gteq) {		\
-		return (a >= b);				\
-	}									\
-	else if (op == operator_lt) {		\
-		return (a < b);					\
-	}									\
-	else if (op == operator_gt) {		\
-		return (a > b);					\
-	}									\
-	else if (op == operator_eq) {		\
-		return (a == b);				\
-	}									\
-	else if (op == operator_ne) {		\
-		return (a != b);				\
-	}									\
-	else if (op->prio == RRR_CONDITION_PRIORITY_AND) {		\
-		return (a && b);									\
-	}														\
-	else if (op->prio == RRR_CONDITION_PRIORITY_OR) {		\
-		return (a || b);									\
-	}														\
-	else if (op == operator_bw_and) {	\
-		return (a & b);					\
-	}									\
-	else if (op == operator_bw_xor) {	\
-		return (a ^ b);					\
-	}									\
-	else if (op == operator_bw_or) {	\
-		return (a | b);					\
-	}									\
-	else if (op == operator_bw_left) {	\
-		return (a << b);				\
-	}									\
-	else if (op == operator_bw_right) {	\
-		return (a >> b);				\
-	}									\
-	else if (op == operator_bw_not) {	\
-		return (~b);					\
-	}									\
-	else if (op == operator_add) {		\
-		return (a + b);					\
-	}									\
-	else if (op == operator_sub) {		\
-		return (a - b);					\
-	}									\
-	else if (op == operator_mul) {		\
-		return (a * b);					\
-	}									\
-	else if (op == operator_div) {		\
-		return (a / b);					\
+	do {switch (op->code) {				\
+		case RRR_CONDITION_OP_LTEQ:		\
+			return (a <= b);			\
+		case RRR_CONDITION_OP_GTEQ:		\
+			return (a >= b);			\
+		case RRR_CONDITION_OP_LT:		\
+			return (a < b);				\
+		case RRR_CONDITION_OP_GT:		\
+			return (a > b);				\
+		case RRR_CONDITION_OP_EQ:		\
+			return (a == b);			\
+		case RRR_CONDITION_OP_NE:		\
+			return (a != b);			\
+		case RRR_CONDITION_OP_AND:		\
+			return (a && b);			\
+		case RRR_CONDITION_OP_OR:		\
+			return (a || b);			\
+		case RRR_CONDITION_OP_BW_AND:	\
+			return (a & b);				\
+		case RRR_CONDITION_OP_BW_XOR:	\
+			return (a ^ b);				\
+		case RRR_CONDITION_OP_BW_OR:	\
+			return (a | b);				\
+		case RRR_CONDITION_OP_BW_LEFT:	\
+			return (a << b);			\
+		case RRR_CONDITION_OP_BW_RIGHT:	\
+			return (a >> b);			\
+		case RRR_CONDITION_OP_BW_NOT:	\
+			return (~b);				\
+		case RRR_CONDITION_OP_ADD:		\
+			return (a + b);				\
+		case RRR_CONDITION_OP_SUB:		\
+			return (a - b);				\
+		case RRR_CONDITION_OP_MUL:		\
+			return (a * b);				\
+		case RRR_CONDITION_OP_DIV:		\
+			return (a / b);				\
+		default:						\
+			break;						\
 	}} while(0)
 
 static uint64_t __rrr_condition_evaluate_operator (
@@ -642,25 +691,71 @@ static int64_t __rrr_condition_evaluate_operator_signed (
 }
 
 static int64_t __rrr_condition_evalute_ensure_signed (
-		struct rrr_condition_running_result *result
+		const struct rrr_condition_value *value
 ) {
 	int64_t signed_result = 0;
 
-	if (!result->is_signed && result->result > INT64_MAX) {
+	if (!value->is_signed && value->result > INT64_MAX) {
 		RRR_MSG_0("Warning: Unsigned integer %" PRIu64 " will overflow when converted to signed in array condition evaluation\n",
-			result->result);
+			value->result);
 	}
 
-	if (result->is_signed) {
-		signed_result = *((int64_t*) &result->result);
+	if (value->is_signed) {
+		signed_result = *((int64_t*) &value->result);
 	}
 	else {
-		signed_result = result->result;
+		signed_result = value->result;
 	}
 
 	return signed_result;
 }
 
+// Value A is NULL for operators with only one operand. The target may
+// be the same as one of the operands.
+static void __rrr_condition_evaluate_values (
+		struct rrr_condition_value *target,
+		const struct rrr_condition_op *op,
+		const struct rrr_condition_value *value_a,
+		const struct rrr_condition_value *value_b
+) {
+	if (value_b->is_signed || (value_a != NULL && value_a->is_signed)) {
+		int64_t signed_a = 0;
+		int64_t signed_b = 0;
+
+		if (value_a != NULL) {
+			signed_a = __rrr_condition_evalute_ensure_signed(value_a);
+		}
+
+		signed_b = __rrr_condition_evalute_ensure_signed(value_b);
+
+		int64_t result_tmp = __rrr_condition_evaluate_operator_signed (
+				signed_a,
+				signed_b,
+				op
+		);
+
+		target->result = *((uint64_t *) &result_tmp);
+		target->is_signed = 1;
+
+		RRR_DBG_3("Array tree condition signed evaluation %" PRIi64 " %s %" PRIi64 " = %" PRIu64 "\n",
+				signed_a, op->op, signed_b, target->result);
+	}
+	else {
+		uint64_t unsigned_a = (value_a != NULL ? value_a->result : 0);
+		uint64_t unsigned_b = value_b->result;
+
+		target->result = __rrr_condition_evaluate_operator (
+				unsigned_a,
+				unsigned_b,
+				op
+		);
+		target->is_signed = 0;
+
+		RRR_DBG_3("Array tree condition unsigned evaluation %" PRIu64 " %s %" PRIu64 " = %" PRIu64 "\n",
+				unsigned_a, op->op, unsigned_b, target->result);
+	}
+}
+
 static void __rrr_condition_evaluate_op (
 		uint64_t *result,
 		const struct rrr_condition_op *op,
@@ -690,47 +785,17 @@ static void __rrr_condition_evaluate_op (
 		RRR_BUG("BUG: Value missing prior to operator in __rrr_condition_evaluate_op, validator should catch this.\n");
 	}
 
-	if (result_b->is_signed || (result_a != NULL && result_a->is_signed)) {
-		int64_t signed_a = 0;
-		int64_t signed_b = 0;
-
-		if (result_a != NULL) {
-			signed_a = __rrr_condition_evalute_ensure_signed(result_a);
-		}
-
-		signed_b = __rrr_condition_evalute_ensure_signed(result_b);
-
-		int64_t result_tmp = __rrr_condition_evaluate_operator_signed (
-				signed_a,
-				signed_b,
-				op
-		);
-
-		position->result = *((uint64_t *) &result_tmp);
-		position->is_signed = 1;
-
-		RRR_DBG_3("Array tree condition signed evaluation %" PRIi64 " %s %" PRIi64 " = %" PRIu64 "\n",
-				signed_a, op->op, signed_b, position->result);
-	}
-	else {
-		uint64_t unsigned_a = (result_a != NULL ? result_a->result : 0);
-		uint64_t unsigned_b = result_b->result;
-
-		position->result = __rrr_condition_evaluate_operator (
-				unsigned_a,
-				unsigned_b,
-				op
-		);
-
-		RRR_DBG_3("Array tree condition unsigned evaluation %" PRIu64 " %s %" PRIu64 " = %" PRIu64 "\n",
-				unsigned_a, op->op, unsigned_b, position->result);
-
-	}
+	__rrr_condition_evaluate_values (
+			&position->value,
+			op,
+			(result_a != NULL ? &result_a->value : NULL),
+			&result_b->value
+	);
 
 	position->carrier = NULL;
 	position->is_evaluated = 1;
 
-	*result = position->result;
+	*result = position->value.result;
 
 	if (result_a != NULL) {
 		result_a->is_evaluated = 0;
@@ -739,73 +804,88 @@ static void __rrr_condition_evaluate_op (
 	result_b->is_evaluated = 0;
 }
 
-static int __rrr_condition_evalute_value (
-		struct rrr_condition_running_result *position,
-		int (*name_evaluate_callback)(RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS),
-		void *name_evaluate_callback_arg
+static int __rrr_condition_parse_constant (
+		struct rrr_condition_value *target,
+		const char *value
 ) {
 	int ret = 0;
 
-	char value_tmp[RRR_CONDITION_VALUE_MAX];
-
-	if (*(position->carrier->value) == '{') {
-		const char *tag_to_pass = __rrr_condition_extract_name (
-				value_tmp,
-				position->carrier->value
-		);
-
-		if ((ret = name_evaluate_callback (
-				&position->result,
-				&position->is_signed,
-				tag_to_pass,
-				name_evaluate_callback_arg
-		)) != 0) {
-			goto out;
-		}
-
-		RRR_DBG_3("Array tree condition tag name evaluation %s->0x%lx%s\n",
-				tag_to_pass, position->result, (position->is_signed ? " (signed)" : ""));
-	}
-	else if (	strlen(position->carrier->value) >= 2 &&
-				rrr_posix_strncasecmp(position->carrier->value, "0x", 2) == 0
-	) {
-		const char *value_start = position->carrier->value + 2;
+	if (strlen(value) >= 2 && rrr_posix_strncasecmp(value, "0x", 2) == 0) {
+		const char *value_start = value + 2;
 		char *endptr = NULL;
 
-		position->result = strtoull(value_start, &endptr, 16);
+		target->result = strtoull(value_start, &endptr, 16);
+		target->is_signed = 0;
 		if (endptr == NULL || *endptr != '\0') {
 			// This might be a bug, parser should validate the numbers
-			RRR_MSG_0("Could not evaluate hex value '%s' in rrr_condition_evaluate\n", value_start);
+			RRR_MSG_0("Could not evaluate hex value '%s' in condition\n", value_start);
 			ret = RRR_CONDITION_SOFT_ERROR;
 			goto out;
 		}
 	}
-	else if (*(position->carrier->value) == '-') {
+	else if (*value == '-') {
 		char *endptr = NULL;
 
-		int64_t tmp = strtoll(position->carrier->value, &endptr, 10);
+		int64_t tmp = strtoll(value, &endptr, 10);
 		if (endptr == NULL || *endptr != '\0') {
 			// This might be a bug, parser should validate the numbers
-			RRR_MSG_0("Could not evaluate negative decimal value '%s' in rrr_condition_evaluate\n", position->carrier->value);
+			RRR_MSG_0("Could not evaluate negative decimal value '%s' in condition\n", value);
 			ret = RRR_CONDITION_SOFT_ERROR;
 			goto out;
 		}
 
-		position->result = *((uint64_t*) &tmp);
-		position->is_signed = 1;
+		target->result = *((uint64_t*) &tmp);
+		target->is_signed = 1;
 	}
 	else {
 		char *endptr = NULL;
 
-		position->result = strtoull(position->carrier->value, &endptr, 10);
+		target->result = strtoull(value, &endptr, 10);
+		target->is_signed = 0;
 		if (endptr == NULL || *endptr != '\0') {
 			// This might be a bug, parser should validate the numbers
-			RRR_MSG_0("Could not evaluate decimal value '%s' in rrr_condition_evaluate\n", position->carrier->value);
+			RRR_MSG_0("Could not evaluate decimal value '%s' in condition\n", value);
 			ret = RRR_CONDITION_SOFT_ERROR;
 			goto out;
 		}
 	}
 
+	out:
+	return ret;
+}
+
+static int __rrr_condition_evalute_value (
+		struct rrr_condition_running_result *position,
+		int (*name_evaluate_callback)(RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS),
+		void *name_evaluate_callback_arg
+) {
+	int ret = 0;
+
+	char value_tmp[RRR_CONDITION_VALUE_MAX];
+
+	if (*(position->carrier->value) == '{') {
+		const char *tag_to_pass = __rrr_condition_extract_name (
+				value_tmp,
+				position->carrier->value
+		);
+
+		if ((ret = name_evaluate_callback (
+				&position->value.result,
+				&position->value.is_signed,
+				-1,
+				tag_to_pass,
+				name_evaluate_callback_arg
+		)) != 0) {
+			goto out;
+		}
+
+		RRR_DBG_3("Array tree condition tag name evaluation %s->0x%lx%s\n",
+				tag_to_pass, position->value.result, (position->value.is_signed ? " (signed)" : ""));
+	}
+	else if ((ret = __rrr_condition_parse_constant(&position->value, position->carrier->value)) != 0) {
+		goto out;
+	}
+
 	position->carrier = NULL;
 	position->is_evaluated = 1;
 
@@ -813,7 +893,7 @@ static int __rrr_condition_evalute_value (
 	return ret;
 }
 
-int rrr_condition_evaluate (
+static int __rrr_condition_evaluate_shunting_yard (
 		uint64_t *result,
 		const struct rrr_condition *condition,
 		int (*name_evaluate_callback)(RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS),
@@ -821,8 +901,6 @@ int rrr_condition_evaluate (
 ) {
 	int ret = RRR_CONDITION_OK;
 
-	*result = 0;
-
 	struct rrr_condition_running_result results[RRR_LL_COUNT(&condition->shunting_yard)];
 	memset(results, '\0', sizeof(results));
 
@@ -858,3 +936,227 @@ int rrr_condition_evaluate (
 	out:
 	return ret;
 }
+
+static void __rrr_condition_program_destroy (
+		struct rrr_condition_program *program
+) {
+	for (int i = 0; i < program->name_count; i++) {
+		rrr_free(program->names[i]);
+	}
+	RRR_FREE_IF_NOT_NULL(program->names);
+	RRR_FREE_IF_NOT_NULL(program->instructions);
+	rrr_free(program);
+}
+
+static int __rrr_condition_program_name_index (
+		int *index,
+		struct rrr_condition_program *program,
+		const char *name
+) {
+	for (int i = 0; i < program->name_count; i++) {
+		if (strcmp(program->names[i], name) == 0) {
+			*index = i;
+			return 0;
+		}
+	}
+
+	char **names_new = rrr_reallocate (
+			program->names,
+			sizeof(*names_new) * (size_t) program->name_count,
+			sizeof(*names_new) * (size_t) (program->name_count + 1)
+	);
+	if (names_new == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_condition_program_name_index\n");
+		return RRR_CONDITION_HARD_ERROR;
+	}
+	program->names = names_new;
+
+	if ((program->names[program->name_count] = rrr_strdup(name)) == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_condition_program_name_index\n");
+		return RRR_CONDITION_HARD_ERROR;
+	}
+
+	*index = program->name_count++;
+
+	return 0;
+}
+
+static int __rrr_condition_program_new (
+		struct rrr_condition_program **target,
+		const struct rrr_condition_shunting_yard *shunting_yard
+) {
+	int ret = RRR_CONDITION_OK;
+
+	*target = NULL;
+
+	struct rrr_condition_program *program = NULL;
+	char value_tmp[RRR_CONDITION_VALUE_MAX];
+
+	if ((program = rrr_allocate(sizeof(*program))) == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_condition_program_new\n");
+		ret = RRR_CONDITION_HARD_ERROR;
+		goto out;
+	}
+
+	memset(program, '\0', sizeof(*program));
+
+	const size_t instructions_size = sizeof(*(program->instructions)) * (size_t) RRR_LL_COUNT(shunting_yard);
+	if (instructions_size > 0) {
+		if ((program->instructions = rrr_allocate(instructions_size)) == NULL) {
+			RRR_MSG_0("Could not allocate memory in __rrr_condition_program_new\n");
+			ret = RRR_CONDITION_HARD_ERROR;
+			goto out_destroy;
+		}
+		memset(program->instructions, '\0', instructions_size);
+	}
+
+	int depth = 0;
+	RRR_LL_ITERATE_BEGIN(shunting_yard, const struct rrr_condition_shunting_yard_carrier);
+		struct rrr_condition_instruction *instruction = &program->instructions[program->instruction_count++];
+
+		if (node->op != NULL) {
+			const int operand_count = (node->op->prio == RRR_CONDITION_PRIORITY_SINGULAR ? 1 : 2);
+			if (depth < operand_count) {
+				RRR_MSG_0("Operator '%s' is missing a value in condition expression\n", node->op->op);
+				ret = RRR_CONDITION_SOFT_ERROR;
+				goto out_destroy;
+			}
+			depth -= operand_count - 1;
+			instruction->type = RRR_CONDITION_INSTRUCTION_OP;
+			instruction->op = node->op;
+			program->op_count++;
+		}
+		else {
+			if (*(node->value) == '{') {
+				instruction->type = RRR_CONDITION_INSTRUCTION_NAME;
+				if ((ret = __rrr_condition_program_name_index (
+						&instruction->name_index,
+						program,
+						__rrr_condition_extract_name(value_tmp, node->value)
+				)) != 0) {
+					goto out_destroy;
+				}
+			}
+			else {
+				struct rrr_condition_value value;
+				if ((ret = __rrr_condition_parse_constant(&value, node->value)) != 0) {
+					goto out_destroy;
+				}
+				instruction->type = RRR_CONDITION_INSTRUCTION_CONSTANT;
+				instruction->value = value.result;
+				instruction->is_signed = (unsigned char) value.is_signed;
+			}
+			if (++depth > program->stack_size) {
+				program->stack_size = depth;
+			}
+		}
+	RRR_LL_ITERATE_END();
+
+	*target = program;
+
+	goto out;
+	out_destroy:
+		__rrr_condition_program_destroy(program);
+	out:
+		return ret;
+}
+
+static int __rrr_condition_program_evaluate (
+		uint64_t *result,
+		const struct rrr_condition_program *program,
+		int (*name_evaluate_callback)(RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS),
+		void *name_evaluate_callback_arg
+) {
+	int ret = RRR_CONDITION_OK;
+
+	struct rrr_condition_value stack[program->stack_size > 0 ? program->stack_size : 1];
+	int depth = 0;
+
+	for (int i = 0; i < program->instruction_count; i++) {
+		const struct rrr_condition_instruction *instruction = &program->instructions[i];
+		struct rrr_condition_value *value;
+
+		switch (instruction->type) {
+			case RRR_CONDITION_INSTRUCTION_CONSTANT:
+				value = &stack[depth++];
+				value->result = instruction->value;
+				value->is_signed = instruction->is_signed;
+				break;
+			case RRR_CONDITION_INSTRUCTION_NAME:
+				value = &stack[depth++];
+				value->is_signed = 0;
+				if ((ret = name_evaluate_callback (
+						&value->result,
+						&value->is_signed,
+						instruction->name_index,
+						program->names[instruction->name_index],
+						name_evaluate_callback_arg
+				)) != 0) {
+					goto out;
+				}
+				RRR_DBG_3("Array tree condition tag name evaluation %s->0x%lx%s\n",
+						program->names[instruction->name_index], value->result, (value->is_signed ? " (signed)" : ""));
+				break;
+			case RRR_CONDITION_INSTRUCTION_OP:
+				if (instruction->op->prio == RRR_CONDITION_PRIORITY_SINGULAR) {
+					value = &stack[depth - 1];
+					__rrr_condition_evaluate_values(value, instruction->op, NULL, value);
+				}
+				else {
+					value = &stack[--depth - 1];
+					__rrr_condition_evaluate_values(value, instruction->op, value, &stack[depth]);
+				}
+				break;
+			default:
+				RRR_BUG("BUG: Unknown instruction type %u in __rrr_condition_program_evaluate\n", instruction->type);
+		};
+	}
+
+	// As when evaluating the shunting yard directly, the result of the
+	// last operator is used. Expressions without operators give zero.
+	*result = (program->op_count > 0 ? stack[0].result : 0);
+
+	out:
+	return ret;
+}
+
+int rrr_condition_evaluate (
+		uint64_t *result,
+		const struct rrr_condition *condition,
+		int (*name_evaluate_callback)(RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS),
+		void *name_evaluate_callback_arg
+) {
+	*result = 0;
+
+	if (condition->program != NULL) {
+		return __rrr_condition_program_evaluate (
+				result,
+				condition->program,
+				name_evaluate_callback,
+				name_evaluate_callback_arg
+		);
+	}
+
+	return __rrr_condition_evaluate_shunting_yard (
+			result,
+			condition,
+			name_evaluate_callback,
+			name_evaluate_callback_arg
+	);
+}
+
+int rrr_condition_name_count (
+		const struct rrr_condition *condition
+) {
+	return (condition->program != NULL ? condition->program->name_count : 0);
+}
+
+const char *rrr_condition_name_get (
+		const struct rrr_condition *condition,
+		int index
+) {
+	if (condition->program == NULL || index < 0 || index >= condition->program->name_count) {
+		RRR_BUG("BUG: Name index %i out of range in rrr_condition_name_get\n", index);
+	}
+	return condition->program->names[index];
+}
@@ -34,11 +34,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_CONDITION_HARD_ERROR	RRR_READ_HARD_ERROR
 #define RRR_CONDITION_SOFT_ERROR	RRR_READ_SOFT_ERROR
 
+// The name index is the position of the name as returned by
+// rrr_condition_name_get, or -1 if the condition is not compiled
 #define RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS \
-	uint64_t *result, int *is_signed, const char *name, void *arg
+	uint64_t *result, int *is_signed, int name_index, const char *name, void *arg
 
 struct rrr_string_builder;
 struct rrr_parse_pos;
+struct rrr_condition_program;
 
 struct rrr_condition_shunting_yard_carrier {
 	RRR_LL_NODE(struct rrr_condition_shunting_yard_carrier);
@@ -57,6 +60,8 @@ struct rrr_condition_shunting_yard {
 
 struct rrr_condition {
 	struct rrr_condition_shunting_yard shunting_yard;
+	// Compiled from the shunting yard by interpret and clone
+	struct rrr_condition_program *program;
 };
 
 void rrr_condition_clear (
@@ -90,5 +95,12 @@ int rrr_condition_evaluate (
 		int (*name_evaluate_callback)(RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS),
 		void *name_evaluate_callback_arg
 );
+int rrr_condition_name_count (
+		const struct rrr_condition *condition
+);
+const char *rrr_condition_name_get (
+		const struct rrr_condition *condition,
+		int index
+);
 
 #endif /* RRR_CONDITION_H */
@@ -25,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_EVENT_FUNCTION_MESSAGE_BROKER_DATA_AVAILABLE 0
 #define RRR_EVENT_FUNCTION_MMAP_CHANNEL_DATA_AVAILABLE   1
 #define RRR_EVENT_FUNCTION_LOG_HOOK_DATA_AVAILABLE       2
-#define RRR_EVENT_FUNCTION_MAX                           2
+#define RRR_EVENT_FUNCTION_MESSAGE_BROKER_BACKPRESSURE_RELEASED 3
+#define RRR_EVENT_FUNCTION_MAX                           3
 
 #endif /* RRR_EVENT_FUNCTIONS_H */
@@ -0,0 +1,261 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include "log.h"
+#include "allocator.h"
+#include "fifo_ring.h"
+
+#define RRR_FIFO_RING_CACHELINE 64
+
+/*
+ * Each cell has a sequence number telling whether it is ready to be written
+ * to or read from for a given lap around the ring. Every successful push
+ * and pop advances a 64-bit position counter, the counters also serve as
+ * totals for statistics.
+ *
+ * The bypass flag is the top bit of the enqueue position. Producers reserve
+ * cells by compare-and-swap on the position without the bit set, hence no
+ * cell can be reserved after the flag has been set.
+ */
+
+#define RRR_FIFO_RING_BYPASS_BIT   ((uint64_t) 1 << 63)
+
+struct rrr_fifo_ring_cell {
+	atomic_uint_fast64_t sequence;
+	char *data;
+	unsigned long int size;
+	uint64_t order;
+};
+
+struct rrr_fifo_ring {
+	struct rrr_fifo_ring_cell *cells;
+	uint64_t mask;
+
+	// Keep the positions on separate cache lines to avoid false sharing
+	// between producers and consumers
+	char pad_0[RRR_FIFO_RING_CACHELINE];
+	atomic_uint_fast64_t enqueue_pos;
+	char pad_1[RRR_FIFO_RING_CACHELINE];
+	atomic_uint_fast64_t dequeue_pos;
+	char pad_2[RRR_FIFO_RING_CACHELINE];
+};
+
+int rrr_fifo_ring_new (
+		struct rrr_fifo_ring **result,
+		uint64_t size
+) {
+	int ret = 0;
+
+	*result = NULL;
+
+	if (size < 2 || (size & (size - 1)) != 0) {
+		RRR_BUG("BUG: Size %" PRIu64 " to rrr_fifo_ring_new was not a power of two\n", size);
+	}
+
+	struct rrr_fifo_ring *ring = NULL;
+
+	if ((ring = rrr_allocate(sizeof(*ring))) == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_fifo_ring_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(ring, '\0', sizeof(*ring));
+
+	if ((ring->cells = rrr_allocate(sizeof(*(ring->cells)) * size)) == NULL) {
+		RRR_MSG_0("Could not allocate memory for cells in rrr_fifo_ring_new\n");
+		ret = 1;
+		goto out_free;
+	}
+
+	for (uint64_t i = 0; i < size; i++) {
+		atomic_init(&ring->cells[i].sequence, i);
+		ring->cells[i].data = NULL;
+		ring->cells[i].size = 0;
+		ring->cells[i].order = 0;
+	}
+
+	ring->mask = size - 1;
+
+	atomic_init(&ring->enqueue_pos, 0);
+	atomic_init(&ring->dequeue_pos, 0);
+
+	*result = ring;
+
+	goto out;
+	out_free:
+		rrr_free(ring);
+	out:
+		return ret;
+}
+
+void rrr_fifo_ring_destroy (
+		struct rrr_fifo_ring *ring,
+		void (*free_data)(void *arg)
+) {
+	char *data;
+	unsigned long int size;
+	uint64_t order;
+
+	while (rrr_fifo_ring_pop(&data, &size, &order, ring) == RRR_FIFO_RING_OK) {
+		if (free_data != NULL) {
+			free_data(data);
+		}
+	}
+
+	rrr_free(ring->cells);
+	rrr_free(ring);
+}
+
+int rrr_fifo_ring_push (
+		struct rrr_fifo_ring *ring,
+		char *data,
+		unsigned long int size,
+		uint64_t order
+) {
+	struct rrr_fifo_ring_cell *cell;
+	uint64_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+
+	for (;;) {
+		if ((pos & RRR_FIFO_RING_BYPASS_BIT) != 0) {
+			return RRR_FIFO_RING_BYPASS;
+		}
+
+		cell = &ring->cells[pos & ring->mask];
+		uint64_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		int64_t diff = (int64_t) sequence - (int64_t) pos;
+
+		if (diff == 0) {
+			// Cell is free for this lap, try to reserve it
+			if (atomic_compare_exchange_weak_explicit (
+					&ring->enqueue_pos,
+					&pos,
+					pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed
+			)) {
+				break;
+			}
+			// On failure, pos now holds the current value, possibly
+			// with the bypass bit set
+		}
+		else if (diff < 0) {
+			// Consumers have not yet emptied the cell from the previous lap
+			return RRR_FIFO_RING_FULL;
+		}
+		else {
+			pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	cell->data = data;
+	cell->size = size;
+	cell->order = order;
+
+	// Publish the cell to consumers
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+	return RRR_FIFO_RING_OK;
+}
+
+int rrr_fifo_ring_pop (
+		char **data,
+		unsigned long int *size,
+		uint64_t *order,
+		struct rrr_fifo_ring *ring
+) {
+	struct rrr_fifo_ring_cell *cell;
+	uint64_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		uint64_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		int64_t diff = (int64_t) sequence - (int64_t) (pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit (
+					&ring->dequeue_pos,
+					&pos,
+					pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed
+			)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			// Producer has not yet published this cell
+			return RRR_FIFO_RING_EMPTY;
+		}
+		else {
+			pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+		}
+	}
+
+	*data = cell->data;
+	*size = cell->size;
+	*order = cell->order;
+
+	// Release the cell for the next lap
+	atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+
+	return RRR_FIFO_RING_OK;
+}
+
+// Approximate when producers or consumers are active
+uint64_t rrr_fifo_ring_count (
+		struct rrr_fifo_ring *ring
+) {
+	uint64_t dequeue_pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+	uint64_t enqueue_pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed) & ~RRR_FIFO_RING_BYPASS_BIT;
+	return (enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0);
+}
+
+uint64_t rrr_fifo_ring_total_pushed (
+		struct rrr_fifo_ring *ring
+) {
+	return atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed) & ~RRR_FIFO_RING_BYPASS_BIT;
+}
+
+// When this returns after setting the flag, all cells ever reserved are
+// counted by rrr_fifo_ring_count and no more cells will be reserved
+void rrr_fifo_ring_bypass_set (
+		struct rrr_fifo_ring *ring,
+		int set
+) {
+	if (set) {
+		atomic_fetch_or_explicit(&ring->enqueue_pos, RRR_FIFO_RING_BYPASS_BIT, memory_order_acq_rel);
+	}
+	else {
+		atomic_fetch_and_explicit(&ring->enqueue_pos, ~RRR_FIFO_RING_BYPASS_BIT, memory_order_acq_rel);
+	}
+}
+
+int rrr_fifo_ring_bypass_get (
+		struct rrr_fifo_ring *ring
+) {
+	return (atomic_load_explicit(&ring->enqueue_pos, memory_order_acquire) & RRR_FIFO_RING_BYPASS_BIT) != 0;
+}
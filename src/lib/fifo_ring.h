@@ -0,0 +1,80 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_FIFO_RING_H
+#define RRR_FIFO_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Must be a power of two
+#define RRR_FIFO_RING_DEFAULT_SIZE 4096
+
+#define RRR_FIFO_RING_OK     0
+#define RRR_FIFO_RING_FULL   1
+#define RRR_FIFO_RING_EMPTY  1
+#define RRR_FIFO_RING_BYPASS 2
+
+/*
+ * Bounded multi-producer multi-consumer ring of data pointers. Producers
+ * and consumers reserve positions using compare-and-swap only, no locks
+ * are used. The structure is private to fifo_ring.c to keep atomics out
+ * of users' headers. While the bypass flag is set, push returns
+ * RRR_FIFO_RING_BYPASS and the producer must write elsewhere.
+ */
+
+struct rrr_fifo_ring;
+
+int rrr_fifo_ring_new (
+		struct rrr_fifo_ring **result,
+		uint64_t size
+);
+void rrr_fifo_ring_destroy (
+		struct rrr_fifo_ring *ring,
+		void (*free_data)(void *arg)
+);
+int rrr_fifo_ring_push (
+		struct rrr_fifo_ring *ring,
+		char *data,
+		unsigned long int size,
+		uint64_t order
+);
+int rrr_fifo_ring_pop (
+		char **data,
+		unsigned long int *size,
+		uint64_t *order,
+		struct rrr_fifo_ring *ring
+);
+uint64_t rrr_fifo_ring_count (
+		struct rrr_fifo_ring *ring
+);
+uint64_t rrr_fifo_ring_total_pushed (
+		struct rrr_fifo_ring *ring
+);
+void rrr_fifo_ring_bypass_set (
+		struct rrr_fifo_ring *ring,
+		int set
+);
+int rrr_fifo_ring_bypass_get (
+		struct rrr_fifo_ring *ring
+);
+
+#endif /* RRR_FIFO_RING_H */
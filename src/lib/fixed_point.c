@@ -31,6 +31,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "allocator.h"
 #include "util/rrr_endian.h"
 #include "util/gnu.h"
+#include "util/swar.h"
 
 static const double decimal_fractions_base2[24] = {
 		1.0/2.0,
@@ -305,6 +306,18 @@ static int __rrr_fixp_str_preliminary_parse (
 	// PRELIMINARY INPUT CHECK AND SEPARATOR SEARCH
 	int dot_count = 0;
 	for (const char *pos = start; pos < end; pos++) {
+		// Skip ahead over blocks of eight digits
+		while (end - pos >= 8 && (*base == 16
+				? rrr_swar_is_hex_digits_8(rrr_swar_load_le64(pos))
+				: rrr_swar_is_digits_8(rrr_swar_load_le64(pos))
+		)) {
+			pos += 8;
+			number_length += 8;
+		}
+		if (pos == end) {
+			break;
+		}
+
 		char c = *pos;
 		if (c >= '0' && c <= '9') {
 			// OK
@@ -341,6 +354,48 @@ static int __rrr_fixp_str_preliminary_parse (
 	return 0;
 }
 
+// The generic integer conversion sums using long double, which is exact
+// while the value fits in the mantissa of a double. This holds for up to 15
+// decimal or 13 hexadecimal digits, and these are instead converted eight
+// digits at a time. Returns 1 when the number is longer and the generic
+// conversion must be used.
+static int __rrr_fixp_str_integer_fast (
+		uint64_t *result,
+		const char *start,
+		const char *end,
+		int base
+) {
+	uint64_t value = 0;
+	const char *pos = start;
+
+	if (base == 16) {
+		if (end - start > 13) {
+			return 1;
+		}
+		for (; end - pos >= 8; pos += 8) {
+			value = (value << 32) | rrr_swar_parse_hex_digits_8(rrr_swar_load_le64(pos));
+		}
+		for (; pos < end; pos++) {
+			value = (value << 4) | (uint64_t) (*pos <= '9' ? *pos - '0' : (*pos | 0x20) - 'a' + 10);
+		}
+	}
+	else {
+		if (end - start > 15) {
+			return 1;
+		}
+		for (; end - pos >= 8; pos += 8) {
+			value = value * 100000000 + rrr_swar_parse_digits_8(rrr_swar_load_le64(pos));
+		}
+		for (; pos < end; pos++) {
+			value = value * 10 + (uint64_t) (*pos - '0');
+		}
+	}
+
+	*result = value;
+
+	return 0;
+}
+
 int rrr_fixp_str_to_fixp (
 		rrr_fixp *target,
 		const char *str,
@@ -409,6 +464,11 @@ int rrr_fixp_str_to_fixp (
 	// INTEGER CONVERSION
 	no_decimals:
 	start = integer_pos;
+
+	if (__rrr_fixp_str_integer_fast(&result_integer, start, (dot != NULL ? dot : end), base) == 0) {
+		goto integer_done;
+	}
+
 	factor = 1.0;
 	for (const char *pos = (dot != NULL ? dot - 1 : end - 1); pos >= start; pos--) {
 		char c = *pos;
@@ -416,6 +476,7 @@ int rrr_fixp_str_to_fixp (
 		factor *= base;
 	}
 
+	integer_done:
 	result |= (result_integer << RRR_FIXED_POINT_BASE2_EXPONENT);
 	result &= ~((uint64_t) 1 << 63);
 
@@ -31,6 +31,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../allocator.h"
 #include "../string_builder.h"
 #include "../array.h"
+#include "../array_view.h"
 #include "../fixed_point.h"
 #include "../util/base64.h"
 #include "../util/macro_utils.h"
@@ -214,86 +215,312 @@ static int __rrr_http_query_builder_append_type_value (
 	return ret;
 }
 
-int rrr_http_query_builder_append_values_from_array (
+struct rrr_http_query_builder_append_callback_data {
+	struct rrr_http_query_builder *query_builder;
+	const char *column_tag;
+	const char *column_translation;
+	const char *separator;
+	int no_separator_on_first;
+	int do_quote_values;
+	int i;
+};
+
+static int __rrr_http_query_builder_append_column_callback (
+		const struct rrr_type_value *value,
+		void *arg
+) {
+	struct rrr_http_query_builder_append_callback_data *callback_data = arg;
+
+	int ret = RRR_HTTP_OK;
+
+	const char *node_tag = callback_data->column_tag;
+	const char *node_value = callback_data->column_translation;
+
+	if (value == NULL) {
+		RRR_MSG_0("Warning: Could not find value with tag %s in incoming message\n",
+				node_tag);
+		ret = RRR_HTTP_SOFT_ERROR;
+		goto out;
+	}
+
+	if (value->element_count > 1) {
+		RRR_MSG_0("Warning: Received message with array of value (multi-value) with tag %s in\n",
+				node_tag);
+		ret = RRR_HTTP_SOFT_ERROR;
+		goto out;
+	}
+
+	// If value is set, translation is to be used. Map values are empty
+	// rather than NULL when not set.
+	const char *tag_to_use = node_value != NULL && *node_value != '\0' ? node_value : node_tag;
+
+	if ((ret = __rrr_http_query_builder_append_type_value (
+		callback_data->query_builder,
+		value,
+		tag_to_use,
+		callback_data->i > 0 || callback_data->no_separator_on_first == 0 ? callback_data->separator : NULL,
+		callback_data->do_quote_values
+	)) != 0) {
+		RRR_MSG_0("Error while adding column '%s'=>'%s' to HTTP query\n",
+				node_tag != NULL ? node_tag : "",
+				node_value != NULL ? node_value : ""
+		);
+		goto out;
+	}
+
+	callback_data->i++;
+
+	out:
+	return ret;
+}
+
+static int __rrr_http_query_builder_append_value_callback (
+		const struct rrr_type_value *value,
+		void *arg
+) {
+	struct rrr_http_query_builder_append_callback_data *callback_data = arg;
+
+	int ret = RRR_HTTP_OK;
+
+	if ((ret = __rrr_http_query_builder_append_type_value (
+		callback_data->query_builder,
+		value,
+		value->tag,
+		callback_data->i > 0 || callback_data->no_separator_on_first == 0 ? callback_data->separator : NULL,
+		callback_data->do_quote_values
+	)) != 0) {
+		RRR_MSG_0("Error while adding array value at position %i tag '%s' to HTTP query\n",
+				callback_data->i, (value->tag != NULL ? value->tag : "(no tag)"));
+		goto out;
+	}
+
+	callback_data->i++;
+
+	out:
+	return ret;
+}
+
+// The value getter calls the callback with the value of the column at the
+// given position in the map, or with NULL if the value was not found. The
+// iterator calls the callback with all values in order.
+static int __rrr_http_query_builder_append_values (
 		struct rrr_http_query_builder *query_builder,
-		const struct rrr_array *array,
 		const struct rrr_map *columns,
 		const char *separator,
 		int no_separator_on_first,
-		int do_quote_values
+		int do_quote_values,
+		int (*value_get)(int pos, const char *tag, int (*callback)(const struct rrr_type_value *value, void *arg), void *callback_arg, void *arg),
+		int (*values_iterate)(int (*callback)(const struct rrr_type_value *value, void *arg), void *callback_arg, void *arg),
+		void *arg
 ) {
 	int ret = RRR_HTTP_OK;
 
-	char buf[512];
-	memset(buf, '\0', 511); // Valgrind moans about conditional jumps on uninitialized bytes
-
-	if (array->version != 7) {
-		RRR_BUG("Array version mismatch in rrr_http_query_builder_append_values_from_array (%u vs %i), module must be updated\n",
-				array->version, 7);
-	}
+	struct rrr_http_query_builder_append_callback_data callback_data = {
+		query_builder,
+		NULL,
+		NULL,
+		separator,
+		no_separator_on_first,
+		do_quote_values,
+		0
+	};
 
 	if (RRR_MAP_COUNT(columns) > 0) {
 		// Add only configured values
-		int i = 0;
+		int pos = 0;
 		RRR_MAP_ITERATE_BEGIN_CONST(columns);
-			const struct rrr_type_value *value = rrr_array_value_get_by_tag_const(array, node_tag);
-
-			if (value == NULL) {
-				RRR_MSG_0("Warning: Could not find value with tag %s in incoming message\n",
-						node_tag);
-				ret = RRR_HTTP_SOFT_ERROR;
-				goto out;
-			}
-
-			if (value->element_count > 1) {
-				RRR_MSG_0("Warning: Received message with array of value (multi-value) with tag %s in\n",
-						node_tag);
-				ret = RRR_HTTP_SOFT_ERROR;
-				goto out;
-			}
-
-			// If value is set, translation is to be used
-			const char *tag_to_use = node_value != NULL ? node_value : node_tag;
-
-			if ((ret = __rrr_http_query_builder_append_type_value (
-				query_builder,
-				value,
-				tag_to_use,
-				i > 0 || no_separator_on_first == 0 ? separator : NULL,
-				do_quote_values
-			)) != 0) {
-				RRR_MSG_0("Error while adding column '%s'=>'%s' to HTTP query\n",
-						node_tag != NULL ? node_tag : "",
-						node_value != NULL ? node_value : ""
-				);
+			callback_data.column_tag = node_tag;
+			callback_data.column_translation = node_value;
+			if ((ret = value_get(pos, node_tag, __rrr_http_query_builder_append_column_callback, &callback_data, arg)) != 0) {
 				goto out;
 			}
-			i++;
+			pos++;
 		RRR_MAP_ITERATE_END();
 	}
 	else {
 		// Add all values
-		int i = 0;
-		RRR_LL_ITERATE_BEGIN(array, struct rrr_type_value);
-			if ((ret = __rrr_http_query_builder_append_type_value (
-				query_builder,
-				node,
-				node->tag,
-				i > 0 || no_separator_on_first == 0 ? separator : NULL,
-				do_quote_values
-			)) != 0) {
-				RRR_MSG_0("Error while adding array value at position %i tag '%s' to HTTP query\n",
-						i, (node->tag != NULL ? node->tag : "(no tag)"));
-				goto out;
-			}
-			i++;
-		RRR_LL_ITERATE_END();
+		ret = values_iterate(__rrr_http_query_builder_append_value_callback, &callback_data, arg);
 	}
 
 	out:
 	return ret;
 }
 
+static int __rrr_http_query_builder_array_value_get (
+		int pos,
+		const char *tag,
+		int (*callback)(const struct rrr_type_value *value, void *arg),
+		void *callback_arg,
+		void *arg
+) {
+	const struct rrr_array *array = arg;
+
+	(void)(pos);
+
+	return callback(rrr_array_value_get_by_tag_const(array, tag), callback_arg);
+}
+
+static int __rrr_http_query_builder_array_values_iterate (
+		int (*callback)(const struct rrr_type_value *value, void *arg),
+		void *callback_arg,
+		void *arg
+) {
+	const struct rrr_array *array = arg;
+
+	int ret = RRR_HTTP_OK;
+
+	RRR_LL_ITERATE_BEGIN(array, const struct rrr_type_value);
+		if ((ret = callback(node, callback_arg)) != 0) {
+			goto out;
+		}
+	RRR_LL_ITERATE_END();
+
+	out:
+	return ret;
+}
+
+int rrr_http_query_builder_append_values_from_array (
+		struct rrr_http_query_builder *query_builder,
+		const struct rrr_array *array,
+		const struct rrr_map *columns,
+		const char *separator,
+		int no_separator_on_first,
+		int do_quote_values
+) {
+	if (array->version != 7) {
+		RRR_BUG("Array version mismatch in rrr_http_query_builder_append_values_from_array (%u vs %i), module must be updated\n",
+				array->version, 7);
+	}
+
+	// Cast away const OK, the array is only read from
+	return __rrr_http_query_builder_append_values (
+			query_builder,
+			columns,
+			separator,
+			no_separator_on_first,
+			do_quote_values,
+			__rrr_http_query_builder_array_value_get,
+			__rrr_http_query_builder_array_values_iterate,
+			(void *) array
+	);
+}
+
+struct rrr_http_query_builder_view_data {
+	const struct rrr_msg_msg *message;
+	// Values of the columns, at the same positions as in the map
+	const struct rrr_array_view_value *values;
+	int (*callback)(const struct rrr_type_value *value, void *arg);
+	void *callback_arg;
+};
+
+static int __rrr_http_query_builder_view_value_get (
+		int pos,
+		const char *tag,
+		int (*callback)(const struct rrr_type_value *value, void *arg),
+		void *callback_arg,
+		void *arg
+) {
+	struct rrr_http_query_builder_view_data *view_data = arg;
+
+	(void)(tag);
+
+	if (view_data->values[pos].definition == NULL) {
+		return callback(NULL, callback_arg);
+	}
+
+	return rrr_array_view_value_with_type_value(&view_data->values[pos], callback, callback_arg);
+}
+
+static int __rrr_http_query_builder_view_values_iterate_callback (
+		const struct rrr_array_view_value *value,
+		void *arg
+) {
+	struct rrr_http_query_builder_view_data *view_data = arg;
+	return rrr_array_view_value_with_type_value(value, view_data->callback, view_data->callback_arg);
+}
+
+static int __rrr_http_query_builder_view_values_iterate (
+		int (*callback)(const struct rrr_type_value *value, void *arg),
+		void *callback_arg,
+		void *arg
+) {
+	struct rrr_http_query_builder_view_data *view_data = arg;
+
+	view_data->callback = callback;
+	view_data->callback_arg = callback_arg;
+
+	return rrr_array_view_iterate (
+			view_data->message,
+			__rrr_http_query_builder_view_values_iterate_callback,
+			view_data
+	);
+}
+
+// Same as rrr_http_query_builder_append_values_from_array, but values are
+// read directly from the array message without unpacking it. All columns
+// are found in one pass over the message.
+int rrr_http_query_builder_append_values_from_array_view (
+		struct rrr_http_query_builder *query_builder,
+		const struct rrr_msg_msg *message,
+		const struct rrr_map *columns,
+		const char *separator,
+		int no_separator_on_first,
+		int do_quote_values
+) {
+	int ret = RRR_HTTP_OK;
+
+	const char **tags = NULL;
+	struct rrr_array_view_value *values = NULL;
+
+	struct rrr_http_query_builder_view_data view_data = {
+		message,
+		NULL,
+		NULL,
+		NULL
+	};
+
+	const int column_count = RRR_MAP_COUNT(columns);
+
+	if (column_count > 0) {
+		if ((tags = rrr_allocate(sizeof(*tags) * (size_t) column_count)) == NULL ||
+		    (values = rrr_allocate(sizeof(*values) * (size_t) column_count)) == NULL
+		) {
+			RRR_MSG_0("Could not allocate memory in rrr_http_query_builder_append_values_from_array_view\n");
+			ret = RRR_HTTP_HARD_ERROR;
+			goto out;
+		}
+
+		int pos = 0;
+		RRR_MAP_ITERATE_BEGIN_CONST(columns);
+			tags[pos++] = node_tag;
+		RRR_MAP_ITERATE_END();
+
+		if (rrr_array_view_get_by_tags(values, message, tags, column_count) != 0) {
+			RRR_MSG_0("Warning: Could not read array message while looking up columns\n");
+			ret = RRR_HTTP_SOFT_ERROR;
+			goto out;
+		}
+
+		view_data.values = values;
+	}
+
+	ret = __rrr_http_query_builder_append_values (
+			query_builder,
+			columns,
+			separator,
+			no_separator_on_first,
+			do_quote_values,
+			__rrr_http_query_builder_view_value_get,
+			__rrr_http_query_builder_view_values_iterate,
+			&view_data
+	);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(tags);
+	RRR_FREE_IF_NOT_NULL(values);
+	return ret;
+}
+
 int rrr_http_query_builder_append_values_from_map (
 		struct rrr_http_query_builder *query_builder,
 		struct rrr_map *columns,
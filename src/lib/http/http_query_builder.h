@@ -28,6 +28,7 @@ struct rrr_string_builder;
 struct rrr_map;
 struct rrr_array;
 struct rrr_type_value;
+struct rrr_msg_msg;
 
 struct rrr_http_query_builder {
 	struct rrr_string_builder *string_builder;
@@ -53,6 +54,14 @@ int rrr_http_query_builder_append_values_from_array (
 		int no_separator_on_first,
 		int do_quote_values
 );
+int rrr_http_query_builder_append_values_from_array_view (
+		struct rrr_http_query_builder *query_builder,
+		const struct rrr_msg_msg *message,
+		const struct rrr_map *columns,
+		const char *separator,
+		int no_separator_on_first,
+		int do_quote_values
+);
 int rrr_http_query_builder_append_values_from_map (
 		struct rrr_http_query_builder *query_builder,
 		struct rrr_map *columns,
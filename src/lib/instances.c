@@ -22,6 +22,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <unistd.h>
 
 #include <stdlib.h>
+#include <limits.h>
+#include <string.h>
 
 #include "log.h"
 #include "cmodule/cmodule_main.h"
@@ -36,6 +38,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "mqtt/mqtt_topic.h"
 #include "stats/stats_instance.h"
 #include "util/gnu.h"
+#include "util/posix.h"
 
 #define RRR_INSTANCE_DEFAULT_THREAD_WATCHDOG_TIMER_MS 5000
 
@@ -107,6 +110,7 @@ static void __rrr_instance_destroy (
 	rrr_instance_friend_collection_clear(&target->wait_for);
 
 	RRR_FREE_IF_NOT_NULL(target->topic_filter);
+	RRR_FREE_IF_NOT_NULL(target->wal_directory);
 	rrr_mqtt_topic_token_destroy(target->topic_first_token);
 
 	rrr_free(target->module_data);
@@ -295,10 +299,20 @@ static int __rrr_instance_parse_misc (
 		int do_enable_buffer;
 		int do_enable_backstop;
 		int do_duplicate;
+		char *buffer_engine;
+		rrr_setting_uint buffer_high_watermark;
+		rrr_setting_uint buffer_low_watermark;
+		char *priority;
+		char *priority_dequeue;
+		char *buffer_wal_directory;
+		rrr_setting_uint buffer_wal_sync_interval_ms;
+		rrr_setting_uint buffer_wal_segment_size;
 	} data_tmp;
 
 	struct data *data = &data_tmp;
 
+	memset(data, '\0', sizeof(*data));
+
 	// Note : Options are both default yes and default no, take care
 
 	// Default YES options
@@ -317,7 +331,101 @@ static int __rrr_instance_parse_misc (
 		data_final->misc_flags |= RRR_INSTANCE_MISC_OPTIONS_DUPLICATE;
 	}
 
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UTF8_DEFAULT_NULL("buffer_engine", buffer_engine);
+	if (data->buffer_engine == NULL || rrr_posix_strcasecmp(data->buffer_engine, "ring") == 0) {
+		// Default
+	}
+	else if (rrr_posix_strcasecmp(data->buffer_engine, "list") == 0) {
+		data_final->misc_flags |= RRR_INSTANCE_MISC_OPTIONS_BUFFER_ENGINE_LIST;
+	}
+	else {
+		RRR_MSG_0("Invalid value '%s' for buffer_engine in instance %s, valid options are ring and list\n",
+				data->buffer_engine, config->name);
+		ret = 1;
+		goto out;
+	}
+
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("buffer_high_watermark", buffer_high_watermark, RRR_MESSAGE_BROKER_DEFAULT_HIGH_WATERMARK);
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("buffer_low_watermark", buffer_low_watermark, data->buffer_high_watermark / 10);
+
+	if (data->buffer_high_watermark > INT_MAX) {
+		RRR_MSG_0("Value of buffer_high_watermark in instance %s was too big\n", config->name);
+		ret = 1;
+		goto out;
+	}
+	if (data->buffer_high_watermark > 0 && data->buffer_low_watermark >= data->buffer_high_watermark) {
+		RRR_MSG_0("Value of buffer_low_watermark in instance %s must be less than buffer_high_watermark (%" PRIrrrbl ")\n",
+				config->name, data->buffer_high_watermark);
+		ret = 1;
+		goto out;
+	}
+
+	data_final->buffer_high_watermark = (unsigned int) data->buffer_high_watermark;
+	data_final->buffer_low_watermark = (unsigned int) (data->buffer_high_watermark > 0 ? data->buffer_low_watermark : 0);
+
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UTF8_DEFAULT_NULL("priority", priority);
+	if (data->priority == NULL || rrr_posix_strcasecmp(data->priority, "normal") == 0) {
+		data_final->priority_lane = RRR_MESSAGE_BROKER_PRIORITY_LANE_NORMAL;
+	}
+	else if (rrr_posix_strcasecmp(data->priority, "high") == 0) {
+		data_final->priority_lane = RRR_MESSAGE_BROKER_PRIORITY_LANE_HIGH;
+	}
+	else if (rrr_posix_strcasecmp(data->priority, "low") == 0) {
+		data_final->priority_lane = RRR_MESSAGE_BROKER_PRIORITY_LANE_LOW;
+	}
+	else {
+		RRR_MSG_0("Invalid value '%s' for priority in instance %s, valid options are high, normal and low\n",
+				data->priority, config->name);
+		ret = 1;
+		goto out;
+	}
+
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UTF8_DEFAULT_NULL("priority_dequeue", priority_dequeue);
+	if (data->priority_dequeue == NULL || rrr_posix_strcasecmp(data->priority_dequeue, "strict") == 0) {
+		data_final->priority_dequeue = RRR_MESSAGE_BROKER_PRIORITY_DEQUEUE_STRICT;
+	}
+	else if (rrr_posix_strcasecmp(data->priority_dequeue, "weighted") == 0) {
+		data_final->priority_dequeue = RRR_MESSAGE_BROKER_PRIORITY_DEQUEUE_WEIGHTED;
+	}
+	else {
+		RRR_MSG_0("Invalid value '%s' for priority_dequeue in instance %s, valid options are strict and weighted\n",
+				data->priority_dequeue, config->name);
+		ret = 1;
+		goto out;
+	}
+
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UTF8_DEFAULT_NULL("buffer_wal_directory", buffer_wal_directory);
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("buffer_wal_sync_interval_ms", buffer_wal_sync_interval_ms, RRR_MSG_HOLDER_WAL_DEFAULT_SYNC_INTERVAL_MS);
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("buffer_wal_segment_size", buffer_wal_segment_size, RRR_MSG_HOLDER_WAL_DEFAULT_SEGMENT_SIZE);
+
+	if (data->buffer_wal_directory != NULL) {
+		if (!data->do_enable_buffer || data->do_duplicate) {
+			RRR_MSG_0("buffer_wal_directory was set in instance %s, but this cannot be used when buffer is disabled or duplicate is enabled\n",
+					config->name);
+			ret = 1;
+			goto out;
+		}
+		if (data->buffer_wal_sync_interval_ms > UINT_MAX) {
+			RRR_MSG_0("Value of buffer_wal_sync_interval_ms in instance %s was too big\n", config->name);
+			ret = 1;
+			goto out;
+		}
+		if (data->buffer_wal_segment_size == 0 || data->buffer_wal_segment_size > SIZE_MAX) {
+			RRR_MSG_0("Invalid value of buffer_wal_segment_size in instance %s\n", config->name);
+			ret = 1;
+			goto out;
+		}
+		data_final->wal_directory = data->buffer_wal_directory;
+		data_final->wal_sync_interval_ms = (unsigned int) data->buffer_wal_sync_interval_ms;
+		data_final->wal_segment_size = (size_t) data->buffer_wal_segment_size;
+		data->buffer_wal_directory = NULL;
+	}
+
 	out:
+	RRR_FREE_IF_NOT_NULL(data->buffer_engine);
+	RRR_FREE_IF_NOT_NULL(data->priority);
+	RRR_FREE_IF_NOT_NULL(data->priority_dequeue);
+	RRR_FREE_IF_NOT_NULL(data->buffer_wal_directory);
 	return ret;
 }
 
@@ -515,7 +623,11 @@ struct rrr_instance_runtime_data *rrr_instance_runtime_data_new (
 			&data->message_broker_handle,
 			init_data->message_broker,
 			init_data->module->instance_name,
-			(init_data->instance->misc_flags & RRR_INSTANCE_MISC_OPTIONS_DISABLE_BUFFER) != 0
+			(init_data->instance->misc_flags & RRR_INSTANCE_MISC_OPTIONS_DISABLE_BUFFER) != 0,
+			(init_data->instance->misc_flags & RRR_INSTANCE_MISC_OPTIONS_BUFFER_ENGINE_LIST
+				? RRR_FIFO_BUFFER_ENGINE_LIST
+				: RRR_FIFO_BUFFER_ENGINE_RING
+			)
 	) != 0) {
 		RRR_MSG_0("Could not register with message broker in rrr_instance_new_thread\n");
 		goto out_free;
@@ -531,6 +643,7 @@ struct rrr_instance_runtime_data *rrr_instance_runtime_data_new (
 
 struct rrr_instance_add_senders_to_broker_callback_data {
 	struct rrr_message_broker_costumer *target;
+	const struct rrr_mqtt_topic_token *topic_filter;
 	struct rrr_message_broker *broker;
 	struct rrr_instance *faulty_sender;
 };
@@ -555,7 +668,7 @@ static int __rrr_instance_add_senders_to_broker_callback (
 		goto out;
 	}
 
-	if ((ret = rrr_message_broker_sender_add(data->target, handle)) != 0) {
+	if ((ret = rrr_message_broker_sender_add(data->target, handle, data->topic_filter)) != 0) {
 		RRR_MSG_0("Failed to add costumer '%s' in __rrr_instance_add_senders_to_broker_callback\n", INSTANCE_M_NAME(instance));
 		data->faulty_sender = instance;
 		ret = 1;
@@ -581,8 +694,10 @@ static int __rrr_instance_add_senders_to_broker (
 
 	*faulty_sender = NULL;
 
+	// The broker drops messages not matching the topic filter of the instance
 	struct rrr_instance_add_senders_to_broker_callback_data callback_data = {
 			handle,
+			instance->topic_first_token,
 			broker,
 			NULL
 	};
@@ -621,6 +736,17 @@ static int __rrr_instance_before_start_tasks (
 		);
 	}
 
+	// Instances nobody reads from would only block, leave them without backpressure
+	if (rrr_instance_count_receivers_of_self(instance) > 0) {
+		rrr_message_broker_watermarks_set(self, instance->buffer_high_watermark, instance->buffer_low_watermark);
+	}
+	else {
+		rrr_message_broker_watermarks_set(self, 0, 0);
+	}
+
+	rrr_message_broker_priority_lane_set(self, instance->priority_lane);
+	rrr_message_broker_priority_dequeue_set(self, instance->priority_dequeue);
+
 	struct rrr_instance *faulty_instance = NULL;
 	if (__rrr_instance_add_senders_to_broker(&faulty_instance, broker, instance) != 0) {
 		RRR_MSG_0("Failed to add senders of instance %s. Faulty sender was %s.\n",
@@ -925,6 +1051,22 @@ int rrr_instances_create_and_start_threads (
 		}
 	RRR_LL_ITERATE_END();
 
+	// Replaying the write-ahead log notifies readers, they must all be added first
+	RRR_LL_ITERATE_BEGIN(instances, struct rrr_instance);
+		if (node->wal_directory == NULL) {
+			RRR_LL_ITERATE_NEXT();
+		}
+		RRR_DBG_1("Enabling write-ahead log in %s for instance %p '%s'\n", node->wal_directory, node, node->config->name);
+		if ((ret = rrr_message_broker_wal_enable (
+				rrr_message_broker_costumer_find_by_name(message_broker, node->config->name),
+				node->wal_directory,
+				node->wal_segment_size,
+				(uint64_t) node->wal_sync_interval_ms * 1000
+		)) != 0) {
+			goto out_destroy_collection;
+		}
+	RRR_LL_ITERATE_END();
+
 	struct rrr_instance_collection_start_threads_check_wait_for_callback_data callback_data = { instances };
 
 	if (rrr_thread_collection_start_all (
@@ -1039,35 +1181,67 @@ int rrr_instance_count_receivers_of_self (
 	return callback_data.count;
 }
 
-int rrr_instance_default_set_output_buffer_ratelimit_when_needed (
-		int *delivery_entry_count,
-		int *delivery_ratelimit_active,
+// Post write batch counters with the batch size histogram of the output buffer,
+// counters for shared messages read from duplicated buffers and time spent
+// waiting for readers when the output buffer was full. Latency and depth
+// are posted for each priority lane of the senders, and write-ahead
+// log counters if the log is enabled.
+int rrr_instance_default_post_broker_stats (
 		struct rrr_instance_runtime_data *thread_data
 ) {
 	int ret = 0;
 
-	if (rrr_message_broker_get_entry_count_and_ratelimit (
-			delivery_entry_count,
-			delivery_ratelimit_active,
-			INSTANCE_D_HANDLE(thread_data)
-	) != 0) {
-		RRR_MSG_0("Error while getting output buffer size in %s instance %s\n",
-				INSTANCE_D_MODULE_NAME(thread_data), INSTANCE_D_NAME(thread_data));
-		ret = 1;
-		goto out;
+	struct rrr_message_broker_write_batch_stats batch_stats;
+	struct rrr_message_broker_shared_payload_stats shared_payload_stats;
+	struct rrr_message_broker_backpressure_stats backpressure_stats;
+	struct rrr_message_broker_lane_stats lane_stats[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT];
+	struct rrr_msg_holder_wal_stats wal_stats;
+	static const char *lane_names[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT] = {"high", "normal", "low"};
+	char path[64];
+
+	rrr_message_broker_get_write_batch_stats(&batch_stats, INSTANCE_D_HANDLE(thread_data));
+	rrr_message_broker_get_shared_payload_stats(&shared_payload_stats, INSTANCE_D_HANDLE(thread_data));
+	rrr_message_broker_get_backpressure_stats(&backpressure_stats, INSTANCE_D_HANDLE(thread_data));
+	rrr_message_broker_get_lane_stats(lane_stats, INSTANCE_D_HANDLE(thread_data));
+
+	ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "backpressure_blocks", 0, backpressure_stats.total_blocks);
+	ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "backpressure_blocked_ms", 0, backpressure_stats.total_blocked_us / 1000);
+
+	ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "shared_payload_copies_avoided", 0, shared_payload_stats.total_shared);
+	ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "shared_payload_copies", 0, shared_payload_stats.total_copied);
+
+	ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "write_batches", 0, batch_stats.total_batches);
+	ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "write_batch_entries", 0, batch_stats.total_entries);
+
+	for (int i = 0; i < RRR_MESSAGE_BROKER_WRITE_BATCH_HISTOGRAM_SIZE; i++) {
+		sprintf(path, "write_batch_size_%i-%i", 1 << i, (1 << (i + 1)) - 1);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), path, 0, batch_stats.histogram[i]);
 	}
 
-	if (*delivery_entry_count > 10000 && *delivery_ratelimit_active == 0) {
-		RRR_DBG_1("Enabling ratelimit on buffer in %s instance %s due to slow reader\n",
-				INSTANCE_D_MODULE_NAME(thread_data), INSTANCE_D_NAME(thread_data));
-		rrr_message_broker_set_ratelimit(INSTANCE_D_HANDLE(thread_data), 1);
+	for (int i = 0; i < RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT; i++) {
+		if (lane_stats[i].total_entries == 0 && lane_stats[i].depth == 0) {
+			continue;
+		}
+		sprintf(path, "lane_%s_entries", lane_names[i]);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), path, 0, lane_stats[i].total_entries);
+		sprintf(path, "lane_%s_depth", lane_names[i]);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), path, 0, (uint64_t) lane_stats[i].depth);
+		sprintf(path, "lane_%s_latency_avg_us", lane_names[i]);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), path, 0,
+				lane_stats[i].total_entries > 0 ? lane_stats[i].total_latency_us / lane_stats[i].total_entries : 0);
+		sprintf(path, "lane_%s_latency_max_us", lane_names[i]);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), path, 0, lane_stats[i].max_latency_us);
 	}
-	else if (*delivery_entry_count < 10 && *delivery_ratelimit_active == 1) {
-		RRR_DBG_1("Disabling ratelimit on buffer in %s instance %s due to low buffer level\n",
-				INSTANCE_D_MODULE_NAME(thread_data), INSTANCE_D_NAME(thread_data));
-		rrr_message_broker_set_ratelimit(INSTANCE_D_HANDLE(thread_data), 0);
+
+	if (INSTANCE_D_INSTANCE(thread_data)->wal_directory != NULL) {
+		rrr_message_broker_get_wal_stats(&wal_stats, INSTANCE_D_HANDLE(thread_data));
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "wal_appended", 0, wal_stats.total_appended);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "wal_acked", 0, wal_stats.total_acked);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "wal_replayed", 0, wal_stats.total_replayed);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "wal_commits", 0, wal_stats.total_commits);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "wal_syncs", 0, wal_stats.total_syncs);
+		ret |= rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "wal_segments", 0, wal_stats.segments);
 	}
 
-	out:
 	return ret;
 }
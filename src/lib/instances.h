@@ -33,6 +33,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_INSTANCE_MISC_OPTIONS_DISABLE_BUFFER   (1<<0)
 #define RRR_INSTANCE_MISC_OPTIONS_DISABLE_BACKSTOP (1<<1)
 #define RRR_INSTANCE_MISC_OPTIONS_DUPLICATE        (1<<2)
+#define RRR_INSTANCE_MISC_OPTIONS_BUFFER_ENGINE_LIST (1<<3)
 
 struct rrr_stats_instance;
 struct rrr_cmodule;
@@ -50,10 +51,17 @@ struct rrr_instance {
 	struct rrr_signal_handler *signal_handler;
 	char *topic_filter;
 	struct rrr_mqtt_topic_token *topic_first_token;
+	char *wal_directory;
 
 	// Static members
 	unsigned long int senders_count;
 	int misc_flags;
+	unsigned int buffer_high_watermark;
+	unsigned int buffer_low_watermark;
+	int priority_lane;
+	int priority_dequeue;
+	unsigned int wal_sync_interval_ms;
+	size_t wal_segment_size;
 
 	// Shortcuts
 	struct rrr_instance_config_data *config;
@@ -204,9 +212,7 @@ int rrr_instance_create_from_config (
 int rrr_instance_count_receivers_of_self (
 		struct rrr_instance *self
 );
-int rrr_instance_default_set_output_buffer_ratelimit_when_needed (
-		int *delivery_entry_count,
-		int *delivery_ratelimit_active,
+int rrr_instance_default_post_broker_stats (
 		struct rrr_instance_runtime_data *thread_data
 );
 
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <string.h>
 #include <stddef.h>
+#include <errno.h>
 #include <pthread.h>
 #include <inttypes.h>
 #include <sys/types.h>
@@ -30,6 +31,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "message_broker.h"
 #include "allocator.h"
 #include "random.h"
+#include "rrr_strerror.h"
 #include "event/event.h"
 #include "event/event_functions.h"
 #include "ip/ip.h"
@@ -38,6 +40,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "message_holder/message_holder_struct.h"
 #include "message_holder/message_holder_util.h"
 #include "message_holder/message_holder_collection.h"
+#include "message_holder/message_holder_wal.h"
+#include "messages/msg_msg.h"
 #include "util/linked_list.h"
 #include "util/macro_utils.h"
 #include "util/posix.h"
@@ -62,14 +66,35 @@ struct rrr_message_broker_costumer {
 	struct rrr_fifo_buffer main_queue;
 	struct rrr_message_broker_split_buffer_collection split_buffers;
 	struct rrr_msg_holder_slot *slot;
+	struct rrr_msg_holder_wal *wal;
 	char *name;
 	int usercount;
 	int flags;
 	int split_buffers_active;
+	int write_notify_filtered;
+	int queue_engine;
 	uint64_t unique_counter;
 	struct rrr_event_queue *events;
+	pthread_mutex_t stats_lock;
+	struct rrr_message_broker_write_batch_stats write_batch_stats;
+	struct rrr_message_broker_shared_payload_stats shared_payload_stats;
+	struct rrr_message_broker_backpressure_stats backpressure_stats;
+	pthread_mutex_t backpressure_lock;
+	pthread_cond_t backpressure_cond;
+	int backpressure_high_watermark;
+	int backpressure_low_watermark;
+	int backpressure_active;
+	int backpressure_nonblocking;
+	enum rrr_message_broker_priority_lane priority_lane;
+	int priority_dequeue;
+	struct rrr_message_broker_lane_stats lane_stats[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT];
 	struct rrr_message_broker_costumer *write_notify_listeners[RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX];
 	struct rrr_message_broker_costumer *senders[RRR_MESSAGE_BROKER_SENDERS_MAX];
+
+	// Topic filters of readers and of ourselves as reader, at the same
+	// positions as in the lists above. NULL means no filtering.
+	const struct rrr_mqtt_topic_token *write_notify_listener_topic_filters[RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX];
+	const struct rrr_mqtt_topic_token *sender_topic_filters[RRR_MESSAGE_BROKER_SENDERS_MAX];
 };
 
 struct rrr_message_broker {
@@ -111,8 +136,10 @@ static void __rrr_message_broker_costumer_decref (
 
 static int __rrr_message_broker_friend_add (
 		struct rrr_message_broker_costumer **target,
+		const struct rrr_mqtt_topic_token **target_topic_filters,
 		size_t target_size,
-		struct rrr_message_broker_costumer *listener_costumer
+		struct rrr_message_broker_costumer *listener_costumer,
+		const struct rrr_mqtt_topic_token *topic_filter
 ) {
 	int ret = RRR_MESSAGE_BROKER_OK;
 
@@ -120,6 +147,7 @@ static int __rrr_message_broker_friend_add (
 		if (target[i] == NULL) {
 			__rrr_message_broker_costumer_incref_unlocked(listener_costumer);
 			target[i] = listener_costumer;
+			target_topic_filters[i] = topic_filter;
 			listener_costumer = NULL;
 			break;
 		}
@@ -158,6 +186,12 @@ static void __rrr_message_broker_costumer_destroy (
 
 	rrr_event_queue_destroy(costumer->events);
 	rrr_fifo_buffer_destroy(&costumer->main_queue);
+	if (costumer->wal != NULL) {
+		rrr_msg_holder_wal_destroy(costumer->wal);
+	}
+	pthread_cond_destroy(&costumer->backpressure_cond);
+	pthread_mutex_destroy(&costumer->backpressure_lock);
+	pthread_mutex_destroy(&costumer->stats_lock);
 	pthread_mutex_destroy(&costumer->split_buffers.lock);
 	// Do this at the end in case we need to read the name in a debugger
 	RRR_FREE_IF_NOT_NULL(costumer->name);
@@ -195,7 +229,8 @@ void rrr_message_broker_costumer_unregister (
 static int __rrr_message_broker_costumer_new (
 		struct rrr_message_broker_costumer **result,
 		const char *name_unique,
-		int no_buffer
+		int no_buffer,
+		int queue_engine
 ) {
 	int ret = 0;
 
@@ -220,7 +255,7 @@ static int __rrr_message_broker_costumer_new (
 		goto out_free;
 	}
 
-	if (rrr_fifo_buffer_init_custom_free(&costumer->main_queue, rrr_msg_holder_decref_void) != 0) {
+	if (rrr_fifo_buffer_init_custom_free_with_engine(&costumer->main_queue, rrr_msg_holder_decref_void, queue_engine) != 0) {
 		RRR_MSG_0("Could not initialize buffer in __rrr_message_broker_costumer_new\n");
 		ret = 1;
 		goto out_free_name;
@@ -232,10 +267,28 @@ static int __rrr_message_broker_costumer_new (
 		goto out_destroy_fifo;
 	}
 
+	if ((rrr_posix_mutex_init(&costumer->stats_lock, 0)) != 0) {
+		RRR_MSG_0("Could not initialize mutex B in __rrr_message_broker_costumer_new\n");
+		ret = 1;
+		goto out_destroy_split_buffer_lock;
+	}
+
+	if ((rrr_posix_mutex_init(&costumer->backpressure_lock, 0)) != 0) {
+		RRR_MSG_0("Could not initialize mutex C in __rrr_message_broker_costumer_new\n");
+		ret = 1;
+		goto out_destroy_stats_lock;
+	}
+
+	if ((rrr_posix_cond_init(&costumer->backpressure_cond, 0)) != 0) {
+		RRR_MSG_0("Could not initialize condition in __rrr_message_broker_costumer_new\n");
+		ret = 1;
+		goto out_destroy_backpressure_lock;
+	}
+
 	if ((ret = rrr_event_queue_new(&costumer->events)) != 0){
 		RRR_MSG_0("Could not create event queue in __rrr_message_broker_costumer_new\n");
 		ret = 1;
-		goto out_destroy_split_buffer_lock;
+		goto out_destroy_backpressure_cond;
 	}
 
 	if (no_buffer) {
@@ -245,12 +298,23 @@ static int __rrr_message_broker_costumer_new (
 	}
 
 	costumer->usercount = 1;
+	costumer->queue_engine = queue_engine;
+	costumer->backpressure_high_watermark = RRR_MESSAGE_BROKER_DEFAULT_HIGH_WATERMARK;
+	costumer->backpressure_low_watermark = RRR_MESSAGE_BROKER_DEFAULT_LOW_WATERMARK;
+	costumer->priority_lane = RRR_MESSAGE_BROKER_PRIORITY_LANE_NORMAL;
+	costumer->priority_dequeue = RRR_MESSAGE_BROKER_PRIORITY_DEQUEUE_STRICT;
 
 	*result = costumer;
 
 	goto out;
 	out_cleanup_events:
 		rrr_event_queue_destroy(costumer->events);
+	out_destroy_backpressure_cond:
+		pthread_cond_destroy(&costumer->backpressure_cond);
+	out_destroy_backpressure_lock:
+		pthread_mutex_destroy(&costumer->backpressure_lock);
+	out_destroy_stats_lock:
+		pthread_mutex_destroy(&costumer->stats_lock);
 	out_destroy_split_buffer_lock:
 		pthread_mutex_destroy(&costumer->split_buffers.lock);
 	out_destroy_fifo:
@@ -401,7 +465,8 @@ int rrr_message_broker_costumer_register (
 		struct rrr_message_broker_costumer **result,
 		struct rrr_message_broker *broker,
 		const char *name_unique,
-		int no_buffer
+		int no_buffer,
+		int queue_engine
 ) {
 	int ret = 0;
 
@@ -416,7 +481,7 @@ int rrr_message_broker_costumer_register (
 				name_unique);
 	}
 
-	if ((ret = __rrr_message_broker_costumer_new (&costumer, name_unique, no_buffer)) != 0) {
+	if ((ret = __rrr_message_broker_costumer_new (&costumer, name_unique, no_buffer, queue_engine)) != 0) {
 		goto out;
 	}
 
@@ -429,7 +494,8 @@ int rrr_message_broker_costumer_register (
 
 	*result = costumer;
 
-	RRR_DBG_8("Message broker registered costumer '%s' handle is %p no buffer is %i\n", name_unique, costumer, no_buffer);
+	RRR_DBG_8("Message broker registered costumer '%s' handle is %p no buffer is %i queue engine is %s\n",
+			name_unique, costumer, no_buffer, (queue_engine == RRR_FIFO_BUFFER_ENGINE_RING ? "ring" : "list"));
 
 	out:
 	pthread_mutex_unlock(&broker->lock);
@@ -437,7 +503,8 @@ int rrr_message_broker_costumer_register (
 }
 
 static int __rrr_message_broker_split_output_buffer_new_and_add (
-		struct rrr_message_broker_split_buffer_collection *target
+		struct rrr_message_broker_split_buffer_collection *target,
+		int queue_engine
 ) {
 	int ret = 0;
 
@@ -450,7 +517,7 @@ static int __rrr_message_broker_split_output_buffer_new_and_add (
 
 	memset(node, '\0', sizeof(*node));
 
-	if (rrr_fifo_buffer_init_custom_free(&node->queue, rrr_msg_holder_decref_void) != 0) {
+	if (rrr_fifo_buffer_init_custom_free_with_engine(&node->queue, rrr_msg_holder_decref_void, queue_engine) != 0) {
 		RRR_MSG_0("Could not initialize buffer in __rrr_message_broker_split_output_buffer_new\n");
 		ret = 1;
 		goto out_free;
@@ -488,7 +555,7 @@ int rrr_message_broker_setup_split_output_buffer (
 		}
 
 		while (slots--) {
-			if ((ret = __rrr_message_broker_split_output_buffer_new_and_add(&costumer->split_buffers)) != 0) {
+			if ((ret = __rrr_message_broker_split_output_buffer_new_and_add(&costumer->split_buffers, costumer->queue_engine)) != 0) {
 				goto out;
 			}
 		}
@@ -500,24 +567,94 @@ int rrr_message_broker_setup_split_output_buffer (
 	return ret;
 }
 
+// Number of written entries matching the topic filter of each
+// listener, only counted when notifications are filtered
+struct rrr_message_broker_write_notify_counts {
+	rrr_length listeners[RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX];
+};
+
+// With split buffers, listeners which get none of the written entries into
+// their buffer are not notified. Readers of a slot must always be notified
+// as all of them must read the entry.
+static int __rrr_message_broker_write_notify_is_filtered (
+		const struct rrr_message_broker_costumer *costumer
+) {
+	return costumer->write_notify_filtered && costumer->split_buffers_active && costumer->slot == NULL;
+}
+
+static int __rrr_message_broker_topic_filter_match (
+		int *does_match,
+		const struct rrr_msg_holder *entry,
+		const struct rrr_mqtt_topic_token *topic_filter
+);
+
+// Entry must be locked by caller
+static int __rrr_message_broker_write_notify_counts_add (
+		struct rrr_message_broker_write_notify_counts *counts,
+		struct rrr_message_broker_costumer *costumer,
+		const struct rrr_msg_holder *entry
+) {
+	int ret = RRR_MESSAGE_BROKER_OK;
+
+	if (!__rrr_message_broker_write_notify_is_filtered(costumer)) {
+		goto out;
+	}
+
+	for (int i = 0; i < RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX; i++) {
+		if (costumer->write_notify_listeners[i] == NULL) {
+			break;
+		}
+
+		int does_match = 1;
+		if (costumer->write_notify_listener_topic_filters[i] != NULL &&
+		    (ret = __rrr_message_broker_topic_filter_match (
+				&does_match,
+				entry,
+				costumer->write_notify_listener_topic_filters[i]
+		)) != 0) {
+			goto out;
+		}
+
+		if (does_match) {
+			counts->listeners[i]++;
+		}
+	}
+
+	out:
+	return ret;
+}
+
+// Amount in each notification is limited to 255, send multiple if needed
 static int __rrr_message_broker_write_notifications_send_final (
 		struct rrr_message_broker_costumer *listener,
-		uint8_t amount,
+		rrr_length count,
 		int (*check_cancel_callback)(void *arg),
 		void *check_cancel_callback_arg
 ) {
-	return rrr_event_pass (
-			listener->events,
-			RRR_EVENT_FUNCTION_MESSAGE_BROKER_DATA_AVAILABLE,
-			amount,
-			check_cancel_callback,
-			check_cancel_callback_arg
-	);
+	int ret = 0;
+
+	while (count > 0) {
+		uint8_t amount = (count > 0xff ? 0xff : (uint8_t) count);
+		if ((ret = rrr_event_pass (
+				listener->events,
+				RRR_EVENT_FUNCTION_MESSAGE_BROKER_DATA_AVAILABLE,
+				amount,
+				check_cancel_callback,
+				check_cancel_callback_arg
+		)) != 0) {
+			goto out;
+		}
+		count -= amount;
+	}
+
+	out:
+	return ret;
 }
 
 static int __rrr_message_broker_write_notifications_send_all (
 		struct rrr_message_broker_costumer *costumer,
-		uint8_t amount,
+		rrr_length count,
+		const struct rrr_message_broker_write_notify_counts *counts,
 		int (*check_cancel_callback)(void *arg),
 		void *check_cancel_callback_arg
 ) {
@@ -529,9 +666,10 @@ static int __rrr_message_broker_write_notifications_send_all (
 			goto out;
 		}
 
+		// Listeners not getting any of the entries into their split buffer are not woken up
 		if ((ret = __rrr_message_broker_write_notifications_send_final (
 				listener,
-				amount,
+				(__rrr_message_broker_write_notify_is_filtered(costumer) ? counts->listeners[i] : count),
 				check_cancel_callback,
 				check_cancel_callback_arg
 		)) != 0) {
@@ -545,7 +683,7 @@ static int __rrr_message_broker_write_notifications_send_all (
 
 static int __rrr_message_broker_write_notifications_send_random (
 		struct rrr_message_broker_costumer *costumer,
-		uint8_t amount,
+		rrr_length count,
 		int (*check_cancel_callback)(void *arg),
 		void *check_cancel_callback_arg
 ) {
@@ -557,32 +695,217 @@ static int __rrr_message_broker_write_notifications_send_random (
 		max++;
 	}
 
-	if (max > 0) {
+	int ret = 0;
+
+	// Pick a listener for each notification
+	while (max > 0 && count > 0) {
+		uint8_t amount = (count > 0xff ? 0xff : (uint8_t) count);
 		rrr_biglength target = rrr_rand();
 		target = target % max;
-		return __rrr_message_broker_write_notifications_send_final (
+		if ((ret = __rrr_message_broker_write_notifications_send_final (
 				costumer->write_notify_listeners[target],
 				amount,
 				check_cancel_callback,
 				check_cancel_callback_arg
-		);
+		)) != 0) {
+			break;
+		}
+		count -= amount;
 	}
 
-	return 0;
+	return ret;
 }
 
 static int __rrr_message_broker_write_notifications_send (
 		struct rrr_message_broker_costumer *costumer,
-		uint8_t amount,
+		rrr_length count,
+		const struct rrr_message_broker_write_notify_counts *counts,
 		int (*check_cancel_callback)(void *arg),
 		void *check_cancel_callback_arg
 ) {
 	return costumer->split_buffers_active
-		? __rrr_message_broker_write_notifications_send_all(costumer, amount, check_cancel_callback, check_cancel_callback_arg)
-		: __rrr_message_broker_write_notifications_send_random(costumer, amount, check_cancel_callback, check_cancel_callback_arg)
+		? __rrr_message_broker_write_notifications_send_all(costumer, count, counts, check_cancel_callback, check_cancel_callback_arg)
+		: __rrr_message_broker_write_notifications_send_random(costumer, count, check_cancel_callback, check_cancel_callback_arg)
 	;
 }
 
+static void __rrr_message_broker_write_batch_stats_add (
+		struct rrr_message_broker_costumer *costumer,
+		rrr_length count
+) {
+	int bucket = 0;
+	for (rrr_length i = count >> 1; i > 0 && bucket < RRR_MESSAGE_BROKER_WRITE_BATCH_HISTOGRAM_SIZE - 1; i >>= 1) {
+		bucket++;
+	}
+
+	pthread_mutex_lock(&costumer->stats_lock);
+	costumer->write_batch_stats.total_batches++;
+	costumer->write_batch_stats.total_entries += count;
+	costumer->write_batch_stats.histogram[bucket]++;
+	pthread_mutex_unlock(&costumer->stats_lock);
+}
+
+// Entries in the main queue plus entries in the fullest split buffer, the
+// slowest reader decides when writers are held back
+static int __rrr_message_broker_backpressure_entry_count_get (
+		struct rrr_message_broker_costumer *costumer
+) {
+	int count_max = 0;
+
+	pthread_mutex_lock(&costumer->split_buffers.lock);
+	RRR_LL_ITERATE_BEGIN(&costumer->split_buffers, struct rrr_message_broker_split_buffer_node);
+		int count = rrr_fifo_buffer_get_entry_count_combined(&node->queue);
+		if (count > count_max) {
+			count_max = count;
+		}
+	RRR_LL_ITERATE_END();
+	pthread_mutex_unlock(&costumer->split_buffers.lock);
+
+	return rrr_fifo_buffer_get_entry_count_combined(&costumer->main_queue) + count_max;
+}
+
+// Must be called while holding the backpressure lock. Returns 1 if writers
+// are to be held back.
+static int __rrr_message_broker_backpressure_update_unlocked (
+		int *did_release,
+		struct rrr_message_broker_costumer *costumer
+) {
+	*did_release = 0;
+
+	if (costumer->slot != NULL) {
+		// Slot writers always wait for the reader
+		return 0;
+	}
+
+	if (costumer->backpressure_high_watermark == 0) {
+		if (costumer->backpressure_active) {
+			costumer->backpressure_active = 0;
+			*did_release = 1;
+		}
+		goto out;
+	}
+
+	int count = __rrr_message_broker_backpressure_entry_count_get(costumer);
+
+	if (!costumer->backpressure_active && count >= costumer->backpressure_high_watermark) {
+		RRR_DBG_8("Message broker costumer %s backpressure activated, %i entries in output buffer\n",
+				costumer->name, count);
+		costumer->backpressure_active = 1;
+	}
+	else if (costumer->backpressure_active && count <= costumer->backpressure_low_watermark) {
+		RRR_DBG_8("Message broker costumer %s backpressure released, %i entries in output buffer\n",
+				costumer->name, count);
+		costumer->backpressure_active = 0;
+		*did_release = 1;
+	}
+
+	out:
+	if (*did_release) {
+		pthread_cond_broadcast(&costumer->backpressure_cond);
+	}
+	return costumer->backpressure_active;
+}
+
+// Non-blocking writers are told by event when they may resume writing
+static int __rrr_message_broker_backpressure_release_notify (
+		struct rrr_message_broker_costumer *costumer
+) {
+	return rrr_event_pass (
+			costumer->events,
+			RRR_EVENT_FUNCTION_MESSAGE_BROKER_BACKPRESSURE_RELEASED,
+			1,
+			NULL,
+			NULL
+	);
+}
+
+// Called by readers after polling
+static int __rrr_message_broker_backpressure_release_as_needed (
+		struct rrr_message_broker_costumer *costumer
+) {
+	int did_release = 0;
+	int do_notify = 0;
+
+	pthread_mutex_lock(&costumer->backpressure_lock);
+	if (costumer->backpressure_active) {
+		__rrr_message_broker_backpressure_update_unlocked(&did_release, costumer);
+		do_notify = did_release && costumer->backpressure_nonblocking;
+	}
+	pthread_mutex_unlock(&costumer->backpressure_lock);
+
+	return (do_notify ? __rrr_message_broker_backpressure_release_notify(costumer) : 0);
+}
+
+static void __rrr_message_broker_backpressure_unlock_void (void *arg) {
+	struct rrr_message_broker_costumer *costumer = arg;
+	pthread_mutex_unlock(&costumer->backpressure_lock);
+}
+
+// Called by writers prior to writing. Waits until readers have brought the buffer down
+// to the low watermark if the high watermark has been reached. If the thread is asked
+// to stop while waiting, we return and let the write complete.
+static int __rrr_message_broker_backpressure_wait (
+		struct rrr_message_broker_costumer *costumer,
+		int (*check_cancel_callback)(void *arg),
+		void *check_cancel_callback_arg
+) {
+	int ret = 0;
+
+	int did_release_dummy = 0;
+	uint64_t time_start = 0;
+
+	pthread_mutex_lock(&costumer->backpressure_lock);
+	pthread_cleanup_push(__rrr_message_broker_backpressure_unlock_void, costumer);
+
+	while ( !costumer->backpressure_nonblocking &&
+	        __rrr_message_broker_backpressure_update_unlocked(&did_release_dummy, costumer)
+	) {
+		if (time_start == 0) {
+			time_start = rrr_time_get_64();
+		}
+
+		struct timespec wakeup_time;
+		rrr_time_gettimeofday_timespec(&wakeup_time, 100 * 1000); /* 100 ms */
+		if ((ret = pthread_cond_timedwait(&costumer->backpressure_cond, &costumer->backpressure_lock, &wakeup_time)) != 0) {
+			if (ret != ETIMEDOUT) {
+				RRR_MSG_0("Failed while waiting on condition in __rrr_message_broker_backpressure_wait: %s\n", rrr_strerror(ret));
+				ret = 1;
+				break;
+			}
+			ret = 0;
+		}
+
+		if (check_cancel_callback != NULL && check_cancel_callback(check_cancel_callback_arg) != 0) {
+			break;
+		}
+	}
+
+	pthread_cleanup_pop(1);
+
+	if (time_start != 0) {
+		rrr_message_broker_backpressure_blocked_time_add(costumer, rrr_time_get_64() - time_start);
+	}
+
+	return ret;
+}
+
+// Records appended to the write-ahead log by the write callbacks are written
+// once per fifo write, which makes batches share one commit
+static int __rrr_message_broker_wal_commit (
+		struct rrr_message_broker_costumer *costumer
+) {
+	if (costumer->wal == NULL) {
+		return RRR_MESSAGE_BROKER_OK;
+	}
+
+	if (rrr_msg_holder_wal_commit(costumer->wal) != 0) {
+		RRR_MSG_0("Failed to commit write-ahead log in message broker costumer %s\n", costumer->name);
+		return RRR_MESSAGE_BROKER_ERR;
+	}
+
+	return RRR_MESSAGE_BROKER_OK;
+}
+
 struct rrr_message_broker_write_entry_intermediate_callback_data {
 	struct rrr_message_broker_costumer *costumer;
 	const struct sockaddr *addr;
@@ -593,6 +916,7 @@ struct rrr_message_broker_write_entry_intermediate_callback_data {
 	void *callback_arg;
 	int (*check_cancel_callback)(void *arg);
 	void *check_cancel_callback_arg;
+	struct rrr_message_broker_write_notify_counts notify_counts;
 };
 
 struct rrr_message_broker_message_holder_double_pointer {
@@ -749,6 +1073,18 @@ static int __rrr_message_broker_write_entry_intermediate (RRR_FIFO_WRITE_CALLBAC
 			RRR_BUG("BUG: Entry message was set but data length was left being + in __rrr_message_broker_write_entry_intermediate, callback must set data length\n");
 		}
 
+		if (callback_data->costumer->wal != NULL && rrr_msg_holder_wal_append(callback_data->costumer->wal, entry) != 0) {
+			rrr_msg_holder_unlock(entry);
+			ret = RRR_FIFO_GLOBAL_ERR;
+			goto out;
+		}
+
+		if (__rrr_message_broker_write_notify_counts_add(&callback_data->notify_counts, callback_data->costumer, entry) != 0) {
+			rrr_msg_holder_unlock(entry);
+			ret = RRR_FIFO_GLOBAL_ERR;
+			goto out;
+		}
+
 		// Prevents cleanup_pop below to free the entry now that everything is in order
 		rrr_msg_holder_incref_while_locked(entry);
 		rrr_msg_holder_unlock(entry);
@@ -838,7 +1174,8 @@ int rrr_message_broker_write_entry (
 			callback,
 			callback_arg,
 			check_cancel_callback,
-			check_cancel_callback_arg
+			check_cancel_callback_arg,
+			{{0}}
 	};
 
 	if (costumer->slot != NULL) {
@@ -858,6 +1195,14 @@ int rrr_message_broker_write_entry (
 		}
 	}
 	else {
+		if ((ret = __rrr_message_broker_backpressure_wait (
+				costumer,
+				check_cancel_callback,
+				check_cancel_callback_arg
+		)) != 0) {
+			ret = RRR_MESSAGE_BROKER_ERR;
+			goto out;
+		}
 		if ((ret = rrr_fifo_buffer_write (
 				&costumer->main_queue,
 				__rrr_message_broker_write_entry_intermediate,
@@ -867,12 +1212,16 @@ int rrr_message_broker_write_entry (
 			ret = RRR_MESSAGE_BROKER_ERR;
 			goto out;
 		}
+		if ((ret = __rrr_message_broker_wal_commit(costumer)) != 0) {
+			goto out;
+		}
 	}
 
 	if (callback_data.entries_written > 0) {
 		ret = __rrr_message_broker_write_notifications_send (
 				costumer,
 				callback_data.entries_written,
+				&callback_data.notify_counts,
 				check_cancel_callback,
 				check_cancel_callback_arg
 		);
@@ -882,8 +1231,14 @@ int rrr_message_broker_write_entry (
 	return ret;
 }
 
+struct rrr_message_broker_write_entry_wal_callback_data {
+	struct rrr_message_broker_costumer *costumer;
+	struct rrr_msg_holder *entry;
+};
+
 static int __rrr_message_broker_clone_and_write_entry_callback (RRR_FIFO_WRITE_CALLBACK_ARGS) {
-	const struct rrr_msg_holder *source = arg;
+	struct rrr_message_broker_write_entry_wal_callback_data *callback_data = arg;
+	const struct rrr_msg_holder *source = callback_data->entry;
 
 	int ret = 0;
 
@@ -897,6 +1252,12 @@ static int __rrr_message_broker_clone_and_write_entry_callback (RRR_FIFO_WRITE_C
 
 	rrr_msg_holder_lock(target);
 	target->buffer_time = rrr_time_get_64();
+	if (callback_data->costumer->wal != NULL && rrr_msg_holder_wal_append(callback_data->costumer->wal, target) != 0) {
+		rrr_msg_holder_unlock(target);
+		rrr_msg_holder_decref(target);
+		ret = 1;
+		goto out;
+	}
 	rrr_msg_holder_unlock(target);
 
 	*data = (char *) target;
@@ -909,6 +1270,32 @@ static int __rrr_message_broker_clone_and_write_entry_callback (RRR_FIFO_WRITE_C
 	return ret;
 }
 				
+// Source must be locked by caller
+static int __rrr_message_broker_clone_shared_and_write_entry_callback (RRR_FIFO_WRITE_CALLBACK_ARGS) {
+	struct rrr_msg_holder *source = arg;
+
+	int ret = 0;
+
+	struct rrr_msg_holder *target = NULL;
+
+	if (rrr_msg_holder_clone_shared(&target, source) != 0) {
+		RRR_MSG_0("Could not clone entry in __rrr_message_broker_clone_shared_and_write_entry_callback\n");
+		ret = 1;
+		goto out;
+	}
+
+	rrr_msg_holder_lock(target);
+	target->buffer_time = rrr_time_get_64();
+	rrr_msg_holder_unlock(target);
+
+	*data = (char *) target;
+	*size = sizeof(*target);
+	*order = 0;
+
+	out:
+	return ret;
+}
+
 static void __rrr_message_broker_clone_and_write_entry_slot_callback (
 		struct rrr_msg_holder *entry,
 		void *arg
@@ -928,6 +1315,8 @@ int rrr_message_broker_clone_and_write_entry (
 ) {
 	int ret = RRR_MESSAGE_BROKER_OK;
 
+	struct rrr_message_broker_write_notify_counts notify_counts = {0};
+
 	if (costumer->slot != NULL) {
 		if ((ret = rrr_msg_holder_slot_write_clone (
 				costumer->slot,
@@ -941,20 +1330,32 @@ int rrr_message_broker_clone_and_write_entry (
 		}
 	}
 	else {
+		// Cast away const OK, the entry is only read from
+		struct rrr_message_broker_write_entry_wal_callback_data callback_data = {
+				costumer,
+				(struct rrr_msg_holder *) entry
+		};
 		if (rrr_fifo_buffer_write (
 				&costumer->main_queue,
 				__rrr_message_broker_clone_and_write_entry_callback,
-				(void *) entry
+				&callback_data
 		) != 0) {
 			RRR_MSG_0("Error while writing to buffer in rrr_message_broker_clone_and_write_entry\n");
 			ret = RRR_MESSAGE_BROKER_ERR;
 			goto out;
 		}
+		if ((ret = __rrr_message_broker_wal_commit(costumer)) != 0) {
+			goto out;
+		}
+		if ((ret = __rrr_message_broker_write_notify_counts_add(&notify_counts, costumer, entry)) != 0) {
+			goto out;
+		}
 	}
 
 	ret = __rrr_message_broker_write_notifications_send (
 			costumer,
 			1,
+			&notify_counts,
 			NULL,
 			NULL
 	);
@@ -966,7 +1367,12 @@ int rrr_message_broker_clone_and_write_entry (
 }
 
 static int __rrr_message_broker_write_entry_unsafe_callback(RRR_FIFO_WRITE_CALLBACK_ARGS) {
-	struct rrr_msg_holder *entry = arg;
+	struct rrr_message_broker_write_entry_wal_callback_data *callback_data = arg;
+	struct rrr_msg_holder *entry = callback_data->entry;
+
+	if (callback_data->costumer->wal != NULL && rrr_msg_holder_wal_append(callback_data->costumer->wal, entry) != 0) {
+		return 1;
+	}
 
 	*data = (char *) entry;
 	*size = sizeof(*entry);
@@ -988,6 +1394,8 @@ int rrr_message_broker_incref_and_write_entry_unsafe_no_unlock (
 ) {
 	int ret = RRR_MESSAGE_BROKER_OK;
 
+	struct rrr_message_broker_write_notify_counts notify_counts = {0};
+
 	rrr_msg_holder_lock(entry);
 	entry->buffer_time = rrr_time_get_64();
 	rrr_msg_holder_unlock(entry);
@@ -1003,20 +1411,39 @@ int rrr_message_broker_incref_and_write_entry_unsafe_no_unlock (
 		}
 	}
 	else {
+		if ((ret = __rrr_message_broker_backpressure_wait (
+				costumer,
+				check_cancel_callback,
+				check_cancel_callback_arg
+		)) != 0) {
+			ret = RRR_MESSAGE_BROKER_ERR;
+			goto out;
+		}
+		struct rrr_message_broker_write_entry_wal_callback_data callback_data = {
+				costumer,
+				entry
+		};
 		if (rrr_fifo_buffer_write (
 				&costumer->main_queue,
 				__rrr_message_broker_write_entry_unsafe_callback,
-				entry
+				&callback_data
 		) != 0) {
 			RRR_MSG_0("Error while writing to buffer in rrr_message_broker_write_entry_unsafe\n");
 			ret = RRR_MESSAGE_BROKER_ERR;
 			goto out;
 		}
+		if ((ret = __rrr_message_broker_wal_commit(costumer)) != 0) {
+			goto out;
+		}
+		if ((ret = __rrr_message_broker_write_notify_counts_add(&notify_counts, costumer, entry)) != 0) {
+			goto out;
+		}
 	}
 
 	ret = __rrr_message_broker_write_notifications_send (
 			costumer,
 			1,
+			&notify_counts,
 			check_cancel_callback,
 			check_cancel_callback_arg
 	);
@@ -1025,8 +1452,31 @@ int rrr_message_broker_incref_and_write_entry_unsafe_no_unlock (
 	return ret;
 }
 
+struct rrr_message_broker_write_entries_from_collection_callback_data {
+	struct rrr_message_broker_costumer *costumer;
+	struct rrr_msg_holder_collection *collection;
+	struct rrr_message_broker_write_notify_counts notify_counts;
+};
+
 int __rrr_message_broker_write_entries_from_collection_callback (RRR_FIFO_WRITE_CALLBACK_ARGS) {
-	struct rrr_msg_holder_collection *collection = arg;
+	struct rrr_message_broker_write_entries_from_collection_callback_data *callback_data = arg;
+	struct rrr_msg_holder_collection *collection = callback_data->collection;
+
+	{
+		struct rrr_msg_holder *entry = RRR_LL_FIRST(collection);
+		int ret_tmp = 0;
+		rrr_msg_holder_lock(entry);
+		if (callback_data->costumer->wal != NULL) {
+			ret_tmp = rrr_msg_holder_wal_append(callback_data->costumer->wal, entry);
+		}
+		if (ret_tmp == 0) {
+			ret_tmp = __rrr_message_broker_write_notify_counts_add(&callback_data->notify_counts, callback_data->costumer, entry);
+		}
+		rrr_msg_holder_unlock(entry);
+		if (ret_tmp != 0) {
+			return RRR_FIFO_GLOBAL_ERR;
+		}
+	}
 
 	struct rrr_msg_holder *entry = RRR_LL_SHIFT(collection);
 
@@ -1040,7 +1490,8 @@ int __rrr_message_broker_write_entries_from_collection_callback (RRR_FIFO_WRITE_
 // This function removes entries one by one from the given collection. All refcounts passed in
 // must equal exactly 1. No entries may be locked prior to calling this function. If this function
 // fails, entries might still reside inside the collection which have not yet been added to the
-// buffer. The caller owns these. Read about 'unsafe' above.
+// buffer. The caller owns these. Read about 'unsafe' above. The entries are linked into the buffer
+// using one lock acquisition and counted as one batch in the write batch statistics.
 int rrr_message_broker_write_entries_from_collection_unsafe (
 		struct rrr_message_broker_costumer *costumer,
 		struct rrr_msg_holder_collection *collection,
@@ -1053,55 +1504,262 @@ int rrr_message_broker_write_entries_from_collection_unsafe (
 		goto out_final;
 	}
 
-	int written_entries = RRR_LL_COUNT(collection);
+	rrr_length count_before = (rrr_length) RRR_LL_COUNT(collection);
 
+	uint64_t time_now = rrr_time_get_64();
 	RRR_LL_ITERATE_BEGIN(collection, struct rrr_msg_holder);
 		rrr_msg_holder_lock(node);
-		node->buffer_time = rrr_time_get_64();
+		node->buffer_time = time_now;
 		rrr_msg_holder_unlock(node);
 	RRR_LL_ITERATE_END();
 
+	struct rrr_message_broker_write_entries_from_collection_callback_data callback_data = {
+			costumer,
+			collection,
+			{{0}}
+	};
+
 	if (costumer->slot != NULL) {
 		ret = rrr_msg_holder_slot_write_from_collection(costumer->slot, collection, check_cancel_callback, check_cancel_callback_arg);
 	}
-	else {
-		ret = rrr_fifo_buffer_write(&costumer->main_queue, __rrr_message_broker_write_entries_from_collection_callback, collection);
+	else if ((ret = __rrr_message_broker_backpressure_wait(costumer, check_cancel_callback, check_cancel_callback_arg)) == 0) {
+		ret = rrr_fifo_buffer_write_batch(&costumer->main_queue, __rrr_message_broker_write_entries_from_collection_callback, &callback_data);
+		ret |= __rrr_message_broker_wal_commit(costumer);
 	}
 
-	while (written_entries > 0) {
-		if (written_entries > 0xff) {
-			ret = __rrr_message_broker_write_notifications_send (
-					costumer,
-					0xff,
-					check_cancel_callback,
-					check_cancel_callback_arg
-			);
-			written_entries -= 0xff;
-		}
-		else {
-			ret = __rrr_message_broker_write_notifications_send (
-					costumer,
-					written_entries,
-					check_cancel_callback,
-					check_cancel_callback_arg
-			);
-			written_entries = 0;
-		}
+	rrr_length written_entries = count_before - (rrr_length) RRR_LL_COUNT(collection);
+
+	if (written_entries > 0) {
+		__rrr_message_broker_write_batch_stats_add(costumer, written_entries);
+
+		ret |= __rrr_message_broker_write_notifications_send (
+				costumer,
+				written_entries,
+				&callback_data.notify_counts,
+				check_cancel_callback,
+				check_cancel_callback_arg
+		);
 	}
 
 	out_final:
 	return ret;
 }
 
-struct rrr_message_broker_read_entry_intermediate_callback_data {
-	uint16_t *amount;
-	struct rrr_message_broker_costumer *source;
-	struct rrr_message_broker_costumer *self;
-	int broker_poll_flags;
+void rrr_message_broker_write_batch_init (
+		struct rrr_message_broker_write_batch *batch,
+		struct rrr_message_broker_costumer *costumer,
+		int (*check_cancel_callback)(void *arg),
+		void *check_cancel_callback_arg
+) {
+	memset(batch, '\0', sizeof(*batch));
+	batch->costumer = costumer;
+	batch->check_cancel_callback = check_cancel_callback;
+	batch->check_cancel_callback_arg = check_cancel_callback_arg;
+}
+
+// Drop any entries not yet flushed
+void rrr_message_broker_write_batch_clear (
+		struct rrr_message_broker_write_batch *batch
+) {
+	rrr_msg_holder_collection_clear(&batch->entries);
+}
+
+int rrr_message_broker_write_batch_flush (
+		struct rrr_message_broker_write_batch *batch
+) {
+	int ret = RRR_MESSAGE_BROKER_OK;
+
+	if (RRR_LL_COUNT(&batch->entries) == 0) {
+		goto out;
+	}
+
+	if ((ret = rrr_message_broker_write_entries_from_collection_unsafe (
+			batch->costumer,
+			&batch->entries,
+			batch->check_cancel_callback,
+			batch->check_cancel_callback_arg
+	)) != 0) {
+		RRR_MSG_0("Error while writing batch to buffer in rrr_message_broker_write_batch_flush\n");
+		ret = RRR_MESSAGE_BROKER_ERR;
+		goto out;
+	}
+
+	out:
+	// Entries not written are owned by us
+	rrr_message_broker_write_batch_clear(batch);
+	return ret;
+}
+
+// Takes all entries from the collection which must satisfy the same requirements as for
+// rrr_message_broker_write_entries_from_collection_unsafe. Flushes if the batch becomes full.
+int rrr_message_broker_write_batch_take_collection (
+		struct rrr_message_broker_write_batch *batch,
+		struct rrr_msg_holder_collection *collection
+) {
+	RRR_LL_MERGE_AND_CLEAR_SOURCE_HEAD(&batch->entries, collection);
+
+	if (RRR_LL_COUNT(&batch->entries) >= RRR_MESSAGE_BROKER_WRITE_BATCH_MAX) {
+		return rrr_message_broker_write_batch_flush(batch);
+	}
+
+	return RRR_MESSAGE_BROKER_OK;
+}
+
+// Callback semantics are the same as for rrr_message_broker_write_entry, but new
+// entries are kept in the batch until it is flushed or becomes full
+int rrr_message_broker_write_batch_entry (
+		struct rrr_message_broker_write_batch *batch,
+		const struct sockaddr *addr,
+		socklen_t socklen,
+		int protocol,
+		int (*callback)(struct rrr_msg_holder *new_entry, void *arg),
+		void *callback_arg
+) {
+	int ret = RRR_MESSAGE_BROKER_OK;
+
+	struct rrr_msg_holder *entry = NULL;
+	int write_drop = 0;
+	int write_again = 0;
+
+	do {
+		if (rrr_msg_holder_new (
+				&entry,
+				0,
+				addr,
+				socklen,
+				protocol,
+				NULL
+		) != 0) {
+			RRR_MSG_0("Could not allocate entry in rrr_message_broker_write_batch_entry\n");
+			ret = RRR_MESSAGE_BROKER_ERR;
+			goto out;
+		}
+
+		// Callback must always unlock entry
+		rrr_msg_holder_lock(entry);
+
+		if ((ret = __rrr_message_broker_write_entry_callback_intermediate (
+				&write_drop,
+				&write_again,
+				entry,
+				callback,
+				callback_arg
+		)) != 0) {
+			ret = RRR_MESSAGE_BROKER_ERR;
+			goto out;
+		}
+
+		if (write_again && batch->check_cancel_callback(batch->check_cancel_callback_arg) != 0) {
+			write_again = 0;
+		}
+
+		if (write_drop) {
+			rrr_msg_holder_decref(entry);
+			entry = NULL;
+			continue;
+		}
+
+		rrr_msg_holder_lock(entry);
+		if (entry->usercount != 1) {
+			RRR_BUG("BUG: Usercount was not 1 after callback in rrr_message_broker_write_batch_entry\n");
+		}
+		if (entry->message != NULL && entry->data_length == 0) {
+			RRR_BUG("BUG: Entry message was set but data length was left being 0 in rrr_message_broker_write_batch_entry, callback must set data length\n");
+		}
+		rrr_msg_holder_unlock(entry);
+
+		RRR_LL_APPEND(&batch->entries, entry);
+		entry = NULL;
+
+		if (RRR_LL_COUNT(&batch->entries) >= RRR_MESSAGE_BROKER_WRITE_BATCH_MAX) {
+			if ((ret = rrr_message_broker_write_batch_flush(batch)) != 0) {
+				goto out;
+			}
+		}
+	} while (write_again);
+
+	out:
+	if (entry != NULL) {
+		rrr_msg_holder_decref(entry);
+	}
+	return ret;
+}
+
+// Messages without a topic never match a filter
+static int __rrr_message_broker_topic_filter_match (
+		int *does_match,
+		const struct rrr_msg_holder *entry,
+		const struct rrr_mqtt_topic_token *topic_filter
+) {
+	int ret = RRR_MESSAGE_BROKER_OK;
+
+	*does_match = 0;
+
+	const struct rrr_msg_msg *message = entry->message;
+
+	if (message != NULL && MSG_TOPIC_LENGTH(message) > 0 && rrr_msg_msg_topic_match (
+			does_match,
+			message,
+			topic_filter
+	) != 0) {
+		RRR_MSG_0("Error while matching topic against topic filter in message broker\n");
+		ret = RRR_MESSAGE_BROKER_ERR;
+	}
+
+	return ret;
+}
+
+struct rrr_message_broker_read_entry_intermediate_callback_data {
+	uint16_t *amount;
+	struct rrr_message_broker_costumer *source;
+	struct rrr_message_broker_costumer *self;
+	const struct rrr_mqtt_topic_token *topic_filter;
+	int broker_poll_flags;
 	int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE);
 	void *callback_arg;
+
+	// Latency of entries passed to the callback, counted per lane
+	uint64_t time_now;
+	uint64_t entries;
+	uint64_t latency_us_total;
+	uint64_t latency_us_max;
 };
 
+// Readers which do not promise to leave messages untouched get their own copy of shared messages
+static int __rrr_message_broker_poll_intermediate_shared_payload_handling (
+		struct rrr_msg_holder *entry,
+		struct rrr_message_broker_read_entry_intermediate_callback_data *callback_data
+) {
+	int ret = 0;
+
+	int did_copy = 0;
+
+	if (!rrr_msg_holder_message_is_shared(entry)) {
+		goto out;
+	}
+
+	if (!(callback_data->broker_poll_flags & RRR_MESSAGE_BROKER_POLL_F_SHARED_PAYLOAD_OK)) {
+		if (rrr_msg_holder_message_make_writable(&did_copy, entry) != 0) {
+			RRR_MSG_0("Failed to copy shared message while polling in message broker costumer %s\n",
+					callback_data->self->name);
+			ret = RRR_MESSAGE_BROKER_ERR;
+			goto out;
+		}
+	}
+
+	pthread_mutex_lock(&callback_data->self->stats_lock);
+	if (did_copy) {
+		callback_data->self->shared_payload_stats.total_copied++;
+	}
+	else {
+		callback_data->self->shared_payload_stats.total_shared++;
+	}
+	pthread_mutex_unlock(&callback_data->self->stats_lock);
+
+	out:
+	return ret;
+}
+
 static int __rrr_message_broker_poll_intermediate_backstop_handling (
 		int *backstop,
 		struct rrr_msg_holder *entry,
@@ -1121,11 +1779,46 @@ static int __rrr_message_broker_poll_intermediate_backstop_handling (
 		return 0;
 	}
 
+	int ret = 0;
+
+	// Split buffers are filtered already when they are filled
+	if (callback_data->topic_filter != NULL) {
+		int does_match = 0;
+		if ((ret = __rrr_message_broker_topic_filter_match(&does_match, entry, callback_data->topic_filter)) != 0) {
+			rrr_msg_holder_unlock(entry);
+			return ret;
+		}
+		if (!does_match) {
+			RRR_DBG_3("Message broker topic filter in %s: Message read from %s dropped\n",
+					callback_data->self->name, callback_data->source->name);
+			rrr_msg_holder_unlock(entry);
+			return 0;
+		}
+	}
+
 	// Set regardless of flag, we don't know if the source wishes to check backstop or not
 	if (entry->source == NULL) {
 		entry->source = callback_data->source;
 	}
 
+	if ((ret = __rrr_message_broker_poll_intermediate_shared_payload_handling (
+			entry,
+			callback_data
+	)) != 0) {
+		rrr_msg_holder_unlock(entry);
+		return ret;
+	}
+
+	uint64_t latency_us = callback_data->time_now > entry->buffer_time
+		? callback_data->time_now - entry->buffer_time
+		: 0;
+
+	callback_data->entries++;
+	callback_data->latency_us_total += latency_us;
+	if (latency_us > callback_data->latency_us_max) {
+		callback_data->latency_us_max = latency_us;
+	}
+
 	return callback_data->callback(entry, callback_data->callback_arg);
 }
 
@@ -1139,6 +1832,10 @@ static int __rrr_message_broker_poll_delete_intermediate (RRR_FIFO_READ_CALLBACK
 
 	rrr_msg_holder_lock(entry);
 
+	// The callback might write the entry to another buffer which
+	// has its own write-ahead log, read the sequence number first
+	const uint64_t wal_seq = entry->wal_seq;
+
 	int backstop_dummy = 0;
 	ret = __rrr_message_broker_poll_intermediate_backstop_handling (
 			&backstop_dummy,
@@ -1149,6 +1846,10 @@ static int __rrr_message_broker_poll_delete_intermediate (RRR_FIFO_READ_CALLBACK
 	// Callback must unlock
 	rrr_msg_holder_decref(entry);
 
+	if (wal_seq != 0 && callback_data->source->wal != NULL) {
+		rrr_msg_holder_wal_ack(callback_data->source->wal, wal_seq);
+	}
+
 	if (--(*callback_data->amount) == 0) {
 		ret |= RRR_FIFO_SEARCH_STOP;
 	}
@@ -1201,17 +1902,29 @@ static void __rrr_message_broker_get_source_buffer (
 
 	struct rrr_fifo_buffer *found_buffer = NULL;
 
+	// Each reader uses the split buffer at its position in the listener list, the
+	// topic filter of the reader is applied when the buffer is filled
+	int listener_pos = -1;
+	for (int i = 0; i < RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX && costumer->write_notify_listeners[i] != NULL; i++) {
+		if (costumer->write_notify_listeners[i] == self) {
+			listener_pos = i;
+			break;
+		}
+	}
+
+	if (listener_pos < 0) {
+		RRR_BUG("BUG: Reader %s is not a listener of %s in __rrr_message_broker_get_source_buffer\n",
+			self->name, costumer->name);
+	}
+
 	int pos = 0;
 	RRR_LL_ITERATE_BEGIN(&costumer->split_buffers, struct rrr_message_broker_split_buffer_node);
-		if (node->owner == self) {
-			found_buffer = &node->queue;
-			RRR_LL_ITERATE_LAST();
-		}
-		else if (node->owner == NULL) {
-			// Allocate
-			RRR_DBG_1("Message broker costumer %s add split buffer reader %s at position %i\n",
-				costumer->name, self->name, pos);
-			node->owner = self;
+		if (pos == listener_pos) {
+			if (node->owner == NULL) {
+				RRR_DBG_1("Message broker costumer %s add split buffer reader %s at position %i\n",
+					costumer->name, self->name, pos);
+				node->owner = self;
+			}
 			found_buffer = &node->queue;
 			RRR_LL_ITERATE_LAST();
 		}
@@ -1237,12 +1950,35 @@ static int __rrr_message_broker_split_buffers_fill_callback (RRR_FIFO_READ_CALLB
 
 	// Split buffer lock must be held by caller
 
+	struct rrr_msg_holder *entry = (struct rrr_msg_holder *) data;
+
+	// All split buffers share the message of the entry. Readers copy it
+	// if needed when polling.
+	rrr_msg_holder_lock(entry);
+	int pos = 0;
 	RRR_LL_ITERATE_BEGIN(&costumer->split_buffers, struct rrr_message_broker_split_buffer_node);
+		// Split buffers are at the same positions as the listeners
+		const struct rrr_mqtt_topic_token *topic_filter = (pos < RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX
+			? costumer->write_notify_listener_topic_filters[pos]
+			: NULL
+		);
+		pos++;
+
+		if (topic_filter != NULL) {
+			int does_match = 0;
+			if ((ret = __rrr_message_broker_topic_filter_match(&does_match, entry, topic_filter)) != 0) {
+				goto out;
+			}
+			if (!does_match) {
+				RRR_LL_ITERATE_NEXT();
+			}
+		}
+
 		// Use delayed write in case there are other threads reading from their buffer
 		if ((ret = rrr_fifo_buffer_write_delayed (
 				&node->queue,
-				__rrr_message_broker_clone_and_write_entry_callback,
-				(void *) data
+				__rrr_message_broker_clone_shared_and_write_entry_callback,
+				entry
 		)) != 0) {
 			RRR_MSG_0("Error while writing to buffer in __rrr_message_broker_split_buffers_fill_callback\n");
 			ret = RRR_MESSAGE_BROKER_ERR;
@@ -1251,6 +1987,7 @@ static int __rrr_message_broker_split_buffers_fill_callback (RRR_FIFO_READ_CALLB
 	RRR_LL_ITERATE_END();
 
 	out:
+	rrr_msg_holder_unlock(entry);
 	return ret | RRR_FIFO_SEARCH_FREE;
 }
 
@@ -1286,8 +2023,8 @@ static int __rrr_message_broker_split_buffers_fill (
 
 #define RRR_MESSAGE_BROKER_POLL_SPLIT_BUFFER_HANDLING()                  \
     struct rrr_fifo_buffer *source_buffer = NULL;                        \
+    int source_buffer_is_main = 0;                                       \
     do {                                                                 \
-        int source_buffer_is_main = 0;                                   \
         __rrr_message_broker_get_source_buffer (                         \
     	    &source_buffer_is_main, &source_buffer, costumer, self       \
         ); if (source_buffer_is_main == 0 &&                             \
@@ -1317,53 +2054,62 @@ size_t rrr_message_broker_senders_count (
 	return ret;
 }
 
-int rrr_message_broker_poll_delete (
-		uint16_t *amount,
-		struct rrr_message_broker_costumer *self,
-		int broker_poll_flags,
-		int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE),
-		void *callback_arg,
+static int __rrr_message_broker_poll_delete_lane (
+		int *depth,
+		struct rrr_message_broker_read_entry_intermediate_callback_data *callback_data,
+		enum rrr_message_broker_priority_lane lane,
 		unsigned int wait_milliseconds
 ) {
+	struct rrr_message_broker_costumer *self = callback_data->self;
+
 	int ret = RRR_MESSAGE_BROKER_OK;
 
-	struct rrr_message_broker_read_entry_intermediate_callback_data callback_data = {
-			amount,
-			NULL,
-			self,
-			broker_poll_flags,
-			callback,
-			callback_arg
-	};
+	*depth = 0;
 
 	FRIENDS_ITERATE_BEGIN(senders,RRR_MESSAGE_BROKER_SENDERS_MAX);
-		callback_data.source = costumer;
+		if (costumer->priority_lane != lane) {
+			continue;
+		}
+
+		callback_data->source = costumer;
+		callback_data->topic_filter = self->sender_topic_filters[i];
 
 		if (costumer->slot != NULL) {
 			if ((ret = rrr_msg_holder_slot_read (
 					costumer->slot,
 					self,
 					__rrr_message_broker_poll_delete_slot_intermediate,
-					&callback_data,
+					callback_data,
 					wait_milliseconds
 			)) != 0) {
 				goto out;
 			}
+			(*depth) += rrr_msg_holder_slot_count(costumer->slot);
 		}
 		else {
 			RRR_MESSAGE_BROKER_POLL_SPLIT_BUFFER_HANDLING();
 
+			if (!source_buffer_is_main) {
+				callback_data->topic_filter = NULL;
+			}
+
 			if ((ret = rrr_fifo_buffer_read_clear_forward (
 					source_buffer,
 					__rrr_message_broker_poll_delete_intermediate,
-					&callback_data,
+					callback_data,
 					wait_milliseconds
 			)) != 0) {
 				goto out;
 			}
+
+			if ((ret = __rrr_message_broker_backpressure_release_as_needed(costumer)) != 0) {
+				goto out;
+			}
+
+			(*depth) += rrr_fifo_buffer_get_entry_count(source_buffer);
 		}
 
-		if (*amount == 0) {
+		if (*(callback_data->amount) == 0) {
 			break;
 		}
 	FRIENDS_ITERATE_END();
@@ -1372,38 +2118,291 @@ int rrr_message_broker_poll_delete (
 	return ret;
 }
 
-int rrr_message_broker_set_ratelimit (
-		struct rrr_message_broker_costumer *costumer,
-		int set
+static uint16_t __rrr_message_broker_poll_lane_amount (
+		const struct rrr_message_broker_costumer *self,
+		const int lane_senders[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT],
+		enum rrr_message_broker_priority_lane lane,
+		uint16_t amount
+) {
+	static const unsigned int weights[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT] = {4, 2, 1};
+
+	if (self->priority_dequeue != RRR_MESSAGE_BROKER_PRIORITY_DEQUEUE_WEIGHTED) {
+		return amount;
+	}
+
+	// Whatever higher lanes did not use is shared among this and the lower lanes
+	unsigned int weight_sum = 0;
+	for (int i = lane; i < RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT; i++) {
+		if (lane_senders[i] > 0) {
+			weight_sum += weights[i];
+		}
+	}
+
+	uint16_t lane_amount = (uint16_t) ((unsigned int) amount * weights[lane] / weight_sum);
+
+	return lane_amount > 0 ? lane_amount : 1;
+}
+
+int rrr_message_broker_poll_delete (
+		uint16_t *amount,
+		struct rrr_message_broker_costumer *self,
+		int broker_poll_flags,
+		int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE),
+		void *callback_arg,
+		unsigned int wait_milliseconds
 ) {
 	int ret = RRR_MESSAGE_BROKER_OK;
 
-	rrr_fifo_buffer_set_do_ratelimit(&costumer->main_queue, set);
+	uint16_t lane_amount = 0;
+	int lane_senders[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT] = {0};
 
-	RRR_LL_ITERATE_BEGIN(&costumer->split_buffers, struct rrr_message_broker_split_buffer_node);
-		rrr_fifo_buffer_set_do_ratelimit(&node->queue, set);
-	RRR_LL_ITERATE_END();
+	struct rrr_message_broker_read_entry_intermediate_callback_data callback_data = {
+			&lane_amount,
+			NULL,
+			self,
+			NULL,
+			broker_poll_flags,
+			callback,
+			callback_arg,
+			0,
+			0,
+			0,
+			0
+	};
+
+	FRIENDS_ITERATE_BEGIN(senders,RRR_MESSAGE_BROKER_SENDERS_MAX);
+		lane_senders[costumer->priority_lane]++;
+	FRIENDS_ITERATE_END();
 
+	for (int lane = 0; lane < RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT && *amount > 0; lane++) {
+		if (lane_senders[lane] == 0) {
+			continue;
+		}
+
+		lane_amount = __rrr_message_broker_poll_lane_amount(self, lane_senders, lane, *amount);
+
+		const uint16_t lane_amount_orig = lane_amount;
+		int depth = 0;
+
+		callback_data.time_now = rrr_time_get_64();
+		callback_data.entries = 0;
+		callback_data.latency_us_total = 0;
+		callback_data.latency_us_max = 0;
+
+		ret = __rrr_message_broker_poll_delete_lane (
+				&depth,
+				&callback_data,
+				lane,
+				wait_milliseconds
+		);
+
+		*amount -= lane_amount_orig - lane_amount;
+
+		pthread_mutex_lock(&self->stats_lock);
+		struct rrr_message_broker_lane_stats *stats = &self->lane_stats[lane];
+		stats->total_entries += callback_data.entries;
+		stats->total_latency_us += callback_data.latency_us_total;
+		if (callback_data.latency_us_max > stats->max_latency_us) {
+			stats->max_latency_us = callback_data.latency_us_max;
+		}
+		stats->depth = depth;
+		pthread_mutex_unlock(&self->stats_lock);
+
+		if (ret != 0) {
+			goto out;
+		}
+	}
+
+	out:
 	return ret;
 }
 
-int rrr_message_broker_get_entry_count_and_ratelimit (
+void rrr_message_broker_watermarks_set (
+		struct rrr_message_broker_costumer *costumer,
+		unsigned int high_watermark,
+		unsigned int low_watermark
+) {
+	if (high_watermark > 0 && low_watermark >= high_watermark) {
+		RRR_BUG("BUG: Low watermark %u was not less than high watermark %u in rrr_message_broker_watermarks_set\n",
+				low_watermark, high_watermark);
+	}
+
+	int did_release = 0;
+	int do_notify = 0;
+
+	pthread_mutex_lock(&costumer->backpressure_lock);
+	costumer->backpressure_high_watermark = (int) high_watermark;
+	costumer->backpressure_low_watermark = (int) low_watermark;
+	__rrr_message_broker_backpressure_update_unlocked(&did_release, costumer);
+	do_notify = did_release && costumer->backpressure_nonblocking;
+	pthread_mutex_unlock(&costumer->backpressure_lock);
+
+	if (do_notify) {
+		__rrr_message_broker_backpressure_release_notify(costumer);
+	}
+}
+
+// Writers which must not block, like those driven by events, call this function
+// during initialization. Such writers must call rrr_message_broker_backpressure_check
+// regularly and pause their input while it returns 1. When backpressure is released,
+// the RRR_EVENT_FUNCTION_MESSAGE_BROKER_BACKPRESSURE_RELEASED event is passed to the
+// event queue of the costumer.
+void rrr_message_broker_backpressure_nonblocking_set (
+		struct rrr_message_broker_costumer *costumer
+) {
+	pthread_mutex_lock(&costumer->backpressure_lock);
+	costumer->backpressure_nonblocking = 1;
+	pthread_mutex_unlock(&costumer->backpressure_lock);
+}
+
+// No locking, call prior to starting threads
+void rrr_message_broker_priority_lane_set (
+		struct rrr_message_broker_costumer *costumer,
+		enum rrr_message_broker_priority_lane lane
+) {
+	if (lane >= RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT) {
+		RRR_BUG("BUG: Invalid lane %i in rrr_message_broker_priority_lane_set\n", lane);
+	}
+	costumer->priority_lane = lane;
+}
+
+// No locking, call prior to starting threads
+void rrr_message_broker_priority_dequeue_set (
+		struct rrr_message_broker_costumer *costumer,
+		int priority_dequeue
+) {
+	costumer->priority_dequeue = priority_dequeue;
+}
+
+// Must be called before any threads write to the costumer. Entries left
+// in the log by a previous run are put back into the buffer, and readers
+// must therefore already have been added as senders.
+int rrr_message_broker_wal_enable (
+		struct rrr_message_broker_costumer *costumer,
+		const char *directory,
+		size_t segment_size,
+		uint64_t sync_interval_us
+) {
+	int ret = RRR_MESSAGE_BROKER_OK;
+
+	struct rrr_msg_holder_collection replayed = {0};
+	struct rrr_msg_holder_wal *wal = NULL;
+
+	if (costumer->slot != NULL || costumer->split_buffers_active) {
+		RRR_MSG_0("Write-ahead log cannot be used in message broker costumer %s which has slot or split buffers\n",
+				costumer->name);
+		ret = RRR_MESSAGE_BROKER_ERR;
+		goto out;
+	}
+
+	if (costumer->wal != NULL) {
+		RRR_BUG("BUG: Write-ahead log was already enabled in rrr_message_broker_wal_enable\n");
+	}
+
+	if (rrr_msg_holder_wal_new (
+			&wal,
+			&replayed,
+			directory,
+			costumer->name,
+			segment_size,
+			sync_interval_us
+	) != 0) {
+		RRR_MSG_0("Failed to create write-ahead log in message broker costumer %s\n", costumer->name);
+		ret = RRR_MESSAGE_BROKER_ERR;
+		goto out;
+	}
+
+	rrr_length count = (rrr_length) RRR_LL_COUNT(&replayed);
+
+	if (count > 0) {
+		RRR_DBG_1("Message broker costumer %s replaying %" PRIrrrl " entries from write-ahead log\n",
+				costumer->name, count);
+
+		uint64_t time_now = rrr_time_get_64();
+		RRR_LL_ITERATE_BEGIN(&replayed, struct rrr_msg_holder);
+			node->buffer_time = time_now;
+		RRR_LL_ITERATE_END();
+
+		// The log is not set in the costumer yet, entries are not appended again
+		struct rrr_message_broker_write_entries_from_collection_callback_data callback_data = {
+				costumer,
+				&replayed,
+				{{0}}
+		};
+		if (rrr_fifo_buffer_write_batch(&costumer->main_queue, __rrr_message_broker_write_entries_from_collection_callback, &callback_data) != 0) {
+			RRR_MSG_0("Failed to write replayed entries to buffer in message broker costumer %s\n", costumer->name);
+			ret = RRR_MESSAGE_BROKER_ERR;
+			goto out_destroy;
+		}
+
+		if ((ret = __rrr_message_broker_write_notifications_send (
+				costumer,
+				count,
+				&callback_data.notify_counts,
+				NULL,
+				NULL
+		)) != 0) {
+			goto out_destroy;
+		}
+	}
+
+	costumer->wal = wal;
+
+	goto out;
+	out_destroy:
+		rrr_msg_holder_wal_destroy(wal);
+	out:
+		rrr_msg_holder_collection_clear(&replayed);
+		return ret;
+}
+
+int rrr_message_broker_backpressure_check (
+		struct rrr_message_broker_costumer *costumer
+) {
+	int active = 0;
+	int did_release = 0;
+	int do_notify = 0;
+
+	pthread_mutex_lock(&costumer->backpressure_lock);
+	active = __rrr_message_broker_backpressure_update_unlocked(&did_release, costumer);
+	do_notify = did_release && costumer->backpressure_nonblocking;
+	pthread_mutex_unlock(&costumer->backpressure_lock);
+
+	if (do_notify) {
+		__rrr_message_broker_backpressure_release_notify(costumer);
+	}
+
+	return active;
+}
+
+void rrr_message_broker_backpressure_blocked_time_add (
+		struct rrr_message_broker_costumer *costumer,
+		uint64_t blocked_us
+) {
+	pthread_mutex_lock(&costumer->stats_lock);
+	costumer->backpressure_stats.total_blocks++;
+	costumer->backpressure_stats.total_blocked_us += blocked_us;
+	pthread_mutex_unlock(&costumer->stats_lock);
+}
+
+int rrr_message_broker_get_entry_count_and_backpressure (
 		int *entry_count,
-		int *ratelimit_active,
+		int *backpressure_active,
 		struct rrr_message_broker_costumer *costumer
 ) {
 	int ret = RRR_MESSAGE_BROKER_OK;
 
 	*entry_count = 0;
-	*ratelimit_active = 0;
+	*backpressure_active = 0;
 
 	if (costumer->slot != NULL) {
-		*ratelimit_active = 0;
 		*entry_count = rrr_msg_holder_slot_count(costumer->slot);
 	}
 	else {
-		// Ratelimit is the same on split buffers
-		*ratelimit_active = rrr_fifo_buffer_get_ratelimit_active(&costumer->main_queue);
+		pthread_mutex_lock(&costumer->backpressure_lock);
+		*backpressure_active = costumer->backpressure_active;
+		pthread_mutex_unlock(&costumer->backpressure_lock);
+
 		*entry_count = rrr_fifo_buffer_get_entry_count(&costumer->main_queue);
 
 		RRR_LL_ITERATE_BEGIN(&costumer->split_buffers, struct rrr_message_broker_split_buffer_node);
@@ -1434,6 +2433,54 @@ int rrr_message_broker_get_fifo_stats (
 	return ret;
 }
 
+void rrr_message_broker_get_write_batch_stats (
+		struct rrr_message_broker_write_batch_stats *target,
+		struct rrr_message_broker_costumer *costumer
+) {
+	pthread_mutex_lock(&costumer->stats_lock);
+	*target = costumer->write_batch_stats;
+	pthread_mutex_unlock(&costumer->stats_lock);
+}
+
+void rrr_message_broker_get_shared_payload_stats (
+		struct rrr_message_broker_shared_payload_stats *target,
+		struct rrr_message_broker_costumer *costumer
+) {
+	pthread_mutex_lock(&costumer->stats_lock);
+	*target = costumer->shared_payload_stats;
+	pthread_mutex_unlock(&costumer->stats_lock);
+}
+
+void rrr_message_broker_get_backpressure_stats (
+		struct rrr_message_broker_backpressure_stats *target,
+		struct rrr_message_broker_costumer *costumer
+) {
+	pthread_mutex_lock(&costumer->stats_lock);
+	*target = costumer->backpressure_stats;
+	pthread_mutex_unlock(&costumer->stats_lock);
+}
+
+void rrr_message_broker_get_lane_stats (
+		struct rrr_message_broker_lane_stats target[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT],
+		struct rrr_message_broker_costumer *costumer
+) {
+	pthread_mutex_lock(&costumer->stats_lock);
+	memcpy(target, costumer->lane_stats, sizeof(costumer->lane_stats));
+	pthread_mutex_unlock(&costumer->stats_lock);
+}
+
+// Stats are zero if the write-ahead log is not enabled
+void rrr_message_broker_get_wal_stats (
+		struct rrr_msg_holder_wal_stats *target,
+		struct rrr_message_broker_costumer *costumer
+) {
+	if (costumer->wal == NULL) {
+		memset(target, '\0', sizeof(*target));
+		return;
+	}
+	rrr_msg_holder_wal_get_stats(target, costumer->wal);
+}
+
 int rrr_message_broker_with_ctx_and_buffer_lock_do (
 		struct rrr_message_broker_costumer *costumer,
 		int (*callback)(void *callback_arg_1, void *callback_arg_2),
@@ -1454,39 +2501,50 @@ int rrr_message_broker_with_ctx_and_buffer_lock_do (
 
 static int __rrr_message_broker_write_listener_add (
 		struct rrr_message_broker_costumer *costumer,
-		struct rrr_message_broker_costumer *listener_costumer
+		struct rrr_message_broker_costumer *listener_costumer,
+		const struct rrr_mqtt_topic_token *topic_filter
 ) {
 	int ret = RRR_MESSAGE_BROKER_OK;
 
 	if ((ret = __rrr_message_broker_friend_add(
 			costumer->write_notify_listeners,
+			costumer->write_notify_listener_topic_filters,
 			RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX,
-			listener_costumer
+			listener_costumer,
+			topic_filter
 	)) != 0) {
 		RRR_MSG_0("Failed to add write notification listener to costumer %s, too many listeners\n", costumer->name);
 	}
+	else if (topic_filter != NULL) {
+		costumer->write_notify_filtered = 1;
+	}
 
 	return ret;
 }
 
-// No locking, call prior to starting threads
+// No locking, call prior to starting threads. If a topic filter is given, the
+// costumer only receives messages from the sender with a matching topic. The
+// filter must not be destroyed before the costumer.
 int rrr_message_broker_sender_add (
 		struct rrr_message_broker_costumer *costumer,
-		struct rrr_message_broker_costumer *listener_costumer
+		struct rrr_message_broker_costumer *listener_costumer,
+		const struct rrr_mqtt_topic_token *topic_filter
 ) {
 	int ret = RRR_MESSAGE_BROKER_OK;
 
 	if ((ret = __rrr_message_broker_friend_add (
 			costumer->senders,
+			costumer->sender_topic_filters,
 			RRR_MESSAGE_BROKER_SENDERS_MAX,
-			listener_costumer
+			listener_costumer,
+			topic_filter
 	)) != 0) {
 		RRR_MSG_0("Failed to add sender to costumer %s, too many senders\n", costumer->name);
 		goto out;
 	}
 
 	// Reverse arguments
-	ret = __rrr_message_broker_write_listener_add(listener_costumer, costumer);
+	ret = __rrr_message_broker_write_listener_add(listener_costumer, costumer, topic_filter);
 
 	out:
 	return ret;
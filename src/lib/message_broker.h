@@ -28,6 +28,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "buffer.h"
 #include "poll_helper.h"
 #include "event.h"
+#include "message_holder/message_holder_collection.h"
+#include "message_holder/message_holder_wal.h"
 #include "util/linked_list.h"
 
 #define RRR_MESSAGE_BROKER_OK		0
@@ -36,16 +38,84 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_MESSAGE_BROKER_DROP		(1<<1)
 #define RRR_MESSAGE_BROKER_AGAIN	(1<<2)
 
-#define RRR_MESSAGE_BROKER_POLL_F_CHECK_BACKSTOP    (1<<0)
+#define RRR_MESSAGE_BROKER_POLL_F_CHECK_BACKSTOP      (1<<0)
+// Poll callback promises not to modify shared messages without making them writable
+#define RRR_MESSAGE_BROKER_POLL_F_SHARED_PAYLOAD_OK   (1<<1)
 
 #define RRR_MESSAGE_BROKER_SENDERS_MAX                64
 #define RRR_MESSAGE_BROKER_WRITE_NOTIFY_LISTENER_MAX  RRR_MESSAGE_BROKER_SENDERS_MAX
 
+// Batches are flushed automatically when reaching this size, it equals the
+// maximum amount which can be passed in one event notification.
+#define RRR_MESSAGE_BROKER_WRITE_BATCH_MAX            0xff
+
+// Histogram buckets are power of two sizes, 1, 2-3, 4-7 ... 128-255
+#define RRR_MESSAGE_BROKER_WRITE_BATCH_HISTOGRAM_SIZE 8
+
+// Writers are held back when the output buffer reaches the high watermark
+// and released when readers have brought it down to the low watermark
+#define RRR_MESSAGE_BROKER_DEFAULT_HIGH_WATERMARK     10000
+#define RRR_MESSAGE_BROKER_DEFAULT_LOW_WATERMARK      1000
+
+// Readers poll senders in the high lane first and senders in the low lane last.
+// Senders are put in the normal lane unless something else is set.
+enum rrr_message_broker_priority_lane {
+	RRR_MESSAGE_BROKER_PRIORITY_LANE_HIGH,
+	RRR_MESSAGE_BROKER_PRIORITY_LANE_NORMAL,
+	RRR_MESSAGE_BROKER_PRIORITY_LANE_LOW
+};
+
+#define RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT        (RRR_MESSAGE_BROKER_PRIORITY_LANE_LOW + 1)
+
+// With weighted dequeue, lanes get shares of each poll in the ratio 4:2:1
+// instead of the higher lanes being drained first
+#define RRR_MESSAGE_BROKER_PRIORITY_DEQUEUE_STRICT    0
+#define RRR_MESSAGE_BROKER_PRIORITY_DEQUEUE_WEIGHTED  1
+
 struct rrr_msg_holder;
 struct rrr_msg_holder_collection;
 struct rrr_msg_holder_slot;
 struct rrr_message_broker_costumer;
 struct rrr_message_broker;
+struct rrr_mqtt_topic_token;
+
+struct rrr_message_broker_write_batch_stats {
+	uint64_t total_batches;
+	uint64_t total_entries;
+	uint64_t histogram[RRR_MESSAGE_BROKER_WRITE_BATCH_HISTOGRAM_SIZE];
+};
+
+// Counted by readers of duplicated output buffers
+struct rrr_message_broker_shared_payload_stats {
+	uint64_t total_shared;
+	uint64_t total_copied;
+};
+
+/*
+ * A write batch collects new entries from a producer and writes them to the
+ * broker using one buffer lock acquisition. Listeners are notified once per
+ * flush. The struct is usually kept on the stack of a read function.
+ */
+struct rrr_message_broker_backpressure_stats {
+	uint64_t total_blocks;
+	uint64_t total_blocked_us;
+};
+
+// Counted by readers, depth is the number of entries left in the
+// buffers of senders in the lane after the last poll
+struct rrr_message_broker_lane_stats {
+	uint64_t total_entries;
+	uint64_t total_latency_us;
+	uint64_t max_latency_us;
+	int depth;
+};
+
+struct rrr_message_broker_write_batch {
+	struct rrr_message_broker_costumer *costumer;
+	struct rrr_msg_holder_collection entries;
+	int (*check_cancel_callback)(void *arg);
+	void *check_cancel_callback_arg;
+};
 
 void rrr_message_broker_unregister_all (
 		struct rrr_message_broker *broker
@@ -68,7 +138,8 @@ int rrr_message_broker_costumer_register (
 		struct rrr_message_broker_costumer **result,
 		struct rrr_message_broker *broker,
 		const char *name_unique,
-		int no_buffer
+		int no_buffer,
+		int queue_engine
 );
 int rrr_message_broker_setup_split_output_buffer (
 		struct rrr_message_broker_costumer *costumer,
@@ -104,6 +175,30 @@ int rrr_message_broker_write_entries_from_collection_unsafe (
 		int (*check_cancel_callback)(void *arg),
 		void *check_cancel_callback_arg
 );
+void rrr_message_broker_write_batch_init (
+		struct rrr_message_broker_write_batch *batch,
+		struct rrr_message_broker_costumer *costumer,
+		int (*check_cancel_callback)(void *arg),
+		void *check_cancel_callback_arg
+);
+void rrr_message_broker_write_batch_clear (
+		struct rrr_message_broker_write_batch *batch
+);
+int rrr_message_broker_write_batch_flush (
+		struct rrr_message_broker_write_batch *batch
+);
+int rrr_message_broker_write_batch_take_collection (
+		struct rrr_message_broker_write_batch *batch,
+		struct rrr_msg_holder_collection *collection
+);
+int rrr_message_broker_write_batch_entry (
+		struct rrr_message_broker_write_batch *batch,
+		const struct sockaddr *addr,
+		socklen_t socklen,
+		int protocol,
+		int (*callback)(struct rrr_msg_holder *new_entry, void *arg),
+		void *callback_arg
+);
 size_t rrr_message_broker_senders_count (
 		struct rrr_message_broker_costumer *self
 );
@@ -115,19 +210,64 @@ int rrr_message_broker_poll_delete (
 		void *callback_arg,
 		unsigned int wait_milliseconds
 );
-int rrr_message_broker_set_ratelimit (
+void rrr_message_broker_watermarks_set (
+		struct rrr_message_broker_costumer *costumer,
+		unsigned int high_watermark,
+		unsigned int low_watermark
+);
+void rrr_message_broker_priority_lane_set (
+		struct rrr_message_broker_costumer *costumer,
+		enum rrr_message_broker_priority_lane lane
+);
+void rrr_message_broker_priority_dequeue_set (
+		struct rrr_message_broker_costumer *costumer,
+		int priority_dequeue
+);
+int rrr_message_broker_wal_enable (
 		struct rrr_message_broker_costumer *costumer,
-		int set
+		const char *directory,
+		size_t segment_size,
+		uint64_t sync_interval_us
+);
+void rrr_message_broker_backpressure_nonblocking_set (
+		struct rrr_message_broker_costumer *costumer
 );
-int rrr_message_broker_get_entry_count_and_ratelimit (
+int rrr_message_broker_backpressure_check (
+		struct rrr_message_broker_costumer *costumer
+);
+void rrr_message_broker_backpressure_blocked_time_add (
+		struct rrr_message_broker_costumer *costumer,
+		uint64_t blocked_us
+);
+int rrr_message_broker_get_entry_count_and_backpressure (
 		int *entry_count,
-		int *ratelimit_active,
+		int *backpressure_active,
 		struct rrr_message_broker_costumer *costumer
 );
 int rrr_message_broker_get_fifo_stats (
 		struct rrr_fifo_buffer_stats *target,
 		struct rrr_message_broker_costumer *costumer
 );
+void rrr_message_broker_get_write_batch_stats (
+		struct rrr_message_broker_write_batch_stats *target,
+		struct rrr_message_broker_costumer *costumer
+);
+void rrr_message_broker_get_shared_payload_stats (
+		struct rrr_message_broker_shared_payload_stats *target,
+		struct rrr_message_broker_costumer *costumer
+);
+void rrr_message_broker_get_backpressure_stats (
+		struct rrr_message_broker_backpressure_stats *target,
+		struct rrr_message_broker_costumer *costumer
+);
+void rrr_message_broker_get_lane_stats (
+		struct rrr_message_broker_lane_stats target[RRR_MESSAGE_BROKER_PRIORITY_LANE_COUNT],
+		struct rrr_message_broker_costumer *costumer
+);
+void rrr_message_broker_get_wal_stats (
+		struct rrr_msg_holder_wal_stats *target,
+		struct rrr_message_broker_costumer *costumer
+);
 struct rrr_event_queue *rrr_message_broker_event_queue_get (
 		struct rrr_message_broker_costumer *costumer
 );
@@ -139,7 +279,8 @@ int rrr_message_broker_with_ctx_and_buffer_lock_do (
 );
 int rrr_message_broker_sender_add (
 		struct rrr_message_broker_costumer *costumer,
-		struct rrr_message_broker_costumer *listener_costumer
+		struct rrr_message_broker_costumer *listener_costumer,
+		const struct rrr_mqtt_topic_token *topic_filter
 );
 
 #endif /* RRR_MESSAGE_BROKER_H */
@@ -21,7 +21,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/types.h>
+#include <stdatomic.h>
 
 #include "../log.h"
 #include "../allocator.h"
@@ -33,6 +35,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../util/posix.h"
 #include "../util/linked_list.h"
 
+/*
+ * A message shared between multiple entries, typically when one message is
+ * written to multiple output buffers. The message is immutable as long as more
+ * than one entry refers to it. The last entry to let go frees the message.
+ */
+struct rrr_msg_holder_shared {
+	atomic_int usercount;
+	void *message;
+};
+
 // This lock protects the lock member of all ip buffer entries
 // and must be held when accessing the locks
 pthread_mutex_t rrr_msg_holder_master_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -55,6 +67,223 @@ static void __rrr_msg_holder_util_lock_destroy (
 	pthread_mutex_unlock(&rrr_msg_holder_master_lock);
 }
 
+/*
+ * Destroyed holders are kept in a small per-thread pool with their lock still
+ * initialized and are reused by rrr_msg_holder_new. Holders are usually created
+ * in one thread and destroyed in another, a thread with too many holders
+ * therefore moves half of them to a global pool from which other threads
+ * refill. Holders are only freed when both pools are full.
+ *
+ * The slab allocator already recycles the memory, the pool additionally saves
+ * initialization and destruction of the lock which are done while holding the
+ * master lock, and the allocation of the address storage.
+ */
+
+#define RRR_MSG_HOLDER_POOL_LOCAL_MAX   128
+#define RRR_MSG_HOLDER_POOL_GLOBAL_MAX  8192
+
+struct rrr_msg_holder_pool {
+	struct rrr_msg_holder *first;
+	int count;
+	int key_is_set;
+};
+
+static __thread struct rrr_msg_holder_pool rrr_msg_holder_pool_local = {0};
+static struct rrr_msg_holder_pool rrr_msg_holder_pool_global = {0};
+static pthread_mutex_t rrr_msg_holder_pool_global_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t rrr_msg_holder_pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rrr_msg_holder_pool_key;
+
+static atomic_uint_fast64_t rrr_msg_holder_pool_hits = 0;
+static atomic_uint_fast64_t rrr_msg_holder_pool_misses = 0;
+static atomic_uint_fast64_t rrr_msg_holder_pool_frees = 0;
+static atomic_int rrr_msg_holder_pool_enabled = 1;
+
+static void __rrr_msg_holder_pool_push (
+		struct rrr_msg_holder_pool *pool,
+		struct rrr_msg_holder *entry
+) {
+	entry->ptr_prev = NULL;
+	entry->ptr_next = pool->first;
+	pool->first = entry;
+	pool->count++;
+}
+
+static struct rrr_msg_holder *__rrr_msg_holder_pool_pop (
+		struct rrr_msg_holder_pool *pool
+) {
+	struct rrr_msg_holder *entry = pool->first;
+
+	if (entry != NULL) {
+		pool->first = entry->ptr_next;
+		pool->count--;
+		entry->ptr_next = NULL;
+	}
+
+	return entry;
+}
+
+static void __rrr_msg_holder_pool_entry_free (
+		struct rrr_msg_holder *entry
+) {
+	__rrr_msg_holder_util_lock_destroy(entry);
+	RRR_FREE_IF_NOT_NULL(entry->addr);
+	rrr_free(entry);
+	rrr_msg_holder_pool_frees++;
+}
+
+static void __rrr_msg_holder_pool_free_all (
+		struct rrr_msg_holder_pool *pool
+) {
+	struct rrr_msg_holder *entry;
+
+	while ((entry = __rrr_msg_holder_pool_pop(pool)) != NULL) {
+		__rrr_msg_holder_pool_entry_free(entry);
+	}
+}
+
+// Move holders from a local pool to the global pool until the local pool has
+// the given count. Holders not fitting in the global pool are freed.
+static void __rrr_msg_holder_pool_local_flush (
+		struct rrr_msg_holder_pool *local,
+		int count_keep
+) {
+	struct rrr_msg_holder_pool excess = {0};
+	struct rrr_msg_holder *entry;
+
+	pthread_mutex_lock(&rrr_msg_holder_pool_global_lock);
+	while (local->count > count_keep && (entry = __rrr_msg_holder_pool_pop(local)) != NULL) {
+		__rrr_msg_holder_pool_push (
+				rrr_msg_holder_pool_global.count < RRR_MSG_HOLDER_POOL_GLOBAL_MAX
+					? &rrr_msg_holder_pool_global
+					: &excess,
+				entry
+		);
+	}
+	pthread_mutex_unlock(&rrr_msg_holder_pool_global_lock);
+
+	__rrr_msg_holder_pool_free_all(&excess);
+}
+
+static void __rrr_msg_holder_pool_thread_exit (
+		void *arg
+) {
+	struct rrr_msg_holder_pool *local = arg;
+	__rrr_msg_holder_pool_local_flush(local, 0);
+	local->key_is_set = 0;
+}
+
+static void __rrr_msg_holder_pool_key_create (void) {
+	if (pthread_key_create(&rrr_msg_holder_pool_key, __rrr_msg_holder_pool_thread_exit) != 0) {
+		RRR_BUG("BUG: Could not create thread key in __rrr_msg_holder_pool_key_create\n");
+	}
+}
+
+static struct rrr_msg_holder *__rrr_msg_holder_pool_acquire (void) {
+	struct rrr_msg_holder_pool *local = &rrr_msg_holder_pool_local;
+	struct rrr_msg_holder *entry;
+
+	if (!atomic_load_explicit(&rrr_msg_holder_pool_enabled, memory_order_relaxed)) {
+		rrr_msg_holder_pool_misses++;
+		return NULL;
+	}
+
+	if (local->count == 0) {
+		pthread_mutex_lock(&rrr_msg_holder_pool_global_lock);
+		while (local->count < RRR_MSG_HOLDER_POOL_LOCAL_MAX / 2 &&
+		       (entry = __rrr_msg_holder_pool_pop(&rrr_msg_holder_pool_global)) != NULL
+		) {
+			__rrr_msg_holder_pool_push(local, entry);
+		}
+		pthread_mutex_unlock(&rrr_msg_holder_pool_global_lock);
+	}
+
+	if ((entry = __rrr_msg_holder_pool_pop(local)) != NULL) {
+		rrr_msg_holder_pool_hits++;
+	}
+	else {
+		rrr_msg_holder_pool_misses++;
+	}
+
+	return entry;
+}
+
+// Entry must be unlocked and have no users
+static void __rrr_msg_holder_pool_release (
+		struct rrr_msg_holder *entry
+) {
+	struct rrr_msg_holder_pool *local = &rrr_msg_holder_pool_local;
+
+	if (!atomic_load_explicit(&rrr_msg_holder_pool_enabled, memory_order_relaxed)) {
+		__rrr_msg_holder_pool_entry_free(entry);
+		return;
+	}
+
+	// Makes sure the pool is flushed when the thread exits
+	if (!local->key_is_set) {
+		pthread_once(&rrr_msg_holder_pool_key_once, __rrr_msg_holder_pool_key_create);
+		pthread_setspecific(rrr_msg_holder_pool_key, local);
+		local->key_is_set = 1;
+	}
+
+	__rrr_msg_holder_pool_push(local, entry);
+
+	if (local->count > RRR_MSG_HOLDER_POOL_LOCAL_MAX) {
+		__rrr_msg_holder_pool_local_flush(local, RRR_MSG_HOLDER_POOL_LOCAL_MAX / 2);
+	}
+}
+
+// Clear all members except the lock which is kept initialized while
+// pooled and the address storage which is reused
+static void __rrr_msg_holder_pool_entry_reset (
+		struct rrr_msg_holder *entry
+) {
+	const size_t lock_begin = offsetof(struct rrr_msg_holder, lock);
+	const size_t lock_end = lock_begin + sizeof(entry->lock);
+
+	struct sockaddr_storage *addr = entry->addr;
+
+	memset(entry, '\0', lock_begin);
+	memset(((char *) entry) + lock_end, '\0', sizeof(*entry) - lock_end);
+
+	entry->addr = addr;
+}
+
+void rrr_msg_holder_pool_get_stats (
+		struct rrr_msg_holder_pool_stats *stats
+) {
+	stats->total_hits = rrr_msg_holder_pool_hits;
+	stats->total_misses = rrr_msg_holder_pool_misses;
+	stats->total_frees = rrr_msg_holder_pool_frees;
+
+	pthread_mutex_lock(&rrr_msg_holder_pool_global_lock);
+	stats->global_count = (unsigned int) rrr_msg_holder_pool_global.count;
+	pthread_mutex_unlock(&rrr_msg_holder_pool_global_lock);
+}
+
+// Holders already in the pools are kept when disabling until cleanup
+void rrr_msg_holder_pool_set_enabled (
+		int enabled
+) {
+	atomic_store_explicit(&rrr_msg_holder_pool_enabled, enabled != 0, memory_order_relaxed);
+}
+
+// Must be called before rrr_allocator_cleanup. Holders pooled in other threads
+// which are still running are not freed.
+void rrr_msg_holder_pool_cleanup (void) {
+	struct rrr_msg_holder_pool pool = {0};
+
+	__rrr_msg_holder_pool_local_flush(&rrr_msg_holder_pool_local, 0);
+
+	pthread_mutex_lock(&rrr_msg_holder_pool_global_lock);
+	pool = rrr_msg_holder_pool_global;
+	rrr_msg_holder_pool_global.first = NULL;
+	rrr_msg_holder_pool_global.count = 0;
+	pthread_mutex_unlock(&rrr_msg_holder_pool_global_lock);
+
+	__rrr_msg_holder_pool_free_all(&pool);
+}
+
 void rrr_msg_holder_lock (
 		struct rrr_msg_holder *entry
 ) {
@@ -109,6 +338,28 @@ void rrr_msg_holder_unlock_void (
 	rrr_msg_holder_unlock(entry);
 }
 
+// Entry must be locked. Frees or lets go of the message.
+static void __rrr_msg_holder_message_release (
+		struct rrr_msg_holder *entry
+) {
+	if (entry->shared == NULL) {
+		RRR_FREE_IF_NOT_NULL(entry->message);
+		return;
+	}
+
+	if (entry->shared->message != entry->message) {
+		RRR_BUG("BUG: Message of entry differs from shared message in __rrr_msg_holder_message_release\n");
+	}
+
+	if (atomic_fetch_sub(&entry->shared->usercount, 1) == 1) {
+		rrr_free(entry->shared->message);
+		rrr_free(entry->shared);
+	}
+
+	entry->shared = NULL;
+	entry->message = NULL;
+}
+
 void rrr_msg_holder_private_data_clear (
 		struct rrr_msg_holder *entry
 ) {
@@ -141,13 +392,12 @@ void rrr_msg_holder_decref_while_locked_and_unlock (
 		RRR_BUG("BUG: ip buffer entry double destroy\n");
 	}
 	else if (--(entry->usercount) == 0) {
-		RRR_FREE_IF_NOT_NULL(entry->message);
+		__rrr_msg_holder_message_release(entry);
 		rrr_msg_holder_private_data_clear(entry);
 		entry->usercount = 1; // Avoid bug trap
 		rrr_msg_holder_unlock(entry);
-		__rrr_msg_holder_util_lock_destroy(entry);
 		entry->usercount = -1; // Lets us know that destroy has been called
-		rrr_free(entry);
+		__rrr_msg_holder_pool_release(entry);
 	}
 	else {
 		rrr_msg_holder_unlock(entry);
@@ -204,6 +454,39 @@ void rrr_msg_holder_decref_void (
 	rrr_msg_holder_decref(entry);
 }
 
+// Entry must be locked. If addr is NULL, a zeroed address of the given length is set.
+static int __rrr_msg_holder_addr_set (
+		struct rrr_msg_holder *entry,
+		const struct sockaddr *addr,
+		socklen_t addr_len
+) {
+	if (addr_len > sizeof(*(entry->addr))) {
+		RRR_BUG("Address too long (%u > %lu) in __rrr_msg_holder_addr_set\n", addr_len, sizeof(*(entry->addr)));
+	}
+
+	entry->addr_len = 0;
+
+	if (addr_len == 0) {
+		return 0;
+	}
+
+	if (entry->addr == NULL && (entry->addr = rrr_allocate_group(sizeof(*(entry->addr)), RRR_ALLOCATOR_GROUP_MSG_HOLDER)) == NULL) {
+		RRR_MSG_0("Could not allocate memory for address in __rrr_msg_holder_addr_set\n");
+		return 1;
+	}
+
+	if (addr == NULL) {
+		memset(entry->addr, '\0', sizeof(*(entry->addr)));
+	}
+	else {
+		memcpy(entry->addr, addr, addr_len);
+	}
+
+	entry->addr_len = addr_len;
+
+	return 0;
+}
+
 int rrr_msg_holder_new (
 		struct rrr_msg_holder **result,
 		ssize_t data_length,
@@ -216,19 +499,24 @@ int rrr_msg_holder_new (
 
 	*result = NULL;
 
-	struct rrr_msg_holder *entry = rrr_allocate_group(sizeof(*entry), RRR_ALLOCATOR_GROUP_MSG_HOLDER);
-	if (entry == NULL) {
+	struct rrr_msg_holder *entry = __rrr_msg_holder_pool_acquire();
+
+	if (entry != NULL) {
+		__rrr_msg_holder_pool_entry_reset(entry);
+	}
+	else if ((entry = rrr_allocate_group(sizeof(*entry), RRR_ALLOCATOR_GROUP_MSG_HOLDER)) == NULL) {
 		RRR_MSG_0("Could not allocate memory in message_holder_new\n");
 		ret = 1;
 		goto out;
 	}
+	else {
+		memset(entry, '\0', sizeof(*entry));
 
-	memset(entry, '\0', sizeof(*entry));
-
-	if (__rrr_msg_holder_lock_init(entry) != 0) {
-		RRR_MSG_0("Could not initialize lock in rrr_msg_holder_new\n");
-		ret = 1;
-		goto out_free;
+		if (__rrr_msg_holder_lock_init(entry) != 0) {
+			RRR_MSG_0("Could not initialize lock in rrr_msg_holder_new\n");
+			ret = 1;
+			goto out_free;
+		}
 	}
 
 	// Avoid usercount bug trap, write once again while holding the lock below
@@ -238,20 +526,13 @@ int rrr_msg_holder_new (
 
 	RRR_LL_NODE_INIT(entry);
 
-	if (addr == NULL) {
-		memset(&entry->addr, '\0', sizeof(entry->addr));
-	}
-	else if (addr_len > sizeof(entry->addr)) {
-		RRR_BUG("Address too long (%u > %lu) in rrr_msg_holder_new\n", addr_len, sizeof(entry->addr));
-	}
-	else {
-		memcpy(&entry->addr, addr, addr_len);
-	}
-
-	if (addr_len > sizeof(entry->addr)) {
-		RRR_BUG("addr_len too long in message_holder_new\n");
+	if (__rrr_msg_holder_addr_set(entry, addr, addr_len) != 0) {
+		rrr_msg_holder_unlock(entry);
+		entry->usercount = -1;
+		__rrr_msg_holder_pool_release(entry);
+		ret = 1;
+		goto out;
 	}
-	entry->addr_len = addr_len;
 
 	entry->send_time = 0;
 	entry->message = message;
@@ -280,7 +561,7 @@ int rrr_msg_holder_clone_no_data (
 	int ret = rrr_msg_holder_new (
 			result,
 			0,
-			(struct sockaddr *) &source->addr,
+			(source->addr_len > 0 ? (const struct sockaddr *) source->addr : NULL),
 			source->addr_len,
 			source->protocol,
 			NULL
@@ -301,12 +582,12 @@ void rrr_msg_holder_set_data_unlocked (
 		void *message,
 		ssize_t message_data_length
 ) {
-	RRR_FREE_IF_NOT_NULL(target->message);
+	__rrr_msg_holder_message_release(target);
 	target->message = message;
 	target->data_length = message_data_length;
 }
 
-void rrr_msg_holder_set_unlocked (
+int rrr_msg_holder_set_unlocked (
 		struct rrr_msg_holder *target,
 		void *message,
 		ssize_t message_data_length,
@@ -314,10 +595,107 @@ void rrr_msg_holder_set_unlocked (
 		socklen_t addr_len,
 		int protocol
 ) {
+	if (__rrr_msg_holder_addr_set(target, addr, addr_len) != 0) {
+		return 1;
+	}
 	rrr_msg_holder_set_data_unlocked (target, message, message_data_length);
-	memcpy(&target->addr, addr, addr_len);
-	target->addr_len = addr_len;
 	target->protocol = protocol;
+	return 0;
+}
+
+// Source must be locked. The new entry refers to the same message as the
+// source, neither of them may modify the message without making it writable.
+int rrr_msg_holder_clone_shared (
+		struct rrr_msg_holder **result,
+		struct rrr_msg_holder *source
+) {
+	int ret = 0;
+
+	*result = NULL;
+
+	struct rrr_msg_holder *entry = NULL;
+
+	if (source->message == NULL) {
+		RRR_BUG("BUG: Source message was NULL in rrr_msg_holder_clone_shared\n");
+	}
+
+	if (source->shared == NULL) {
+		struct rrr_msg_holder_shared *shared = rrr_allocate(sizeof(*shared));
+		if (shared == NULL) {
+			RRR_MSG_0("Could not allocate memory in rrr_msg_holder_clone_shared\n");
+			ret = 1;
+			goto out;
+		}
+
+		atomic_init(&shared->usercount, 1);
+		shared->message = source->message;
+		source->shared = shared;
+	}
+
+	if ((ret = rrr_msg_holder_clone_no_data(&entry, source)) != 0) {
+		goto out;
+	}
+
+	atomic_fetch_add(&source->shared->usercount, 1);
+
+	rrr_msg_holder_lock(entry);
+	entry->shared = source->shared;
+	entry->message = source->message;
+	entry->data_length = source->data_length;
+	rrr_msg_holder_unlock(entry);
+
+	*result = entry;
+
+	out:
+	return ret;
+}
+
+// Entry must be locked. If the message is shared with other entries, this entry
+// gets its own copy. If we are the last user, the message is taken over without
+// copying.
+int rrr_msg_holder_message_make_writable (
+		int *did_copy,
+		struct rrr_msg_holder *entry
+) {
+	int ret = 0;
+
+	*did_copy = 0;
+
+	struct rrr_msg_holder_shared *shared = entry->shared;
+
+	if (shared == NULL) {
+		goto out;
+	}
+
+	if (atomic_load(&shared->usercount) == 1) {
+		// No other entries may refer to the shared message, the count cannot increase
+		rrr_free(shared);
+		entry->shared = NULL;
+		goto out;
+	}
+
+	void *message_new = rrr_allocate(entry->data_length);
+	if (message_new == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_msg_holder_message_make_writable\n");
+		ret = 1;
+		goto out;
+	}
+
+	memcpy(message_new, entry->message, entry->data_length);
+
+	__rrr_msg_holder_message_release(entry);
+
+	entry->message = message_new;
+	*did_copy = 1;
+
+	out:
+	return ret;
+}
+
+int rrr_msg_holder_message_is_shared (
+		const struct rrr_msg_holder *entry
+) {
+	return entry->shared != NULL;
 }
 
 int rrr_msg_holder_address_matches (
@@ -325,7 +703,7 @@ int rrr_msg_holder_address_matches (
 		const struct rrr_msg_holder *b
 ) {
 	if (	 a->addr_len == b->addr_len &&
-			(a->addr_len == 0 || memcmp(&a->addr, &b->addr, a->addr_len) == 0) &&
+			(a->addr_len == 0 || memcmp(a->addr, b->addr, a->addr_len) == 0) &&
 			 a->protocol == b->protocol
 	) {
 		return 1;
@@ -27,6 +27,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 struct rrr_msg_holder;
 
+struct rrr_msg_holder_pool_stats {
+	uint64_t total_hits;
+	uint64_t total_misses;
+	uint64_t total_frees;
+	unsigned int global_count;
+};
+
+void rrr_msg_holder_pool_get_stats (
+		struct rrr_msg_holder_pool_stats *stats
+);
+void rrr_msg_holder_pool_set_enabled (
+		int enabled
+);
+void rrr_msg_holder_pool_cleanup (void);
+
 void rrr_msg_holder_lock (
 		struct rrr_msg_holder *entry
 );
@@ -82,7 +97,7 @@ void rrr_msg_holder_set_data_unlocked (
 		void *message,
 		ssize_t message_data_length
 );
-void rrr_msg_holder_set_unlocked (
+int rrr_msg_holder_set_unlocked (
 		struct rrr_msg_holder *target,
 		void *message,
 		ssize_t message_data_length,
@@ -90,6 +105,17 @@ void rrr_msg_holder_set_unlocked (
 		socklen_t addr_len,
 		int protocol
 );
+int rrr_msg_holder_clone_shared (
+		struct rrr_msg_holder **result,
+		struct rrr_msg_holder *source
+);
+int rrr_msg_holder_message_make_writable (
+		int *did_copy,
+		struct rrr_msg_holder *entry
+);
+int rrr_msg_holder_message_is_shared (
+		const struct rrr_msg_holder *entry
+);
 int rrr_msg_holder_address_matches (
 		const struct rrr_msg_holder *a,
 		const struct rrr_msg_holder *b
@@ -0,0 +1,352 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../log.h"
+#include "../allocator.h"
+#include "../rrr_strerror.h"
+#include "../socket/rrr_socket.h"
+#include "../util/gnu.h"
+#include "../util/linked_list.h"
+#include "../util/macro_utils.h"
+#include "message_holder_spill.h"
+#include "message_holder_struct.h"
+
+struct rrr_msg_holder_spill_record_header {
+	uint32_t data_size;
+	uint32_t addr_len;
+	int32_t protocol;
+	uint32_t reserved;
+};
+
+#define RRR_MSG_HOLDER_SPILL_ALIGN(size) \
+	(((size) + 7) & ~((size_t) 7))
+
+#define RRR_MSG_HOLDER_SPILL_RECORD_SIZE(data_size, addr_len) \
+	RRR_MSG_HOLDER_SPILL_ALIGN(sizeof(struct rrr_msg_holder_spill_record_header) + (addr_len) + (data_size))
+
+/*
+ * Segments are only mapped while being written to or read from, full segments
+ * waiting to be read are left to the page cache.
+ */
+struct rrr_msg_holder_spill_segment {
+	RRR_LL_NODE(struct rrr_msg_holder_spill_segment);
+	int fd;
+	char *map;
+	size_t size;
+	size_t write_pos;
+	size_t read_pos;
+};
+
+struct rrr_msg_holder_spill {
+	RRR_LL_HEAD(struct rrr_msg_holder_spill_segment);
+	char *filename_template;
+	size_t segment_size;
+	uint64_t entry_count;
+	struct rrr_msg_holder_spill_stats stats;
+};
+
+static int __rrr_msg_holder_spill_segment_map (
+		struct rrr_msg_holder_spill_segment *segment
+) {
+	if (segment->map != NULL) {
+		return 0;
+	}
+
+	void *map = mmap(NULL, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+	if (map == MAP_FAILED) {
+		RRR_MSG_0("Failed to map spill segment of size %llu: %s\n",
+				(unsigned long long) segment->size, rrr_strerror(errno));
+		return 1;
+	}
+
+	segment->map = map;
+
+	return 0;
+}
+
+static void __rrr_msg_holder_spill_segment_unmap (
+		struct rrr_msg_holder_spill_segment *segment
+) {
+	if (segment->map == NULL) {
+		return;
+	}
+	munmap(segment->map, segment->size);
+	segment->map = NULL;
+}
+
+static void __rrr_msg_holder_spill_segment_destroy (
+		struct rrr_msg_holder_spill_segment *segment
+) {
+	__rrr_msg_holder_spill_segment_unmap(segment);
+	rrr_socket_close_no_unlink(segment->fd);
+	rrr_free(segment);
+}
+
+static int __rrr_msg_holder_spill_segment_new (
+		struct rrr_msg_holder_spill *spill,
+		size_t size
+) {
+	int ret = 0;
+
+	char *filename = NULL;
+	struct rrr_msg_holder_spill_segment *segment = NULL;
+
+	if ((filename = rrr_strdup(spill->filename_template)) == NULL) {
+		RRR_MSG_0("Could not allocate memory for filename in __rrr_msg_holder_spill_segment_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((segment = rrr_allocate(sizeof(*segment))) == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_msg_holder_spill_segment_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(segment, '\0', sizeof(*segment));
+
+	if ((segment->fd = rrr_socket_mkstemp(filename, "msg_holder_spill")) < 0) {
+		RRR_MSG_0("Failed to create spill file '%s': %s\n", filename, rrr_strerror(errno));
+		ret = 1;
+		goto out_free;
+	}
+
+	// Nobody else needs the file, space is freed when it is closed
+	unlink(filename);
+
+	if (ftruncate(segment->fd, (off_t) size) != 0) {
+		RRR_MSG_0("Failed to set size of spill file '%s' to %llu: %s\n",
+				filename, (unsigned long long) size, rrr_strerror(errno));
+		ret = 1;
+		goto out_close;
+	}
+
+	segment->size = size;
+
+	if ((ret = __rrr_msg_holder_spill_segment_map(segment)) != 0) {
+		goto out_close;
+	}
+
+	RRR_DBG_3("Message holder spill created segment of size %llu from template %s\n",
+			(unsigned long long) size, spill->filename_template);
+
+	RRR_LL_APPEND(spill, segment);
+	spill->stats.total_segments++;
+	spill->stats.bytes_in_use += size;
+	segment = NULL;
+
+	goto out;
+	out_close:
+		rrr_socket_close_no_unlink(segment->fd);
+	out_free:
+		rrr_free(segment);
+	out:
+		RRR_FREE_IF_NOT_NULL(filename);
+		return ret;
+}
+
+int rrr_msg_holder_spill_new (
+		struct rrr_msg_holder_spill **target,
+		const char *directory,
+		const char *name,
+		size_t segment_size
+) {
+	int ret = 0;
+
+	*target = NULL;
+
+	struct rrr_msg_holder_spill *spill = rrr_allocate(sizeof(*spill));
+	if (spill == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_msg_holder_spill_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(spill, '\0', sizeof(*spill));
+
+	if (rrr_asprintf(&spill->filename_template, "%s/rrr-spill-%s-XXXXXX", directory, name) <= 0) {
+		RRR_MSG_0("Could not allocate memory for filename template in rrr_msg_holder_spill_new\n");
+		ret = 1;
+		goto out_free;
+	}
+
+	spill->segment_size = RRR_MSG_HOLDER_SPILL_ALIGN(segment_size);
+
+	*target = spill;
+
+	goto out;
+	out_free:
+		rrr_free(spill);
+	out:
+		return ret;
+}
+
+void rrr_msg_holder_spill_destroy (
+		struct rrr_msg_holder_spill *spill
+) {
+	RRR_LL_DESTROY(spill, struct rrr_msg_holder_spill_segment, __rrr_msg_holder_spill_segment_destroy(node));
+	rrr_free(spill->filename_template);
+	rrr_free(spill);
+}
+
+uint64_t rrr_msg_holder_spill_count (
+		const struct rrr_msg_holder_spill *spill
+) {
+	return spill->entry_count;
+}
+
+void rrr_msg_holder_spill_get_stats (
+		struct rrr_msg_holder_spill_stats *target,
+		const struct rrr_msg_holder_spill *spill
+) {
+	*target = spill->stats;
+}
+
+// Entry must be locked by caller
+int rrr_msg_holder_spill_write (
+		struct rrr_msg_holder_spill *spill,
+		const struct rrr_msg_holder *entry
+) {
+	int ret = 0;
+
+	if (entry->data_length < 0 || (uint64_t) entry->data_length > UINT32_MAX) {
+		RRR_BUG("BUG: Invalid data length %lli in rrr_msg_holder_spill_write\n", (long long int) entry->data_length);
+	}
+
+	const size_t data_size = (size_t) entry->data_length;
+	const size_t record_size = RRR_MSG_HOLDER_SPILL_RECORD_SIZE(data_size, entry->addr_len);
+
+	struct rrr_msg_holder_spill_segment *segment = RRR_LL_LAST(spill);
+
+	if (segment == NULL || segment->size - segment->write_pos < record_size) {
+		if (segment != NULL && segment != RRR_LL_FIRST(spill)) {
+			__rrr_msg_holder_spill_segment_unmap(segment);
+		}
+		if ((ret = __rrr_msg_holder_spill_segment_new (
+				spill,
+				record_size > spill->segment_size ? record_size : spill->segment_size
+		)) != 0) {
+			goto out;
+		}
+		segment = RRR_LL_LAST(spill);
+	}
+
+	struct rrr_msg_holder_spill_record_header header = {
+		(uint32_t) data_size,
+		(uint32_t) entry->addr_len,
+		(int32_t) entry->protocol,
+		0
+	};
+
+	char *pos = segment->map + segment->write_pos;
+
+	memcpy(pos, &header, sizeof(header));
+	pos += sizeof(header);
+
+	if (entry->addr_len > 0) {
+		memcpy(pos, entry->addr, entry->addr_len);
+		pos += entry->addr_len;
+	}
+
+	memcpy(pos, entry->message, data_size);
+
+	segment->write_pos += record_size;
+	spill->entry_count++;
+	spill->stats.total_written++;
+
+	out:
+	return ret;
+}
+
+// Reading stops when the callback returns non-zero, the record is
+// then kept and read again in the next round
+int rrr_msg_holder_spill_read (
+		struct rrr_msg_holder_spill *spill,
+		unsigned int max_entries,
+		int (*callback)(const void *data, size_t data_size, const struct sockaddr *addr, socklen_t addr_len, int protocol, void *arg),
+		void *callback_arg
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder_spill_segment *segment;
+
+	for (unsigned int i = 0; i < max_entries && (segment = RRR_LL_FIRST(spill)) != NULL; i++) {
+		if (segment->read_pos == segment->write_pos) {
+			if (segment == RRR_LL_LAST(spill)) {
+				// Everything is read, start over in the same segment
+				segment->read_pos = 0;
+				segment->write_pos = 0;
+				break;
+			}
+
+			segment = RRR_LL_SHIFT(spill);
+			spill->stats.bytes_in_use -= segment->size;
+			__rrr_msg_holder_spill_segment_destroy(segment);
+
+			if ((segment = RRR_LL_FIRST(spill)) == NULL) {
+				break;
+			}
+		}
+
+		if ((ret = __rrr_msg_holder_spill_segment_map(segment)) != 0) {
+			goto out;
+		}
+
+		const char *pos = segment->map + segment->read_pos;
+
+		struct rrr_msg_holder_spill_record_header header;
+		memcpy(&header, pos, sizeof(header));
+		pos += sizeof(header);
+
+		struct sockaddr_storage addr;
+		if (header.addr_len > sizeof(addr)) {
+			RRR_BUG("BUG: Invalid address length %" PRIu32 " in rrr_msg_holder_spill_read\n", header.addr_len);
+		}
+		memcpy(&addr, pos, header.addr_len);
+		pos += header.addr_len;
+
+		if ((ret = callback (
+				pos,
+				header.data_size,
+				(const struct sockaddr *) &addr,
+				(socklen_t) header.addr_len,
+				header.protocol,
+				callback_arg
+		)) != 0) {
+			goto out;
+		}
+
+		segment->read_pos += RRR_MSG_HOLDER_SPILL_RECORD_SIZE(header.data_size, header.addr_len);
+		spill->entry_count--;
+		spill->stats.total_read++;
+	}
+
+	out:
+	return ret;
+}
@@ -0,0 +1,75 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_MESSAGE_HOLDER_SPILL_H
+#define RRR_MESSAGE_HOLDER_SPILL_H
+
+#include <sys/socket.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define RRR_MSG_HOLDER_SPILL_DEFAULT_SEGMENT_SIZE (16 * 1024 * 1024)
+
+/*
+ * A spill queue stores message data with address and protocol in memory
+ * mapped segment files, entries are read back in the order they were written.
+ * The files are unlinked as soon as they are created and disappear when the
+ * queue is destroyed or the program stops. Not thread safe.
+ */
+
+struct rrr_msg_holder;
+struct rrr_msg_holder_spill;
+
+struct rrr_msg_holder_spill_stats {
+	uint64_t total_written;
+	uint64_t total_read;
+	uint64_t total_segments;
+	uint64_t bytes_in_use;
+};
+
+int rrr_msg_holder_spill_new (
+		struct rrr_msg_holder_spill **target,
+		const char *directory,
+		const char *name,
+		size_t segment_size
+);
+void rrr_msg_holder_spill_destroy (
+		struct rrr_msg_holder_spill *spill
+);
+uint64_t rrr_msg_holder_spill_count (
+		const struct rrr_msg_holder_spill *spill
+);
+void rrr_msg_holder_spill_get_stats (
+		struct rrr_msg_holder_spill_stats *target,
+		const struct rrr_msg_holder_spill *spill
+);
+int rrr_msg_holder_spill_write (
+		struct rrr_msg_holder_spill *spill,
+		const struct rrr_msg_holder *entry
+);
+int rrr_msg_holder_spill_read (
+		struct rrr_msg_holder_spill *spill,
+		unsigned int max_entries,
+		int (*callback)(const void *data, size_t data_size, const struct sockaddr *addr, socklen_t addr_len, int protocol, void *arg),
+		void *callback_arg
+);
+
+#endif /* RRR_MESSAGE_HOLDER_SPILL_H */
@@ -32,31 +32,48 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //#define RRR_MESSAGE_HOLDER_DEBUG_REFCOUNT
 //#define RRR_MESSAGE_HOLDER_DEBUG_LOCK_RECURSION
 
+struct rrr_msg_holder_shared;
+
+/*
+ * Members used for every message are placed first to keep them within the
+ * first cache line. The address is stored out of line as most messages
+ * never have one.
+ */
 struct rrr_msg_holder {
 	RRR_LL_NODE(struct rrr_msg_holder);
-	pthread_mutex_t lock;
-#ifdef RRR_MESSAGE_HOLDER_DEBUG_LOCK_RECURSION
-	int lock_recursion_count;
-#endif
 	int usercount;
-	ssize_t data_length;
-	struct sockaddr_storage addr;
 	socklen_t addr_len;
-	int protocol;
-	const void *source;
+	ssize_t data_length;
 	void *message;
 
+	// Set when message is shared with other entries. The message
+	// must then not be modified, see rrr_msg_holder_message_make_writable
+	struct rrr_msg_holder_shared *shared;
+
 	// Message broker updates this on writes to buffer
 	uint64_t buffer_time;
 
-	// Available for modules
-	uint64_t send_time;
+	// Position in the write-ahead log of the buffer, zero if not logged
+	uint64_t wal_seq;
 
-	// Used by higher levels to control partial sends
-	ssize_t bytes_sent;
-	ssize_t bytes_to_send;
+	const void *source;
+
+	pthread_mutex_t lock;
+#ifdef RRR_MESSAGE_HOLDER_DEBUG_LOCK_RECURSION
+	int lock_recursion_count;
+#endif
+	int protocol;
+
+	// Available for modules
 	int endian_indicator;
 
+	// Only valid when addr_len is not zero. The storage is kept when the
+	// address is cleared and when the holder is reused.
+	struct sockaddr_storage *addr;
+
+	// Available for modules
+	uint64_t send_time;
+
 	// Available for modules
 	void *private_data;
 	void (*private_data_destroy)(void *private_data);
@@ -93,7 +93,7 @@ int rrr_msg_holder_util_clone_no_locking (
 	int ret = rrr_msg_holder_util_new_with_empty_message (
 			result,
 			message_data_length,
-			(struct sockaddr *) &source->addr,
+			(struct sockaddr *) source->addr,
 			source->addr_len,
 			source->protocol
 	);
@@ -0,0 +1,754 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../log.h"
+#include "../allocator.h"
+#include "../rrr_strerror.h"
+#include "../util/crc32.h"
+#include "../util/gnu.h"
+#include "../util/linked_list.h"
+#include "../util/macro_utils.h"
+#include "../util/posix.h"
+#include "../util/readfile.h"
+#include "../util/rrr_readdir.h"
+#include "../util/rrr_time.h"
+#include "message_holder_wal.h"
+#include "message_holder.h"
+#include "message_holder_struct.h"
+#include "message_holder_collection.h"
+
+#define RRR_MSG_HOLDER_WAL_MAGIC          0x52574c31 // RWL1
+#define RRR_MSG_HOLDER_WAL_SYNC_FDS_MAX   16
+
+// The checksum covers everything in the record after the checksum field
+struct rrr_msg_holder_wal_record_header {
+	uint32_t magic;
+	uint32_t crc32;
+	uint64_t seq;
+	uint32_t data_size;
+	uint32_t addr_len;
+	int32_t protocol;
+	uint32_t reserved;
+};
+
+#define RRR_MSG_HOLDER_WAL_ALIGN(size) \
+	(((size) + 7) & ~((size_t) 7))
+
+#define RRR_MSG_HOLDER_WAL_RECORD_SIZE(data_size, addr_len) \
+	RRR_MSG_HOLDER_WAL_ALIGN(sizeof(struct rrr_msg_holder_wal_record_header) + (addr_len) + (data_size))
+
+#define RRR_MSG_HOLDER_WAL_CRC_OFFSET \
+	(offsetof(struct rrr_msg_holder_wal_record_header, crc32) + sizeof(uint32_t))
+
+/*
+ * Only the last segment is written to. Older segments keep their file open
+ * until they are deleted so that they can still be synced, segments from a
+ * previous run have no open file.
+ */
+struct rrr_msg_holder_wal_segment {
+	RRR_LL_NODE(struct rrr_msg_holder_wal_segment);
+	char *path;
+	int fd;
+	int needs_sync;
+	size_t size;
+	uint64_t first_seq;
+	uint64_t last_seq;
+	uint64_t outstanding;
+};
+
+struct rrr_msg_holder_wal_segment_collection {
+	RRR_LL_HEAD(struct rrr_msg_holder_wal_segment);
+};
+
+/*
+ * The lock protects everything but the sync thread members. Files are synced
+ * without holding the lock, the sync lock must then be held to prevent the
+ * files from being closed. Lock order is sync lock first.
+ */
+struct rrr_msg_holder_wal {
+	struct rrr_msg_holder_wal_segment_collection segments;
+	pthread_mutex_t lock;
+	pthread_mutex_t sync_lock;
+	pthread_cond_t sync_cond;
+	pthread_t sync_thread;
+	int sync_thread_started;
+	int sync_thread_stop;
+	char *directory;
+	char *name;
+	size_t segment_size;
+	uint64_t sync_interval_us;
+	uint64_t seq;
+	char *buf;
+	size_t buf_size;
+	size_t buf_pos;
+	struct rrr_msg_holder_wal_stats stats;
+};
+
+static int __rrr_msg_holder_wal_segment_destroy (
+		struct rrr_msg_holder_wal_segment *segment
+) {
+	if (segment->fd >= 0) {
+		close(segment->fd);
+	}
+	rrr_free(segment->path);
+	rrr_free(segment);
+	return 0;
+}
+
+static int __rrr_msg_holder_wal_segment_new (
+		struct rrr_msg_holder_wal_segment **target,
+		const char *directory,
+		const char *name,
+		uint64_t first_seq
+) {
+	int ret = 0;
+
+	*target = NULL;
+
+	struct rrr_msg_holder_wal_segment *segment = NULL;
+
+	if ((segment = rrr_allocate(sizeof(*segment))) == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_msg_holder_wal_segment_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(segment, '\0', sizeof(*segment));
+
+	segment->fd = -1;
+	segment->first_seq = first_seq;
+	segment->last_seq = first_seq - 1;
+
+	if (rrr_asprintf(&segment->path, "%s/rrr-wal-%s-%016" PRIx64 ".wal", directory, name, first_seq) <= 0) {
+		RRR_MSG_0("Could not allocate memory for path in __rrr_msg_holder_wal_segment_new\n");
+		ret = 1;
+		goto out_free;
+	}
+
+	*target = segment;
+
+	goto out;
+	out_free:
+		rrr_free(segment);
+	out:
+		return ret;
+}
+
+static int __rrr_msg_holder_wal_segment_open_new (
+		struct rrr_msg_holder_wal *wal
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder_wal_segment *segment = NULL;
+
+	if ((ret = __rrr_msg_holder_wal_segment_new (&segment, wal->directory, wal->name, wal->seq + 1)) != 0) {
+		goto out;
+	}
+
+	if ((segment->fd = open(segment->path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600)) < 0) {
+		RRR_MSG_0("Failed to create write-ahead log segment '%s': %s\n", segment->path, rrr_strerror(errno));
+		ret = 1;
+		goto out_destroy;
+	}
+
+	RRR_DBG_3("Write-ahead log %s created segment %s\n", wal->name, segment->path);
+
+	RRR_LL_APPEND(&wal->segments, segment);
+	wal->stats.segments++;
+
+	goto out;
+	out_destroy:
+		__rrr_msg_holder_wal_segment_destroy(segment);
+	out:
+		return ret;
+}
+
+// Records after a broken record, like one being written when the program
+// stopped, are ignored
+static int __rrr_msg_holder_wal_replay_segment (
+		struct rrr_msg_holder_wal *wal,
+		struct rrr_msg_holder_collection *replayed,
+		struct rrr_msg_holder_wal_segment *segment
+) {
+	int ret = 0;
+
+	char *data = NULL;
+	rrr_biglength data_size = 0;
+	size_t pos = 0;
+
+	if ((ret = rrr_readfile_read(&data, &data_size, segment->path, 0, 0)) != 0) {
+		RRR_MSG_0("Failed to read write-ahead log segment '%s'\n", segment->path);
+		goto out;
+	}
+
+	while (pos + sizeof(struct rrr_msg_holder_wal_record_header) <= data_size) {
+		struct rrr_msg_holder_wal_record_header header;
+		memcpy(&header, data + pos, sizeof(header));
+
+		if (header.magic != RRR_MSG_HOLDER_WAL_MAGIC ||
+		    header.addr_len > sizeof(struct sockaddr_storage) ||
+		    RRR_MSG_HOLDER_WAL_RECORD_SIZE((size_t) header.data_size, header.addr_len) > data_size - pos ||
+		    rrr_crc32cmp (
+				data + pos + RRR_MSG_HOLDER_WAL_CRC_OFFSET,
+				sizeof(header) - RRR_MSG_HOLDER_WAL_CRC_OFFSET + header.addr_len + header.data_size,
+				header.crc32
+		    ) != 0
+		) {
+			RRR_MSG_0("Warning: Broken record at position %llu in write-ahead log segment '%s', ignoring the rest of the segment\n",
+					(unsigned long long) pos, segment->path);
+			break;
+		}
+
+		const char *addr = data + pos + sizeof(header);
+		const char *message_data = addr + header.addr_len;
+		void *message = NULL;
+		struct rrr_msg_holder *entry = NULL;
+
+		if ((message = rrr_allocate(header.data_size > 0 ? header.data_size : 1)) == NULL) {
+			RRR_MSG_0("Could not allocate memory for message in __rrr_msg_holder_wal_replay_segment\n");
+			ret = 1;
+			goto out;
+		}
+
+		memcpy(message, message_data, header.data_size);
+
+		if ((ret = rrr_msg_holder_new (
+				&entry,
+				(ssize_t) header.data_size,
+				header.addr_len > 0 ? (const struct sockaddr *) addr : NULL,
+				(socklen_t) header.addr_len,
+				header.protocol,
+				message
+		)) != 0) {
+			rrr_free(message);
+			goto out;
+		}
+
+		entry->wal_seq = header.seq;
+		RRR_LL_APPEND(replayed, entry);
+
+		if (segment->outstanding++ == 0) {
+			segment->first_seq = header.seq;
+		}
+		segment->last_seq = header.seq;
+
+		if (header.seq > wal->seq) {
+			wal->seq = header.seq;
+		}
+
+		wal->stats.total_replayed++;
+
+		pos += RRR_MSG_HOLDER_WAL_RECORD_SIZE((size_t) header.data_size, header.addr_len);
+	}
+
+	RRR_DBG_1("Write-ahead log %s replayed %" PRIu64 " entries from segment %s\n",
+			wal->name, segment->outstanding, segment->path);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(data);
+	return ret;
+}
+
+struct rrr_msg_holder_wal_replay_readdir_callback_data {
+	struct rrr_msg_holder_wal *wal;
+	struct rrr_msg_holder_wal_segment_collection *segments;
+	size_t prefix_length;
+};
+
+static int __rrr_msg_holder_wal_replay_readdir_callback (
+		struct dirent *entry,
+		const char *orig_path,
+		const char *resolved_path,
+		unsigned char type,
+		void *private_data
+) {
+	struct rrr_msg_holder_wal_replay_readdir_callback_data *callback_data = private_data;
+
+	(void)(orig_path);
+	(void)(resolved_path);
+
+	int ret = 0;
+
+	struct rrr_msg_holder_wal_segment *segment = NULL;
+	const char *seq_str = entry->d_name + callback_data->prefix_length;
+	uint64_t seq = 0;
+	char *end = NULL;
+
+	if (type != DT_REG || strlen(seq_str) != 16 + strlen(".wal") || strcmp(seq_str + 16, ".wal") != 0) {
+		goto out;
+	}
+
+	seq = strtoull(seq_str, &end, 16);
+	if (end != seq_str + 16) {
+		goto out;
+	}
+
+	if ((ret = __rrr_msg_holder_wal_segment_new (
+			&segment,
+			callback_data->wal->directory,
+			callback_data->wal->name,
+			seq
+	)) != 0) {
+		goto out;
+	}
+
+	// Keep ordered by sequence number
+	RRR_LL_ITERATE_BEGIN(callback_data->segments, struct rrr_msg_holder_wal_segment);
+		if (node->first_seq > seq) {
+			RRR_LL_ITERATE_INSERT(callback_data->segments, segment);
+			segment = NULL;
+			RRR_LL_ITERATE_LAST();
+		}
+	RRR_LL_ITERATE_END();
+
+	if (segment != NULL) {
+		RRR_LL_APPEND(callback_data->segments, segment);
+	}
+
+	out:
+	return ret;
+}
+
+static int __rrr_msg_holder_wal_replay (
+		struct rrr_msg_holder_wal *wal,
+		struct rrr_msg_holder_collection *replayed
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder_wal_segment_collection segments = {0};
+	char *prefix = NULL;
+
+	if (rrr_asprintf(&prefix, "rrr-wal-%s-", wal->name) <= 0) {
+		RRR_MSG_0("Could not allocate memory for prefix in __rrr_msg_holder_wal_replay\n");
+		ret = 1;
+		goto out;
+	}
+
+	struct rrr_msg_holder_wal_replay_readdir_callback_data callback_data = {
+		wal,
+		&segments,
+		strlen(prefix)
+	};
+
+	if ((ret = rrr_readdir_foreach_prefix (
+			wal->directory,
+			prefix,
+			__rrr_msg_holder_wal_replay_readdir_callback,
+			&callback_data
+	)) != 0) {
+		goto out;
+	}
+
+	RRR_LL_ITERATE_BEGIN(&segments, struct rrr_msg_holder_wal_segment);
+		if ((ret = __rrr_msg_holder_wal_replay_segment(wal, replayed, node)) != 0) {
+			goto out;
+		}
+		if (node->outstanding == 0) {
+			unlink(node->path);
+			RRR_LL_ITERATE_SET_DESTROY();
+		}
+	RRR_LL_ITERATE_END_CHECK_DESTROY(&segments, __rrr_msg_holder_wal_segment_destroy(node));
+
+	wal->stats.segments += (uint64_t) RRR_LL_COUNT(&segments);
+	RRR_LL_MERGE_AND_CLEAR_SOURCE_HEAD(&wal->segments, &segments);
+
+	out:
+	RRR_LL_DESTROY(&segments, struct rrr_msg_holder_wal_segment, __rrr_msg_holder_wal_segment_destroy(node));
+	RRR_FREE_IF_NOT_NULL(prefix);
+	return ret;
+}
+
+static int __rrr_msg_holder_wal_sync (
+		struct rrr_msg_holder_wal *wal
+) {
+	int ret = 0;
+
+	int fds[RRR_MSG_HOLDER_WAL_SYNC_FDS_MAX];
+	int fd_count;
+
+	pthread_mutex_lock(&wal->sync_lock);
+
+	do {
+		fd_count = 0;
+
+		pthread_mutex_lock(&wal->lock);
+		RRR_LL_ITERATE_BEGIN(&wal->segments, struct rrr_msg_holder_wal_segment);
+			if (node->needs_sync) {
+				node->needs_sync = 0;
+				fds[fd_count++] = node->fd;
+				if (fd_count == RRR_MSG_HOLDER_WAL_SYNC_FDS_MAX) {
+					RRR_LL_ITERATE_LAST();
+				}
+			}
+		RRR_LL_ITERATE_END();
+		if (fd_count > 0) {
+			wal->stats.total_syncs++;
+		}
+		pthread_mutex_unlock(&wal->lock);
+
+		for (int i = 0; i < fd_count; i++) {
+			if (fdatasync(fds[i]) != 0) {
+				RRR_MSG_0("Failed to sync write-ahead log %s: %s\n", wal->name, rrr_strerror(errno));
+				ret = 1;
+				goto out;
+			}
+		}
+	} while (fd_count == RRR_MSG_HOLDER_WAL_SYNC_FDS_MAX);
+
+	out:
+	pthread_mutex_unlock(&wal->sync_lock);
+	return ret;
+}
+
+static void *__rrr_msg_holder_wal_sync_thread (
+		void *arg
+) {
+	struct rrr_msg_holder_wal *wal = arg;
+
+	pthread_mutex_lock(&wal->lock);
+	while (!wal->sync_thread_stop) {
+		struct timespec wakeup_time;
+		rrr_time_gettimeofday_timespec(&wakeup_time, wal->sync_interval_us);
+		pthread_cond_timedwait(&wal->sync_cond, &wal->lock, &wakeup_time);
+
+		if (wal->sync_thread_stop) {
+			break;
+		}
+
+		pthread_mutex_unlock(&wal->lock);
+		// Errors are printed, writers will notice on the next sync failure if any
+		__rrr_msg_holder_wal_sync(wal);
+		pthread_mutex_lock(&wal->lock);
+	}
+	pthread_mutex_unlock(&wal->lock);
+
+	return NULL;
+}
+
+int rrr_msg_holder_wal_new (
+		struct rrr_msg_holder_wal **target,
+		struct rrr_msg_holder_collection *replayed,
+		const char *directory,
+		const char *name,
+		size_t segment_size,
+		uint64_t sync_interval_us
+) {
+	int ret = 0;
+
+	*target = NULL;
+
+	struct rrr_msg_holder_wal *wal = rrr_allocate(sizeof(*wal));
+	if (wal == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_msg_holder_wal_new\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(wal, '\0', sizeof(*wal));
+
+	if ((wal->directory = rrr_strdup(directory)) == NULL || (wal->name = rrr_strdup(name)) == NULL) {
+		RRR_MSG_0("Could not allocate memory for names in rrr_msg_holder_wal_new\n");
+		ret = 1;
+		goto out_free;
+	}
+
+	if ((ret = rrr_posix_mutex_init(&wal->lock, 0)) != 0) {
+		RRR_MSG_0("Could not initialize mutex A in rrr_msg_holder_wal_new\n");
+		goto out_free;
+	}
+
+	if ((ret = rrr_posix_mutex_init(&wal->sync_lock, 0)) != 0) {
+		RRR_MSG_0("Could not initialize mutex B in rrr_msg_holder_wal_new\n");
+		goto out_destroy_lock;
+	}
+
+	if ((ret = rrr_posix_cond_init(&wal->sync_cond, 0)) != 0) {
+		RRR_MSG_0("Could not initialize condition in rrr_msg_holder_wal_new\n");
+		goto out_destroy_sync_lock;
+	}
+
+	wal->segment_size = segment_size;
+	wal->sync_interval_us = sync_interval_us;
+
+	if ((ret = __rrr_msg_holder_wal_replay(wal, replayed)) != 0) {
+		goto out_destroy_segments;
+	}
+
+	if ((ret = __rrr_msg_holder_wal_segment_open_new(wal)) != 0) {
+		goto out_destroy_segments;
+	}
+
+	if (sync_interval_us > 0) {
+		if ((ret = pthread_create(&wal->sync_thread, NULL, __rrr_msg_holder_wal_sync_thread, wal)) != 0) {
+			RRR_MSG_0("Could not start sync thread in rrr_msg_holder_wal_new: %s\n", rrr_strerror(ret));
+			ret = 1;
+			goto out_destroy_segments;
+		}
+		wal->sync_thread_started = 1;
+	}
+
+	*target = wal;
+
+	goto out;
+	out_destroy_segments:
+		RRR_LL_DESTROY(&wal->segments, struct rrr_msg_holder_wal_segment, __rrr_msg_holder_wal_segment_destroy(node));
+		pthread_cond_destroy(&wal->sync_cond);
+	out_destroy_sync_lock:
+		pthread_mutex_destroy(&wal->sync_lock);
+	out_destroy_lock:
+		pthread_mutex_destroy(&wal->lock);
+	out_free:
+		RRR_FREE_IF_NOT_NULL(wal->directory);
+		RRR_FREE_IF_NOT_NULL(wal->name);
+		rrr_free(wal);
+	out:
+		return ret;
+}
+
+// Segments with entries not yet acknowledged are kept for the next run
+void rrr_msg_holder_wal_destroy (
+		struct rrr_msg_holder_wal *wal
+) {
+	if (wal->sync_thread_started) {
+		pthread_mutex_lock(&wal->lock);
+		wal->sync_thread_stop = 1;
+		pthread_cond_signal(&wal->sync_cond);
+		pthread_mutex_unlock(&wal->lock);
+		pthread_join(wal->sync_thread, NULL);
+	}
+
+	rrr_msg_holder_wal_commit(wal);
+	__rrr_msg_holder_wal_sync(wal);
+
+	RRR_LL_ITERATE_BEGIN(&wal->segments, struct rrr_msg_holder_wal_segment);
+		if (node->outstanding == 0) {
+			unlink(node->path);
+		}
+	RRR_LL_ITERATE_END();
+
+	RRR_LL_DESTROY(&wal->segments, struct rrr_msg_holder_wal_segment, __rrr_msg_holder_wal_segment_destroy(node));
+	pthread_cond_destroy(&wal->sync_cond);
+	pthread_mutex_destroy(&wal->sync_lock);
+	pthread_mutex_destroy(&wal->lock);
+	RRR_FREE_IF_NOT_NULL(wal->buf);
+	rrr_free(wal->directory);
+	rrr_free(wal->name);
+	rrr_free(wal);
+}
+
+void rrr_msg_holder_wal_get_stats (
+		struct rrr_msg_holder_wal_stats *target,
+		struct rrr_msg_holder_wal *wal
+) {
+	pthread_mutex_lock(&wal->lock);
+	*target = wal->stats;
+	pthread_mutex_unlock(&wal->lock);
+}
+
+// Entry must be locked or otherwise exclusively accessed by caller. The
+// record is written to file on the next commit.
+int rrr_msg_holder_wal_append (
+		struct rrr_msg_holder_wal *wal,
+		struct rrr_msg_holder *entry
+) {
+	int ret = 0;
+
+	if (entry->data_length < 0 || (uint64_t) entry->data_length > UINT32_MAX) {
+		RRR_BUG("BUG: Invalid data length %lli in rrr_msg_holder_wal_append\n", (long long int) entry->data_length);
+	}
+
+	const size_t data_size = (size_t) entry->data_length;
+	const size_t record_size = RRR_MSG_HOLDER_WAL_RECORD_SIZE(data_size, entry->addr_len);
+
+	pthread_mutex_lock(&wal->lock);
+
+	if (wal->buf_size - wal->buf_pos < record_size) {
+		size_t new_size = (wal->buf_size > 0 ? wal->buf_size : 65536);
+		while (new_size - wal->buf_pos < record_size) {
+			new_size *= 2;
+		}
+		char *buf_new = rrr_reallocate(wal->buf, wal->buf_size, new_size);
+		if (buf_new == NULL) {
+			RRR_MSG_0("Could not allocate memory in rrr_msg_holder_wal_append\n");
+			ret = 1;
+			goto out;
+		}
+		wal->buf = buf_new;
+		wal->buf_size = new_size;
+	}
+
+	struct rrr_msg_holder_wal_segment *segment = RRR_LL_LAST(&wal->segments);
+
+	struct rrr_msg_holder_wal_record_header header = {
+		RRR_MSG_HOLDER_WAL_MAGIC,
+		0,
+		++(wal->seq),
+		(uint32_t) data_size,
+		(uint32_t) entry->addr_len,
+		(int32_t) entry->protocol,
+		0
+	};
+
+	char *record = wal->buf + wal->buf_pos;
+
+	memset(record, '\0', record_size);
+	memcpy(record, &header, sizeof(header));
+	if (entry->addr_len > 0) {
+		memcpy(record + sizeof(header), entry->addr, entry->addr_len);
+	}
+	memcpy(record + sizeof(header) + entry->addr_len, entry->message, data_size);
+
+	header.crc32 = rrr_crc32buf (
+			record + RRR_MSG_HOLDER_WAL_CRC_OFFSET,
+			sizeof(header) - RRR_MSG_HOLDER_WAL_CRC_OFFSET + entry->addr_len + data_size
+	);
+	memcpy(record + offsetof(struct rrr_msg_holder_wal_record_header, crc32), &header.crc32, sizeof(header.crc32));
+
+	wal->buf_pos += record_size;
+
+	segment->last_seq = header.seq;
+	segment->outstanding++;
+	wal->stats.total_appended++;
+
+	entry->wal_seq = header.seq;
+
+	out:
+	pthread_mutex_unlock(&wal->lock);
+	return ret;
+}
+
+// Removes a partially written commit from the end of a segment. Replay stops
+// at a broken record, anything written after it would otherwise be lost.
+static void __rrr_msg_holder_wal_segment_truncate (
+		struct rrr_msg_holder_wal_segment *segment
+) {
+	if (ftruncate(segment->fd, (off_t) segment->size) != 0 || lseek(segment->fd, (off_t) segment->size, SEEK_SET) < 0) {
+		RRR_MSG_0("Failed to truncate write-ahead log segment '%s': %s\n", segment->path, rrr_strerror(errno));
+	}
+}
+
+// Writes appended records to file in one operation and starts a new segment
+// if the current one is full. If writing fails, the records are kept and
+// written again by the next commit.
+int rrr_msg_holder_wal_commit (
+		struct rrr_msg_holder_wal *wal
+) {
+	int ret = 0;
+
+	pthread_mutex_lock(&wal->lock);
+
+	if (wal->buf_pos == 0) {
+		pthread_mutex_unlock(&wal->lock);
+		goto out;
+	}
+
+	struct rrr_msg_holder_wal_segment *segment = RRR_LL_LAST(&wal->segments);
+
+	size_t pos = 0;
+	while (pos < wal->buf_pos) {
+		ssize_t bytes = write(segment->fd, wal->buf + pos, wal->buf_pos - pos);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			RRR_MSG_0("Failed to write to write-ahead log segment '%s': %s\n", segment->path, rrr_strerror(errno));
+			ret = 1;
+			break;
+		}
+		pos += (size_t) bytes;
+	}
+
+	if (ret != 0) {
+		__rrr_msg_holder_wal_segment_truncate(segment);
+		pthread_mutex_unlock(&wal->lock);
+		goto out;
+	}
+
+	segment->size += pos;
+	segment->needs_sync = 1;
+	wal->buf_pos = 0;
+	wal->stats.total_commits++;
+
+	if (segment->size >= wal->segment_size) {
+		ret = __rrr_msg_holder_wal_segment_open_new(wal);
+	}
+
+	pthread_mutex_unlock(&wal->lock);
+
+	if (ret == 0 && wal->sync_interval_us == 0) {
+		ret = __rrr_msg_holder_wal_sync(wal);
+	}
+
+	out:
+	return ret;
+}
+
+// Called when an entry has been removed from the buffer. The segment
+// is deleted when all its entries are acknowledged.
+void rrr_msg_holder_wal_ack (
+		struct rrr_msg_holder_wal *wal,
+		uint64_t seq
+) {
+	struct rrr_msg_holder_wal_segment *segment_delete = NULL;
+
+	pthread_mutex_lock(&wal->lock);
+
+	int found = 0;
+	RRR_LL_ITERATE_BEGIN(&wal->segments, struct rrr_msg_holder_wal_segment);
+		if (seq >= node->first_seq && seq <= node->last_seq) {
+			found = 1;
+			if (--(node->outstanding) == 0 && node != RRR_LL_LAST(&wal->segments)) {
+				segment_delete = node;
+				RRR_LL_ITERATE_SET_DESTROY();
+			}
+			RRR_LL_ITERATE_LAST();
+		}
+	RRR_LL_ITERATE_END_CHECK_DESTROY_NO_FREE(&wal->segments);
+
+	if (!found) {
+		RRR_BUG("BUG: Sequence number %" PRIu64 " not found in rrr_msg_holder_wal_ack\n", seq);
+	}
+
+	wal->stats.total_acked++;
+	if (segment_delete != NULL) {
+		wal->stats.segments--;
+	}
+
+	pthread_mutex_unlock(&wal->lock);
+
+	if (segment_delete != NULL) {
+		RRR_DBG_3("Write-ahead log %s deleting segment %s\n", wal->name, segment_delete->path);
+		unlink(segment_delete->path);
+		pthread_mutex_lock(&wal->sync_lock);
+		__rrr_msg_holder_wal_segment_destroy(segment_delete);
+		pthread_mutex_unlock(&wal->sync_lock);
+	}
+}
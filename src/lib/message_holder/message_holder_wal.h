@@ -0,0 +1,81 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_MESSAGE_HOLDER_WAL_H
+#define RRR_MESSAGE_HOLDER_WAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RRR_MSG_HOLDER_WAL_DEFAULT_SEGMENT_SIZE      (16 * 1024 * 1024)
+#define RRR_MSG_HOLDER_WAL_DEFAULT_SYNC_INTERVAL_MS  100
+
+/*
+ * A write-ahead log keeps copies of entries in segment files until they are
+ * acknowledged. Appended entries are written to the current segment on commit,
+ * and a background thread syncs the files to disk at the given interval. With
+ * an interval of zero, each commit syncs before returning. A segment file is
+ * deleted once all its entries are acknowledged, and entries in files left by
+ * a previous run are returned when the log is created. Entries may be
+ * returned more than once if the program stops before a segment is deleted.
+ */
+
+struct rrr_msg_holder;
+struct rrr_msg_holder_wal;
+struct rrr_msg_holder_collection;
+
+struct rrr_msg_holder_wal_stats {
+	uint64_t total_appended;
+	uint64_t total_acked;
+	uint64_t total_replayed;
+	uint64_t total_commits;
+	uint64_t total_syncs;
+	uint64_t segments;
+};
+
+int rrr_msg_holder_wal_new (
+		struct rrr_msg_holder_wal **target,
+		struct rrr_msg_holder_collection *replayed,
+		const char *directory,
+		const char *name,
+		size_t segment_size,
+		uint64_t sync_interval_us
+);
+void rrr_msg_holder_wal_destroy (
+		struct rrr_msg_holder_wal *wal
+);
+void rrr_msg_holder_wal_get_stats (
+		struct rrr_msg_holder_wal_stats *target,
+		struct rrr_msg_holder_wal *wal
+);
+int rrr_msg_holder_wal_append (
+		struct rrr_msg_holder_wal *wal,
+		struct rrr_msg_holder *entry
+);
+int rrr_msg_holder_wal_commit (
+		struct rrr_msg_holder_wal *wal
+);
+void rrr_msg_holder_wal_ack (
+		struct rrr_msg_holder_wal *wal,
+		uint64_t seq
+);
+
+#endif /* RRR_MESSAGE_HOLDER_WAL_H */
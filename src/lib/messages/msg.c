@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../log.h"
 #include "../allocator.h"
@@ -35,6 +36,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../rrr_types.h"
 #include "../util/crc32.h"
 #include "../util/rrr_endian.h"
+#include "../util/macro_utils.h"
 
 void rrr_msg_populate_head (
 		struct rrr_msg *message,
@@ -179,9 +181,115 @@ int rrr_msg_check_data_checksum_and_length (
 	return 0;
 }
 
-int rrr_msg_to_host_and_verify_with_callback (
+static int __rrr_msg_to_host_and_verify_with_callback (
 		struct rrr_msg **msg,
 		rrr_length expected_size,
+		int is_batch_member,
+		RRR_MSG_TO_HOST_AND_VERIFY_CALLBACKS_COMMA,
+		void *callback_arg1,
+		void *callback_arg2
+);
+
+static int __rrr_msg_batch_to_host_and_verify_with_callback (
+		struct rrr_msg *batch,
+		rrr_length batch_size,
+		RRR_MSG_TO_HOST_AND_VERIFY_CALLBACKS_COMMA,
+		void *callback_arg1,
+		void *callback_arg2
+) {
+	int ret = 0;
+
+	struct rrr_msg *scratch = NULL;
+	rrr_length scratch_size = 0;
+
+	// Validate the member sizes before any callbacks are called to avoid
+	// delivering parts of a corrupt batch
+	rrr_u32 count = 0;
+	for (rrr_length pos = sizeof(*batch); pos < batch_size; count++) {
+		const struct rrr_msg *member_network = (const struct rrr_msg *) (((const char *) batch) + pos);
+		const rrr_length remaining = batch_size - pos;
+
+		if (remaining < sizeof(*member_network)) {
+			RRR_MSG_0("Batch message member was truncated in rrr_msg_to_host_and_verify_with_callback\n");
+			ret = RRR_MSG_READ_SOFT_ERROR;
+			goto out;
+		}
+
+		const rrr_length member_size = rrr_be32toh(member_network->msg_size);
+		if (member_size < sizeof(*member_network) || member_size > remaining) {
+			RRR_MSG_0("Invalid size %" PRIrrrl " of batch message member in rrr_msg_to_host_and_verify_with_callback, %" PRIrrrl " bytes remaining\n",
+					member_size, remaining);
+			ret = RRR_MSG_READ_SOFT_ERROR;
+			goto out;
+		}
+
+		pos += member_size;
+	}
+
+	if (count != batch->msg_value) {
+		RRR_MSG_0("Member count mismatch in batch message in rrr_msg_to_host_and_verify_with_callback (%" PRIu32 "<>%" PRIu32 ")\n",
+				count, batch->msg_value);
+		ret = RRR_MSG_READ_SOFT_ERROR;
+		goto out;
+	}
+
+	for (rrr_length pos = sizeof(*batch); pos < batch_size; ) {
+		struct rrr_msg *member = (struct rrr_msg *) (((char *) batch) + pos);
+		const rrr_length member_size = rrr_be32toh(member->msg_size);
+
+		// Members are converted and passed to callbacks in place, except
+		// rrr_msg_msg. Callbacks may take control of the memory of those by
+		// setting the pointer to NULL, they are copied to a separate allocation
+		// which is reused for the next member unless a callback took it.
+		if (rrr_be16toh(member->msg_type) == RRR_MSG_TYPE_MESSAGE) {
+			if (scratch_size < member_size) {
+				RRR_FREE_IF_NOT_NULL(scratch);
+				scratch_size = 0;
+				if ((scratch = rrr_allocate_group(member_size, RRR_ALLOCATOR_GROUP_MSG)) == NULL) {
+					RRR_MSG_0("Could not allocate memory for batch message member in rrr_msg_to_host_and_verify_with_callback\n");
+					ret = RRR_MSG_READ_HARD_ERROR;
+					goto out;
+				}
+				scratch_size = member_size;
+			}
+			memcpy(scratch, member, member_size);
+			member = scratch;
+		}
+
+		ret = __rrr_msg_to_host_and_verify_with_callback (
+				&member,
+				member_size,
+				1,
+				callback_msg,
+				callback_addr_msg,
+				callback_log_msg,
+				callback_ctrl_msg,
+				callback_stats_msg,
+				callback_arg1,
+				callback_arg2
+		);
+
+		if (member == NULL) {
+			scratch = NULL;
+			scratch_size = 0;
+		}
+
+		if (ret != 0) {
+			goto out;
+		}
+
+		pos += member_size;
+	}
+
+	out:
+	RRR_FREE_IF_NOT_NULL(scratch);
+	return ret;
+}
+
+static int __rrr_msg_to_host_and_verify_with_callback (
+		struct rrr_msg **msg,
+		rrr_length expected_size,
+		int is_batch_member,
 		RRR_MSG_TO_HOST_AND_VERIFY_CALLBACKS_COMMA,
 		void *callback_arg1,
 		void *callback_arg2
@@ -197,13 +305,35 @@ int rrr_msg_to_host_and_verify_with_callback (
 		goto out;
 	}
 
-	if (rrr_msg_check_data_checksum_and_length(*msg, expected_size) != 0) {
+	// Members of a batch have no checksums of their own, the data
+	// checksum of the batch has already been checked
+	if (is_batch_member) {
+		if (RRR_MSG_IS_BATCH(*msg)) {
+			RRR_MSG_0("Received a batch message inside another batch message in rrr_msg_to_host_and_verify_with_callback\n");
+			ret = RRR_MSG_READ_SOFT_ERROR;
+			goto out;
+		}
+	}
+	else if (rrr_msg_check_data_checksum_and_length(*msg, expected_size) != 0) {
 		RRR_MSG_0 ("Message checksum was invalid in rrr_msg_to_host_and_verify_with_callback\n");
 		ret = RRR_MSG_READ_SOFT_ERROR;
 		goto out;
 	}
 
-	if (RRR_MSG_IS_RRR_MESSAGE(*msg)) {
+	if (RRR_MSG_IS_BATCH(*msg)) {
+		ret = __rrr_msg_batch_to_host_and_verify_with_callback (
+				*msg,
+				expected_size,
+				callback_msg,
+				callback_addr_msg,
+				callback_log_msg,
+				callback_ctrl_msg,
+				callback_stats_msg,
+				callback_arg1,
+				callback_arg2
+		);
+	}
+	else if (RRR_MSG_IS_RRR_MESSAGE(*msg)) {
 		if (callback_msg == NULL) {
 			RRR_MSG_0("Received an rrr_msg_msg in rrr_msg_to_host_and_verify_with_callback but no callback is defined for this type\n");
 			ret = RRR_MSG_READ_SOFT_ERROR;
@@ -287,3 +417,106 @@ int rrr_msg_to_host_and_verify_with_callback (
 	out:
 	return ret;
 }
+
+int rrr_msg_to_host_and_verify_with_callback (
+		struct rrr_msg **msg,
+		rrr_length expected_size,
+		RRR_MSG_TO_HOST_AND_VERIFY_CALLBACKS_COMMA,
+		void *callback_arg1,
+		void *callback_arg2
+) {
+	return __rrr_msg_to_host_and_verify_with_callback (
+			msg,
+			expected_size,
+			0,
+			callback_msg,
+			callback_addr_msg,
+			callback_log_msg,
+			callback_ctrl_msg,
+			callback_stats_msg,
+			callback_arg1,
+			callback_arg2
+	);
+}
+
+void rrr_msg_batch_clear (
+		struct rrr_msg_batch *batch
+) {
+	RRR_FREE_IF_NOT_NULL(batch->data);
+	memset(batch, '\0', sizeof(*batch));
+}
+
+int rrr_msg_batch_append_msg_msg (
+		struct rrr_msg_batch *batch,
+		const struct rrr_msg_msg *message
+) {
+	const rrr_length message_size = MSG_TOTAL_SIZE(message);
+
+	if (batch->data_size == 0) {
+		batch->data_size = sizeof(struct rrr_msg);
+	}
+
+	if (message_size > RRR_LENGTH_MAX - batch->data_size) {
+		RRR_MSG_0("Batch message would exceed maximum size in rrr_msg_batch_append_msg_msg\n");
+		return 1;
+	}
+
+	const rrr_length size_needed = batch->data_size + message_size;
+
+	if (size_needed > batch->data_capacity) {
+		rrr_length capacity_new = batch->data_capacity > RRR_LENGTH_MAX / 2
+			? RRR_LENGTH_MAX
+			: batch->data_capacity * 2;
+		if (capacity_new < size_needed) {
+			capacity_new = size_needed;
+		}
+
+		char *data_new = rrr_reallocate(batch->data, batch->data_capacity, capacity_new);
+		if (data_new == NULL) {
+			RRR_MSG_0("Could not allocate memory in rrr_msg_batch_append_msg_msg\n");
+			return 1;
+		}
+
+		batch->data = data_new;
+		batch->data_capacity = capacity_new;
+	}
+
+	struct rrr_msg_msg *member = (struct rrr_msg_msg *) (batch->data + batch->data_size);
+
+	memcpy(member, message, message_size);
+
+	rrr_msg_msg_prepare_for_network(member);
+	rrr_msg_populate_head((struct rrr_msg *) member, RRR_MSG_TYPE_MESSAGE, message_size, 0);
+
+	member->header_crc32 = 0;
+	member->data_crc32 = 0;
+	member->msg_type = rrr_htobe16(member->msg_type);
+	member->msg_size = rrr_htobe32(member->msg_size);
+	member->msg_value = rrr_htobe32(member->msg_value);
+
+	batch->data_size = size_needed;
+	batch->count++;
+
+	return 0;
+}
+
+void rrr_msg_batch_finalize (
+		struct rrr_msg **result,
+		rrr_length *result_size,
+		struct rrr_msg_batch *batch
+) {
+	if (batch->count == 0) {
+		RRR_BUG("BUG: Batch was empty in rrr_msg_batch_finalize\n");
+	}
+
+	struct rrr_msg *msg = (struct rrr_msg *) batch->data;
+
+	rrr_msg_populate_head(msg, RRR_MSG_TYPE_BATCH, batch->data_size, batch->count);
+	rrr_msg_checksum_and_to_network_endian(msg);
+
+	*result = msg;
+	*result_size = batch->data_size;
+
+	batch->data = NULL;
+	rrr_msg_batch_clear(batch);
+}
@@ -51,6 +51,15 @@ struct rrr_msg_addr;
 struct rrr_msg_log;
 struct rrr_msg_stats;
 
+// Members are appended in network byte order, the head of the batch
+// itself is written by rrr_msg_batch_finalize
+struct rrr_msg_batch {
+	char *data;
+	rrr_length data_size;
+	rrr_length data_capacity;
+	rrr_u32 count;
+};
+
 void rrr_msg_populate_head (
 		struct rrr_msg *message,
 		rrr_u16 type,
@@ -85,5 +94,17 @@ int rrr_msg_to_host_and_verify_with_callback (
 		void *callback_arg1,
 		void *callback_arg2
 );
+void rrr_msg_batch_clear (
+		struct rrr_msg_batch *batch
+);
+int rrr_msg_batch_append_msg_msg (
+		struct rrr_msg_batch *batch,
+		const struct rrr_msg_msg *message
+);
+void rrr_msg_batch_finalize (
+		struct rrr_msg **result,
+		rrr_length *result_size,
+		struct rrr_msg_batch *batch
+);
 
 #endif /* RRR_MSG_H */
@@ -31,6 +31,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_MSG_TYPE_TREE_DATA          6
 #define RRR_MSG_TYPE_MESSAGE_ADDR       8
 #define RRR_MSG_TYPE_MESSAGE_LOG       16
+#define RRR_MSG_TYPE_BATCH             32
 
 // This bit is reserved for holding the type=control number
 #define RRR_MSG_CTRL_F_RESERVED    (1<<0)
@@ -73,6 +74,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 	((msg)->msg_type == RRR_MSG_TYPE_MESSAGE_LOG)
 #define RRR_MSG_IS_TREE_DATA(msg) \
 	((msg)->msg_type == RRR_MSG_TYPE_TREE_DATA)
+#define RRR_MSG_IS_BATCH(msg) \
+	((msg)->msg_type == RRR_MSG_TYPE_BATCH)
 
 #define RRR_MSG_TYPE_OK(msg)                                   \
     (RRR_MSG_IS_CTRL(msg) ||                                   \
@@ -80,9 +83,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
      RRR_MSG_IS_RRR_MESSAGE_ADDR(msg) ||                       \
      RRR_MSG_IS_SETTING(msg) ||                                \
      RRR_MSG_IS_RRR_MESSAGE_LOG(msg) ||                        \
-     RRR_MSG_IS_TREE_DATA(msg)                                 \
+     RRR_MSG_IS_TREE_DATA(msg) ||                              \
+     RRR_MSG_IS_BATCH(msg)                                     \
     )
 
+// A batch message carries a number of other messages of any type except batch
+// packed back to back in its data field, and msg_value holds the member count.
+// The members are in network byte order, but their header_crc32 and data_crc32
+// fields are zero as the data_crc32 of the batch covers all of them.
+
 // The header_crc32 is calculated AFTER conversion to network
 // byte order (big endian). The crc32 is then converted itself.
 
@@ -840,6 +840,7 @@ static int __rrr_perl5_message_to_hv (
 
     // New style array handling
     rrr_array_clear(array);
+    rrr_array_arena_enable(array);
     if (MSG_IS_ARRAY(message)) {
 	    	uint16_t array_version_dummy;
 		if (rrr_array_message_append_to_collection(&array_version_dummy, array, message) != 0) {
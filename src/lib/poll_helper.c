@@ -30,39 +30,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "message_broker.h"
 #include "message_holder/message_holder_struct.h"
 #include "message_holder/message_holder.h"
-#include "messages/msg_msg.h"
-
-static int __rrr_poll_intermediate_callback_topic_filter (
-		int *does_match,
-		struct rrr_instance_runtime_data *thread_data,
-		struct rrr_msg_holder *entry
-) {
-	int ret = 0;
-
-	*does_match = 0;
-
-	if (MSG_TOPIC_LENGTH((const struct rrr_msg_msg *) entry->message) > 0 && rrr_msg_msg_topic_match (
-			does_match,
-			(const struct rrr_msg_msg *) entry->message,
-			INSTANCE_D_TOPIC(thread_data)
-	) != 0) {
-		RRR_MSG_0("Error while matching topic against topic filter while polling in instance %s\n",
-				INSTANCE_D_NAME(thread_data));
-		ret = RRR_MESSAGE_BROKER_ERR;
-		goto out;
-	}
-
-	if (RRR_DEBUGLEVEL_3) {
-		RRR_DBG_3("Result of topic match while polling in instance %s with topic filter is '%s': %s\n",
-				INSTANCE_D_NAME(thread_data),
-				INSTANCE_D_TOPIC_STR(thread_data),
-				(does_match ? "MATCH" : "MISMATCH/DROPPED")
-		);
-	}
-
-	out:
-	return ret;
-}
 
 struct rrr_poll_intermediate_callback_data {
 	struct rrr_instance_runtime_data *thread_data;
@@ -74,39 +41,24 @@ static int __rrr_poll_intermediate_callback (
 ) {
 	struct rrr_poll_intermediate_callback_data *callback_data = arg;
 
-	int ret = RRR_MESSAGE_BROKER_OK;
+	// Topic filter is checked by the message broker
 
-	int does_match = 1;
-
-	if (callback_data->thread_data->init_data.topic_first_token != NULL) {
-		if ((ret = __rrr_poll_intermediate_callback_topic_filter(&does_match, callback_data->thread_data, entry)) != 0) {
-			goto out;
-		}
-	}
-
-	if (does_match) {
-		// Callback unlocks
-		return callback_data->callback(entry, callback_data->thread_data);
-	}
-
-	out:
-		rrr_msg_holder_unlock(entry);
-		return ret;
+	// Callback unlocks
+	return callback_data->callback(entry, callback_data->thread_data);
 }
 
-int rrr_poll_do_poll_delete (
+static int __rrr_poll_do_poll_delete (
 		uint16_t *amount,
 		struct rrr_instance_runtime_data *thread_data,
 		int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE),
-		unsigned int wait_milliseconds
+		unsigned int wait_milliseconds,
+		int message_broker_flags
 ) {
 	struct rrr_poll_intermediate_callback_data callback_data = {
 		thread_data,
 		callback
 	};
 
-	int message_broker_flags = 0;
-
 	if (!(INSTANCE_D_INSTANCE(thread_data)->misc_flags & RRR_INSTANCE_MISC_OPTIONS_DISABLE_BACKSTOP)) {
 		message_broker_flags |= RRR_MESSAGE_BROKER_POLL_F_CHECK_BACKSTOP;
 	}
@@ -119,3 +71,23 @@ int rrr_poll_do_poll_delete (
 			wait_milliseconds
 	);
 }
+
+int rrr_poll_do_poll_delete (
+		uint16_t *amount,
+		struct rrr_instance_runtime_data *thread_data,
+		int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE),
+		unsigned int wait_milliseconds
+) {
+	return __rrr_poll_do_poll_delete (amount, thread_data, callback, wait_milliseconds, 0);
+}
+
+// The callback must not modify the message of an entry without first calling
+// rrr_msg_holder_message_make_writable, messages may be shared with other readers.
+int rrr_poll_do_poll_delete_shared_payload (
+		uint16_t *amount,
+		struct rrr_instance_runtime_data *thread_data,
+		int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE),
+		unsigned int wait_milliseconds
+) {
+	return __rrr_poll_do_poll_delete (amount, thread_data, callback, wait_milliseconds, RRR_MESSAGE_BROKER_POLL_F_SHARED_PAYLOAD_OK);
+}
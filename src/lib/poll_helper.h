@@ -60,6 +60,12 @@ int rrr_poll_do_poll_delete (
 		int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE),
 		unsigned int wait_milliseconds
 );
+int rrr_poll_do_poll_delete_shared_payload (
+		uint16_t *amount,
+		struct rrr_instance_runtime_data *thread_data,
+		int (*callback)(RRR_MODULE_POLL_CALLBACK_SIGNATURE),
+		unsigned int wait_milliseconds
+);
 int rrr_poll_add_senders_to_broker (
 		struct rrr_instance **faulty_sender,
 		struct rrr_message_broker *broker,
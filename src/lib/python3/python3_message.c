@@ -1543,6 +1543,8 @@ PyObject *rrr_python3_rrr_message_new_from_message_and_address (
 		goto out_err;
 	}
 
+	rrr_array_arena_enable(&array_tmp);
+
 	uint16_t array_version_dummy;
 	if (rrr_array_message_append_to_collection(&array_version_dummy, &array_tmp, msg) != 0) {
 		RRR_MSG_0("Could not parse array from message in rrr_python3_rrr_message_new_from_message_and_address\n");
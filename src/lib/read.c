@@ -543,8 +543,7 @@ static int __rrr_read_common_get_session_target_length_from_array_tree_callback
 ) {
 	struct rrr_read_common_get_session_target_length_from_array_tree_data *data = arg;
 
-	rrr_array_clear(data->array_final);
-	RRR_LL_MERGE_AND_CLEAR_SOURCE_HEAD(data->array_final, array);
+	rrr_array_move(data->array_final, array);
 
 	return 0;
 }
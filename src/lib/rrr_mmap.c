@@ -27,6 +27,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include "log.h"
 #include "rrr_mmap.h"
@@ -55,6 +56,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  * In the future, housekeeping functions may be made available to deal with holes in the heap.
  *
+ * Heaps in collections are registered in a radix map which points from each granule of the
+ * address space to the heap occupying it. Frees look up their heap in the map without taking
+ * the index lock, and pointers not found in the map are not from any collection.
+ *
  */
 
 #define RRR_MMAP_HEAP_CHUNK_MIN_SIZE 16
@@ -65,6 +70,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 static const uint64_t rrr_mmap_sentinel_template = 0xa0a0a0a00a0a0a0a;
 #endif
 
+#define RRR_MMAP_MAP_LEAF_BITS 14
+#define RRR_MMAP_MAP_ROOT_BITS (48 - RRR_MMAP_COLLECTION_GRANULE_SHIFT - RRR_MMAP_MAP_LEAF_BITS)
+
+struct rrr_mmap_map_leaf {
+	_Atomic(struct rrr_mmap *) granules[1 << RRR_MMAP_MAP_LEAF_BITS];
+};
+
+// Leaves are never freed as lookups do not lock. Only the parts of the
+// address space where heaps have been placed get leaves.
+static _Atomic(struct rrr_mmap_map_leaf *) rrr_mmap_map_root[1 << RRR_MMAP_MAP_ROOT_BITS];
+static pthread_mutex_t rrr_mmap_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct rrr_mmap_heap_block_index {
 	uint64_t block_used_map;
 	uint64_t block_sizes[64];
@@ -361,6 +378,71 @@ void *rrr_mmap_allocate (
 	return result;
 }
 
+// Adds used blocks to the histogram, free space is freed blocks and
+// the unused space after the last block
+static void __rrr_mmap_usage (
+		struct rrr_mmap_stats_heap *heap,
+		uint64_t *histogram,
+		struct rrr_mmap *mmap
+) {
+	memset(heap, '\0', sizeof(*heap));
+
+	pthread_mutex_lock(&mmap->lock);
+
+	heap->heap_size = mmap->heap_size;
+	heap->allocation_count = mmap->allocation_count;
+
+	uint64_t block_pos = 0;
+	while (block_pos < mmap->heap_size) {
+		struct rrr_mmap_heap_block_index *index = (struct rrr_mmap_heap_block_index *) (mmap->heap + block_pos);
+
+		block_pos += sizeof(struct rrr_mmap_heap_block_index);
+		if (block_pos > mmap->heap_size) {
+			break;
+		}
+
+		// Blocks are only merged within an index
+		uint64_t consecutive_free_size = 0;
+
+		for (uint64_t j = 0; j < 64; j++) {
+			uint64_t used_mask = (uint64_t) 1 << j;
+
+			if (index->block_sizes[j] == 0) {
+				if ((index->block_used_map & used_mask) == used_mask) {
+					// Unusable merged chunk
+					continue;
+				}
+
+				// Last block
+				const uint64_t tail_size = mmap->heap_size - block_pos;
+				heap->bytes_free += tail_size;
+				if (consecutive_free_size + tail_size > heap->largest_free_chunk) {
+					heap->largest_free_chunk = consecutive_free_size + tail_size;
+				}
+				goto out_unlock;
+			}
+
+			if ((index->block_used_map & used_mask) == used_mask) {
+				heap->bytes_in_use += index->block_sizes[j];
+				histogram[rrr_mmap_stats_histogram_bucket(index->block_sizes[j])]++;
+				consecutive_free_size = 0;
+			}
+			else {
+				heap->bytes_free += index->block_sizes[j];
+				consecutive_free_size += index->block_sizes[j];
+				if (consecutive_free_size > heap->largest_free_chunk) {
+					heap->largest_free_chunk = consecutive_free_size;
+				}
+			}
+
+			block_pos += index->block_sizes[j];
+		}
+	}
+
+	out_unlock:
+	pthread_mutex_unlock(&mmap->lock);
+}
+
 static int __rrr_mmap_is_empty (
 		uint64_t *allocation_count,
 		struct rrr_mmap *mmap
@@ -450,6 +532,7 @@ int rrr_mmap_heap_reallocate (
 static int __rrr_mmap_init (
 		struct rrr_mmap *result,
 		uint64_t heap_size,
+		uint64_t alignment,
 		int is_shared
 ) {
 	int ret = 0;
@@ -463,13 +546,22 @@ static int __rrr_mmap_init (
 
 	uint64_t heap_size_padded = heap_size + (4096 - (heap_size % 4096));
 
+	if (alignment > 0) {
+		heap_size_padded += (alignment - (heap_size_padded % alignment)) % alignment;
+	}
+
 	if ((ret = rrr_posix_mutex_init(&result->lock, (is_shared ? RRR_POSIX_MUTEX_IS_PSHARED : 0))) != 0) {
 		RRR_MSG_0("Could not initialize mutex in rrr_mmap_init (%i)\n", ret);
 		ret = 1;
 		goto out_munmap_heap;
 	}
 
-	if ((result->heap = __rrr_mmap(heap_size_padded, is_shared)) == NULL) {
+	// Anonymous mappings are zero-filled, the aligned heap is not
+	// touched to avoid committing all of its pages up front
+	if ((result->heap = (alignment > 0
+			? rrr_posix_mmap_aligned(heap_size_padded, alignment, is_shared)
+			: __rrr_mmap(heap_size_padded, is_shared)
+	)) == NULL) {
 		RRR_MSG_0("Could not allocate memory with mmap in rrr_mmap_init: %s\n", rrr_strerror(errno));
 		ret = 1;
 		goto out;
@@ -504,7 +596,7 @@ int rrr_mmap_new (
 		goto out;
 	}
 
-	if ((ret = __rrr_mmap_init (result, heap_size, is_shared)) != 0) {
+	if ((ret = __rrr_mmap_init (result, heap_size, 0 /* No alignment */, is_shared)) != 0) {
 		goto out_munmap_main;
 	}
 
@@ -542,37 +634,70 @@ void rrr_mmap_destroy (
 #define RRR_MMAP_ITERATE_END() \
 	}} while(0)
 
-static void __rrr_mmap_collection_minmax_update (
-		struct rrr_mmap_collection *collection
+static _Atomic(struct rrr_mmap *) *__rrr_mmap_map_granule (
+		uintptr_t ptr,
+		int create
 ) {
-	size_t pos = 0;
-	RRR_MMAP_ITERATE_BEGIN();
-		if (node->heap != NULL) {
-			collection->minmax[pos].heap_min = (uintptr_t) node->heap;
-			collection->minmax[pos].heap_max = (uintptr_t) node->heap + node->heap_size;
-			collection->minmax[pos].mmap_idx = i;
-			pos++;
-		}
-		if (pos == collection->mmap_count) {
-			break;
+	const uintptr_t granule = ptr >> RRR_MMAP_COLLECTION_GRANULE_SHIFT;
+	const uintptr_t root_pos = granule >> RRR_MMAP_MAP_LEAF_BITS;
+
+	if (root_pos >= (1 << RRR_MMAP_MAP_ROOT_BITS)) {
+		return NULL;
+	}
+
+	struct rrr_mmap_map_leaf *leaf = atomic_load_explicit(&rrr_mmap_map_root[root_pos], memory_order_acquire);
+
+	if (leaf == NULL && create) {
+		pthread_mutex_lock(&rrr_mmap_map_lock);
+		if ((leaf = atomic_load_explicit(&rrr_mmap_map_root[root_pos], memory_order_acquire)) == NULL) {
+			if ((leaf = calloc(1, sizeof(*leaf))) != NULL) {
+				atomic_store_explicit(&rrr_mmap_map_root[root_pos], leaf, memory_order_release);
+			}
 		}
-	RRR_MMAP_ITERATE_END();
+		pthread_mutex_unlock(&rrr_mmap_map_lock);
+	}
+
+	if (leaf == NULL) {
+		return NULL;
+	}
+
+	return &leaf->granules[granule & ((1 << RRR_MMAP_MAP_LEAF_BITS) - 1)];
 }
 
-static int __rrr_mmap_collection_minmax_search (
-		size_t *pos,
-		struct rrr_mmap_collection *collection,
-		uintptr_t ptr
+static void __rrr_mmap_map_set (
+		struct rrr_mmap *mmap,
+		struct rrr_mmap *value
+) {
+	for (uint64_t pos = 0; pos < mmap->heap_size; pos += RRR_MMAP_COLLECTION_GRANULE_SIZE) {
+		// Granules are known to exist after registration
+		atomic_store_explicit(__rrr_mmap_map_granule((uintptr_t) mmap->heap + pos, 0), value, memory_order_release);
+	}
+}
+
+static int __rrr_mmap_map_register (
+		struct rrr_mmap *mmap
 ) {
-	for (size_t j = 0; j < collection->mmap_count; j++) {
-		if (ptr >= collection->minmax[j].heap_min && ptr < collection->minmax[j].heap_max) {
-			*pos = collection->minmax[j].mmap_idx;
+	for (uint64_t pos = 0; pos < mmap->heap_size; pos += RRR_MMAP_COLLECTION_GRANULE_SIZE) {
+		if (__rrr_mmap_map_granule((uintptr_t) mmap->heap + pos, 1) == NULL) {
+			RRR_MSG_0("Could not register heap %p in mmap map\n", mmap->heap);
 			return 1;
 		}
 	}
+
+	__rrr_mmap_map_set(mmap, mmap);
+
 	return 0;
 }
 
+static void __rrr_mmap_collection_node_cleanup (
+		struct rrr_mmap_collection *collection,
+		struct rrr_mmap *node
+) {
+	__rrr_mmap_map_set(node, NULL);
+	__rrr_mmap_cleanup(node);
+	collection->mmap_count--;
+}
+
 void rrr_mmap_collections_maintenance (
 		struct rrr_mmap_stats *stats,
 		struct rrr_mmap_collection *collections,
@@ -581,6 +706,10 @@ void rrr_mmap_collections_maintenance (
 ) {
 	memset(stats, '\0', sizeof(*stats));
 
+	if (collection_count > RRR_MMAP_STATS_GROUP_COUNT) {
+		RRR_BUG("BUG: Too many collections in rrr_mmap_collections_maintenance\n");
+	}
+
 	pthread_rwlock_rdlock(index_lock);
 	for (size_t i = 0; i < collection_count; i++) {
 		struct rrr_mmap_collection *collection = &collections[i];
@@ -597,6 +726,7 @@ void rrr_mmap_collections_maintenance (
 	pthread_rwlock_wrlock(index_lock);
 	for (size_t i = 0; i < collection_count; i++) {
 		struct rrr_mmap_collection *collection = &collections[i];
+		struct rrr_mmap_stats_group *group = &stats->groups[i];
 		RRR_MMAP_ITERATE_BEGIN();
 			if (node->heap == NULL) {
 				continue;
@@ -605,12 +735,21 @@ void rrr_mmap_collections_maintenance (
 			stats->mmap_total_heap_size += node->heap_size;
 			stats->mmap_total_count++;
 
+			struct rrr_mmap_stats_heap *heap = &group->heaps[group->mmap_count++];
+			__rrr_mmap_usage(heap, group->histogram, node);
+
+			group->bytes_in_use += heap->bytes_in_use;
+			group->bytes_reserved += heap->heap_size;
+			group->mmap_bytes_free += heap->bytes_free;
+			if (heap->largest_free_chunk > group->mmap_largest_free_chunk) {
+				group->mmap_largest_free_chunk = heap->largest_free_chunk;
+			}
+
 			uint64_t allocation_count;
 			if (__rrr_mmap_is_empty(&allocation_count, node)) {
 				if (++node->maintenance_cleanup_strikes >= RRR_MMAP_COLLECTION_MAINTENANCE_CLEANUP_STRIKES) {
-					 __rrr_mmap_cleanup (node);
-					collection->mmap_count--;
-					__rrr_mmap_collection_minmax_update(collection);
+					__rrr_mmap_collection_node_cleanup(collection, node);
+					collection->reclaimed_count++;
 					continue;
 				}
 				stats->mmap_total_empty_count++;
@@ -626,6 +765,9 @@ void rrr_mmap_collections_maintenance (
 				}
 			}
 		RRR_MMAP_ITERATE_END();
+
+		group->mmap_reclaimed_count = collection->reclaimed_count;
+		group->mmap_allocation_failure_count = collection->allocation_failure_count;
 	}
 	pthread_rwlock_unlock(index_lock);
 }
@@ -645,8 +787,7 @@ void rrr_mmap_collections_clear (
 		struct rrr_mmap_collection *collection = &collections[i];
 		RRR_MMAP_ITERATE_BEGIN();
 			if (node->heap != NULL) {
-				__rrr_mmap_cleanup (node);
-				collection->mmap_count--;
+				__rrr_mmap_collection_node_cleanup(collection, node);
 				count++;
 			}
 		RRR_MMAP_ITERATE_END();
@@ -683,15 +824,26 @@ void *rrr_mmap_collection_allocate (
 	pthread_rwlock_wrlock(index_lock);
 	RRR_MMAP_ITERATE_BEGIN();
 		if (node->heap == NULL) {
-			if (__rrr_mmap_init (node, bytes > min_mmap_size ? bytes : min_mmap_size, is_shared) != 0) {
+			if (__rrr_mmap_init (
+					node,
+					bytes > min_mmap_size ? bytes : min_mmap_size,
+					RRR_MMAP_COLLECTION_GRANULE_SIZE,
+					is_shared
+			) != 0) {
+				break;
+			}
+			if (__rrr_mmap_map_register(node) != 0) {
+				__rrr_mmap_cleanup(node);
 				break;
 			}
 			collection->mmap_count++;
-			__rrr_mmap_collection_minmax_update(collection);
 			result = rrr_mmap_allocate(node, bytes);
 			break;
 		}
 	RRR_MMAP_ITERATE_END();
+	if (result == NULL) {
+		collection->allocation_failure_count++;
+	}
 	pthread_rwlock_unlock(index_lock);
 
 	out:
@@ -699,33 +851,18 @@ void *rrr_mmap_collection_allocate (
 }
 
 int rrr_mmap_collections_free (
-		struct rrr_mmap_collection *collections,
-		size_t collection_count,
-		pthread_rwlock_t *index_lock,
 		void *ptr
 ) {
-	int ret = 1; // Error
-
-	pthread_rwlock_rdlock(index_lock);
-
-	for (size_t j = 0; j < collection_count; j++) {
-		if (collections[j].mmap_count == 0) {
-			continue;
-		}
+	_Atomic(struct rrr_mmap *) *granule = __rrr_mmap_map_granule((uintptr_t) ptr, 0);
+	struct rrr_mmap *mmap = NULL;
 
-		size_t pos = 0;
-		if (__rrr_mmap_collection_minmax_search (
-				&pos,
-				&collections[j],
-				(uintptr_t) ptr
-		) == 1) {
-			rrr_mmap_free(&collections[j].mmaps[pos], ptr);
-			ret = 0;
-		}
+	// A heap may not be cleaned up while it still holds the
+	// allocation, no lock is needed to use the mmap
+	if (granule == NULL || (mmap = atomic_load_explicit(granule, memory_order_acquire)) == NULL) {
+		return 1;
 	}
 
-	pthread_rwlock_unlock(index_lock);
-
-	return ret;
+	rrr_mmap_free(mmap, ptr);
 
+	return 0;
 }
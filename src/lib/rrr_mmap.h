@@ -32,6 +32,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_MMAP_COLLECTION_ALLOCATION_MAX 32768
 #define RRR_MMAP_TO_FREE_LIST_MAX 16
 
+// Heaps in collections are aligned to and sized in granules. Each granule
+// maps to at most one heap, allowing the heap of a pointer to be found
+// by a lookup in a radix map.
+#define RRR_MMAP_COLLECTION_GRANULE_SHIFT 20
+#define RRR_MMAP_COLLECTION_GRANULE_SIZE ((uint64_t) 1 << RRR_MMAP_COLLECTION_GRANULE_SHIFT)
+
 // Flag set after a certain number of allocations to prevent more
 // usage. This allows new memory to be allocated in series in new
 // and clean mmaps.
@@ -53,16 +59,11 @@ struct rrr_mmap {
 	int is_shared;
 };
 
-struct rrr_mmap_heap_index {
-	uintptr_t heap_min;
-	uintptr_t heap_max;
-	size_t mmap_idx;
-};
-
 struct rrr_mmap_collection {
 	size_t mmap_count;
+	uint64_t reclaimed_count;
+	uint64_t allocation_failure_count;
 	struct rrr_mmap mmaps[RRR_MMAP_COLLECTION_MAX];
-	struct rrr_mmap_heap_index minmax[RRR_MMAP_COLLECTION_MAX];
 };
 
 void rrr_mmap_free (
@@ -107,9 +108,6 @@ void *rrr_mmap_collection_allocate (
 		int is_shared
 );
 int rrr_mmap_collections_free (
-		struct rrr_mmap_collection *collections,
-		size_t collection_count,
-		pthread_rwlock_t *index_lock,
 		void *ptr
 );
 
@@ -24,6 +24,41 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdint.h>
 
+#include "allocator.h"
+#include "rrr_mmap.h"
+
+#define RRR_MMAP_STATS_GROUP_COUNT          (RRR_ALLOCATOR_GROUP_MAX + 1)
+
+// Bucket n holds allocations of up to 16 << n bytes, the last
+// bucket holds everything larger
+#define RRR_MMAP_STATS_HISTOGRAM_BUCKETS    13
+
+struct rrr_mmap_stats_heap {
+	uint64_t heap_size;
+	uint64_t bytes_in_use;
+	uint64_t bytes_free;
+	uint64_t largest_free_chunk;
+	uint64_t allocation_count;
+};
+
+// Counts ending with _count are totals since program start except for
+// the current number of mmaps and slabs. Slab objects in the caches
+// of threads are counted as being in use.
+struct rrr_mmap_stats_group {
+	uint64_t bytes_in_use;
+	uint64_t bytes_reserved;
+	uint64_t histogram[RRR_MMAP_STATS_HISTOGRAM_BUCKETS];
+	uint64_t mmap_count;
+	uint64_t mmap_bytes_free;
+	uint64_t mmap_largest_free_chunk;
+	uint64_t mmap_reclaimed_count;
+	uint64_t mmap_allocation_failure_count;
+	uint64_t slab_count;
+	uint64_t slab_released_count;
+	uint64_t slab_allocation_failure_count;
+	struct rrr_mmap_stats_heap heaps[RRR_MMAP_COLLECTION_MAX];
+};
+
 struct rrr_mmap_stats {
 	uint64_t mmap_total_count;
 	uint64_t mmap_total_empty_count;
@@ -31,6 +66,21 @@ struct rrr_mmap_stats {
 	uint64_t mmap_total_heap_size;
 	uint64_t mmap_total_allocation;
 	uint64_t mmap_total_free;
+	uint64_t slab_total_count;
+	uint64_t slab_total_empty_count;
+	uint64_t slab_total_released_count;
+	uint64_t slab_total_bytes_in_use;
+	struct rrr_mmap_stats_group groups[RRR_MMAP_STATS_GROUP_COUNT];
 };
 
+static inline unsigned int rrr_mmap_stats_histogram_bucket (
+		uint64_t bytes
+) {
+	unsigned int bucket = 0;
+	while (bucket < RRR_MMAP_STATS_HISTOGRAM_BUCKETS - 1 && bytes > ((uint64_t) 16 << bucket)) {
+		bucket++;
+	}
+	return bucket;
+}
+
 #endif /* RRR_MMAP_STATS_H */
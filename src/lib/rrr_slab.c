@@ -0,0 +1,536 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "allocator.h"
+#include "rrr_slab.h"
+#include "rrr_mmap_stats.h"
+#include "util/posix.h"
+
+/*
+ * Description of slab allocator:
+ *
+ * Allocations are rounded up to one of a number of size classes. Each size
+ * class of each allocation group has its own slabs, and all objects in a slab
+ * have the same size. A slab starts with a header followed by the objects.
+ *
+ * Slabs are carved from a single region of reserved address space and are
+ * aligned to the slab size. The slab of an object is found by masking its
+ * address, and whether a pointer belongs to the slab allocator is found by
+ * checking if it is inside the region.
+ *
+ * Each thread keeps a magazine of free objects for every size class. Objects
+ * are allocated from and freed to the magazine without locking. An empty
+ * magazine is refilled with half its size from the slabs of the class and
+ * half of a full magazine is returned to the slabs, both with the class lock
+ * held. Slabs being empty during a number of maintenance runs are given back
+ * to the OS while keeping the address space.
+ *
+ */
+
+#define RRR_SLAB_MAGIC          0x534c4142 // SLAB
+#define RRR_SLAB_HEADER_SIZE    64
+#define RRR_SLAB_CLASS_COUNT    36
+#define RRR_SLAB_GROUP_COUNT    (RRR_ALLOCATOR_GROUP_MAX + 1)
+#define RRR_SLAB_COUNT_MAX      (RRR_SLAB_REGION_SIZE / RRR_SLAB_SIZE)
+
+struct rrr_slab {
+	uint32_t magic;
+	uint16_t class_index;
+	uint8_t group;
+	uint8_t is_partial;
+	uint32_t object_size;
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t bump_count;
+	uint32_t empty_strikes;
+	void *free_list;
+	struct rrr_slab *prev;
+	struct rrr_slab *next;
+};
+
+struct rrr_slab_class {
+	pthread_mutex_t lock;
+	// Slabs with free objects, full slabs are not in any list
+	struct rrr_slab *partial_first;
+	uint64_t slab_count;
+	uint64_t objects_used;
+	uint64_t released_count;
+	uint64_t allocation_failure_count;
+};
+
+struct rrr_slab_magazine {
+	unsigned int count;
+	void *objects[RRR_SLAB_MAGAZINE_SIZE];
+};
+
+struct rrr_slab_thread_cache {
+	struct rrr_slab_magazine magazines[RRR_SLAB_GROUP_COUNT][RRR_SLAB_CLASS_COUNT];
+};
+
+char *rrr_slab_region_base = NULL;
+
+static void *rrr_slab_region_mapping = NULL;
+static int rrr_slab_region_failed = 0;
+static size_t rrr_slab_region_carved = 0;
+static uint32_t rrr_slab_region_free[RRR_SLAB_COUNT_MAX];
+static size_t rrr_slab_region_free_count = 0;
+static uint64_t rrr_slab_region_released = 0;
+static pthread_mutex_t rrr_slab_region_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct rrr_slab_class rrr_slab_classes[RRR_SLAB_GROUP_COUNT][RRR_SLAB_CLASS_COUNT];
+static uint32_t rrr_slab_class_sizes[RRR_SLAB_CLASS_COUNT];
+static uint8_t rrr_slab_class_lookup[RRR_SLAB_OBJECT_MAX / 16 + 1];
+
+static pthread_once_t rrr_slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rrr_slab_key;
+static __thread struct rrr_slab_thread_cache *rrr_slab_thread_cache = NULL;
+
+static inline struct rrr_slab *__rrr_slab_of (
+		const void *ptr
+) {
+	return (struct rrr_slab *) ((uintptr_t) ptr & ~((uintptr_t) RRR_SLAB_SIZE - 1));
+}
+
+static void __rrr_slab_partial_add (
+		struct rrr_slab_class *class,
+		struct rrr_slab *slab
+) {
+	slab->prev = NULL;
+	slab->next = class->partial_first;
+	if (slab->next != NULL) {
+		slab->next->prev = slab;
+	}
+	class->partial_first = slab;
+	slab->is_partial = 1;
+}
+
+static void __rrr_slab_partial_remove (
+		struct rrr_slab_class *class,
+		struct rrr_slab *slab
+) {
+	if (slab->prev != NULL) {
+		slab->prev->next = slab->next;
+	}
+	else {
+		class->partial_first = slab->next;
+	}
+	if (slab->next != NULL) {
+		slab->next->prev = slab->prev;
+	}
+	slab->prev = NULL;
+	slab->next = NULL;
+	slab->is_partial = 0;
+}
+
+// Class lock must be held
+static struct rrr_slab *__rrr_slab_new (
+		int group,
+		uint16_t class_index
+) {
+	struct rrr_slab *slab = NULL;
+
+	pthread_mutex_lock(&rrr_slab_region_lock);
+
+	if (rrr_slab_region_base == NULL) {
+		if (rrr_slab_region_failed) {
+			goto out_unlock;
+		}
+		// Reserve one slab extra to be able to align the start
+		if ((rrr_slab_region_mapping = rrr_posix_mmap_reserve(RRR_SLAB_REGION_SIZE + RRR_SLAB_SIZE)) == NULL) {
+			RRR_MSG_0("Warning: Could not reserve address space for slab allocator, using fallback allocator\n");
+			rrr_slab_region_failed = 1;
+			goto out_unlock;
+		}
+		rrr_slab_region_base = (char *) (((uintptr_t) rrr_slab_region_mapping + RRR_SLAB_SIZE - 1) & ~((uintptr_t) RRR_SLAB_SIZE - 1));
+	}
+
+	if (rrr_slab_region_free_count > 0) {
+		slab = (struct rrr_slab *) (rrr_slab_region_base + (size_t) rrr_slab_region_free[--rrr_slab_region_free_count] * RRR_SLAB_SIZE);
+	}
+	else if (rrr_slab_region_carved < RRR_SLAB_COUNT_MAX) {
+		slab = (struct rrr_slab *) (rrr_slab_region_base + rrr_slab_region_carved * RRR_SLAB_SIZE);
+		if (rrr_posix_mmap_commit(slab, RRR_SLAB_SIZE) != 0) {
+			slab = NULL;
+			goto out_unlock;
+		}
+		rrr_slab_region_carved++;
+	}
+
+	out_unlock:
+	pthread_mutex_unlock(&rrr_slab_region_lock);
+
+	if (slab != NULL) {
+		memset(slab, '\0', sizeof(*slab));
+		slab->magic = RRR_SLAB_MAGIC;
+		slab->class_index = class_index;
+		slab->group = (uint8_t) group;
+		slab->object_size = rrr_slab_class_sizes[class_index];
+		slab->capacity = (RRR_SLAB_SIZE - RRR_SLAB_HEADER_SIZE) / slab->object_size;
+	}
+
+	return slab;
+}
+
+// Class lock must be held
+static void __rrr_slab_release (
+		struct rrr_slab *slab
+) {
+	const uint32_t index = (uint32_t) (((char *) slab - rrr_slab_region_base) / RRR_SLAB_SIZE);
+
+	slab->magic = 0;
+	rrr_posix_mmap_release(slab, RRR_SLAB_SIZE);
+
+	pthread_mutex_lock(&rrr_slab_region_lock);
+	rrr_slab_region_free[rrr_slab_region_free_count++] = index;
+	rrr_slab_region_released++;
+	pthread_mutex_unlock(&rrr_slab_region_lock);
+}
+
+static unsigned int __rrr_slab_class_take (
+		void **objects,
+		unsigned int count,
+		int group,
+		uint16_t class_index
+) {
+	struct rrr_slab_class *class = &rrr_slab_classes[group][class_index];
+
+	unsigned int taken = 0;
+
+	pthread_mutex_lock(&class->lock);
+
+	while (taken < count) {
+		struct rrr_slab *slab = class->partial_first;
+
+		if (slab == NULL) {
+			if ((slab = __rrr_slab_new(group, class_index)) == NULL) {
+				class->allocation_failure_count++;
+				break;
+			}
+			__rrr_slab_partial_add(class, slab);
+			class->slab_count++;
+		}
+
+		while (taken < count) {
+			void *object;
+			if (slab->free_list != NULL) {
+				object = slab->free_list;
+				slab->free_list = *((void **) object);
+			}
+			else if (slab->bump_count < slab->capacity) {
+				object = (char *) slab + RRR_SLAB_HEADER_SIZE + (size_t) slab->bump_count * slab->object_size;
+				slab->bump_count++;
+			}
+			else {
+				break;
+			}
+			slab->used++;
+			objects[taken++] = object;
+		}
+
+		slab->empty_strikes = 0;
+
+		if (slab->free_list == NULL && slab->bump_count == slab->capacity) {
+			__rrr_slab_partial_remove(class, slab);
+		}
+	}
+
+	class->objects_used += taken;
+
+	pthread_mutex_unlock(&class->lock);
+
+	return taken;
+}
+
+static void __rrr_slab_class_put (
+		void **objects,
+		unsigned int count,
+		int group,
+		uint16_t class_index
+) {
+	struct rrr_slab_class *class = &rrr_slab_classes[group][class_index];
+
+	pthread_mutex_lock(&class->lock);
+
+	for (unsigned int i = 0; i < count; i++) {
+		struct rrr_slab *slab = __rrr_slab_of(objects[i]);
+		*((void **) objects[i]) = slab->free_list;
+		slab->free_list = objects[i];
+		slab->used--;
+		if (!slab->is_partial) {
+			__rrr_slab_partial_add(class, slab);
+		}
+	}
+
+	class->objects_used -= count;
+
+	pthread_mutex_unlock(&class->lock);
+}
+
+static void __rrr_slab_thread_cache_flush (
+		struct rrr_slab_thread_cache *cache
+) {
+	for (int group = 0; group < RRR_SLAB_GROUP_COUNT; group++) {
+		for (uint16_t class_index = 0; class_index < RRR_SLAB_CLASS_COUNT; class_index++) {
+			struct rrr_slab_magazine *magazine = &cache->magazines[group][class_index];
+			if (magazine->count > 0) {
+				__rrr_slab_class_put(magazine->objects, magazine->count, group, class_index);
+				magazine->count = 0;
+			}
+		}
+	}
+}
+
+// Frees done by later thread exit functions create a new cache, the
+// key is then set again and this function runs once more
+static void __rrr_slab_thread_exit (
+		void *arg
+) {
+	struct rrr_slab_thread_cache *cache = arg;
+	__rrr_slab_thread_cache_flush(cache);
+	rrr_slab_thread_cache = NULL;
+	free(cache);
+}
+
+static void __rrr_slab_once (void) {
+	if (pthread_key_create(&rrr_slab_key, __rrr_slab_thread_exit) != 0) {
+		RRR_BUG("BUG: Could not create thread key in __rrr_slab_once\n");
+	}
+
+	// 16 byte steps up to 128 bytes, then four classes per power of two
+	for (int i = 0; i < RRR_SLAB_CLASS_COUNT; i++) {
+		if (i < 8) {
+			rrr_slab_class_sizes[i] = 16 * (uint32_t) (i + 1);
+		}
+		else {
+			const uint32_t base = (uint32_t) 128 << ((i - 8) / 4);
+			rrr_slab_class_sizes[i] = base + (base / 4) * (uint32_t) ((i - 8) % 4 + 1);
+		}
+	}
+
+	if (rrr_slab_class_sizes[RRR_SLAB_CLASS_COUNT - 1] != RRR_SLAB_OBJECT_MAX) {
+		RRR_BUG("BUG: Size of last class was not the maximum object size in __rrr_slab_once\n");
+	}
+
+	uint8_t class_index = 0;
+	for (size_t i = 0; i < sizeof(rrr_slab_class_lookup); i++) {
+		while (rrr_slab_class_sizes[class_index] < i * 16) {
+			class_index++;
+		}
+		rrr_slab_class_lookup[i] = class_index;
+	}
+
+	for (int group = 0; group < RRR_SLAB_GROUP_COUNT; group++) {
+		for (int class_index = 0; class_index < RRR_SLAB_CLASS_COUNT; class_index++) {
+			if (rrr_posix_mutex_init(&rrr_slab_classes[group][class_index].lock, 0) != 0) {
+				RRR_BUG("BUG: Could not initialize lock in __rrr_slab_once\n");
+			}
+		}
+	}
+}
+
+static struct rrr_slab_thread_cache *__rrr_slab_thread_cache_get (void) {
+	struct rrr_slab_thread_cache *cache = rrr_slab_thread_cache;
+
+	if (cache != NULL) {
+		return cache;
+	}
+
+	pthread_once(&rrr_slab_once, __rrr_slab_once);
+
+	if ((cache = malloc(sizeof(*cache))) == NULL) {
+		return NULL;
+	}
+
+	memset(cache, '\0', sizeof(*cache));
+
+	if (pthread_setspecific(rrr_slab_key, cache) != 0) {
+		free(cache);
+		return NULL;
+	}
+
+	rrr_slab_thread_cache = cache;
+
+	return cache;
+}
+
+// Returns NULL if the size is too large for the slabs or if the
+// region is full, the caller should then use another allocator
+void *rrr_slab_allocate (
+		size_t bytes,
+		int group
+) {
+	if (bytes > RRR_SLAB_OBJECT_MAX) {
+		return NULL;
+	}
+
+	struct rrr_slab_thread_cache *cache = __rrr_slab_thread_cache_get();
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	const uint16_t class_index = rrr_slab_class_lookup[(bytes + 15) >> 4];
+	struct rrr_slab_magazine *magazine = &cache->magazines[group][class_index];
+
+	if (magazine->count == 0) {
+		if ((magazine->count = __rrr_slab_class_take (
+				magazine->objects,
+				RRR_SLAB_MAGAZINE_SIZE / 2,
+				group,
+				class_index
+		)) == 0) {
+			return NULL;
+		}
+	}
+
+	return magazine->objects[--magazine->count];
+}
+
+void rrr_slab_free (
+		void *ptr
+) {
+	struct rrr_slab *slab = __rrr_slab_of(ptr);
+
+	if (slab->magic != RRR_SLAB_MAGIC) {
+		RRR_BUG("BUG: Pointer %p freed in rrr_slab_free is not in a slab\n", ptr);
+	}
+
+	struct rrr_slab_thread_cache *cache = __rrr_slab_thread_cache_get();
+	if (cache == NULL) {
+		__rrr_slab_class_put(&ptr, 1, slab->group, slab->class_index);
+		return;
+	}
+
+	struct rrr_slab_magazine *magazine = &cache->magazines[slab->group][slab->class_index];
+
+	// Return the oldest half, the most recently freed objects are likely still in cache
+	if (magazine->count == RRR_SLAB_MAGAZINE_SIZE) {
+		__rrr_slab_class_put(magazine->objects, RRR_SLAB_MAGAZINE_SIZE / 2, slab->group, slab->class_index);
+		memmove (
+				magazine->objects,
+				magazine->objects + RRR_SLAB_MAGAZINE_SIZE / 2,
+				sizeof(magazine->objects[0]) * (RRR_SLAB_MAGAZINE_SIZE / 2)
+		);
+		magazine->count = RRR_SLAB_MAGAZINE_SIZE / 2;
+	}
+
+	magazine->objects[magazine->count++] = ptr;
+}
+
+size_t rrr_slab_usable_size (
+		const void *ptr
+) {
+	return __rrr_slab_of(ptr)->object_size;
+}
+
+// Adds to the statistics, which are not cleared first. Objects in the
+// magazines of threads are counted as being in use.
+void rrr_slab_maintenance (
+		struct rrr_mmap_stats *stats
+) {
+	pthread_once(&rrr_slab_once, __rrr_slab_once);
+
+	for (int group = 0; group < RRR_SLAB_GROUP_COUNT; group++) {
+		struct rrr_mmap_stats_group *group_stats = &stats->groups[group];
+
+		for (int class_index = 0; class_index < RRR_SLAB_CLASS_COUNT; class_index++) {
+			struct rrr_slab_class *class = &rrr_slab_classes[group][class_index];
+
+			pthread_mutex_lock(&class->lock);
+
+			struct rrr_slab *slab = class->partial_first;
+			while (slab != NULL) {
+				struct rrr_slab *next = slab->next;
+				if (slab->used == 0) {
+					if (++slab->empty_strikes >= RRR_SLAB_MAINTENANCE_CLEANUP_STRIKES) {
+						__rrr_slab_partial_remove(class, slab);
+						__rrr_slab_release(slab);
+						class->slab_count--;
+						class->released_count++;
+					}
+					else {
+						stats->slab_total_empty_count++;
+					}
+				}
+				slab = next;
+			}
+
+			const uint64_t bytes_in_use = class->objects_used * rrr_slab_class_sizes[class_index];
+
+			stats->slab_total_count += class->slab_count;
+			stats->slab_total_bytes_in_use += bytes_in_use;
+
+			group_stats->bytes_in_use += bytes_in_use;
+			group_stats->bytes_reserved += class->slab_count * RRR_SLAB_SIZE;
+			group_stats->histogram[rrr_mmap_stats_histogram_bucket(rrr_slab_class_sizes[class_index])] += class->objects_used;
+			group_stats->slab_count += class->slab_count;
+			group_stats->slab_released_count += class->released_count;
+			group_stats->slab_allocation_failure_count += class->allocation_failure_count;
+
+			pthread_mutex_unlock(&class->lock);
+		}
+	}
+
+	pthread_mutex_lock(&rrr_slab_region_lock);
+	stats->slab_total_released_count = rrr_slab_region_released;
+	pthread_mutex_unlock(&rrr_slab_region_lock);
+}
+
+// Caller must ensure that no other threads use the allocator. Objects
+// in the magazines of other threads which are still running are lost.
+void rrr_slab_cleanup (void) {
+	if (rrr_slab_thread_cache != NULL) {
+		pthread_setspecific(rrr_slab_key, NULL);
+		free(rrr_slab_thread_cache);
+		rrr_slab_thread_cache = NULL;
+	}
+
+	if (rrr_slab_region_mapping == NULL) {
+		return;
+	}
+
+	for (int group = 0; group < RRR_SLAB_GROUP_COUNT; group++) {
+		for (int class_index = 0; class_index < RRR_SLAB_CLASS_COUNT; class_index++) {
+			struct rrr_slab_class *class = &rrr_slab_classes[group][class_index];
+			pthread_mutex_lock(&class->lock);
+			class->partial_first = NULL;
+			class->slab_count = 0;
+			class->objects_used = 0;
+			pthread_mutex_unlock(&class->lock);
+		}
+	}
+
+	pthread_mutex_lock(&rrr_slab_region_lock);
+	munmap(rrr_slab_region_mapping, RRR_SLAB_REGION_SIZE + RRR_SLAB_SIZE);
+	rrr_slab_region_mapping = NULL;
+	rrr_slab_region_base = NULL;
+	rrr_slab_region_failed = 0;
+	rrr_slab_region_carved = 0;
+	rrr_slab_region_free_count = 0;
+	pthread_mutex_unlock(&rrr_slab_region_lock);
+}
@@ -0,0 +1,62 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_SLAB_H
+#define RRR_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RRR_SLAB_SIZE                          (256 * 1024)
+#define RRR_SLAB_REGION_SIZE                   ((size_t) 1024 * 1024 * 1024)
+#define RRR_SLAB_OBJECT_MAX                    16384
+#define RRR_SLAB_MAGAZINE_SIZE                 32
+#define RRR_SLAB_MAINTENANCE_CLEANUP_STRIKES   3
+
+struct rrr_mmap_stats;
+
+// Set when slabs are carved from the region, allocations never
+// come from below or above it
+extern char *rrr_slab_region_base;
+
+static inline int rrr_slab_owns (
+		const void *ptr
+) {
+	return rrr_slab_region_base != NULL &&
+	       (uintptr_t) ptr - (uintptr_t) rrr_slab_region_base < RRR_SLAB_REGION_SIZE;
+}
+
+void *rrr_slab_allocate (
+		size_t bytes,
+		int group
+);
+void rrr_slab_free (
+		void *ptr
+);
+size_t rrr_slab_usable_size (
+		const void *ptr
+);
+void rrr_slab_maintenance (
+		struct rrr_mmap_stats *stats
+);
+void rrr_slab_cleanup (void);
+
+#endif /* RRR_SLAB_H */
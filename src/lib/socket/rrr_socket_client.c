@@ -62,6 +62,13 @@ struct rrr_socket_client_collection {
 	void (*client_fd_close_callback)(int fd, const struct sockaddr *addr, socklen_t addr_len, const char *addr_string, enum rrr_socket_client_collection_create_type create_type, short was_finalized, void *arg);
 	void *client_fd_close_callback_arg;
 
+	// Called after each read event when all messages read have been delivered (if set)
+	int (*read_done_callback)(void *arg);
+	void *read_done_callback_arg;
+
+	// Set while the user is not able to receive more data
+	int read_paused;
+
 	// Common settings
 	ssize_t read_step_max_size;
 	int read_flags_socket;
@@ -548,7 +555,9 @@ static int __rrr_socket_client_fd_event_setup (
 			goto out;
 		}
 
-		EVENT_ADD(client_fd->event_read);
+		if (!client_fd->client->collection->read_paused) {
+			EVENT_ADD(client_fd->event_read);
+		}
 	}
 
 	if (event_write_callback != NULL) {
@@ -631,6 +640,17 @@ static void __rrr_socket_client_return_value_process (
 	}
 }
 
+// Lets users flush anything gathered from the callbacks during one read event
+static int __rrr_socket_client_read_done_notify (
+		struct rrr_socket_client_collection *collection,
+		int ret
+) {
+	if (collection->read_done_callback != NULL && collection->read_done_callback(collection->read_done_callback_arg) != 0) {
+		return RRR_READ_HARD_ERROR;
+	}
+	return ret;
+}
+
 static int __rrr_socket_client_collection_read_message_complete_callback (
 		struct rrr_read_session *read_session,
 		void *arg
@@ -785,25 +805,25 @@ static void __rrr_socket_client_event_read_message (
 
 	uint64_t bytes_read = 0;
 
-	__rrr_socket_client_return_value_process (
-		collection,
-		client,
-		rrr_socket_read_message_default (
-				&bytes_read,
-				&client->read_sessions,
-				fd,
-				sizeof(struct rrr_msg),
-				collection->read_step_max_size,
-				0, // No max size
-				collection->read_flags_socket,
-				0, // No ratelimit interval
-				0, // No ratelimit max bytes
-				rrr_read_common_get_session_target_length_from_message_and_checksum,
-				NULL,
-				__rrr_socket_client_collection_read_message_complete_callback,
-				client
-		)
+	int ret = rrr_socket_read_message_default (
+		&bytes_read,
+		&client->read_sessions,
+		fd,
+		sizeof(struct rrr_msg),
+		collection->read_step_max_size,
+		0, // No max size
+		collection->read_flags_socket,
+		0, // No ratelimit interval
+		0, // No ratelimit max bytes
+		rrr_read_common_get_session_target_length_from_message_and_checksum,
+		NULL,
+		__rrr_socket_client_collection_read_message_complete_callback,
+		client
 	);
+
+	ret = __rrr_socket_client_read_done_notify(collection, ret);
+
+	__rrr_socket_client_return_value_process (collection, client, ret);
 }
 
 static void __rrr_socket_client_event_read_raw (
@@ -822,25 +842,25 @@ static void __rrr_socket_client_event_read_raw (
 
 	uint64_t bytes_read = 0;
 
-	__rrr_socket_client_return_value_process (
-		collection,
-		client,
-		rrr_socket_read_message_default (
-				&bytes_read,
-				&client->read_sessions,
-				fd,
-				4096,
-				collection->read_step_max_size,
-				0, // No max size
-				collection->read_flags_socket,
-				0, // No ratelimit interval
-				0, // No ratelimit max bytes
-				collection->get_target_size,
-				collection->get_target_size_arg,
-				__rrr_socket_client_collection_read_raw_complete_callback,
-				client
-		)
+	int ret = rrr_socket_read_message_default (
+		&bytes_read,
+		&client->read_sessions,
+		fd,
+		4096,
+		collection->read_step_max_size,
+		0, // No max size
+		collection->read_flags_socket,
+		0, // No ratelimit interval
+		0, // No ratelimit max bytes
+		collection->get_target_size,
+		collection->get_target_size_arg,
+		__rrr_socket_client_collection_read_raw_complete_callback,
+		client
 	);
+
+	ret = __rrr_socket_client_read_done_notify(collection, ret);
+
+	__rrr_socket_client_return_value_process (collection, client, ret);
 }
 
 static int __rrr_socket_client_event_read_array_tree_callback (
@@ -872,25 +892,25 @@ static void __rrr_socket_client_event_read_array_tree (
 
 	struct rrr_array array_tmp = {0};
 
-	__rrr_socket_client_return_value_process (
-		collection,
-		client,
-		rrr_socket_common_receive_array_tree (
-			&bytes_read,
-			&client->read_sessions,
-			fd,
-			collection->read_flags_socket,
-			&array_tmp,
-			collection->array_tree,
-			collection->array_do_sync_byte_by_byte,
-			collection->read_step_max_size,
-			0, // No ratelimit interval
-			0, // No ratelimit max bytes
-			collection->array_message_max_size,
-			__rrr_socket_client_event_read_array_tree_callback,
-			client
-		) & ~(RRR_READ_SOFT_ERROR) // Prevent connection closure upon parse errors (read session is still cleared by read framework)
-	);
+	int ret = rrr_socket_common_receive_array_tree (
+		&bytes_read,
+		&client->read_sessions,
+		fd,
+		collection->read_flags_socket,
+		&array_tmp,
+		collection->array_tree,
+		collection->array_do_sync_byte_by_byte,
+		collection->read_step_max_size,
+		0, // No ratelimit interval
+		0, // No ratelimit max bytes
+		collection->array_message_max_size,
+		__rrr_socket_client_event_read_array_tree_callback,
+		client
+	) & ~(RRR_READ_SOFT_ERROR); // Prevent connection closure upon parse errors (read session is still cleared by read framework)
+
+	ret = __rrr_socket_client_read_done_notify(collection, ret);
+
+	__rrr_socket_client_return_value_process (collection, client, ret);
 
 	rrr_array_clear(&array_tmp);
 }
@@ -1835,6 +1855,42 @@ void rrr_socket_client_collection_fd_close_notify_setup (
 	collection->client_fd_close_callback_arg = client_fd_close_callback_arg;
 }
 
+void rrr_socket_client_collection_read_done_notify_setup (
+		struct rrr_socket_client_collection *collection,
+		int (*read_done_callback)(void *arg),
+		void *read_done_callback_arg
+) {
+	collection->read_done_callback = read_done_callback;
+	collection->read_done_callback_arg = read_done_callback_arg;
+}
+
+// Stop or resume reading from all current and future file descriptors
+// in the collection, including accepting new connections
+void rrr_socket_client_collection_read_pause_set (
+		struct rrr_socket_client_collection *collection,
+		int pause
+) {
+	if (collection->read_paused == pause) {
+		return;
+	}
+
+	collection->read_paused = pause;
+
+	RRR_LL_ITERATE_BEGIN(collection, struct rrr_socket_client);
+		struct rrr_socket_client *client = node;
+		RRR_LL_ITERATE_BEGIN(client, struct rrr_socket_client_fd);
+			if (EVENT_INITIALIZED(node->event_read)) {
+				if (pause) {
+					EVENT_REMOVE(node->event_read);
+				}
+				else {
+					EVENT_ADD(node->event_read);
+				}
+			}
+		RRR_LL_ITERATE_END();
+	RRR_LL_ITERATE_END();
+}
+
 void rrr_socket_client_collection_event_setup (
 		struct rrr_socket_client_collection *collection,
 		int (*callback_private_data_new)(void **target, int fd, void *private_arg),
@@ -170,6 +170,15 @@ void rrr_socket_client_collection_fd_close_notify_setup (
 		void (*client_fd_close_callback)(int fd, const struct sockaddr *addr, socklen_t addr_len, const char *addr_string, enum rrr_socket_client_collection_create_type create_type, short was_finalized, void *arg),
 		void *client_fd_close_callback_arg
 );
+void rrr_socket_client_collection_read_done_notify_setup (
+		struct rrr_socket_client_collection *collection,
+		int (*read_done_callback)(void *arg),
+		void *read_done_callback_arg
+);
+void rrr_socket_client_collection_read_pause_set (
+		struct rrr_socket_client_collection *collection,
+		int pause
+);
 void rrr_socket_client_collection_event_setup (
 		struct rrr_socket_client_collection *collection,
 		int (*callback_private_data_new)(void **target, int fd, void *private_arg),
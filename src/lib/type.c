@@ -28,6 +28,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "log.h"
 #include "allocator.h"
 #include "type.h"
+#include "type_scan.h"
 #include "fixed_point.h"
 #include "socket/rrr_socket.h"
 #include "messages/msg.h"
@@ -36,37 +37,34 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "util/macro_utils.h"
 #include "util/gnu.h"
 #include "util/hex.h"
+#include "util/arena.h"
+#include "util/swar.h"
 
-static int __rrr_type_convert_integer_10 (
-		char **end,
-		long long int *result,
-		const char *value
+static void *__rrr_type_value_part_allocate (
+		struct rrr_type_value *value,
+		size_t size
 ) {
-	if (*value == '\0') {
-		return 1;
-	}
-	*result = strtoll(value, end, 10);
-	if (*end == value) {
-		return 1;
-	}
-	return 0;
+	return (value->arena != NULL
+		? rrr_arena_allocate(value->arena, size)
+		: rrr_allocate(size)
+	);
 }
 
-static int __rrr_type_convert_unsigned_integer_10 (
-		char **end,
-		unsigned long long int *result,
-		const char *value
+// Parts may have been replaced after the value was created in an
+// arena, only those still in the arena are left alone
+static void __rrr_type_value_part_free (
+		const struct rrr_type_value *value,
+		void *ptr
 ) {
-	if (*value == '\0') {
-		return 1;
-	}
-	*result = strtoull(value, end, 10);
-	if (*end == value) {
-		return 1;
+	if (ptr == NULL || (value->arena != NULL && rrr_arena_owns(value->arena, ptr))) {
+		return;
 	}
-	return 0;
+	rrr_free(ptr);
 }
 
+#define RRR_TYPE_VALUE_PART_FREE_IF_NOT_NULL(value, part) \
+	do {__rrr_type_value_part_free(value, (value)->part); (value)->part = NULL;} while (0)
+
 #define CHECK_END_AND_RETURN(length)                           \
     if (start + length > end) {                                \
         return RRR_TYPE_PARSE_INCOMPLETE;                      \
@@ -176,7 +174,7 @@ static int __rrr_type_import_int (
 	CHECK_END_AND_RETURN(total_size);
 
 	node->total_stored_length = node->element_count * (rrr_length) sizeof(uint64_t);
-	node->data = rrr_allocate(node->total_stored_length);
+	node->data = __rrr_type_value_part_allocate(node, node->total_stored_length);
 	if (node->data == NULL) {
 		RRR_MSG_0("Could not allocate memory in __rrr_type_import_int\n");
 		return RRR_TYPE_PARSE_HARD_ERR;
@@ -227,7 +225,7 @@ static int __rrr_type_import_blob (RRR_TYPE_IMPORT_ARGS) {
 	CHECK_END_AND_RETURN(total_size);
 
 	node->total_stored_length = total_size;
-	node->data = rrr_allocate(total_size);
+	node->data = __rrr_type_value_part_allocate(node, total_size);
 	if (node->data == NULL) {
 		RRR_MSG_0("Could not allocate memory in import_blob\n");
 		return RRR_TYPE_PARSE_HARD_ERR;
@@ -240,6 +238,91 @@ static int __rrr_type_import_blob (RRR_TYPE_IMPORT_ARGS) {
 	return RRR_TYPE_PARSE_OK;
 }
 
+static int __rrr_type_numeric_str_char_ok (
+		char c,
+		int is_signed
+) {
+	return (c >= '0' && c <= '9') || c == '+' || c == ' ' || c == '\t' || (is_signed && c == '-');
+}
+
+// Converts the same way as strtoll/strtoull including saturation on
+// overflow, but the whole input must be consumed. Digits are converted
+// eight at a time when possible.
+static int __rrr_type_convert_numeric_str_10 (
+		uint64_t *result,
+		const char *start,
+		const char *end,
+		int is_signed
+) {
+	const char *pos = start;
+	int is_negative = 0;
+	int is_overflow = 0;
+	uint64_t value = 0;
+
+	while (pos < end && (*pos == ' ' || *pos == '\t')) {
+		pos++;
+	}
+
+	if (pos < end && (*pos == '+' || *pos == '-')) {
+		is_negative = *pos == '-';
+		pos++;
+	}
+
+	const char *digits = pos;
+
+	while (end - pos >= 8 && rrr_swar_is_digits_8(rrr_swar_load_le64(pos))) {
+		pos += 8;
+	}
+	while (pos < end && *pos >= '0' && *pos <= '9') {
+		pos++;
+	}
+
+	if (pos == digits || pos != end) {
+		return 1;
+	}
+
+	while (end - digits > 1 && *digits == '0') {
+		digits++;
+	}
+
+	if (end - digits > 20) {
+		is_overflow = 1;
+	}
+	else {
+		// Up to 19 digits always fit, a 20th digit is checked separately
+		const char *stop = (end - digits == 20 ? end - 1 : end);
+		for (; stop - digits >= 8; digits += 8) {
+			value = value * 100000000 + rrr_swar_parse_digits_8(rrr_swar_load_le64(digits));
+		}
+		for (; digits < stop; digits++) {
+			value = value * 10 + (uint64_t) (*digits - '0');
+		}
+		if (digits < end) {
+			const uint64_t last = (uint64_t) (*digits - '0');
+			if (value > (UINT64_MAX - last) / 10) {
+				is_overflow = 1;
+			}
+			else {
+				value = value * 10 + last;
+			}
+		}
+	}
+
+	if (is_signed) {
+		if (is_negative) {
+			*result = (is_overflow || value > (uint64_t) INT64_MAX + 1 ? (uint64_t) INT64_MIN : 0 - value);
+		}
+		else {
+			*result = (is_overflow || value > (uint64_t) INT64_MAX ? (uint64_t) INT64_MAX : value);
+		}
+	}
+	else {
+		*result = (is_overflow ? UINT64_MAX : (is_negative ? 0 - value : value));
+	}
+
+	return 0;
+}
+
 static int __rrr_type_import_numeric_str_raw (
 		char target[8],
 		rrr_length *parsed_bytes,
@@ -255,74 +338,50 @@ static int __rrr_type_import_numeric_str_raw (
 		RRR_BUG("BUG: end was less than start in rrr_type_import_istr_raw\n");
 	}
 
-	int found_end_char = 0;
-	int total_length = 0;
-
-	union {
-		long long int s;
-		unsigned long long int u;
-	} result;
-
-	result.s = 0;
+	// At most 63 characters are allowed
+	const char *limit = (end - start > 64 ? start + 64 : end);
+	const char *pos = start;
 
-	// Must match return argument
-	RRR_ASSERT(8==sizeof(result),rrr_type_import_numeric_str_raw_size_of_result_correct);
-
-	char tmp[64];
-	memset(tmp, '\0', sizeof(tmp));
-
-	for (const char *pos = start; pos < end; pos++) {
-		if ((*pos >= '0' && *pos <= '9') || *pos == '+' || *pos == ' ' || *pos == '\t' || (is_signed && *pos == '-')) {
-			tmp[total_length++] = *pos;
-
-			// Make sure we don't overwrite last \0 needed by conversion function
-			if ((unsigned int) total_length > sizeof(tmp) - 1) {
-				RRR_MSG_0("Import failed in rrr_type_import_numeric_str_raw, number too long (> 63 characters)\n");
-				return RRR_TYPE_PARSE_SOFT_ERR;
-			}
+	while (pos < limit) {
+		if (limit - pos >= 8 && rrr_swar_is_digits_8(rrr_swar_load_le64(pos))) {
+			pos += 8;
 			continue;
 		}
-		else {
-			found_end_char = 1;
+		if (!__rrr_type_numeric_str_char_ok(*pos, is_signed)) {
 			break;
 		}
+		pos++;
 	}
 
-	if (found_end_char == 0) {
+	if (pos == limit) {
+		if (pos - start == 64) {
+			RRR_MSG_0("Import failed in rrr_type_import_numeric_str_raw, number too long (> 63 characters)\n");
+			return RRR_TYPE_PARSE_SOFT_ERR;
+		}
 		return RRR_TYPE_PARSE_INCOMPLETE;
 	}
 
+	const rrr_length total_length = (rrr_length) (pos - start);
+
 	if (total_length == 0) {
 		RRR_MSG_0("Import failed in rrr_type_import_numeric_str_raw, no number found.\n");
 		return RRR_TYPE_PARSE_SOFT_ERR;
 	}
 
-	char *convert_end = NULL;
+	uint64_t result = 0;
 
-	if (is_signed) {
-		if (__rrr_type_convert_integer_10(&convert_end, &result.s, tmp)) {
-			RRR_MSG_0("Error while converting signed integer in rrr_type_import_numeric_str_raw A, input data was '%s'\n", tmp);
-			return RRR_TYPE_PARSE_SOFT_ERR;
-		}
-	}
-	else {
-		if (__rrr_type_convert_unsigned_integer_10(&convert_end, &result.u, tmp)) {
-			RRR_MSG_0("Error while converting unsigned integer in rrr_type_import_numeric_str_raw A, input data was '%s'\n", tmp);
-			return RRR_TYPE_PARSE_SOFT_ERR;
-		}
-	}
+	// Must match return argument
+	RRR_ASSERT(8==sizeof(result),rrr_type_import_numeric_str_raw_size_of_result_correct);
 
-	if (convert_end - tmp != total_length) {
-		RRR_MSG_0("Error while converting number in rrr_type_import_numeric_str_raw B, input data was '%s'\n", tmp);
+	if (__rrr_type_convert_numeric_str_10(&result, start, pos, is_signed) != 0) {
+		RRR_MSG_0("Error while converting %s integer in rrr_type_import_numeric_str_raw, input data was '%.*s'\n",
+				(is_signed ? "signed" : "unsigned"), (int) total_length, start);
 		return RRR_TYPE_PARSE_SOFT_ERR;
 	}
 
 	memcpy(target, &result, sizeof(result));
 
-	if (convert_end < tmp) {
-		RRR_BUG("BUG: convert_end was less than tmp in __rrr_type_import_numeric_str_raw\n");
-	}
-	*parsed_bytes = (rrr_length) total_length;
+	*parsed_bytes = total_length;
 
 	return RRR_TYPE_PARSE_OK;
 }
@@ -361,7 +420,7 @@ static int __rrr_type_import_ustr (RRR_TYPE_IMPORT_ARGS) {
 	// Keep on separate line to suppress warning from static code analysis
 	size_t allocation_size = sizeof(rrr_type_ustr);
 
-	if ((node->data = (char *) rrr_allocate(allocation_size)) == NULL) {
+	if ((node->data = (char *) __rrr_type_value_part_allocate(node, allocation_size)) == NULL) {
 		RRR_MSG_0("Could not allocate memory in __rrr_type_import_ustr\n");
 		ret = RRR_TYPE_PARSE_HARD_ERR;
 		goto out;
@@ -395,7 +454,7 @@ static int __rrr_type_import_istr (RRR_TYPE_IMPORT_ARGS) {
 	// Keep on separate line to suppress warning from static code analysis
 	size_t allocation_size = sizeof(rrr_type_istr);
 
-	if ((node->data = (char *) rrr_allocate(allocation_size)) == NULL) {
+	if ((node->data = (char *) __rrr_type_value_part_allocate(node, allocation_size)) == NULL) {
 		RRR_MSG_0("Could not allocate memory in __rrr_type_import_istr\n");
 		ret = RRR_TYPE_PARSE_HARD_ERR;
 		goto out;
@@ -413,15 +472,18 @@ static int __rrr_type_import_istr (RRR_TYPE_IMPORT_ARGS) {
 	return ret;
 }
 
-static int __rrr_type_validate_sep (char c) {
-	return RRR_TYPE_CHAR_IS_SEP(c);
-}
-
-static int __rrr_type_validate_stx (char c) {
-	return RRR_TYPE_CHAR_IS_STX(c);
+static rrr_length __rrr_type_scan_not_stx (const char *buf, rrr_length len) {
+	rrr_length pos = 0;
+	for (; pos < len; pos++) {
+		const char c = buf[pos];
+		if (!RRR_TYPE_CHAR_IS_STX(c)) {
+			break;
+		}
+	}
+	return pos;
 }
 
-static int __rrr_type_import_sep_stx (RRR_TYPE_IMPORT_ARGS, int (*validate)(char c)) {
+static int __rrr_type_import_sep_stx (RRR_TYPE_IMPORT_ARGS, rrr_length (*scan_invalid)(const char *buf, rrr_length len)) {
 	if (node->data != NULL) {
 		RRR_BUG("data was not NULL in import_sep_stx\n");
 	}
@@ -430,23 +492,14 @@ static int __rrr_type_import_sep_stx (RRR_TYPE_IMPORT_ARGS, int (*validate)(char
 
 	CHECK_END_AND_RETURN(total_size);
 
-	rrr_length found = 0;
-	for (const char *start_tmp = start; start_tmp < end && found < total_size; start_tmp++) {
-		char c = *start_tmp;
-		if (!validate(c)) {
-			RRR_MSG_0("Invalid separator character 0x%01x\n", c);
-			return RRR_TYPE_PARSE_SOFT_ERR;
-		}
-
-		found++;
-	}
-
+	// Enough data is present after the end check
+	rrr_length found = scan_invalid(start, total_size);
 	if (found != total_size) {
-		RRR_MSG_0("Not enough special characters found\n");
+		RRR_MSG_0("Invalid separator character 0x%01x\n", start[found]);
 		return RRR_TYPE_PARSE_SOFT_ERR;
 	}
 
-	node->data = rrr_allocate((size_t) found);
+	node->data = __rrr_type_value_part_allocate(node, (size_t) found);
 	if (node->data == NULL) {
 		RRR_MSG_0("Could not allocate memory in import_sep_stx\n");
 		return RRR_TYPE_PARSE_HARD_ERR;
@@ -462,7 +515,7 @@ static int __rrr_type_import_sep_stx (RRR_TYPE_IMPORT_ARGS, int (*validate)(char
 
 static int __rrr_type_import_sep (RRR_TYPE_IMPORT_ARGS) {
 	int ret = RRR_TYPE_PARSE_OK;
-	if ((ret = __rrr_type_import_sep_stx(node, parsed_bytes, start, end, __rrr_type_validate_sep)) != RRR_TYPE_PARSE_OK) {
+	if ((ret = __rrr_type_import_sep_stx(node, parsed_bytes, start, end, rrr_type_scan_not_sep)) != RRR_TYPE_PARSE_OK) {
 		if (ret != RRR_TYPE_PARSE_INCOMPLETE) {
 			RRR_MSG_0("Import of sep type failed\n");
 		}
@@ -472,7 +525,7 @@ static int __rrr_type_import_sep (RRR_TYPE_IMPORT_ARGS) {
 
 static int __rrr_type_import_stx (RRR_TYPE_IMPORT_ARGS) {
 	int ret = RRR_TYPE_PARSE_OK;
-	if ((ret = __rrr_type_import_sep_stx(node, parsed_bytes, start, end, __rrr_type_validate_stx)) != RRR_TYPE_PARSE_OK) {
+	if ((ret = __rrr_type_import_sep_stx(node, parsed_bytes, start, end, __rrr_type_scan_not_stx)) != RRR_TYPE_PARSE_OK) {
 		RRR_MSG_0("Import of stx type failed\n");
 	}
 	return ret;
@@ -480,14 +533,24 @@ static int __rrr_type_import_stx (RRR_TYPE_IMPORT_ARGS) {
 
 static int __rrr_type_msg_to_host_single (
 		struct rrr_msg_msg *msg_msg,
-		rrr_length max_size
+		rrr_length max_size,
+		int is_batch_member
 ) {
 	struct rrr_msg *msg = (struct rrr_msg *) msg_msg;
 
 	int ret = 0;
 	rrr_length target_size = 0;
 
-	{
+	// Members of a batch have no checksums of their own
+	if (is_batch_member) {
+		if (max_size < sizeof(*msg)) {
+			RRR_MSG_0("Batch member was truncated in __rrr_type_msg_to_host_single\n");
+			ret = RRR_TYPE_PARSE_SOFT_ERR;
+			goto out;
+		}
+		target_size = rrr_be32toh(msg->msg_size);
+	}
+	else {
 		rrr_length target_size_tmp = 0;
 		if (rrr_msg_get_target_size_and_check_checksum (
 				&target_size_tmp,
@@ -514,12 +577,24 @@ static int __rrr_type_msg_to_host_single (
 		goto out;
 	}
 
-	if (rrr_msg_check_data_checksum_and_length(msg, target_size) != 0) {
+	if (is_batch_member) {
+		if (!RRR_MSG_IS_RRR_MESSAGE(msg)) {
+			RRR_MSG_0("Batch member of type %u was not an RRR message in __rrr_type_msg_to_host_single\n", msg->msg_type);
+			ret = RRR_TYPE_PARSE_SOFT_ERR;
+			goto out;
+		}
+	}
+	else if (rrr_msg_check_data_checksum_and_length(msg, target_size) != 0) {
 		RRR_MSG_0("Invalid checksum for message data in __rrr_type_msg_to_host_single\n");
 		ret = RRR_TYPE_PARSE_SOFT_ERR;
 		goto out;
 	}
 
+	// Members of a batch are converted by the caller
+	if (RRR_MSG_IS_BATCH(msg)) {
+		goto out;
+	}
+
 	if (rrr_msg_msg_to_host_and_verify(msg_msg, target_size) != 0) {
 		RRR_MSG_0("Message was invalid in __rrr_type_msg_to_host_single\n");
 		ret = RRR_TYPE_PARSE_SOFT_ERR;
@@ -530,11 +605,60 @@ static int __rrr_type_msg_to_host_single (
 	return ret;
 }
 
+static int __rrr_type_msg_batch_unpack (
+		rrr_length *member_count,
+		struct rrr_type_value *node,
+		rrr_length pos
+) {
+	const struct rrr_msg *batch = (const struct rrr_msg *) (node->data + pos);
+	const rrr_length head_size = (rrr_length) sizeof(*batch);
+	const rrr_length end = pos + batch->msg_size - head_size;
+	const rrr_u32 member_count_expected = batch->msg_value;
+
+	int ret = 0;
+
+	*member_count = 0;
+
+	// The head of the batch is removed, the members are then stored back to
+	// back like any other messages in the value
+	memmove (
+			node->data + pos,
+			node->data + pos + head_size,
+			node->total_stored_length - pos - head_size
+	);
+	node->total_stored_length -= head_size;
+
+	rrr_length count = 0;
+	while (pos < end) {
+		struct rrr_msg_msg *msg_msg = (struct rrr_msg_msg *) (node->data + pos);
+
+		if ((ret = __rrr_type_msg_to_host_single (msg_msg, end - pos, 1)) != 0) {
+			goto out;
+		}
+
+		pos += MSG_TOTAL_SIZE(msg_msg);
+		count++;
+	}
+
+	if (count != member_count_expected) {
+		RRR_MSG_0("Member count mismatch in batch message in __rrr_type_msg_batch_unpack (%" PRIrrrl "<>%" PRIu32 ")\n",
+				count, member_count_expected);
+		ret = RRR_TYPE_PARSE_SOFT_ERR;
+		goto out;
+	}
+
+	*member_count = count;
+
+	out:
+	return ret;
+}
+
 static int __rrr_type_msg_unpack (RRR_TYPE_UNPACK_ARGS) {
 	int ret = 0;
 
 	// It is not possible to specify a multi-value msg definition, but we
-	// support it here for now anyway
+	// support it here for now anyway. A batch message is also unpacked into
+	// multiple values.
 
 	rrr_length pos = 0;
 	rrr_length count = 0;
@@ -544,10 +668,23 @@ static int __rrr_type_msg_unpack (RRR_TYPE_UNPACK_ARGS) {
 
 		rrr_length max_size = node->total_stored_length - pos;
 
-		if ((ret = __rrr_type_msg_to_host_single (msg_msg, max_size)) != 0) {
+		if ((ret = __rrr_type_msg_to_host_single (msg_msg, max_size, 0)) != 0) {
 			goto out;
 		}
 
+		if (RRR_MSG_IS_BATCH(msg)) {
+			const rrr_length members_size = msg->msg_size - (rrr_length) sizeof(*msg);
+			rrr_length member_count = 0;
+
+			if ((ret = __rrr_type_msg_batch_unpack (&member_count, node, pos)) != 0) {
+				goto out;
+			}
+
+			pos += members_size;
+			count += member_count;
+			continue;
+		}
+
 		pos += msg->msg_size;
 		count++;
 	}
@@ -623,7 +760,7 @@ static int __rrr_type_import_msg (RRR_TYPE_IMPORT_ARGS) {
 		goto out;
 	}
 
-	node->data = rrr_allocate((rrr_length) target_size_total);
+	node->data = __rrr_type_value_part_allocate(node, (rrr_length) target_size_total);
 	if (node->data == NULL) {
 		RRR_MSG_0("Could not allocate memory in __rrr_type_import_msg\n");
 		ret = RRR_TYPE_PARSE_HARD_ERR;
@@ -904,7 +1041,7 @@ static int __rrr_type_import_fixp (RRR_TYPE_IMPORT_ARGS) {
 	// Keep on separate line to suppress warning from static code analysis
 	size_t allocation_size = sizeof(fixp);
 
-	if ((node->data = (char *) rrr_allocate(allocation_size)) == NULL) {
+	if ((node->data = (char *) __rrr_type_value_part_allocate(node, allocation_size)) == NULL) {
 		RRR_MSG_0("Could not allocate memory in __rrr_type_import_fixp\n");
 		ret = RRR_TYPE_PARSE_HARD_ERR;
 		goto out;
@@ -940,19 +1077,18 @@ static int __get_import_length_str (RRR_TYPE_GET_IMPORT_LENGTH_ARGS) {
 	}
 	start++;
 
-	int prev_was_backslash = 0;
-	for (; start < end; start++) {
-		char c = *start;
-		if (!prev_was_backslash && c == '"') {
-			ret = RRR_TYPE_PARSE_OK;
+	// Skip to the next quote or backslash, the byte following a
+	// backslash is always part of the string
+	while (start < end) {
+		start += rrr_type_scan_quote_or_escape(start, (rrr_length) (end - start));
+		if (start >= end) {
 			break;
 		}
-		else if (!prev_was_backslash && c == '\\') {
-			prev_was_backslash = 1;
-		}
-		else {
-			prev_was_backslash = 0;
+		if (*start == '"') {
+			ret = RRR_TYPE_PARSE_OK;
+			break;
 		}
+		start += 2;
 	}
 
 	if (ret == RRR_TYPE_PARSE_OK) {
@@ -973,22 +1109,16 @@ static int __get_import_length_nsep (RRR_TYPE_GET_IMPORT_LENGTH_ARGS) {
 
 	int ret = RRR_TYPE_PARSE_INCOMPLETE;
 
-	rrr_length length = 0;
-
 	// Parse any number of bytes until a separator is found.
-	for (const char *pos = start; pos < end; pos++) {
-		if (RRR_TYPE_CHAR_IS_SEP_A(*pos)||RRR_TYPE_CHAR_IS_SEP_F(*pos)) {
-			if (length == 0) {
-				RRR_MSG_0("No characters found for array nsep-field, only separator found\n");
-				ret = RRR_TYPE_PARSE_SOFT_ERR;
-			}
-			else {
-				ret = RRR_TYPE_PARSE_OK;
-			}
-			break;
+	rrr_length length = rrr_type_scan_nsep_end(start, (rrr_length) (end - start));
+	if (length < end - start) {
+		if (length == 0) {
+			RRR_MSG_0("No characters found for array nsep-field, only separator found\n");
+			ret = RRR_TYPE_PARSE_SOFT_ERR;
+		}
+		else {
+			ret = RRR_TYPE_PARSE_OK;
 		}
-
-		length++;
 	}
 
 	*import_length = length;
@@ -1070,10 +1200,16 @@ static int __rrr_type_import_str (RRR_TYPE_IMPORT_ARGS) {
 	node->import_length = import_length;
 	*parsed_bytes = parsed_bytes_tmp + 2;
 
-	// Strip out escape sequences inside of the string
+	// Strip out escape sequences inside of the string, starting at the
+	// first backslash if any
+	const char *first_backslash = memchr(node->data, '\\', node->total_stored_length);
+	if (first_backslash == NULL) {
+		goto out;
+	}
+
 	int prev_was_backslash = 0;
-	rrr_length wpos = 0;
-	for (rrr_length i = 0; i < node->total_stored_length; i++) {
+	rrr_length wpos = (rrr_length) (first_backslash - node->data);
+	for (rrr_length i = wpos; i < node->total_stored_length; i++) {
 		char c = node->data[i];
 		if (!prev_was_backslash && c == '\\') {
 			prev_was_backslash = 1;
@@ -1337,9 +1473,9 @@ void rrr_type_value_destroy (
 	}
 	RRR_FREE_IF_NOT_NULL(template->import_length_ref);
 	RRR_FREE_IF_NOT_NULL(template->element_count_ref);
-	RRR_FREE_IF_NOT_NULL(template->tag);
-	RRR_FREE_IF_NOT_NULL(template->data);
-	rrr_free(template);
+	RRR_TYPE_VALUE_PART_FREE_IF_NOT_NULL(template, tag);
+	RRR_TYPE_VALUE_PART_FREE_IF_NOT_NULL(template, data);
+	__rrr_type_value_part_free(template, template);
 }
 
 int rrr_type_value_set_tag (
@@ -1347,9 +1483,9 @@ int rrr_type_value_set_tag (
 		const char *tag,
 		rrr_length tag_length
 ) {
-	RRR_FREE_IF_NOT_NULL(value->tag);
+	RRR_TYPE_VALUE_PART_FREE_IF_NOT_NULL(value, tag);
 	if (tag_length > 0) {
-		value->tag = rrr_allocate(tag_length + 1);
+		value->tag = __rrr_type_value_part_allocate(value, tag_length + 1);
 		if (value->tag == NULL) {
 			RRR_MSG_0("Could not allocate tag in rrr_type_value_set_tag\n");
 			return 1;
@@ -1370,26 +1506,30 @@ void rrr_type_value_set_data (
 		RRR_BUG("BUG: Data length not divisible by element count in rrr_type_value_set_data or element count was 0\n");
 	}
 
-	RRR_FREE_IF_NOT_NULL(value->data);
+	RRR_TYPE_VALUE_PART_FREE_IF_NOT_NULL(value, data);
 	value->total_stored_length = data_length;
 	value->data = data;
 }
 
-int rrr_type_value_new (
+static int __rrr_type_value_new (
 		struct rrr_type_value **result,
+		struct rrr_arena *arena,
 		const struct rrr_type_definition *type,
 		rrr_type_flags flags,
 		rrr_length tag_length,
 		const char *tag,
 		rrr_length import_length,
-		char *import_length_ref,
+		const char *import_length_ref,
 		rrr_length element_count,
 		const char *element_count_ref,
 		rrr_length stored_length
 ) {
 	int ret = 0;
 
-	struct rrr_type_value *value = rrr_allocate(sizeof(*value));
+	struct rrr_type_value *value = (arena != NULL
+		? rrr_arena_allocate(arena, sizeof(*value))
+		: rrr_allocate(sizeof(*value))
+	);
 	if (value == NULL) {
 		RRR_MSG_0("Could not allocate template in rrr_type_value_new\n");
 		ret = 1;
@@ -1398,6 +1538,8 @@ int rrr_type_value_new (
 
 	memset(value, '\0', sizeof(*value));
 
+	value->arena = arena;
+
 	value->flags = flags;
 	value->tag_length = tag_length;
 	value->element_count = element_count;
@@ -1422,7 +1564,7 @@ int rrr_type_value_new (
 	}
 
 	if (stored_length > 0) {
-		value->data = rrr_allocate(stored_length);
+		value->data = __rrr_type_value_part_allocate(value, stored_length);
 		if (value->data == NULL) {
 			RRR_MSG_0("Could not allocate data for template in rrr_type_value_new\n");
 			ret = 1;
@@ -1446,6 +1588,58 @@ int rrr_type_value_new (
 	return ret;
 }
 
+int rrr_type_value_new (
+		struct rrr_type_value **result,
+		const struct rrr_type_definition *type,
+		rrr_type_flags flags,
+		rrr_length tag_length,
+		const char *tag,
+		rrr_length import_length,
+		char *import_length_ref,
+		rrr_length element_count,
+		const char *element_count_ref,
+		rrr_length stored_length
+) {
+	return __rrr_type_value_new (
+			result,
+			NULL,
+			type,
+			flags,
+			tag_length,
+			tag,
+			import_length,
+			import_length_ref,
+			element_count,
+			element_count_ref,
+			stored_length
+	);
+}
+
+int rrr_type_value_new_arena (
+		struct rrr_type_value **result,
+		struct rrr_arena *arena,
+		const struct rrr_type_definition *type,
+		rrr_type_flags flags,
+		rrr_length tag_length,
+		const char *tag,
+		rrr_length element_count,
+		rrr_length stored_length
+) {
+	return __rrr_type_value_new (
+			result,
+			arena,
+			type,
+			flags,
+			tag_length,
+			tag,
+			stored_length,
+			NULL,
+			element_count,
+			NULL,
+			stored_length
+	);
+}
+
 int rrr_type_value_new_simple (
 		struct rrr_type_value **result,
 		const struct rrr_type_definition *type,
@@ -1517,8 +1711,9 @@ int rrr_type_new_h (
 	return ret;
 }
 
-int rrr_type_value_clone (
+static int __rrr_type_value_clone (
 		struct rrr_type_value **target,
+		struct rrr_arena *arena,
 		const struct rrr_type_value *source,
 		int do_clone_data
 ) {
@@ -1526,8 +1721,11 @@ int rrr_type_value_clone (
 
 	*target = NULL;
 
-	struct rrr_type_value *new_value;
-	if ((new_value = rrr_allocate(sizeof(*new_value))) == NULL) {
+	struct rrr_type_value *new_value = (arena != NULL
+		? rrr_arena_allocate(arena, sizeof(*new_value))
+		: rrr_allocate(sizeof(*new_value))
+	);
+	if (new_value == NULL) {
 		RRR_MSG_0("Could not allocate memory in rrr_type_value_clone\n");
 		ret = 1;
 		goto out;
@@ -1541,6 +1739,7 @@ int rrr_type_value_clone (
 	new_value->element_count_ref = NULL;
 	new_value->tag = NULL;
 	new_value->data = NULL;
+	new_value->arena = arena;
 
 	if (source->import_length_ref != NULL && (new_value->import_length_ref = rrr_strdup(source->import_length_ref)) == NULL) {
 		RRR_MSG_0("Could not duplicate string in rrr_type_value_clone\n");
@@ -1555,7 +1754,7 @@ int rrr_type_value_clone (
 	}
 
 	if (do_clone_data && source->data != NULL) {
-		if ((new_value->data = rrr_allocate(source->total_stored_length)) == NULL) {
+		if ((new_value->data = __rrr_type_value_part_allocate(new_value, source->total_stored_length)) == NULL) {
 			RRR_MSG_0("Could not allocate memory for data in rrr_type_value_clone\n");
 			ret = 1;
 			goto out;
@@ -1569,7 +1768,7 @@ int rrr_type_value_clone (
 
 	if (source->tag_length > 0) {
 		// Do not use strdup, no \0 at the end
-		if ((new_value->tag = rrr_allocate(source->tag_length + 1)) == NULL) {
+		if ((new_value->tag = __rrr_type_value_part_allocate(new_value, source->tag_length + 1)) == NULL) {
 			RRR_MSG_0("Could not allocate memory for tag in rrr_type_value_clone\n");
 			ret = 1;
 			goto out;
@@ -1592,6 +1791,23 @@ int rrr_type_value_clone (
 	return ret;
 }
 
+int rrr_type_value_clone (
+		struct rrr_type_value **target,
+		const struct rrr_type_value *source,
+		int do_clone_data
+) {
+	return __rrr_type_value_clone(target, NULL, source, do_clone_data);
+}
+
+int rrr_type_value_clone_arena (
+		struct rrr_type_value **target,
+		struct rrr_arena *arena,
+		const struct rrr_type_value *source,
+		int do_clone_data
+) {
+	return __rrr_type_value_clone(target, arena, source, do_clone_data);
+}
+
 rrr_length rrr_type_value_get_export_length (
 		const struct rrr_type_value *value
 ) {
@@ -186,6 +186,7 @@ static const union type_system_endian {
         const struct rrr_type_value *node
 
 struct rrr_type_value;
+struct rrr_arena;
 
 struct rrr_type_definition {
 	rrr_type type;
@@ -220,11 +221,15 @@ struct rrr_type_value {
 	char *element_count_ref;
 	char *tag;
 	char *data;
+	// When set, the value itself, the tag and the data may be in the
+	// arena and are then freed with it. References are always allocated
+	// separately. The value must not outlive the arena.
+	struct rrr_arena *arena;
 };
 
 #define RRR_TYPE_VALUE_TMP_CREATE(name, data, tag, type, flags, tag_length, total_length, element_count)             \
     const struct rrr_type_value name = {                                                                             \
-        NULL, NULL, type, flags, tag_length, 0, NULL, total_length, element_count, NULL, (char *) tag, (char *) data \
+        NULL, NULL, type, flags, tag_length, 0, NULL, total_length, element_count, NULL, (char *) tag, (char *) data, NULL \
     }
 
 #define RRR_TYPE_DECLARE_EXTERN(name) \
@@ -316,6 +321,16 @@ int rrr_type_value_new (
 		const char *element_count_ref,
 		rrr_length stored_length
 );
+int rrr_type_value_new_arena (
+		struct rrr_type_value **result,
+		struct rrr_arena *arena,
+		const struct rrr_type_definition *type,
+		rrr_type_flags flags,
+		rrr_length tag_length,
+		const char *tag,
+		rrr_length element_count,
+		rrr_length stored_length
+);
 int rrr_type_value_new_simple (
 		struct rrr_type_value **result,
 		const struct rrr_type_definition *type,
@@ -339,6 +354,12 @@ int rrr_type_value_clone (
 		const struct rrr_type_value *source,
 		int do_clone_data
 );
+int rrr_type_value_clone_arena (
+		struct rrr_type_value **target,
+		struct rrr_arena *arena,
+		const struct rrr_type_value *source,
+		int do_clone_data
+);
 rrr_length rrr_type_value_get_export_length (
 		const struct rrr_type_value *value
 );
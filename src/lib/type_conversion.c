@@ -28,6 +28,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "type.h"
 #include "rrr_types.h"
 #include "map.h"
+#include "array.h"
 #include "allocator.h"
 #include "util/macro_utils.h"
 #include "util/hex.h"
@@ -671,3 +672,397 @@ int rrr_type_conversion_collection_new_from_map (
 	}
 	return ret;
 }
+
+#define RRR_TYPE_CONVERSION_PLAN_CACHE_SIZE 8
+
+// Plan keys hold the properties of a value which can decide the outcome
+// of a type-only conversion. Tags never affect conversions, and of the
+// lengths only emptiness and element count > 1 are checked.
+#define RRR_TYPE_CONVERSION_PLAN_KEY_MULTI  (1 << 16)
+#define RRR_TYPE_CONVERSION_PLAN_KEY_EMPTY  (1 << 17)
+
+enum rrr_type_conversion_plan_action {
+	RRR_TYPE_CONVERSION_PLAN_KEEP,
+	RRR_TYPE_CONVERSION_PLAN_RETYPE,
+	RRR_TYPE_CONVERSION_PLAN_GENERIC
+};
+
+enum rrr_type_conversion_plan_outcome {
+	RRR_TYPE_CONVERSION_PLAN_OUTCOME_NOT_POSSIBLE,
+	RRR_TYPE_CONVERSION_PLAN_OUTCOME_RETYPE,
+	RRR_TYPE_CONVERSION_PLAN_OUTCOME_DATA
+};
+
+struct rrr_type_conversion_plan_step {
+	enum rrr_type_conversion_plan_action action;
+	const struct rrr_type_definition *definition;
+};
+
+struct rrr_type_conversion_plan {
+	int in_use;
+	uint32_t hash;
+	size_t value_count;
+	uint32_t *keys;
+	struct rrr_type_conversion_plan_step *steps;
+};
+
+struct rrr_type_conversion_plan_cache {
+	const struct rrr_type_conversion_collection *list;
+	int flags;
+	uint64_t hits;
+	uint64_t misses;
+	size_t wpos;
+	uint32_t *keys_tmp;
+	size_t keys_tmp_count;
+	struct rrr_type_conversion_plan plans[RRR_TYPE_CONVERSION_PLAN_CACHE_SIZE];
+};
+
+static uint32_t __rrr_type_conversion_plan_key (
+		const struct rrr_type_value *value
+) {
+	return (uint32_t) value->definition->type |
+	       ((uint32_t) value->flags) << 8 |
+	       (value->element_count > 1 ? RRR_TYPE_CONVERSION_PLAN_KEY_MULTI : 0) |
+	       (value->total_stored_length == 0 ? RRR_TYPE_CONVERSION_PLAN_KEY_EMPTY : 0);
+}
+
+// Mirrors the ENSURE checks and the early returns of the conversion
+// functions. Any method which creates new data or looks at the value
+// data is reported as such and must be run on the actual value.
+static enum rrr_type_conversion_plan_outcome __rrr_type_conversion_plan_method (
+		const struct rrr_type_definition **definition,
+		const struct rrr_type_conversion_definition *method,
+		const int flags,
+		const uint32_t key
+) {
+	const rrr_type type = (*definition)->type;
+	const int is_blob = RRR_TYPE_IS_BLOB(type) && (!(flags & RRR_TYPE_CONVERT_F_STRICT_BLOBS) || RRR_TYPE_IS_BLOB_EXCACT(type));
+	const int is_str = RRR_TYPE_IS_STR(type) && (!(flags & RRR_TYPE_CONVERT_F_STRICT_STRINGS) || RRR_TYPE_IS_STR_EXCACT(type));
+	const int is_empty = (key & RRR_TYPE_CONVERSION_PLAN_KEY_EMPTY) != 0;
+	const int is_multi = (key & RRR_TYPE_CONVERSION_PLAN_KEY_MULTI) != 0;
+
+	int possible = 0;
+	int is_retype = 0;
+
+	if (*definition == method->to) {
+		// Identical types are always cloned
+		return RRR_TYPE_CONVERSION_PLAN_OUTCOME_RETYPE;
+	}
+
+	switch (method->identifier) {
+		case RRR_TYPE_CONVERSION_H2STR:
+		case RRR_TYPE_CONVERSION_H2VAIN:
+			possible = RRR_TYPE_IS_64(type);
+			break;
+		case RRR_TYPE_CONVERSION_BLOB2STR:
+		case RRR_TYPE_CONVERSION_BLOB2BLOB:
+			possible = is_blob;
+			is_retype = 1;
+			break;
+		case RRR_TYPE_CONVERSION_BLOB2HEX:
+			possible = is_blob;
+			break;
+		case RRR_TYPE_CONVERSION_STR2STR:
+			possible = is_str;
+			is_retype = 1;
+			break;
+		case RRR_TYPE_CONVERSION_STR2BLOB:
+			possible = is_str && !is_empty;
+			is_retype = 1;
+			break;
+		case RRR_TYPE_CONVERSION_STR2H:
+			possible = is_str;
+			break;
+		case RRR_TYPE_CONVERSION_STR2VAIN:
+			possible = is_str && !is_multi && is_empty;
+			break;
+		case RRR_TYPE_CONVERSION_MSG2BLOB:
+			possible = RRR_TYPE_IS_MSG(type);
+			is_retype = 1;
+			break;
+		case RRR_TYPE_CONVERSION_VAIN2H:
+		case RRR_TYPE_CONVERSION_VAIN2STR:
+			possible = RRR_TYPE_IS_VAIN(type);
+			break;
+		default:
+			RRR_BUG("BUG: Unknown conversion %i in __rrr_type_conversion_plan_method\n", method->identifier);
+	}
+
+	if (!possible) {
+		return RRR_TYPE_CONVERSION_PLAN_OUTCOME_NOT_POSSIBLE;
+	}
+
+	if (!is_retype) {
+		return RRR_TYPE_CONVERSION_PLAN_OUTCOME_DATA;
+	}
+
+	*definition = method->to;
+
+	return RRR_TYPE_CONVERSION_PLAN_OUTCOME_RETYPE;
+}
+
+static void __rrr_type_conversion_plan_step_make (
+		struct rrr_type_conversion_plan_step *step,
+		const struct rrr_type_definition *definition_orig,
+		const struct rrr_type_conversion_collection *list,
+		const int flags,
+		const uint32_t key
+) {
+	const struct rrr_type_definition *definition = definition_orig;
+	enum rrr_type_conversion_plan_outcome outcome = RRR_TYPE_CONVERSION_PLAN_OUTCOME_NOT_POSSIBLE;
+
+	step->action = RRR_TYPE_CONVERSION_PLAN_KEEP;
+	step->definition = NULL;
+
+	if (list->item_count == 0) {
+		step->action = RRR_TYPE_CONVERSION_PLAN_GENERIC;
+		return;
+	}
+
+	for (size_t i = 0; i < list->item_count; i++) {
+		outcome = __rrr_type_conversion_plan_method(&definition, list->items[i], flags, key);
+		if (outcome == RRR_TYPE_CONVERSION_PLAN_OUTCOME_DATA) {
+			step->action = RRR_TYPE_CONVERSION_PLAN_GENERIC;
+			return;
+		}
+		if (outcome == RRR_TYPE_CONVERSION_PLAN_OUTCOME_NOT_POSSIBLE && !(flags & RRR_TYPE_CONVERT_F_ON_ERROR_TRY_NEXT)) {
+			// Whole list fails, value is left unchanged
+			return;
+		}
+	}
+
+	// The list reports not possible if the last method fails, earlier
+	// successful conversions are then discarded
+	if (outcome == RRR_TYPE_CONVERSION_PLAN_OUTCOME_RETYPE && definition != definition_orig) {
+		step->action = RRR_TYPE_CONVERSION_PLAN_RETYPE;
+		step->definition = definition;
+	}
+}
+
+static void __rrr_type_conversion_plan_clear (
+		struct rrr_type_conversion_plan *plan
+) {
+	RRR_FREE_IF_NOT_NULL(plan->keys);
+	RRR_FREE_IF_NOT_NULL(plan->steps);
+	memset(plan, '\0', sizeof(*plan));
+}
+
+static const struct rrr_type_conversion_plan *__rrr_type_conversion_plan_find (
+		const struct rrr_type_conversion_plan_cache *cache,
+		const uint32_t hash,
+		const size_t value_count
+) {
+	for (size_t i = 0; i < RRR_TYPE_CONVERSION_PLAN_CACHE_SIZE; i++) {
+		const struct rrr_type_conversion_plan *plan = &cache->plans[i];
+		if (plan->in_use &&
+		    plan->hash == hash &&
+		    plan->value_count == value_count &&
+		    memcmp(plan->keys, cache->keys_tmp, value_count * sizeof(*plan->keys)) == 0
+		) {
+			return plan;
+		}
+	}
+	return NULL;
+}
+
+static int __rrr_type_conversion_plan_new (
+		const struct rrr_type_conversion_plan **target,
+		struct rrr_type_conversion_plan_cache *cache,
+		const struct rrr_array *array,
+		const uint32_t hash,
+		const size_t value_count
+) {
+	int ret = 0;
+
+	struct rrr_type_conversion_plan *plan = &cache->plans[cache->wpos];
+
+	cache->wpos = (cache->wpos + 1) % RRR_TYPE_CONVERSION_PLAN_CACHE_SIZE;
+
+	__rrr_type_conversion_plan_clear(plan);
+
+	// One extra element to avoid zero allocations for empty arrays
+	if ((plan->keys = rrr_allocate(sizeof(*plan->keys) * (value_count + 1))) == NULL ||
+	    (plan->steps = rrr_allocate(sizeof(*plan->steps) * (value_count + 1))) == NULL
+	) {
+		RRR_MSG_0("Could not allocate memory in __rrr_type_conversion_plan_new\n");
+		ret = RRR_TYPE_CONVERSION_HARD_ERROR;
+		goto out;
+	}
+
+	memcpy(plan->keys, cache->keys_tmp, sizeof(*plan->keys) * value_count);
+
+	size_t i = 0;
+	RRR_LL_ITERATE_BEGIN(array, const struct rrr_type_value);
+		__rrr_type_conversion_plan_step_make (
+				&plan->steps[i],
+				node->definition,
+				cache->list,
+				cache->flags,
+				plan->keys[i]
+		);
+		i++;
+	RRR_LL_ITERATE_END();
+
+	plan->hash = hash;
+	plan->value_count = value_count;
+	plan->in_use = 1;
+
+	*target = plan;
+
+	out:
+	if (ret != 0) {
+		__rrr_type_conversion_plan_clear(plan);
+	}
+	return ret;
+}
+
+static void __rrr_type_conversion_plan_value_replace (
+		struct rrr_array *array,
+		struct rrr_type_value *value_old,
+		struct rrr_type_value *value_new
+) {
+	value_new->ptr_prev = value_old->ptr_prev;
+	value_new->ptr_next = value_old->ptr_next;
+
+	if (value_new->ptr_prev != NULL) {
+		value_new->ptr_prev->ptr_next = value_new;
+	}
+	else {
+		array->ptr_first = value_new;
+	}
+
+	if (value_new->ptr_next != NULL) {
+		value_new->ptr_next->ptr_prev = value_new;
+	}
+	else {
+		array->ptr_last = value_new;
+	}
+}
+
+int rrr_type_conversion_plan_cache_new (
+		struct rrr_type_conversion_plan_cache **target,
+		const struct rrr_type_conversion_collection *list,
+		const int flags
+) {
+	struct rrr_type_conversion_plan_cache *cache = NULL;
+
+	if ((cache = rrr_allocate(sizeof(*cache))) == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_type_conversion_plan_cache_new\n");
+		return 1;
+	}
+
+	memset(cache, '\0', sizeof(*cache));
+
+	cache->list = list;
+	cache->flags = flags;
+
+	*target = cache;
+
+	return 0;
+}
+
+void rrr_type_conversion_plan_cache_destroy (
+		struct rrr_type_conversion_plan_cache *cache
+) {
+	for (size_t i = 0; i < RRR_TYPE_CONVERSION_PLAN_CACHE_SIZE; i++) {
+		__rrr_type_conversion_plan_clear(&cache->plans[i]);
+	}
+	RRR_FREE_IF_NOT_NULL(cache->keys_tmp);
+	rrr_free(cache);
+}
+
+void rrr_type_conversion_plan_cache_get_stats (
+		uint64_t *hits,
+		uint64_t *misses,
+		const struct rrr_type_conversion_plan_cache *cache
+) {
+	*hits = cache->hits;
+	*misses = cache->misses;
+}
+
+int rrr_type_convert_array_using_plan_cache (
+		struct rrr_array *array,
+		struct rrr_type_conversion_plan_cache *cache
+) {
+	int ret = 0;
+
+	struct rrr_type_value *value_new = NULL;
+	const size_t value_count = (size_t) RRR_LL_COUNT(array);
+	int did_replace = 0;
+
+	if (value_count > cache->keys_tmp_count) {
+		uint32_t *keys_new = NULL;
+		if ((keys_new = rrr_reallocate (
+				cache->keys_tmp,
+				sizeof(*keys_new) * cache->keys_tmp_count,
+				sizeof(*keys_new) * value_count
+		)) == NULL) {
+			RRR_MSG_0("Could not allocate memory in rrr_type_convert_array_using_plan_cache\n");
+			ret = RRR_TYPE_CONVERSION_HARD_ERROR;
+			goto out;
+		}
+		cache->keys_tmp = keys_new;
+		cache->keys_tmp_count = value_count;
+	}
+
+	// FNV-1a over the value keys
+	uint32_t hash = 2166136261U;
+	size_t i = 0;
+	RRR_LL_ITERATE_BEGIN(array, const struct rrr_type_value);
+		const uint32_t key = __rrr_type_conversion_plan_key(node);
+		cache->keys_tmp[i++] = key;
+		hash = (hash ^ key) * 16777619U;
+	RRR_LL_ITERATE_END();
+
+	const struct rrr_type_conversion_plan *plan = __rrr_type_conversion_plan_find(cache, hash, value_count);
+
+	if (plan != NULL) {
+		cache->hits++;
+	}
+	else {
+		cache->misses++;
+		if ((ret = __rrr_type_conversion_plan_new(&plan, cache, array, hash, value_count)) != 0) {
+			goto out;
+		}
+	}
+
+	i = 0;
+	RRR_LL_ITERATE_BEGIN(array, struct rrr_type_value);
+		const struct rrr_type_conversion_plan_step *step = &plan->steps[i++];
+
+		switch (step->action) {
+			case RRR_TYPE_CONVERSION_PLAN_KEEP:
+				break;
+			case RRR_TYPE_CONVERSION_PLAN_RETYPE:
+				node->definition = step->definition;
+				break;
+			case RRR_TYPE_CONVERSION_PLAN_GENERIC:
+				if ((ret = rrr_type_convert_using_list (
+						&value_new,
+						node,
+						cache->list,
+						cache->flags
+				)) != 0) {
+					if (ret != RRR_TYPE_CONVERSION_NOT_POSSIBLE) {
+						goto out;
+					}
+					ret = 0;
+					break;
+				}
+				__rrr_type_conversion_plan_value_replace(array, node, value_new);
+				rrr_type_value_destroy(node);
+				value_new = NULL;
+				did_replace = 1;
+				break;
+		}
+	RRR_LL_ITERATE_END();
+
+	out:
+	if (did_replace) {
+		rrr_array_tag_index_invalidate(array);
+	}
+	if (value_new != NULL) {
+		rrr_type_value_destroy(value_new);
+	}
+	return ret;
+}
@@ -37,8 +37,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define RRR_TYPE_CONVERT_F_STRICT_STRINGS       4
 
 struct rrr_map;
+struct rrr_array;
 struct rrr_type_value;
 struct rrr_type_conversion_collection;
+struct rrr_type_conversion_plan_cache;
 
 int rrr_type_convert_using_list (
 		struct rrr_type_value **target,
@@ -54,4 +56,28 @@ int rrr_type_conversion_collection_new_from_map (
 		const struct rrr_map *map
 );
 
+// A plan cache remembers, per array layout, what the conversion list
+// does to each value. Values whose conversions only change the type are
+// then converted in place, and the full list is run only where the
+// result depends on value data. The list must outlive the cache.
+int rrr_type_conversion_plan_cache_new (
+		struct rrr_type_conversion_plan_cache **target,
+		const struct rrr_type_conversion_collection *list,
+		const int flags
+);
+void rrr_type_conversion_plan_cache_destroy (
+		struct rrr_type_conversion_plan_cache *cache
+);
+void rrr_type_conversion_plan_cache_get_stats (
+		uint64_t *hits,
+		uint64_t *misses,
+		const struct rrr_type_conversion_plan_cache *cache
+);
+// Converts all values in the array in place. Values which cannot be
+// converted are left unchanged, like when the list is used directly.
+int rrr_type_convert_array_using_plan_cache (
+		struct rrr_array *array,
+		struct rrr_type_conversion_plan_cache *cache
+);
+
 #endif /* RRR_TYPE_CONVERSION_H */
@@ -0,0 +1,273 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "type.h"
+#include "type_scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#	define RRR_TYPE_SCAN_X86
+#	include <immintrin.h>
+#endif
+
+// The vector kernels compare bytes as signed values, which gives the
+// same results as the RRR_TYPE_CHAR_IS_* macros with signed char. Bytes
+// with the high bit set are never separators.
+
+static pthread_once_t rrr_type_scan_once = PTHREAD_ONCE_INIT;
+static int rrr_type_scan_level_supported = RRR_TYPE_SCAN_LEVEL_SCALAR;
+static int rrr_type_scan_level = RRR_TYPE_SCAN_LEVEL_SCALAR;
+
+static void __rrr_type_scan_init (void) {
+#ifdef RRR_TYPE_SCAN_X86
+	__builtin_cpu_init();
+	rrr_type_scan_level_supported = __builtin_cpu_supports("avx2")
+		? RRR_TYPE_SCAN_LEVEL_AVX2
+		: RRR_TYPE_SCAN_LEVEL_SSE2;
+#endif
+	rrr_type_scan_level = rrr_type_scan_level_supported;
+}
+
+static inline int __rrr_type_scan_level (void) {
+	pthread_once(&rrr_type_scan_once, __rrr_type_scan_init);
+	return rrr_type_scan_level;
+}
+
+int rrr_type_scan_level_get (void) {
+	return __rrr_type_scan_level();
+}
+
+int rrr_type_scan_level_set (
+		int level
+) {
+	__rrr_type_scan_level();
+	rrr_type_scan_level = level < rrr_type_scan_level_supported ? level : rrr_type_scan_level_supported;
+	return rrr_type_scan_level;
+}
+
+static rrr_length __rrr_type_scan_not_sep_scalar (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; pos < len; pos++) {
+		const char c = buf[pos];
+		if (!RRR_TYPE_CHAR_IS_SEP(c)) {
+			break;
+		}
+	}
+	return pos;
+}
+
+static rrr_length __rrr_type_scan_nsep_end_scalar (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; pos < len; pos++) {
+		const char c = buf[pos];
+		if (RRR_TYPE_CHAR_IS_SEP_A(c) || RRR_TYPE_CHAR_IS_SEP_F(c)) {
+			break;
+		}
+	}
+	return pos;
+}
+
+static rrr_length __rrr_type_scan_quote_or_escape_scalar (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; pos < len; pos++) {
+		const char c = buf[pos];
+		if (c == '"' || c == '\\') {
+			break;
+		}
+	}
+	return pos;
+}
+
+#ifdef RRR_TYPE_SCAN_X86
+
+#define SSE2_EQ(v,c)          _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define SSE2_RANGE(v,lo,hi)   _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)))
+#define SSE2_OR(a,b)          _mm_or_si128(a, b)
+
+static inline __m128i __rrr_type_scan_nsep_end_mask_sse2 (
+		__m128i v
+) {
+	return SSE2_OR(SSE2_OR(SSE2_EQ(v, '\n'), SSE2_EQ(v, '\r')),
+	       SSE2_OR(SSE2_OR(SSE2_EQ(v, '\t'), SSE2_EQ(v, 0)), SSE2_RANGE(v, 3, 4)));
+}
+
+static inline __m128i __rrr_type_scan_sep_mask_sse2 (
+		__m128i v
+) {
+	return SSE2_OR(SSE2_OR(__rrr_type_scan_nsep_end_mask_sse2(v), SSE2_RANGE(v, 33, 47)),
+	       SSE2_OR(SSE2_OR(SSE2_RANGE(v, 58, 64), SSE2_RANGE(v, 91, 96)), SSE2_RANGE(v, 123, 126)));
+}
+
+static rrr_length __rrr_type_scan_not_sep_sse2 (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; len - pos >= 16; pos += 16) {
+		const unsigned int mask = (unsigned int) _mm_movemask_epi8(__rrr_type_scan_sep_mask_sse2(_mm_loadu_si128((const __m128i *) (buf + pos))));
+		if (mask != 0xffff) {
+			return pos + (rrr_length) __builtin_ctz(~mask);
+		}
+	}
+	return __rrr_type_scan_not_sep_scalar(buf, pos, len);
+}
+
+static rrr_length __rrr_type_scan_nsep_end_sse2 (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; len - pos >= 16; pos += 16) {
+		const unsigned int mask = (unsigned int) _mm_movemask_epi8(__rrr_type_scan_nsep_end_mask_sse2(_mm_loadu_si128((const __m128i *) (buf + pos))));
+		if (mask != 0) {
+			return pos + (rrr_length) __builtin_ctz(mask);
+		}
+	}
+	return __rrr_type_scan_nsep_end_scalar(buf, pos, len);
+}
+
+static rrr_length __rrr_type_scan_quote_or_escape_sse2 (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; len - pos >= 16; pos += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) (buf + pos));
+		const unsigned int mask = (unsigned int) _mm_movemask_epi8(SSE2_OR(SSE2_EQ(v, '"'), SSE2_EQ(v, '\\')));
+		if (mask != 0) {
+			return pos + (rrr_length) __builtin_ctz(mask);
+		}
+	}
+	return __rrr_type_scan_quote_or_escape_scalar(buf, pos, len);
+}
+
+#define AVX2_TARGET           __attribute__((target("avx2")))
+#define AVX2_EQ(v,c)          _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define AVX2_RANGE(v,lo,hi)   _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v))
+#define AVX2_OR(a,b)          _mm256_or_si256(a, b)
+
+static inline AVX2_TARGET __m256i __rrr_type_scan_nsep_end_mask_avx2 (
+		__m256i v
+) {
+	return AVX2_OR(AVX2_OR(AVX2_EQ(v, '\n'), AVX2_EQ(v, '\r')),
+	       AVX2_OR(AVX2_OR(AVX2_EQ(v, '\t'), AVX2_EQ(v, 0)), AVX2_RANGE(v, 3, 4)));
+}
+
+static inline AVX2_TARGET __m256i __rrr_type_scan_sep_mask_avx2 (
+		__m256i v
+) {
+	return AVX2_OR(AVX2_OR(__rrr_type_scan_nsep_end_mask_avx2(v), AVX2_RANGE(v, 33, 47)),
+	       AVX2_OR(AVX2_OR(AVX2_RANGE(v, 58, 64), AVX2_RANGE(v, 91, 96)), AVX2_RANGE(v, 123, 126)));
+}
+
+static AVX2_TARGET rrr_length __rrr_type_scan_not_sep_avx2 (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; len - pos >= 32; pos += 32) {
+		const unsigned int mask = (unsigned int) _mm256_movemask_epi8(__rrr_type_scan_sep_mask_avx2(_mm256_loadu_si256((const __m256i *) (buf + pos))));
+		if (mask != 0xffffffff) {
+			return pos + (rrr_length) __builtin_ctz(~mask);
+		}
+	}
+	return __rrr_type_scan_not_sep_sse2(buf, pos, len);
+}
+
+static AVX2_TARGET rrr_length __rrr_type_scan_nsep_end_avx2 (
+		const char *buf,
+		rrr_length pos,
+		rrr_length len
+) {
+	for (; len - pos >= 32; pos += 32) {
+		const unsigned int mask = (unsigned int) _mm256_movemask_epi8(__rrr_type_scan_nsep_end_mask_avx2(_mm256_loadu_si256((const __m256i *) (buf + pos))));
+		if (mask != 0) {
+			return pos + (rrr_length) __builtin_ctz(mask);
+		}
+	}
+	return __rrr_type_scan_nsep_end_sse2(buf, pos, len);
+}
+
+#define RRR_TYPE_SCAN_DISPATCH(name)                                 \
+    do {switch (__rrr_type_scan_level()) {                           \
+        case RRR_TYPE_SCAN_LEVEL_AVX2:                               \
+            return __rrr_type_scan_##name##_avx2(buf, 0, len);       \
+        case RRR_TYPE_SCAN_LEVEL_SSE2:                               \
+            return __rrr_type_scan_##name##_sse2(buf, 0, len);       \
+        default:                                                     \
+            return __rrr_type_scan_##name##_scalar(buf, 0, len);     \
+    }} while(0)
+
+// For scans where the AVX2 kernel was not measured to be faster
+#define RRR_TYPE_SCAN_DISPATCH_SSE2(name)                            \
+    do {switch (__rrr_type_scan_level()) {                           \
+        case RRR_TYPE_SCAN_LEVEL_AVX2:                               \
+        case RRR_TYPE_SCAN_LEVEL_SSE2:                               \
+            return __rrr_type_scan_##name##_sse2(buf, 0, len);       \
+        default:                                                     \
+            return __rrr_type_scan_##name##_scalar(buf, 0, len);     \
+    }} while(0)
+
+#else
+
+#define RRR_TYPE_SCAN_DISPATCH(name)                                 \
+    return __rrr_type_scan_##name##_scalar(buf, 0, len)
+
+#define RRR_TYPE_SCAN_DISPATCH_SSE2(name)                            \
+    RRR_TYPE_SCAN_DISPATCH(name)
+
+#endif /* RRR_TYPE_SCAN_X86 */
+
+rrr_length rrr_type_scan_not_sep (
+		const char *buf,
+		rrr_length len
+) {
+	RRR_TYPE_SCAN_DISPATCH(not_sep);
+}
+
+rrr_length rrr_type_scan_nsep_end (
+		const char *buf,
+		rrr_length len
+) {
+	RRR_TYPE_SCAN_DISPATCH(nsep_end);
+}
+
+// The AVX2 kernel was not faster than SSE2 when importing quoted strings
+// and is not used
+rrr_length rrr_type_scan_quote_or_escape (
+		const char *buf,
+		rrr_length len
+) {
+	RRR_TYPE_SCAN_DISPATCH_SSE2(quote_or_escape);
+}
@@ -0,0 +1,58 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef RRR_TYPE_SCAN_H
+#define RRR_TYPE_SCAN_H
+
+#include "rrr_types.h"
+
+// Instruction set levels, the best level supported by the CPU is used
+// unless a lower level is set
+#define RRR_TYPE_SCAN_LEVEL_SCALAR  0
+#define RRR_TYPE_SCAN_LEVEL_SSE2    1
+#define RRR_TYPE_SCAN_LEVEL_AVX2    2
+
+// Each function returns the position of the first matching byte or the
+// length of the buffer if no byte matches
+
+// First byte which is not a separator (sep type)
+rrr_length rrr_type_scan_not_sep (
+		const char *buf,
+		rrr_length len
+);
+// First separator ending an nsep value (\r, \n, \t, NULL, ETX or EOT)
+rrr_length rrr_type_scan_nsep_end (
+		const char *buf,
+		rrr_length len
+);
+// First double quote or backslash (str type)
+rrr_length rrr_type_scan_quote_or_escape (
+		const char *buf,
+		rrr_length len
+);
+int rrr_type_scan_level_get (void);
+// Used by tests and benchmarks, not thread safe
+int rrr_type_scan_level_set (
+		int level
+);
+
+#endif /* RRR_TYPE_SCAN_H */
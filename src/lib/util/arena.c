@@ -0,0 +1,134 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../log.h"
+#include "../allocator.h"
+#include "arena.h"
+
+struct rrr_arena_block {
+	struct rrr_arena_block *next;
+	char *begin;
+	char *end;
+};
+
+#define RRR_ARENA_HEADER_SIZE RRR_ARENA_ALIGNED(sizeof(struct rrr_arena))
+#define RRR_ARENA_BLOCK_HEADER_SIZE RRR_ARENA_ALIGNED(sizeof(struct rrr_arena_block))
+
+int rrr_arena_new (
+		struct rrr_arena **target,
+		size_t size
+) {
+	struct rrr_arena *arena = NULL;
+
+	size = RRR_ARENA_ALIGNED(size);
+
+	if ((arena = rrr_allocate(RRR_ARENA_HEADER_SIZE + size)) == NULL) {
+		RRR_MSG_0("Could not allocate memory in rrr_arena_new\n");
+		return 1;
+	}
+
+	arena->first_begin = (char *) arena + RRR_ARENA_HEADER_SIZE;
+	arena->first_end = arena->first_begin + size;
+	arena->pos = arena->first_begin;
+	arena->end = arena->first_end;
+	arena->blocks = NULL;
+
+	*target = arena;
+
+	return 0;
+}
+
+void rrr_arena_destroy (
+		struct rrr_arena *arena
+) {
+	struct rrr_arena_block *block = arena->blocks;
+	while (block != NULL) {
+		struct rrr_arena_block *next = block->next;
+		rrr_free(block);
+		block = next;
+	}
+	rrr_free(arena);
+}
+
+static int __rrr_arena_block_new (
+		struct rrr_arena *arena,
+		size_t size
+) {
+	const size_t first_size = (size_t) (arena->first_end - arena->first_begin);
+
+	if (size < first_size) {
+		size = first_size;
+	}
+
+	struct rrr_arena_block *block = rrr_allocate(RRR_ARENA_BLOCK_HEADER_SIZE + size);
+	if (block == NULL) {
+		RRR_MSG_0("Could not allocate memory in __rrr_arena_block_new\n");
+		return 1;
+	}
+
+	block->begin = (char *) block + RRR_ARENA_BLOCK_HEADER_SIZE;
+	block->end = block->begin + size;
+	block->next = arena->blocks;
+	arena->blocks = block;
+
+	arena->pos = block->begin;
+	arena->end = block->end;
+
+	return 0;
+}
+
+void *rrr_arena_allocate (
+		struct rrr_arena *arena,
+		size_t size
+) {
+	size = RRR_ARENA_ALIGNED(size > 0 ? size : 1);
+
+	if ((size_t) (arena->end - arena->pos) < size && __rrr_arena_block_new(arena, size) != 0) {
+		return NULL;
+	}
+
+	void *result = arena->pos;
+	arena->pos += size;
+
+	return result;
+}
+
+int rrr_arena_owns (
+		const struct rrr_arena *arena,
+		const void *ptr
+) {
+	const char *pos = ptr;
+
+	if (pos >= arena->first_begin && pos < arena->first_end) {
+		return 1;
+	}
+
+	for (const struct rrr_arena_block *block = arena->blocks; block != NULL; block = block->next) {
+		if (pos >= block->begin && pos < block->end) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef RRR_ARENA_H
+#define RRR_ARENA_H
+
+#include <stddef.h>
+
+#define RRR_ARENA_ALIGN 16
+#define RRR_ARENA_ALIGNED(size) (((size) + RRR_ARENA_ALIGN - 1) & ~((size_t) RRR_ARENA_ALIGN - 1))
+
+struct rrr_arena_block;
+
+// Bump allocator where all memory is freed at once. The first block
+// is allocated together with the arena itself, allocations which do
+// not fit are placed in overflow blocks.
+struct rrr_arena {
+	char *pos;
+	char *end;
+	char *first_begin;
+	char *first_end;
+	struct rrr_arena_block *blocks;
+};
+
+int rrr_arena_new (
+		struct rrr_arena **target,
+		size_t size
+);
+void rrr_arena_destroy (
+		struct rrr_arena *arena
+);
+void *rrr_arena_allocate (
+		struct rrr_arena *arena,
+		size_t size
+);
+int rrr_arena_owns (
+		const struct rrr_arena *arena,
+		const void *ptr
+);
+
+#endif /* RRR_ARENA_H */
@@ -28,12 +28,19 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "../log.h"
 
 #include "crc32.h"
+#include "swar.h"
 #include "../rrr_types.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#	define RRR_CRC32_X86
+#	include <immintrin.h>
+#endif
+
 /* The feedback terms table consists of 256, 32-bit entries.  Notes:   */
 /*                                                                     */
 /*  1. The table can be generated at runtime if desired; code to do so */
@@ -105,16 +112,189 @@ static uint32_t crc_32_tab[] = { /* CRC polynomial 0xedb88320 */
 
 #define UPDC32(octet, crc) (crc_32_tab[((crc) ^ (octet)) & 0xff] ^ ((crc) >> 8))
 
+/* Slicing-by-8 uses seven more tables derived from the one above, entry */
+/* i of table k is the CRC of byte i followed by k zero bytes.          */
+
+static uint32_t crc_32_tab_slice[8][256];
+
+static pthread_once_t rrr_crc32_once = PTHREAD_ONCE_INIT;
+static int rrr_crc32_level_supported = RRR_CRC32_LEVEL_SLICE8;
+static int rrr_crc32_level = RRR_CRC32_LEVEL_SLICE8;
+
+static void __rrr_crc32_init (void) {
+	for (int i = 0; i < 256; i++) {
+		uint32_t crc = crc_32_tab[i];
+		crc_32_tab_slice[0][i] = crc;
+		for (int k = 1; k < 8; k++) {
+			crc = crc_32_tab[crc & 0xff] ^ (crc >> 8);
+			crc_32_tab_slice[k][i] = crc;
+		}
+	}
+
+#ifdef RRR_CRC32_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+		rrr_crc32_level_supported = RRR_CRC32_LEVEL_PCLMUL;
+	}
+#endif
+
+	rrr_crc32_level = rrr_crc32_level_supported;
+}
+
+static inline int __rrr_crc32_level (void) {
+	pthread_once(&rrr_crc32_once, __rrr_crc32_init);
+	return rrr_crc32_level;
+}
+
+int rrr_crc32_level_get (void) {
+	return __rrr_crc32_level();
+}
+
+int rrr_crc32_level_set (int level) {
+	__rrr_crc32_level();
+	rrr_crc32_level = level < rrr_crc32_level_supported ? level : rrr_crc32_level_supported;
+	return rrr_crc32_level;
+}
+
+static uint32_t __rrr_crc32_byte (uint32_t crc32, const char *buf, rrr_biglength len) {
+	for (rrr_biglength i = 0; i < len; i++) {
+		crc32 = UPDC32(*(buf + i), crc32);
+	}
+	return crc32;
+}
+
+static uint32_t __rrr_crc32_slice8 (uint32_t crc32, const char *buf, rrr_biglength len) {
+	for (; len >= 8; buf += 8, len -= 8) {
+		const uint64_t word = rrr_swar_load_le64(buf) ^ crc32;
+		crc32 = crc_32_tab_slice[7][word & 0xff] ^
+		        crc_32_tab_slice[6][(word >> 8) & 0xff] ^
+		        crc_32_tab_slice[5][(word >> 16) & 0xff] ^
+		        crc_32_tab_slice[4][(word >> 24) & 0xff] ^
+		        crc_32_tab_slice[3][(word >> 32) & 0xff] ^
+		        crc_32_tab_slice[2][(word >> 40) & 0xff] ^
+		        crc_32_tab_slice[1][(word >> 48) & 0xff] ^
+		        crc_32_tab_slice[0][word >> 56];
+	}
+	return __rrr_crc32_byte(crc32, buf, len);
+}
+
+#ifdef RRR_CRC32_X86
+
+/* Folding with carry-less multiplication followed by a Barrett          */
+/* reduction as described by Intel in "Fast CRC Computation for Generic */
+/* Polynomials Using PCLMULQDQ Instruction". The constants are powers   */
+/* of x modulo the bit-reflected polynomial. Length must be a multiple  */
+/* of 16 and at least 64.                                               */
+
+#define PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+
+static PCLMUL_TARGET uint32_t __rrr_crc32_pclmul_blocks (uint32_t crc32, const char *buf, rrr_biglength len) {
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc32));
+
+	buf += 64;
+	len -= 64;
+
+	// Fold four blocks in parallel
+	for (; len >= 64; buf += 64, len -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (buf + 0x30)));
+	}
+
+	// Fold the four blocks into one
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Fold remaining single blocks
+	for (; len >= 16; buf += 16, len -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) buf)), x5);
+	}
+
+	// Fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_and_si128(x1, mask32);
+	x0 = _mm_clmulepi64_si128(x0, poly, 0x10);
+	x0 = _mm_and_si128(x0, mask32);
+	x0 = _mm_clmulepi64_si128(x0, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x0);
+
+	return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t __rrr_crc32_pclmul (uint32_t crc32, const char *buf, rrr_biglength len) {
+	if (len >= 64) {
+		const rrr_biglength len_blocks = len & ~((rrr_biglength) 15);
+		crc32 = __rrr_crc32_pclmul_blocks(crc32, buf, len_blocks);
+		buf += len_blocks;
+		len -= len_blocks;
+	}
+	return __rrr_crc32_slice8(crc32, buf, len);
+}
+
+#endif /* RRR_CRC32_X86 */
+
 // Returns checksum
 uint32_t rrr_crc32buf (const char *buf, rrr_biglength len) {
-      uint32_t crc32 = 0xFFFFFFFF;
+	uint32_t crc32 = 0xFFFFFFFF;
 
-      for (rrr_biglength i = 0; i < len; i++) {
-    	  crc32 = UPDC32(*(buf + i), crc32);
-//    	  printf ("CRC: %" PRIu32 "\n", crc32);
-      }
+	switch (__rrr_crc32_level()) {
+#ifdef RRR_CRC32_X86
+		case RRR_CRC32_LEVEL_PCLMUL:
+			crc32 = __rrr_crc32_pclmul(crc32, buf, len);
+			break;
+#endif
+		case RRR_CRC32_LEVEL_SLICE8:
+			crc32 = __rrr_crc32_slice8(crc32, buf, len);
+			break;
+		default:
+			crc32 = __rrr_crc32_byte(crc32, buf, len);
+			break;
+	}
 
-      return ~crc32;
+	return ~crc32;
 }
 
 // Returns 0 if checksum is valid
@@ -26,7 +26,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "../rrr_types.h"
 
+// Implementations, the best level supported by the CPU is used unless
+// a lower level is set. All levels produce the same checksum.
+#define RRR_CRC32_LEVEL_BYTE     0
+#define RRR_CRC32_LEVEL_SLICE8   1
+#define RRR_CRC32_LEVEL_PCLMUL   2
+
 uint32_t rrr_crc32buf (const char *buf, rrr_biglength len);
 uint32_t rrr_crc32cmp (const char *buf, rrr_biglength len, uint32_t crc32);
+int rrr_crc32_level_get (void);
+// Used by tests and benchmarks, not thread safe
+int rrr_crc32_level_set (int level);
 
 #endif /* RRR_CRC32_H */
@@ -33,6 +33,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "../log.h"
 #include "../rrr_strerror.h"
@@ -63,6 +64,60 @@ void *rrr_posix_mmap (size_t size, int is_shared) {
 	);
 }
 
+// Alignment must be a multiple of the page size, returns NULL on failure
+void *rrr_posix_mmap_aligned (size_t size, size_t alignment, int is_shared) {
+	char *ptr = mmap (
+			NULL,
+			size + alignment,
+			PROT_READ | PROT_WRITE,
+			(is_shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS,
+			-1,
+			0
+	);
+
+	if (ptr == MAP_FAILED) {
+		return NULL;
+	}
+
+	const size_t head = (alignment - (uintptr_t) ptr % alignment) % alignment;
+
+	if (head > 0) {
+		munmap(ptr, head);
+	}
+	if (alignment - head > 0) {
+		munmap(ptr + head + size, alignment - head);
+	}
+
+	return ptr + head;
+}
+
+// Reserve address space only, memory must be committed before use
+void *rrr_posix_mmap_reserve (size_t size) {
+	void *ptr = mmap (
+			NULL,
+			size,
+			PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			-1,
+			0
+	);
+	return (ptr == MAP_FAILED ? NULL : ptr);
+}
+
+int rrr_posix_mmap_commit (void *ptr, size_t size) {
+	return mprotect(ptr, size, PROT_READ | PROT_WRITE);
+}
+
+// Give pages back to the OS while keeping the mapping, the contents
+// are undefined after this
+void rrr_posix_mmap_release (void *ptr, size_t size) {
+#ifdef MADV_DONTNEED
+	madvise(ptr, size, MADV_DONTNEED);
+#else
+	posix_madvise(ptr, size, POSIX_MADV_DONTNEED);
+#endif
+}
+
 int rrr_posix_strcasecmp (const char *a, const char *b) {
 	return strcasecmp(a, b);
 }
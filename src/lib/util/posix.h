@@ -30,6 +30,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 int rrr_posix_usleep(int useconds);
 void *rrr_posix_mmap (size_t size, int is_shared);
+void *rrr_posix_mmap_aligned (size_t size, size_t alignment, int is_shared);
+void *rrr_posix_mmap_reserve (size_t size);
+int rrr_posix_mmap_commit (void *ptr, size_t size);
+void rrr_posix_mmap_release (void *ptr, size_t size);
 int rrr_posix_strcasecmp (const char *a, const char *b);
 int rrr_posix_strncasecmp (const char *a, const char *b, size_t n);
 int rrr_posix_mutex_init (pthread_mutex_t *mutex, int flags);
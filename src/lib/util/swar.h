@@ -0,0 +1,96 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef RRR_SWAR_H
+#define RRR_SWAR_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Helpers which process eight characters held in a 64 bit integer at a
+ * time. The integer must be loaded with rrr_swar_load_le64 so that the
+ * first character always is in the least significant byte.
+ */
+
+#define RRR_SWAR_ONES  ((uint64_t) 0x0101010101010101ULL)
+#define RRR_SWAR_HIGH  ((uint64_t) 0x8080808080808080ULL)
+
+static inline uint64_t rrr_swar_load_le64 (
+		const char *buf
+) {
+	uint64_t x;
+	memcpy(&x, buf, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	x = __builtin_bswap64(x);
+#endif
+	return x;
+}
+
+// High bit set in each byte which lies within lo-hi, lo must be at least 1
+static inline uint64_t rrr_swar_range_mask (
+		uint64_t x,
+		unsigned char lo,
+		unsigned char hi
+) {
+	const uint64_t t = x & ~RRR_SWAR_HIGH;
+	const uint64_t ge_lo = t + RRR_SWAR_ONES * (uint64_t) (0x80 - lo);
+	const uint64_t gt_hi = t + RRR_SWAR_ONES * (uint64_t) (0x7f - hi);
+	return ge_lo & ~gt_hi & ~x & RRR_SWAR_HIGH;
+}
+
+static inline int rrr_swar_is_digits_8 (
+		uint64_t x
+) {
+	return rrr_swar_range_mask(x, '0', '9') == RRR_SWAR_HIGH;
+}
+
+static inline int rrr_swar_is_hex_digits_8 (
+		uint64_t x
+) {
+	return (rrr_swar_range_mask(x, '0', '9') | rrr_swar_range_mask(x | (RRR_SWAR_ONES * 0x20), 'a', 'f')) == RRR_SWAR_HIGH;
+}
+
+// All eight characters must be decimal digits
+static inline uint32_t rrr_swar_parse_digits_8 (
+		uint64_t x
+) {
+	x -= RRR_SWAR_ONES * '0';
+	x = (x * 10) + (x >> 8);
+	x = (((x & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+	     (((x >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+	return (uint32_t) x;
+}
+
+// All eight characters must be hexadecimal digits
+static inline uint32_t rrr_swar_parse_hex_digits_8 (
+		uint64_t x
+) {
+	// Letters have bit 6 set and their low nibble is 9 less than their value
+	x = (x & (RRR_SWAR_ONES * 0x0f)) + ((x >> 6) & RRR_SWAR_ONES) * 9;
+	x = ((x << 4) | (x >> 8)) & 0x00FF00FF00FF00FFULL;
+	x = ((x << 8) | (x >> 16)) & 0x0000FFFF0000FFFFULL;
+	x = ((x << 16) | (x >> 32)) & 0x00000000FFFFFFFFULL;
+	return (uint32_t) x;
+}
+
+#endif /* RRR_SWAR_H */
@@ -39,7 +39,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/message_holder/message_holder.h"
 #include "../lib/message_holder/message_holder_struct.h"
 #include "../lib/stats/stats_instance.h"
-#include "../lib/array.h"
+#include "../lib/array_view.h"
 
 struct raw_data {
 	int print_data;
@@ -50,7 +50,6 @@ struct raw_data {
 int raw_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 	struct rrr_instance_runtime_data *thread_data = arg;
 	struct raw_data *raw_data = thread_data->private_data;
-	struct rrr_array array_tmp = {0};
 	char *topic_tmp = NULL;
 
 	int ret = 0;
@@ -75,14 +74,7 @@ int raw_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 				INSTANCE_D_NAME(thread_data), (long long unsigned) MSG_TOTAL_SIZE(reading), reading->timestamp, topic_tmp, message_age / 1000.0);
 
 		if (MSG_IS_ARRAY(reading)) {
-			uint16_t array_version_dummy;
-			if (rrr_array_message_append_to_collection(&array_version_dummy, &array_tmp, reading) != 0) {
-				RRR_MSG_0("Could not get array from message in raw_poll_callback of raw instance %s\n",
-						INSTANCE_D_NAME(thread_data));
-				ret = 1;
-				goto out;
-			}
-			if (rrr_array_dump(&array_tmp) != 0) {
+			if (rrr_array_view_dump(reading) != 0) {
 				RRR_MSG_0("Error while dumping array in raw_poll_callback of raw instance %s\n",
 						INSTANCE_D_NAME(thread_data));
 				ret = 1;
@@ -97,7 +89,6 @@ int raw_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 
 	out:
 	RRR_FREE_IF_NOT_NULL(topic_tmp);
-	rrr_array_clear(&array_tmp);
 	rrr_msg_holder_unlock(entry);
 	return ret;
 }
@@ -109,7 +100,8 @@ static int raw_event_broker_data_available (RRR_EVENT_FUNCTION_ARGS) {
 
 	RRR_POLL_HELPER_COUNTERS_UPDATE_BEFORE_POLL(data);
 
-	return rrr_poll_do_poll_delete (amount, thread_data, raw_poll_callback, 0);
+	// Messages are only read
+	return rrr_poll_do_poll_delete_shared_payload (amount, thread_data, raw_poll_callback, 0);
 }
 
 static int raw_event_periodic (void *arg) {
@@ -127,6 +119,7 @@ static int raw_event_periodic (void *arg) {
 	);
 
 	rrr_stats_instance_update_rate (INSTANCE_D_STATS(thread_data), 0, "received", message_count);
+	rrr_instance_default_post_broker_stats(thread_data);
 
 	return rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer_void(thread);
 }
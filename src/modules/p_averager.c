@@ -35,6 +35,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/buffer.h"
 #include "../lib/poll_helper.h"
 #include "../lib/array.h"
+#include "../lib/array_view.h"
 #include "../lib/messages/msg_msg.h"
 #include "../lib/message_holder/message_holder.h"
 #include "../lib/message_holder/message_holder_util.h"
@@ -166,14 +167,12 @@ struct averager_calculation {
 	uint64_t timestamp_min;
 };
 
-static int __averager_get_64_from_array (uint64_t *result, struct averager_data *averager_data, struct rrr_array *array, const char *tag) {
-	struct rrr_type_value *value = NULL;
-
+static int __averager_get_64_from_view (uint64_t *result, struct averager_data *averager_data, const struct rrr_array_view_value *value, const char *tag) {
 	int ret = 0;
 
 	*result = 0;
 
-	if ((value = rrr_array_value_get_by_tag(array, tag)) == NULL) {
+	if (value->definition == NULL) {
 		RRR_MSG_0("Could not find tag '%s' in array message in averager instance %s, dropping message\n",
 				tag, INSTANCE_D_NAME(averager_data->thread_data));
 		ret = 1;
@@ -186,7 +185,9 @@ static int __averager_get_64_from_array (uint64_t *result, struct averager_data
 		goto out;
 	}
 
-	*result = *((uint64_t*) value->data);
+	if ((ret = rrr_array_view_value_get_64(result, value, 0)) != 0) {
+		goto out;
+	}
 
 	out:
 	return ret;
@@ -198,7 +199,9 @@ int averager_process_message (
 		struct rrr_msg_holder *entry_locked
 ) {
 	struct rrr_msg_msg *message = entry_locked->message;
-	struct rrr_array array_tmp = {0};
+
+	static const char * const tags[] = {"measurement", "timestamp_from", "timestamp_to"};
+	struct rrr_array_view_value values[sizeof(tags) / sizeof(tags[0])];
 
 	int ret = 0;
 
@@ -213,9 +216,9 @@ int averager_process_message (
 		goto out;
 	}
 
-	uint16_t array_version_dummy;
-	if (rrr_array_message_append_to_collection(&array_version_dummy, &array_tmp, message) != 0) {
-		RRR_MSG_0("Could not create array in averager_callback of instance %s\n",
+	// Values are read directly from the message without unpacking it
+	if (rrr_array_view_get_by_tags(values, message, tags, sizeof(tags) / sizeof(tags[0])) != 0) {
+		RRR_MSG_0("Could not read array in averager_callback of instance %s\n",
 				INSTANCE_D_NAME(averager_data->thread_data));
 		ret = 1;
 		goto out;
@@ -225,13 +228,13 @@ int averager_process_message (
 	uint64_t timestamp_from;
 	uint64_t timestamp_to;
 
-	if (__averager_get_64_from_array(&data_numeric, averager_data, &array_tmp, "measurement") != 0) {
+	if (__averager_get_64_from_view(&data_numeric, averager_data, &values[0], tags[0]) != 0) {
 		goto out;
 	}
-	if (__averager_get_64_from_array(&timestamp_from, averager_data, &array_tmp, "timestamp_from") != 0) {
+	if (__averager_get_64_from_view(&timestamp_from, averager_data, &values[1], tags[1]) != 0) {
 		goto out;
 	}
-	if (__averager_get_64_from_array(&timestamp_to, averager_data, &array_tmp, "timestamp_to") != 0) {
+	if (__averager_get_64_from_view(&timestamp_to, averager_data, &values[2], tags[2]) != 0) {
 		goto out;
 	}
 
@@ -253,7 +256,6 @@ int averager_process_message (
 	}
 
 	out:
-	rrr_array_clear(&array_tmp);
 	return ret;
 }
 
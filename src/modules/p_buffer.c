@@ -25,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <pthread.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include "../lib/log.h"
 #include "../lib/allocator.h"
@@ -32,6 +33,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/ip/ip.h"
 #include "../lib/message_holder/message_holder.h"
 #include "../lib/message_holder/message_holder_struct.h"
+#include "../lib/message_holder/message_holder_spill.h"
 #include "../lib/poll_helper.h"
 #include "../lib/buffer.h"
 #include "../lib/instance_config.h"
@@ -40,17 +42,187 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/threads.h"
 #include "../lib/message_broker.h"
 #include "../lib/event/event.h"
+#include "../lib/event/event_collection.h"
+#include "../lib/stats/stats_instance.h"
+
+#define BUFFER_DEFAULT_SPILL_WATERMARK        (RRR_MESSAGE_BROKER_DEFAULT_HIGH_WATERMARK / 2)
+#define BUFFER_SPILL_REPLAY_INTERVAL_US       (10 * 1000)
 
 struct buffer_data {
 	struct rrr_instance_runtime_data *thread_data;
 	rrr_setting_uint message_ttl_seconds;
 	uint64_t message_ttl_us;
 	struct rrr_poll_helper_counters counters;
+
+	char *spill_directory;
+	rrr_setting_uint spill_watermark;
+	rrr_setting_uint spill_segment_size;
+	struct rrr_msg_holder_spill *spill;
+
+	struct rrr_event_collection events;
+	rrr_event_handle event_spill_replay;
 };
 
 static void buffer_data_init(struct buffer_data *data, struct rrr_instance_runtime_data *thread_data) {
 	memset(data, '\0', sizeof(*data));
 	data->thread_data = thread_data;
+	rrr_event_collection_init(&data->events, INSTANCE_D_EVENTS(thread_data));
+}
+
+static void buffer_data_cleanup(void *arg) {
+	struct buffer_data *data = arg;
+	rrr_event_collection_clear(&data->events);
+	if (data->spill != NULL) {
+		rrr_msg_holder_spill_destroy(data->spill);
+	}
+	RRR_FREE_IF_NOT_NULL(data->spill_directory);
+}
+
+// Once spilling has started, all messages must go to the spill
+// until it is empty to keep them in order
+static int buffer_spill_check (
+		int *do_spill,
+		struct buffer_data *data
+) {
+	int ret = 0;
+
+	*do_spill = 0;
+
+	if (data->spill == NULL) {
+		goto out;
+	}
+
+	if (rrr_msg_holder_spill_count(data->spill) > 0) {
+		*do_spill = 1;
+		goto out;
+	}
+
+	int entry_count = 0;
+	int backpressure_active = 0;
+
+	if ((ret = rrr_message_broker_get_entry_count_and_backpressure (
+			&entry_count,
+			&backpressure_active,
+			INSTANCE_D_BROKER_ARGS(data->thread_data)
+	)) != 0) {
+		goto out;
+	}
+
+	if ((rrr_setting_uint) entry_count >= data->spill_watermark) {
+		RRR_DBG_1("buffer instance %s output buffer reached %i entries, spilling to disk\n",
+				INSTANCE_D_NAME(data->thread_data), entry_count);
+		*do_spill = 1;
+		EVENT_ADD(data->event_spill_replay);
+	}
+
+	out:
+	return ret;
+}
+
+static int buffer_spill_replay_write_callback (struct rrr_msg_holder *entry, void *arg) {
+	struct rrr_msg_msg *message = arg;
+
+	entry->message = message;
+	entry->data_length = MSG_TOTAL_SIZE(message);
+
+	rrr_msg_holder_unlock(entry);
+	return 0;
+}
+
+static int buffer_spill_replay_callback (
+		const void *data,
+		size_t data_size,
+		const struct sockaddr *addr,
+		socklen_t addr_len,
+		int protocol,
+		void *arg
+) {
+	struct rrr_message_broker_write_batch *batch = arg;
+
+	int ret = 0;
+
+	struct rrr_msg_msg *message = NULL;
+
+	if ((message = rrr_allocate(data_size)) == NULL) {
+		RRR_MSG_0("Could not allocate memory in buffer_spill_replay_callback\n");
+		ret = 1;
+		goto out;
+	}
+
+	memcpy(message, data, data_size);
+
+	if ((ret = rrr_message_broker_write_batch_entry (
+			batch,
+			addr_len > 0 ? addr : NULL,
+			addr_len,
+			protocol,
+			buffer_spill_replay_write_callback,
+			message
+	)) != 0) {
+		goto out;
+	}
+
+	// Message is now owned by the entry
+	message = NULL;
+
+	out:
+	RRR_FREE_IF_NOT_NULL(message);
+	return ret;
+}
+
+static void buffer_event_spill_replay (
+		evutil_socket_t fd,
+		short flags,
+		void *arg
+) {
+	struct rrr_thread *thread = arg;
+	struct rrr_instance_runtime_data *thread_data = thread->private_data;
+	struct buffer_data *data = thread_data->private_data;
+
+	(void)(fd);
+	(void)(flags);
+
+	struct rrr_message_broker_write_batch batch;
+	int entry_count = 0;
+	int backpressure_active = 0;
+
+	rrr_message_broker_write_batch_init(&batch, INSTANCE_D_BROKER_ARGS(thread_data), INSTANCE_D_CANCEL_CHECK_ARGS(thread_data));
+
+	if (rrr_message_broker_get_entry_count_and_backpressure (
+			&entry_count,
+			&backpressure_active,
+			INSTANCE_D_BROKER_ARGS(thread_data)
+	) != 0) {
+		goto out_error;
+	}
+
+	if ((rrr_setting_uint) entry_count < data->spill_watermark) {
+		if (rrr_msg_holder_spill_read (
+				data->spill,
+				(unsigned int) (data->spill_watermark - (rrr_setting_uint) entry_count),
+				buffer_spill_replay_callback,
+				&batch
+		) != 0) {
+			RRR_MSG_0("Failed to read from spill in buffer instance %s\n", INSTANCE_D_NAME(thread_data));
+			goto out_error;
+		}
+
+		if (rrr_message_broker_write_batch_flush(&batch) != 0) {
+			goto out_error;
+		}
+	}
+
+	if (rrr_msg_holder_spill_count(data->spill) == 0) {
+		RRR_DBG_1("buffer instance %s spill is empty, writing directly to output buffer\n",
+				INSTANCE_D_NAME(thread_data));
+		EVENT_REMOVE(data->event_spill_replay);
+	}
+
+	goto out;
+	out_error:
+		rrr_event_dispatch_break(INSTANCE_D_EVENTS(thread_data));
+	out:
+		rrr_message_broker_write_batch_clear(&batch);
 }
 
 static int buffer_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
@@ -74,11 +246,23 @@ static int buffer_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 			(long long unsigned int) message->timestamp
 	);
 
-	ret = rrr_message_broker_incref_and_write_entry_unsafe_no_unlock (
-			INSTANCE_D_BROKER_ARGS(thread_data),
-			entry,
-			INSTANCE_D_CANCEL_CHECK_ARGS(thread_data)
-	);
+	int do_spill = 0;
+	if ((ret = buffer_spill_check(&do_spill, data)) != 0) {
+		goto drop;
+	}
+
+	if (do_spill) {
+		if ((ret = rrr_msg_holder_spill_write(data->spill, entry)) != 0) {
+			RRR_MSG_0("Failed to write to spill in buffer instance %s\n", INSTANCE_D_NAME(thread_data));
+		}
+	}
+	else {
+		ret = rrr_message_broker_incref_and_write_entry_unsafe_no_unlock (
+				INSTANCE_D_BROKER_ARGS(thread_data),
+				entry,
+				INSTANCE_D_CANCEL_CHECK_ARGS(thread_data)
+		);
+	}
 
 	RRR_POLL_HELPER_COUNTERS_UPDATE_POLLED(data);
 
@@ -94,7 +278,8 @@ static int buffer_event_broker_data_available (RRR_EVENT_FUNCTION_ARGS) {
 
 	RRR_POLL_HELPER_COUNTERS_UPDATE_BEFORE_POLL(data);
 
-	return rrr_poll_do_poll_delete (amount, thread_data, buffer_poll_callback, 0);
+	// Messages are only forwarded, shared messages stay shared
+	return rrr_poll_do_poll_delete_shared_payload (amount, thread_data, buffer_poll_callback, 0);
 }
 
 static int buffer_parse_config (struct buffer_data *data, struct rrr_instance_config_data *config) {
@@ -110,6 +295,47 @@ static int buffer_parse_config (struct buffer_data *data, struct rrr_instance_co
 
 	data->message_ttl_us = ((uint64_t) data->message_ttl_seconds) * ((uint64_t) 1000000);
 
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UTF8_DEFAULT_NULL("buffer_spill_directory", spill_directory);
+
+	const unsigned int high_watermark = INSTANCE_D_INSTANCE(data->thread_data)->buffer_high_watermark;
+
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("buffer_spill_watermark", spill_watermark,
+			(high_watermark > 0 ? high_watermark / 2 : BUFFER_DEFAULT_SPILL_WATERMARK));
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("buffer_spill_segment_size", spill_segment_size, RRR_MSG_HOLDER_SPILL_DEFAULT_SEGMENT_SIZE);
+
+	if (data->spill_directory == NULL) {
+		RRR_INSTANCE_CONFIG_IF_EXISTS_THEN("buffer_spill_watermark",
+			RRR_MSG_0("Parameter 'buffer_spill_watermark' set in buffer instance %s without 'buffer_spill_directory'\n", config->name);
+			ret = 1;
+		);
+		RRR_INSTANCE_CONFIG_IF_EXISTS_THEN("buffer_spill_segment_size",
+			RRR_MSG_0("Parameter 'buffer_spill_segment_size' set in buffer instance %s without 'buffer_spill_directory'\n", config->name);
+			ret = 1;
+		);
+		goto out;
+	}
+
+	if (data->spill_watermark == 0 || data->spill_watermark > INT_MAX) {
+		RRR_MSG_0("Invalid value for buffer_spill_watermark in buffer instance %s\n", config->name);
+		ret = 1;
+		goto out;
+	}
+
+	// Writes would otherwise block before spilling starts
+	if (high_watermark > 0 && data->spill_watermark >= high_watermark) {
+		RRR_MSG_0("Value of buffer_spill_watermark in buffer instance %s must be less than buffer_high_watermark (%u)\n",
+				config->name, high_watermark);
+		ret = 1;
+		goto out;
+	}
+
+	if (data->spill_segment_size < 4096 || data->spill_segment_size > UINT32_MAX) {
+		RRR_MSG_0("Invalid value for buffer_spill_segment_size in buffer instance %s, must be in the range 4096-%u\n",
+				config->name, UINT32_MAX);
+		ret = 1;
+		goto out;
+	}
+
 	RRR_INSTANCE_CONFIG_IF_EXISTS_THEN("buffer_do_duplicate",
 		RRR_MSG_0("Warning: Parameter 'buffer_do_duplicate' which is set for instance %s is deprecated. Use 'duplicate' instead, which also works on any mdoule.\n",
 			config->name);
@@ -119,6 +345,27 @@ static int buffer_parse_config (struct buffer_data *data, struct rrr_instance_co
 	return ret;
 }
 
+static int buffer_event_periodic (RRR_EVENT_FUNCTION_PERIODIC_ARGS) {
+	struct rrr_thread *thread = arg;
+	struct rrr_instance_runtime_data *thread_data = thread->private_data;
+
+	struct buffer_data *data = thread_data->private_data;
+
+	rrr_instance_default_post_broker_stats(thread_data);
+
+	if (data->spill != NULL) {
+		struct rrr_msg_holder_spill_stats spill_stats;
+		rrr_msg_holder_spill_get_stats(&spill_stats, data->spill);
+
+		rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "spill_entries", 0, rrr_msg_holder_spill_count(data->spill));
+		rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "spill_written", 0, spill_stats.total_written);
+		rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "spill_read", 0, spill_stats.total_read);
+		rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "spill_bytes", 0, spill_stats.bytes_in_use);
+	}
+
+	return rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer_void(thread);
+}
+
 static void *thread_entry_buffer (struct rrr_thread *thread) {
 	struct rrr_instance_runtime_data *thread_data = thread->private_data;
 	struct buffer_data *data = thread_data->private_data = thread_data->private_memory;
@@ -128,24 +375,50 @@ static void *thread_entry_buffer (struct rrr_thread *thread) {
 
 	buffer_data_init(data, thread_data);
 
+	pthread_cleanup_push(buffer_data_cleanup, data);
+
 	if (buffer_parse_config(data, INSTANCE_D_CONFIG(thread_data)) != 0) {
 		goto out_message;
 	}
 
 	rrr_instance_config_check_all_settings_used(thread_data->init_data.instance_config);
 
+	if (data->spill_directory != NULL) {
+		if (rrr_msg_holder_spill_new (
+				&data->spill,
+				data->spill_directory,
+				INSTANCE_D_NAME(thread_data),
+				(size_t) data->spill_segment_size
+		) != 0) {
+			RRR_MSG_0("Failed to create spill in buffer instance %s\n", INSTANCE_D_NAME(thread_data));
+			goto out_message;
+		}
+
+		if (rrr_event_collection_push_periodic (
+				&data->event_spill_replay,
+				&data->events,
+				buffer_event_spill_replay,
+				thread,
+				BUFFER_SPILL_REPLAY_INTERVAL_US
+		) != 0) {
+			RRR_MSG_0("Failed to create spill replay event in buffer instance %s\n", INSTANCE_D_NAME(thread_data));
+			goto out_message;
+		}
+	}
+
 	RRR_DBG_1 ("buffer instance %s started thread\n",
 			INSTANCE_D_NAME(thread_data));
 
 	rrr_event_dispatch (
 			INSTANCE_D_EVENTS(thread_data),
 			1 * 1000 * 1000,
-			rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer_void,
+			buffer_event_periodic,
 			thread
 	);
 
 	out_message:
 	RRR_DBG_1 ("Thread buffer %p exiting\n", thread);
+	pthread_cleanup_pop(1);
 
 	pthread_exit(0);
 }
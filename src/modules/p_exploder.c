@@ -31,6 +31,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "../lib/message_holder/message_holder.h"
 #include "../lib/message_holder/message_holder_struct.h"
+#include "../lib/message_holder/message_holder_collection.h"
 #include "../lib/poll_helper.h"
 #include "../lib/instance_config.h"
 #include "../lib/instances.h"
@@ -61,86 +62,55 @@ static void exploder_data_cleanup(void *arg) {
 }
 
 static int exploder_process_value (
-		struct exploder_data *data,
+		struct rrr_msg_holder_collection *target,
 		const struct rrr_msg_holder *msg_holder_orig,
 		const struct rrr_type_value *value,
 		uint64_t timestamp,
-		const struct rrr_string_builder *topic_prefix
+		char *topic,
+		rrr_u16 topic_prefix_length,
+		int do_topic_append_tag
 ) {
 	// NOTE ! Do not write the original message to the buffer here, always clone it
 
 	int ret = 0;
 
 	struct rrr_msg_holder *entry_new = NULL;
-	struct rrr_array array_new = {0};
-	struct rrr_string_builder topic_tmp = {0};
+	struct rrr_msg_msg *msg_new = NULL;
 
-	if ((ret = rrr_msg_holder_clone_no_data(&entry_new, msg_holder_orig)) != 0) {
-		goto out;
-	}
-
-	rrr_msg_holder_lock(entry_new);
-
-	const struct rrr_string_builder *topic_to_use;
-
-	if (data->do_topic_append_tag && value->tag != NULL) {
-		if ((ret = rrr_string_builder_append_from(&topic_tmp, topic_prefix)) != 0) {
-			goto out;
-		}
-		if ((ret = rrr_string_builder_append(&topic_tmp, value->tag)) != 0) {
-			goto out;
-		}
-		topic_to_use = &topic_tmp;
-	}
-	else {
-		topic_to_use = topic_prefix;
-	}
-
-	{
-		struct rrr_type_value *value_new = NULL;
-		if ((ret = rrr_type_value_clone (
-				&value_new,
-				value,
-				1 // Do clone data
-		)) != 0) {
-			goto out;
-		}
+	rrr_u16 topic_length = topic_prefix_length;
 
-		// Add to array immediately to manage memory
-		RRR_LL_PUSH(&array_new, value_new);
-		value_new = NULL;
+	if (do_topic_append_tag && value->tag_length > 0) {
+		// The prefix stays in place, only the tag is overwritten
+		memcpy(topic + topic_prefix_length, value->tag, value->tag_length);
+		topic_length = (rrr_u16) (topic_length + value->tag_length);
 	}
 
-	{
-		struct rrr_msg_msg *msg_new = NULL;
-		if ((ret = rrr_array_new_message_from_collection (
-				&msg_new,
-				&array_new,
-				timestamp,
-				rrr_string_builder_buf(topic_to_use),
-				rrr_string_builder_length(topic_to_use)
-		)) != 0) {
-			goto out;
-		}
-
-		// Add to message holder immediately to manage memory
-		entry_new->message = msg_new;
-		entry_new->data_length = MSG_TOTAL_SIZE(msg_new);
+	if ((ret = rrr_array_new_message_from_value (
+			&msg_new,
+			value,
+			timestamp,
+			topic,
+			topic_length
+	)) != 0) {
+		goto out;
 	}
 
-	if ((ret = rrr_message_broker_incref_and_write_entry_unsafe_no_unlock (
-			INSTANCE_D_BROKER_ARGS(data->thread_data),
-			entry_new,
-			INSTANCE_D_CANCEL_CHECK_ARGS(data->thread_data)
-	)) != 0) {
+	if ((ret = rrr_msg_holder_clone_no_data(&entry_new, msg_holder_orig)) != 0) {
 		goto out;
 	}
 
+	rrr_msg_holder_lock(entry_new);
+	rrr_msg_holder_set_data_unlocked(entry_new, msg_new, MSG_TOTAL_SIZE(msg_new));
+	rrr_msg_holder_unlock(entry_new);
+	msg_new = NULL;
+
+	RRR_LL_APPEND(target, entry_new);
+	entry_new = NULL;
+
 	out:
-	rrr_string_builder_clear(&topic_tmp);
-	rrr_array_clear(&array_new);
+	RRR_FREE_IF_NOT_NULL(msg_new);
 	if (entry_new != NULL) {
-		rrr_msg_holder_decref_while_locked_and_unlock(entry_new);
+		rrr_msg_holder_decref(entry_new);
 	}
 	return ret;
 }
@@ -149,14 +119,14 @@ static int exploder_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 	struct rrr_instance_runtime_data *thread_data = arg;
 	struct exploder_data *data = thread_data->private_data;
 
-	(void)(data);
-
 	const struct rrr_msg_msg *message = entry->message;
 
 	int ret = 0;
 
 	struct rrr_string_builder topic_prefix = {0};
 	struct rrr_array array_tmp = {0};
+	struct rrr_msg_holder_collection entries_new = {0};
+	char *topic = NULL;
 
 	RRR_DBG_3("exploder instance %s received a message with timestamp %llu\n",
 			INSTANCE_D_NAME(thread_data),
@@ -174,6 +144,8 @@ static int exploder_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 		goto out_drop;
 	}
 
+	rrr_array_arena_enable(&array_tmp);
+
 	uint16_t array_version_dummy;
 	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array_tmp, message)) != 0) {
 		RRR_MSG_0("Failed to get array values from message in exploder instance %s\n",
@@ -193,16 +165,48 @@ static int exploder_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 		}
 	}
 
+	// The topic buffer is shared by all new messages and has room
+	// for the prefix followed by the longest tag
+	rrr_length tag_length_max = 0;
+	if (data->do_topic_append_tag) {
+		RRR_LL_ITERATE_BEGIN(&array_tmp, const struct rrr_type_value);
+			if (node->tag_length > tag_length_max) {
+				tag_length_max = node->tag_length;
+			}
+		RRR_LL_ITERATE_END();
+	}
+
+	const rrr_biglength topic_prefix_length = rrr_string_builder_length(&topic_prefix);
+
+	if (topic_prefix_length + tag_length_max > UINT16_MAX) {
+		RRR_MSG_0("Topic too long in exploder instance %s, dropping message\n",
+				INSTANCE_D_NAME(thread_data));
+		goto out_drop;
+	}
+
+	if ((topic = rrr_allocate(topic_prefix_length + tag_length_max + 1)) == NULL) {
+		RRR_MSG_0("Could not allocate topic in exploder instance %s\n",
+				INSTANCE_D_NAME(thread_data));
+		ret = 1;
+		goto out_drop;
+	}
+
+	if (topic_prefix_length > 0) {
+		memcpy(topic, rrr_string_builder_buf(&topic_prefix), topic_prefix_length);
+	}
+
 	// Messages generated from one message should have equal timestamps
 	const rrr_u64 timestamp = (data->do_preserve_timestamp ? message->timestamp : rrr_time_get_64());
 
 	RRR_LL_ITERATE_BEGIN(&array_tmp, const struct rrr_type_value);
 		if ((ret = exploder_process_value (
-				data,
+				&entries_new,
 				entry,
 				node,
 				timestamp,
-				&topic_prefix
+				topic,
+				(rrr_u16) topic_prefix_length,
+				data->do_topic_append_tag
 		)) != 0) {
 			RRR_MSG_0("Error while processing values in exploder instance %s\n",
 					INSTANCE_D_NAME(thread_data));
@@ -210,6 +214,17 @@ static int exploder_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 		}
 	RRR_LL_ITERATE_END();
 
+	// All new messages are written using one buffer lock acquisition
+	if ((ret = rrr_message_broker_write_entries_from_collection_unsafe (
+			INSTANCE_D_BROKER_ARGS(thread_data),
+			&entries_new,
+			INSTANCE_D_CANCEL_CHECK_ARGS(thread_data)
+	)) != 0) {
+		RRR_MSG_0("Error while writing new messages in exploder instance %s\n",
+				INSTANCE_D_NAME(thread_data));
+		goto out_drop;
+	}
+
 	if (!data->do_original_passthrough) {
 		goto out_drop;
 	}
@@ -222,6 +237,9 @@ static int exploder_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 	);
 
 	out_drop:
+	// Entries not written are owned by us
+	rrr_msg_holder_collection_clear(&entries_new);
+	RRR_FREE_IF_NOT_NULL(topic);
 	rrr_array_clear(&array_tmp);
 	rrr_string_builder_clear(&topic_prefix);
 	rrr_msg_holder_unlock(entry);
@@ -34,6 +34,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/threads.h"
 #include "../lib/message_broker.h"
 #include "../lib/array.h"
+#include "../lib/array_tag_index.h"
 #include "../lib/string_builder.h"
 #include "../lib/event/event.h"
 #include "../lib/event/event_collection.h"
@@ -138,6 +139,7 @@ struct httpclient_data {
 
 	// Array fields, server name etc.
 	struct rrr_http_client_config http_client_config;
+	struct rrr_array_tag_plan *tags_plan;
 };
 
 static void httpclient_check_queues_and_activate_event_as_needed (
@@ -1135,8 +1137,15 @@ static int httpclient_session_query_prepare_callback (
 	}
 	else {
 		// Add chosen array fields
+		const struct rrr_type_value **values = NULL;
+		if (rrr_array_tag_plan_resolve(&values, data->tags_plan, callback_data->array_from_msg) != 0) {
+			ret = RRR_HTTP_HARD_ERROR;
+			goto out;
+		}
+
+		int tag_pos = 0;
 		RRR_MAP_ITERATE_BEGIN(&data->http_client_config.tags);
-			const struct rrr_type_value *value = rrr_array_value_get_by_tag_const(callback_data->array_from_msg, node_tag);
+			const struct rrr_type_value *value = values[tag_pos++];
 			if (value == NULL) {
 				RRR_MSG_0("Could not find array tag %s while adding HTTP query values in instance %s.\n",
 						node_tag, INSTANCE_D_NAME(data->thread_data));
@@ -1539,6 +1548,13 @@ static int httpclient_parse_config (
 		goto out;
 	}
 
+	if (RRR_MAP_COUNT(&data->http_client_config.tags) > 0 &&
+	    rrr_array_tag_plan_new(&data->tags_plan, &data->http_client_config.tags) != 0
+	) {
+		ret = 1;
+		goto out;
+	}
+
 	{
 		if (data->do_endpoint_from_topic_force && !data->do_endpoint_from_topic) {
 			RRR_MSG_0("http_endpoint_from_topic_force was 'yes' while http_endpoint_from_topic was not in httpclient instance %s, this is an invalid configuration.\n",
@@ -1783,6 +1799,9 @@ static void httpclient_data_cleanup(void *arg) {
 	rrr_http_client_request_data_cleanup(&data->request_data);
 	rrr_net_transport_config_cleanup(&data->net_transport_config);
 	rrr_http_client_config_cleanup(&data->http_client_config);
+	if (data->tags_plan != NULL) {
+		rrr_array_tag_plan_destroy(data->tags_plan);
+	}
 	rrr_msg_holder_collection_clear(&data->from_senders_queue);
 	rrr_msg_holder_collection_clear(&data->from_msgdb_queue);
 	RRR_FREE_IF_NOT_NULL(data->method_tag);
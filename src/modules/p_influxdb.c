@@ -28,7 +28,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "../lib/log.h"
 #include "../lib/allocator.h"
-#include "../lib/array.h"
+#include "../lib/array_view.h"
 #include "../lib/poll_helper.h"
 #include "../lib/instances.h"
 #include "../lib/instance_config.h"
@@ -150,7 +150,7 @@ static int influxdb_receive_http_response (
 
 struct send_data_callback_data {
 	struct influxdb_data *data;
-	struct rrr_array *array;
+	const struct rrr_msg_msg *message;
 	int ret;
 };
 
@@ -174,7 +174,7 @@ static void influxdb_send_data_callback (
 	(void)(socklen);
 
 	struct influxdb_data *data = callback_data->data;
-	struct rrr_array *array = callback_data->array;
+	const struct rrr_msg_msg *message = callback_data->message;
 
 	int ret = INFLUXDB_OK;
 
@@ -235,9 +235,9 @@ static void influxdb_send_data_callback (
 	CHECK_RET();
 
 	// Append tags from array
-	ret = rrr_http_query_builder_append_values_from_array (
+	ret = rrr_http_query_builder_append_values_from_array_view (
 			&query_builder,
-			array,
+			message,
 			&data->http_client_config.tags,
 			",",
 			0, // 0 = put comma before first name
@@ -262,9 +262,9 @@ static void influxdb_send_data_callback (
 	CHECK_RET();
 
 	// Append fields from array
-	ret = rrr_http_query_builder_append_values_from_array (
+	ret = rrr_http_query_builder_append_values_from_array_view (
 			&query_builder,
-			array,
+			message,
 			&data->http_client_config.fields,
 			",",
 			1, // 1 = do not put comma before first name
@@ -355,11 +355,11 @@ static void influxdb_send_data_callback (
 
 static int influxdb_send_data (
 		struct influxdb_data *data,
-		struct rrr_array *array
+		const struct rrr_msg_msg *message
 ) {
 	struct send_data_callback_data callback_data = {
 			data,
-			array,
+			message,
 			0
 	};
 
@@ -385,8 +385,6 @@ static int influxdb_common_callback (
 
 	int ret = 0;
 
-	struct rrr_array array = {0};
-
 	RRR_DBG_2 ("InfluxDB %s: Result from buffer: length %u timestamp from %" PRIu64 "\n",
 			INSTANCE_D_NAME(influxdb_data->thread_data), MSG_TOTAL_SIZE(reading), reading->timestamp);
 
@@ -397,15 +395,15 @@ static int influxdb_common_callback (
 		goto discard;
 	}
 
-	uint16_t array_version_dummy;
-	if (rrr_array_message_append_to_collection(&array_version_dummy, &array, reading) != 0) {
+	// Values are read directly from the message when the query is built
+	if (rrr_array_view_validate(reading) != 0) {
 		RRR_MSG_0("Error while parsing incoming array in influxdb instance %s\n",
 				INSTANCE_D_NAME(influxdb_data->thread_data));
 		ret = 0;
 		goto discard;
 	}
 
-	ret = influxdb_send_data(influxdb_data, &array);
+	ret = influxdb_send_data(influxdb_data, reading);
 	if (ret != 0) {
 		if (ret == INFLUXDB_SOFT_ERR) {
 			RRR_MSG_0("Storing message with error in buffer for later retry in influxdb instance %s\n",
@@ -423,7 +421,6 @@ static int influxdb_common_callback (
 	}
 
 	discard:
-	rrr_array_clear(&array);
 	rrr_msg_holder_unlock(entry);
 	return ret;
 }
@@ -44,7 +44,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/message_broker.h"
 #include "../lib/event/event.h"
 #include "../lib/event/event_collection.h"
+#include "../lib/event/event_functions.h"
 #include "../lib/stats/stats_instance.h"
+#include "../lib/messages/msg.h"
 #include "../lib/messages/msg_msg.h"
 #include "../lib/util/rrr_time.h"
 #include "../lib/util/utf8.h"
@@ -77,9 +79,37 @@ enum ip_action {
 	IP_ACTION_RETURN
 };
 
+// RRR messages to the same destination are packed into a batch message while
+// ip_send_rrr_message_batch_size is set. An address length of zero means the
+// default target.
+struct ip_batch {
+	RRR_LL_NODE(struct ip_batch);
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int protocol;
+	uint64_t create_time;
+	uint64_t send_time;
+	struct rrr_msg_batch batch;
+};
+
+struct ip_batch_collection {
+	RRR_LL_HEAD(struct ip_batch);
+};
+
+static int ip_batch_destroy (struct ip_batch *batch) {
+	rrr_msg_batch_clear(&batch->batch);
+	rrr_free(batch);
+	return 0;
+}
+
+static void ip_batch_collection_clear (struct ip_batch_collection *collection) {
+	RRR_LL_DESTROY(collection, struct ip_batch, ip_batch_destroy(node));
+}
+
 struct ip_data {
 	struct rrr_instance_runtime_data *thread_data;
 	struct rrr_msg_holder_collection send_buffer;
+	struct ip_batch_collection batches;
 
 	struct rrr_event_collection events;
 	rrr_event_handle event_send_buffer_iterate;
@@ -119,6 +149,9 @@ struct ip_data {
 	rrr_setting_uint message_ttl_us;
 	rrr_setting_uint message_max_size;
 
+	rrr_setting_uint batch_size_max;
+	rrr_setting_uint batch_time_ms;
+
 	unsigned int source_udp_port;
 	unsigned int source_tcp_port;
 
@@ -132,6 +165,13 @@ struct ip_data {
 
 	struct rrr_map array_send_tags;
 
+	// Messages from one read event are written to the output buffer together
+	struct rrr_message_broker_write_batch write_batch;
+
+	// Reading from sockets is paused while readers of the output buffer are behind
+	int input_paused;
+	uint64_t input_pause_time;
+
 	uint64_t messages_count_read;
 	uint64_t messages_count_polled;
 };
@@ -147,6 +187,8 @@ static void ip_data_cleanup(void *arg) {
 	}
 	rrr_event_collection_clear(&data->events);
 	rrr_msg_holder_collection_clear(&data->send_buffer);
+	ip_batch_collection_clear(&data->batches);
+	rrr_message_broker_write_batch_clear(&data->write_batch);
 	if (data->definitions != NULL) {
 		rrr_array_tree_destroy(data->definitions);
 	}
@@ -166,6 +208,7 @@ static int ip_data_init(struct ip_data *data, struct rrr_instance_runtime_data *
 	data->thread_data = thread_data;
 
 	rrr_event_collection_init(&data->events, INSTANCE_D_EVENTS(thread_data));
+	rrr_message_broker_write_batch_init(&data->write_batch, INSTANCE_D_BROKER_ARGS(thread_data), INSTANCE_D_CANCEL_CHECK_ARGS(thread_data));
 
 	return 0;
 }
@@ -343,6 +386,29 @@ static int ip_parse_config (struct ip_data *data, struct rrr_instance_config_dat
 	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("ip_graylist_timeout_ms", graylist_timeout_ms, IP_DEFAULT_GRAYLIST_TIMEOUT_MS);
 	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_YESNO("ip_sync_byte_by_byte", do_sync_byte_by_byte, 0);
 	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_YESNO("ip_send_rrr_message", do_send_rrr_msg_msg, 0);
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("ip_send_rrr_message_batch_size", batch_size_max, 0);
+	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_UNSIGNED("ip_send_rrr_message_batch_ms", batch_time_ms, 0);
+
+	if (data->batch_size_max > 0 && data->do_send_rrr_msg_msg == 0) {
+		RRR_MSG_0("ip_send_rrr_message_batch_size was set while ip_send_rrr_message was not 'yes' in ip instance %s, this is a configuration error.\n",
+				config->name);
+		ret = 1;
+		goto out;
+	}
+
+	if (data->batch_time_ms > 0 && data->batch_size_max == 0) {
+		RRR_MSG_0("ip_send_rrr_message_batch_ms was set while ip_send_rrr_message_batch_size was not set in ip instance %s, this is a configuration error.\n",
+				config->name);
+		ret = 1;
+		goto out;
+	}
+
+	if (data->batch_size_max > RRR_LENGTH_MAX) {
+		RRR_MSG_0("ip_send_rrr_message_batch_size was too large in ip instance %s, maximum is %llu\n",
+				config->name, (long long unsigned int) RRR_LENGTH_MAX);
+		ret = 1;
+		goto out;
+	}
 	RRR_INSTANCE_CONFIG_PARSE_OPTIONAL_YESNO("ip_force_target", do_force_target, 0);
 
 	if (data->do_force_target == 1 && data->target_port == 0) {
@@ -375,6 +441,13 @@ static int ip_parse_config (struct ip_data *data, struct rrr_instance_config_dat
 				config->name);
 	}
 
+	if (data->do_preserve_order && data->batch_size_max > 0) {
+		RRR_MSG_0("ip_preserve_order and ip_send_rrr_message_batch_size may not be used together in ip instance %s, this is a configuration error.\n",
+				config->name);
+		ret = 1;
+		goto out;
+	}
+
 	if (data->do_strip_array_separators && data->definitions == NULL) {
 		RRR_MSG_0("ip_strip_array_separators was 'yes' while no array definition was set in ip_input_types in ip instance %s, this is a configuration error.\n",
 				config->name);
@@ -459,7 +532,7 @@ static int ip_read_receive_message (
 	if (rrr_msg_holder_new (
 			&new_entry,
 			MSG_TOTAL_SIZE(message),
-			(struct sockaddr *) &entry_orig->addr,
+			(struct sockaddr *) entry_orig->addr,
 			entry_orig->addr_len,
 			entry_orig->protocol,
 			message
@@ -501,20 +574,26 @@ static int ip_read_data_receive_extract_messages (
 	int found_messages = 0;
 	RRR_LL_ITERATE_BEGIN(array, const struct rrr_type_value);
 		if (RRR_TYPE_IS_MSG(node->definition->type)) {
-			const struct rrr_msg_msg *message = (struct rrr_msg_msg *) node->data;
-			struct rrr_msg_msg *message_new = rrr_msg_msg_duplicate(message);
-			if (message_new == NULL) {
-				RRR_MSG_0("Could not allocate new message in ip read_data_receive_array_callback\n");
-				ret = 1;
-				goto out;
-			}
+			// The value holds multiple messages if a batch was received
+			rrr_length pos = 0;
+			while (pos < node->total_stored_length) {
+				const struct rrr_msg_msg *message = (struct rrr_msg_msg *) (node->data + pos);
+				struct rrr_msg_msg *message_new = rrr_msg_msg_duplicate(message);
+				if (message_new == NULL) {
+					RRR_MSG_0("Could not allocate new message in ip read_data_receive_array_callback\n");
+					ret = 1;
+					goto out;
+				}
 
-			// Guarantees to free message also upon errors
-			if ((ret = ip_read_receive_message(new_entries, data, entry_orig, message_new)) != 0) {
-				goto out;
-			}
+				pos += MSG_TOTAL_SIZE(message);
+
+				// Guarantees to free message also upon errors
+				if ((ret = ip_read_receive_message(new_entries, data, entry_orig, message_new)) != 0) {
+					goto out;
+				}
 
-			found_messages++;
+				found_messages++;
+			}
 		}
 	RRR_LL_ITERATE_END();
 
@@ -561,14 +640,16 @@ static int ip_array_callback_broker (struct rrr_msg_holder *entry, void *arg) {
 			goto out;
 	}
 
-	rrr_msg_holder_set_unlocked (
+	if ((ret = rrr_msg_holder_set_unlocked (
 			entry,
 			NULL,
 			0,
 			(const struct sockaddr *) &callback_data->read_session->src_addr,
 			callback_data->read_session->src_addr_len,
 			protocol
-	);
+	)) != 0) {
+		goto out;
+	}
 
 	if (callback_data->data->do_extract_rrr_messages) {
 		if ((ret = ip_read_data_receive_extract_messages (
@@ -645,10 +726,10 @@ static int ip_array_callback (
 		goto out;
 	}
 
-	if ((ret = rrr_message_broker_write_entries_from_collection_unsafe (
-			INSTANCE_D_BROKER_ARGS(data->thread_data),
-			&callback_data.new_entries,
-			INSTANCE_D_CANCEL_CHECK_ARGS(data->thread_data)
+	// Written to the broker in ip_read_done_callback
+	if ((ret = rrr_message_broker_write_batch_take_collection (
+			&data->write_batch,
+			&callback_data.new_entries
 	)) != 0) {
 		goto out;
 	}
@@ -658,6 +739,57 @@ static int ip_array_callback (
 	return ret;
 }
 
+static void ip_input_pause_update (struct ip_data *data) {
+	int pause = rrr_message_broker_backpressure_check(INSTANCE_D_BROKER_ARGS(data->thread_data));
+
+	if (pause == data->input_paused) {
+		return;
+	}
+
+	if (pause) {
+		RRR_DBG_3("ip instance %s pausing input while output buffer is full\n",
+				INSTANCE_D_NAME(data->thread_data));
+		data->input_pause_time = rrr_time_get_64();
+	}
+	else {
+		RRR_DBG_3("ip instance %s resuming input\n",
+				INSTANCE_D_NAME(data->thread_data));
+		rrr_message_broker_backpressure_blocked_time_add (
+				INSTANCE_D_BROKER_ARGS(data->thread_data),
+				rrr_time_get_64() - data->input_pause_time
+		);
+	}
+
+	rrr_socket_client_collection_read_pause_set(data->collection_tcp, pause);
+	rrr_socket_client_collection_read_pause_set(data->collection_udp, pause);
+
+	data->input_paused = pause;
+}
+
+static int ip_read_done_callback (void *arg) {
+	struct ip_data *data = arg;
+
+	int ret = 0;
+
+	if ((ret = rrr_message_broker_write_batch_flush(&data->write_batch)) != 0) {
+		RRR_MSG_0("Error while writing entries to broker after reading in ip instance %s\n", INSTANCE_D_NAME(data->thread_data));
+	}
+
+	ip_input_pause_update(data);
+
+	return ret;
+}
+
+static int ip_event_backpressure_released (RRR_EVENT_FUNCTION_ARGS) {
+	struct ip_data *data = arg;
+
+	*amount = 0;
+
+	ip_input_pause_update(data);
+
+	return 0;
+}
+
 static int ip_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 	struct rrr_instance_runtime_data *thread_data = arg;
 	struct ip_data *ip_data = thread_data->private_data;
@@ -915,7 +1047,7 @@ static int ip_resolve_push_sendto_callback (
 	rrr_ip_to_str(buf, sizeof(buf), addr, addr_len);
 
 	// If no translation is needed, the original address is copied
-	// rrr_ip_ipv4_mapped_ipv6_to_ipv4_if_needed(&addr, &addr_len, (const struct sockaddr *) &entry_orig->addr, entry_orig->addr_len);
+	// rrr_ip_ipv4_mapped_ipv6_to_ipv4_if_needed(&addr, &addr_len, (const struct sockaddr *) entry_orig->addr, entry_orig->addr_len);
 
 	if ( callback_data->ip_data->udp_send_fd_ip6 > 0 &&
 	     ip_resolve_push_sendto_callback_test_fd (
@@ -1120,7 +1252,7 @@ static int ip_push_raw (
 
 		if (RRR_DEBUGLEVEL_3) {
 			char buf[256];
-			rrr_ip_to_str(buf, sizeof(buf), (const struct sockaddr *) &entry_orig->addr, entry_orig->addr_len);
+			rrr_ip_to_str(buf, sizeof(buf), (const struct sockaddr *) entry_orig->addr, entry_orig->addr_len);
 			RRR_DBG_3("ip instance %s send using address from entry TCP (%s)\n", INSTANCE_D_NAME(thread_data), buf);
 		}
 
@@ -1128,7 +1260,7 @@ static int ip_push_raw (
 		ret = rrr_socket_client_collection_send_push_const_by_address_connect_as_needed (
 				&send_chunk_count,
 				ip_data->collection_tcp,
-				(const struct sockaddr *) &entry_orig->addr,
+				(const struct sockaddr *) entry_orig->addr,
 				entry_orig->addr_len,
 				send_data,
 				send_size,
@@ -1149,7 +1281,7 @@ static int ip_push_raw (
 		if (ip_data->do_multiple_per_connection == 0 || send_chunk_count_limit_reached) {
 			rrr_socket_client_collection_close_when_send_complete_by_address (
 					ip_data->collection_tcp,
-					(const struct sockaddr *) &entry_orig->addr,
+					(const struct sockaddr *) entry_orig->addr,
 					entry_orig->addr_len
 			);
 		}
@@ -1161,13 +1293,13 @@ static int ip_push_raw (
 
 		if (RRR_DEBUGLEVEL_3) {
 			char buf[256];
-			rrr_ip_to_str(buf, sizeof(buf), (const struct sockaddr *) &entry_orig->addr, entry_orig->addr_len);
+			rrr_ip_to_str(buf, sizeof(buf), (const struct sockaddr *) entry_orig->addr, entry_orig->addr_len);
 			RRR_DBG_3("ip instance %s send using address from entry UDP (%s)\n", INSTANCE_D_NAME(thread_data), buf);
 		}
 
 		int send_fd = -1;
 
-		if (entry_orig->addr.ss_family == AF_INET) {
+		if (entry_orig->addr->ss_family == AF_INET) {
 			send_fd = (ip_data->udp_send_fd_ip4 > 0 ? ip_data->udp_send_fd_ip4 : ip_data->udp_send_fd_ip6);
 		}
 		else {
@@ -1179,7 +1311,7 @@ static int ip_push_raw (
 				&send_chunk_count,
 				ip_data->collection_udp,
 				send_fd,
-				(const struct sockaddr *) &entry_orig->addr,
+				(const struct sockaddr *) entry_orig->addr,
 				entry_orig->addr_len,
 				send_data,
 				send_size,
@@ -1210,6 +1342,17 @@ static int ip_push_raw (
 	return ret;
 }
 
+static int ip_entry_is_batch (
+		const struct rrr_msg_holder *entry_locked
+) {
+	const struct rrr_msg *msg = entry_locked->message;
+
+	// Batches are always kept in network order
+	return entry_locked->endian_indicator != 0 &&
+	       entry_locked->data_length >= (ssize_t) sizeof(*msg) &&
+	       rrr_be16toh(msg->msg_type) == RRR_MSG_TYPE_BATCH;
+}
+
 static int ip_push_message (
 		struct ip_data *ip_data,
 		struct rrr_msg_holder *entry
@@ -1231,7 +1374,14 @@ static int ip_push_message (
 
 	// We modify the data in the buffer here, no need to copy as the memory is always
 	// freed after this function.
-	if (ip_data->do_send_rrr_msg_msg != 0) {
+	if (ip_entry_is_batch(entry)) {
+		RRR_DBG_3 ("ip instance %s sends batch of %" PRIu32 " rrr messages size %li\n",
+				INSTANCE_D_NAME(thread_data), rrr_be32toh(((struct rrr_msg *) message)->msg_value), entry->data_length);
+
+		send_data = message;
+		send_size = entry->data_length;
+	}
+	else if (ip_data->do_send_rrr_msg_msg != 0) {
 		if (entry->data_length < (long int) sizeof(*message) - 1) {
 			RRR_MSG_0("ip instance %s had send_rrr_msg_msg set but received a message which was too short (%li<%li), dropping it\n",
 					INSTANCE_D_NAME(thread_data), entry->data_length, (long int) sizeof(*message));
@@ -1354,7 +1504,8 @@ static void ip_timeout_check (
 ) {
 	uint64_t timeout_limit = rrr_time_get_64() - (ip_data->message_send_timeout_s * 1000000);
 
-	if (ip_data->message_ttl_us > 0 && !rrr_msg_msg_ttl_ok(entry_locked->message, ip_data->message_ttl_us)) {
+	// The TTL of batched messages has been checked before they were batched
+	if (ip_data->message_ttl_us > 0 && !ip_entry_is_batch(entry_locked) && !rrr_msg_msg_ttl_ok(entry_locked->message, ip_data->message_ttl_us)) {
 		*ttl_timeout = 1;
 	}
 	else if (ip_data->message_send_timeout_s > 0 && entry_locked->send_time > 0 && entry_locked->send_time < timeout_limit) {
@@ -1362,11 +1513,275 @@ static void ip_timeout_check (
 	}
 }
 
+static int ip_batch_make_entry (
+		struct rrr_msg_holder_collection *target,
+		struct ip_batch *batch
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder *entry = NULL;
+	struct rrr_msg *msg = NULL;
+	rrr_length msg_size = 0;
+
+	rrr_msg_batch_finalize(&msg, &msg_size, &batch->batch);
+
+	if ((ret = rrr_msg_holder_new (
+			&entry,
+			msg_size,
+			(const struct sockaddr *) &batch->addr,
+			batch->addr_len,
+			batch->protocol,
+			msg
+	)) != 0) {
+		RRR_MSG_0("Could not create entry in ip_batch_make_entry\n");
+		goto out;
+	}
+
+	// Now managed by the entry
+	msg = NULL;
+
+	rrr_msg_holder_lock(entry);
+	entry->endian_indicator = 1;
+	entry->send_time = batch->send_time;
+	RRR_LL_APPEND(target, entry);
+	rrr_msg_holder_unlock(entry);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(msg);
+	return ret;
+}
+
+static int ip_batch_push (
+		int *was_batched,
+		struct rrr_msg_holder_collection *batch_entries,
+		struct ip_data *ip_data,
+		struct rrr_msg_holder *entry_locked
+) {
+	const struct rrr_msg_msg *message = entry_locked->message;
+
+	int ret = 0;
+
+	*was_batched = 0;
+
+	// Messages already in network order are new attempts of messages sent
+	// alone earlier, and messages not fitting inside a batch are sent alone
+	if ( ip_data->batch_size_max == 0 ||
+	     entry_locked->endian_indicator != 0 ||
+	     entry_locked->data_length < (ssize_t) sizeof(*message) - 1 ||
+	     sizeof(struct rrr_msg) + MSG_TOTAL_SIZE(message) > ip_data->batch_size_max
+	) {
+		goto out;
+	}
+
+	const socklen_t addr_len = (ip_data->do_force_target ? 0 : entry_locked->addr_len);
+
+	struct ip_batch *batch = NULL;
+	RRR_LL_ITERATE_BEGIN(&ip_data->batches, struct ip_batch);
+		if ( node->addr_len == addr_len &&
+		    (addr_len == 0 || (node->protocol == entry_locked->protocol && memcmp(&node->addr, entry_locked->addr, addr_len) == 0))
+		) {
+			batch = node;
+			RRR_LL_ITERATE_LAST();
+		}
+	RRR_LL_ITERATE_END();
+
+	if (batch == NULL) {
+		if ((batch = rrr_allocate(sizeof(*batch))) == NULL) {
+			RRR_MSG_0("Could not allocate memory in ip_batch_push\n");
+			ret = 1;
+			goto out;
+		}
+
+		memset(batch, '\0', sizeof(*batch));
+
+		if (addr_len > 0) {
+			memcpy(&batch->addr, entry_locked->addr, addr_len);
+		}
+		batch->addr_len = addr_len;
+		batch->protocol = entry_locked->protocol;
+
+		RRR_LL_APPEND(&ip_data->batches, batch);
+	}
+	else if (batch->batch.data_size + MSG_TOTAL_SIZE(message) > ip_data->batch_size_max) {
+		// Full, send the current batch and start a new one
+		if ((ret = ip_batch_make_entry(batch_entries, batch)) != 0) {
+			goto out;
+		}
+	}
+
+	if (batch->batch.count == 0) {
+		batch->create_time = rrr_time_get_64();
+		batch->send_time = entry_locked->send_time;
+	}
+	else if (entry_locked->send_time < batch->send_time) {
+		batch->send_time = entry_locked->send_time;
+	}
+
+	if ((ret = rrr_msg_batch_append_msg_msg(&batch->batch, message)) != 0) {
+		goto out;
+	}
+
+	RRR_DBG_3 ("ip instance %s added rrr message with timestamp %" PRIu64 " size %" PRIu32 " to batch, now %" PRIu32 " messages\n",
+			INSTANCE_D_NAME(ip_data->thread_data), message->timestamp, MSG_TOTAL_SIZE(message), batch->batch.count);
+
+	*was_batched = 1;
+
+	out:
+	return ret;
+}
+
+static int ip_batch_flush (
+		struct rrr_msg_holder_collection *batch_entries,
+		struct ip_data *ip_data
+) {
+	int ret = 0;
+
+	const uint64_t time_limit = rrr_time_get_64() - ip_data->batch_time_ms * 1000;
+
+	RRR_LL_ITERATE_BEGIN(&ip_data->batches, struct ip_batch);
+		if (node->batch.count == 0) {
+			RRR_LL_ITERATE_SET_DESTROY();
+		}
+		else if (node->create_time <= time_limit) {
+			if ((ret = ip_batch_make_entry(batch_entries, node)) != 0) {
+				RRR_LL_ITERATE_LAST();
+			}
+			else {
+				RRR_LL_ITERATE_SET_DESTROY();
+			}
+		}
+	RRR_LL_ITERATE_END_CHECK_DESTROY(&ip_data->batches, 0; ip_batch_destroy(node));
+
+	return ret;
+}
+
+static int ip_batch_send (
+		struct ip_data *ip_data,
+		struct rrr_msg_holder_collection *batch_entries
+) {
+	int ret = 0;
+
+	RRR_LL_ITERATE_BEGIN(batch_entries, struct rrr_msg_holder);
+		rrr_msg_holder_lock(node);
+
+		if ((ret = ip_push_message(ip_data, node)) == RRR_SOCKET_NOT_READY) {
+			// Address possibly graylisted, retried from the send buffer
+			ret = 0;
+			rrr_msg_holder_unlock(node);
+		}
+		else {
+			RRR_LL_ITERATE_SET_DESTROY();
+
+			if (ret == RRR_SOCKET_SOFT_ERROR) {
+				RRR_DBG_3("Batch dropped after send soft error in ip instance %s\n",
+						INSTANCE_D_NAME(ip_data->thread_data));
+				ret = 0;
+			}
+			else if (ret != 0) {
+				RRR_MSG_0("Error while sending batch in ip instance %s\n", INSTANCE_D_NAME(ip_data->thread_data));
+				RRR_LL_ITERATE_LAST();
+			}
+		}
+	RRR_LL_ITERATE_END_CHECK_DESTROY(batch_entries, 0; rrr_msg_holder_decref_while_locked_and_unlock(node));
+
+	RRR_LL_MERGE_AND_CLEAR_SOURCE_HEAD(&ip_data->send_buffer, batch_entries);
+
+	return ret;
+}
+
+static int ip_batch_return_callback (
+		struct rrr_msg_msg **message,
+		void *arg1,
+		void *arg2
+) {
+	struct rrr_msg_holder_collection *entries = arg1;
+	const struct rrr_msg_holder *entry_orig = arg2;
+
+	int ret = 0;
+
+	struct rrr_msg_holder *entry = NULL;
+
+	if ((ret = rrr_msg_holder_new (
+			&entry,
+			MSG_TOTAL_SIZE(*message),
+			(const struct sockaddr *) entry_orig->addr,
+			entry_orig->addr_len,
+			entry_orig->protocol,
+			*message
+	)) != 0) {
+		RRR_MSG_0("Could not create entry in ip_batch_return_callback\n");
+		goto out;
+	}
+
+	// Now managed by the entry
+	*message = NULL;
+
+	RRR_LL_APPEND(entries, entry);
+
+	out:
+	return ret;
+}
+
+static int ip_batch_return (
+		struct ip_data *ip_data,
+		const struct rrr_msg_holder *entry_locked
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder_collection entries = {0};
+	struct rrr_msg *batch = NULL;
+
+	// The entry may still be referenced by the socket client, unpack a copy
+	if ((batch = rrr_allocate(entry_locked->data_length)) == NULL) {
+		RRR_MSG_0("Could not allocate memory in ip_batch_return\n");
+		ret = 1;
+		goto out;
+	}
+
+	memcpy(batch, entry_locked->message, entry_locked->data_length);
+
+	// The batch was made by us, failure means that memory allocation failed
+	if (rrr_msg_to_host_and_verify_with_callback (
+			&batch,
+			(rrr_length) entry_locked->data_length,
+			ip_batch_return_callback,
+			NULL,
+			NULL,
+			NULL,
+			NULL,
+			&entries,
+			(void *) entry_locked
+	) != 0) {
+		RRR_MSG_0("Could not unpack batch to return messages to buffer in ip instance %s\n",
+				INSTANCE_D_NAME(ip_data->thread_data));
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = rrr_message_broker_write_entries_from_collection_unsafe (
+			INSTANCE_D_BROKER_ARGS(ip_data->thread_data),
+			&entries,
+			INSTANCE_D_CANCEL_CHECK_ARGS(ip_data->thread_data)
+	)) != 0) {
+		RRR_MSG_0("Error while adding messages to buffer in ip instance %s\n",
+				INSTANCE_D_NAME(ip_data->thread_data));
+		goto out;
+	}
+
+	out:
+	rrr_msg_holder_collection_clear(&entries);
+	RRR_FREE_IF_NOT_NULL(batch);
+	return ret;
+}
+
 static int ip_send_loop (
 		struct ip_data *ip_data
 ) {
 	int ret = 0;
 
+	// Batches finished while iterating are sent after the iteration
+	struct rrr_msg_holder_collection batch_entries = {0};
+
 	if (ip_data->do_preserve_order) {
 		rrr_msg_holder_collection_sort(&ip_data->send_buffer, rrr_msg_msg_timestamp_compare_void);
 	}
@@ -1380,6 +1795,7 @@ static int ip_send_loop (
 
 		int ttl_reached = 0;
 		int timeout_reached = 0;
+		int was_batched = 0;
 
 		ip_timeout_check(&ttl_reached, &timeout_reached, ip_data, node);
 
@@ -1399,6 +1815,15 @@ static int ip_send_loop (
 			// to spam timed out messages. We do not reset the send_time in the entry.
 			action = ip_data->timeout_action;
 		}
+		else if ((ret = ip_batch_push(&was_batched, &batch_entries, ip_data, node)) != 0) {
+			RRR_MSG_0("Error while adding message to batch in ip instance %s\n", INSTANCE_D_NAME(ip_data->thread_data));
+			action = IP_ACTION_DROP;
+			RRR_LL_ITERATE_LAST();
+		}
+		else if (was_batched) {
+			// The message has been copied into a batch
+			action = IP_ACTION_DROP;
+		}
 		else {
 			if ((ret = ip_push_message(ip_data, node)) != 0) {
 				if (ret == RRR_SOCKET_NOT_READY) {
@@ -1432,7 +1857,12 @@ static int ip_send_loop (
 		else {
 			RRR_LL_ITERATE_SET_DESTROY();
 
-			if (action == IP_ACTION_RETURN) {
+			if (action == IP_ACTION_RETURN && ip_entry_is_batch(node)) {
+				if ((ret = ip_batch_return(ip_data, node)) != 0) {
+					RRR_LL_ITERATE_LAST(); // Destroy function must run and unlock
+				}
+			}
+			else if (action == IP_ACTION_RETURN) {
 				if (node->endian_indicator != 0) {
 					if (rrr_msg_head_to_host_and_verify(node->message, node->data_length) != 0 ||
 						rrr_msg_msg_to_host_and_verify(node->message, node->data_length) != 0
@@ -1473,7 +1903,16 @@ static int ip_send_loop (
 				ttl_reached_count, INSTANCE_D_NAME(ip_data->thread_data));
 	}
 
+	if ((ret = ip_batch_flush(&batch_entries, ip_data)) != 0) {
+		goto out;
+	}
+
+	if ((ret = ip_batch_send(ip_data, &batch_entries)) != 0) {
+		goto out;
+	}
+
 	out:
+	rrr_msg_holder_collection_clear(&batch_entries);
 	return ret;
 }
 
@@ -1772,7 +2211,7 @@ static void ip_event_send_buffer (
 		rrr_event_dispatch_break(INSTANCE_D_EVENTS(ip_data->thread_data));
 	}
 
-	if (RRR_LL_COUNT(&ip_data->send_buffer) > 0) {
+	if (RRR_LL_COUNT(&ip_data->send_buffer) > 0 || RRR_LL_COUNT(&ip_data->batches) > 0) {
 		// Short wait
 		EVENT_INTERVAL_SET(ip_data->event_send_buffer_iterate, 10 * 1000); // 10 ms
 		EVENT_ADD(ip_data->event_send_buffer_iterate);
@@ -1827,7 +2266,7 @@ static int ip_function_periodic (RRR_EVENT_FUNCTION_PERIODIC_ARGS) {
 	}
 	rrr_thread_watchdog_time_update(thread);
 
-	if (RRR_LL_COUNT(&ip_data->send_buffer) > 0) {
+	if (RRR_LL_COUNT(&ip_data->send_buffer) > 0 || RRR_LL_COUNT(&ip_data->batches) > 0) {
 		EVENT_ACTIVATE(ip_data->event_send_buffer_iterate);
 	}
 
@@ -1837,18 +2276,9 @@ static int ip_function_periodic (RRR_EVENT_FUNCTION_PERIODIC_ARGS) {
 	ip_data->messages_count_read = 0;
 	ip_data->messages_count_polled = 0;
 
-	int delivery_entry_count = 0;
-	int delivery_ratelimit_active = 0;
+	rrr_instance_default_post_broker_stats(thread_data);
 
-	if (rrr_instance_default_set_output_buffer_ratelimit_when_needed (
-			&delivery_entry_count,
-			&delivery_ratelimit_active,
-			thread_data
-	) != 0) {
-		RRR_MSG_0("Error while setting ratelimit in ip instance %s\n",
-				INSTANCE_D_NAME(thread_data));
-		return RRR_EVENT_EXIT;
-	}
+	ip_input_pause_update(ip_data);
 
 	rrr_socket_client_collection_send_chunk_iterate (ip_data->collection_udp, ip_send_chunk_periodic_callback, ip_data);
 	rrr_socket_client_collection_send_chunk_iterate (ip_data->collection_tcp, ip_send_chunk_periodic_callback, ip_data);
@@ -1896,6 +2326,11 @@ static void ip_event_setup (
 		ip_fd_close_notify_callback,
 		data
 	);
+	rrr_socket_client_collection_read_done_notify_setup (
+		collection,
+		ip_read_done_callback,
+		data
+	);
 }
 
 static void *thread_entry_ip (struct rrr_thread *thread) {
@@ -1956,6 +2391,16 @@ static void *thread_entry_ip (struct rrr_thread *thread) {
 	ip_event_setup (data, data->collection_tcp, RRR_SOCKET_READ_METHOD_RECV | RRR_SOCKET_READ_CHECK_POLLHUP | RRR_SOCKET_READ_CHECK_EOF | RRR_SOCKET_READ_FIRST_EOF_OK);
 	ip_event_setup (data, data->collection_udp, RRR_SOCKET_READ_METHOD_RECVFROM);
 
+	// Pause reading sockets instead of blocking when the output buffer is full
+	rrr_message_broker_backpressure_nonblocking_set(INSTANCE_D_BROKER_ARGS(thread_data));
+	rrr_event_function_set_with_arg (
+			INSTANCE_D_EVENTS(thread_data),
+			RRR_EVENT_FUNCTION_MESSAGE_BROKER_BACKPRESSURE_RELEASED,
+			ip_event_backpressure_released,
+			data,
+			"ip backpressure released"
+	);
+
 	if (ip_start_udp(data) != 0) {
 		goto out_message;
 	}
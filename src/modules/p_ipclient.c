@@ -545,15 +545,15 @@ static void *thread_entry_ipclient (struct rrr_thread *thread) {
 
 		if (time_now - prev_stats_time > 1000000) {
 			int output_buffer_count = 0;
-			int ratelimit_active = 0;
+			int backpressure_active = 0;
 			unsigned int send_queue_count = 0;
 
-			if (rrr_instance_default_set_output_buffer_ratelimit_when_needed (
+			if (rrr_message_broker_get_entry_count_and_backpressure (
 					&output_buffer_count,
-					&ratelimit_active,
-					thread_data
+					&backpressure_active,
+					INSTANCE_D_BROKER_ARGS(thread_data)
 			) != 0) {
-				RRR_MSG_0("Error while setting ratelimit in ipclient instance %s\n",
+				RRR_MSG_0("Error while getting output buffer size in ipclient instance %s\n",
 					INSTANCE_D_NAME(thread_data));
 				break;
 			}
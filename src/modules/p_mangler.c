@@ -42,12 +42,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/map.h"
 #include "../lib/type.h"
 #include "../lib/type_conversion.h"
+#include "../lib/stats/stats_instance.h"
 
 struct mangler_data {
 	struct rrr_instance_runtime_data *thread_data;
 
 	struct rrr_map conversions_map;
 	struct rrr_type_conversion_collection *conversions;
+	struct rrr_type_conversion_plan_cache *plan_cache;
 
 	int do_non_array_passthrough;
 	int do_convert_tolerant_blobs;
@@ -62,48 +64,14 @@ static void mangler_data_init(struct mangler_data *data, struct rrr_instance_run
 static void mangler_data_cleanup(void *arg) {
 	struct mangler_data *data = arg;
 	RRR_MAP_CLEAR(&data->conversions_map);
+	if (data->plan_cache != NULL) {
+		rrr_type_conversion_plan_cache_destroy(data->plan_cache);
+	}
 	if (data->conversions != NULL) {
 		rrr_type_conversion_collection_destroy(data->conversions);
 	}
 }
 
-static int mangler_process_value (
-		struct rrr_array *array_target,
-		struct mangler_data *data,
-		const struct rrr_type_value *value,
-		const int convert_flags
-) {
-	int ret = 0;
-
-	struct rrr_type_value *new_value = NULL;
-
-	if ((ret = rrr_type_convert_using_list (
-			&new_value,
-			value,
-			data->conversions,
-			convert_flags
-	)) != 0) {
-		if (ret == RRR_TYPE_CONVERSION_NOT_POSSIBLE) {
-			if ((ret = rrr_type_value_clone(&new_value, value, 1)) != 0) {
-				RRR_MSG_0("Failed to clone value in mangler_process_value\n");
-				goto out;
-			}
-		}
-		else {
-			goto out;
-		}
-	}
-
-	RRR_LL_APPEND(array_target, new_value);
-	new_value = NULL;
-
-	out:
-	if (new_value != NULL) {
-		rrr_type_value_destroy(new_value);
-	}
-	return ret;
-}
-
 static int mangler_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 	struct rrr_instance_runtime_data *thread_data = arg;
 	struct mangler_data *data = thread_data->private_data;
@@ -112,7 +80,6 @@ static int mangler_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 
 	struct rrr_msg_msg *message_new = NULL;
 	struct rrr_array array_from_message = {0};
-	struct rrr_array array_new = {0};
 
 	RRR_DBG_3("mangler instance %s received a message with timestamp %llu\n",
 			INSTANCE_D_NAME(thread_data),
@@ -130,6 +97,8 @@ static int mangler_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 		goto out_drop;
 	}
 
+	rrr_array_arena_enable(&array_from_message);
+
 	uint16_t array_version_dummy;
 	if ((ret = rrr_array_message_append_to_collection (
 			&array_version_dummy,
@@ -141,33 +110,21 @@ static int mangler_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 		goto out_drop;
 	}
 
-	const int convert_flags =
-			RRR_TYPE_CONVERT_F_ON_ERROR_TRY_NEXT |
-			(data->do_convert_tolerant_blobs ? 0 : RRR_TYPE_CONVERT_F_STRICT_BLOBS) |
-			(data->do_convert_tolerant_strings ? 0 : RRR_TYPE_CONVERT_F_STRICT_STRINGS);
-
-	int i = 0;
-	RRR_LL_ITERATE_BEGIN(&array_from_message, const struct rrr_type_value);
-		RRR_DBG_3("Mangler instance %s CONVERT idx %i type %s\n",
-				INSTANCE_D_NAME(data->thread_data), i, node->definition->identifier);
-		if ((ret = mangler_process_value (
-				&array_new,
-				data,
-				node,
-				convert_flags
-		)) != 0) {
-			RRR_MSG_0("mangler instance %s dropping message following error %i\n",
-					INSTANCE_D_NAME(thread_data), ret);
-			// Let only hard error propagate
-			ret &= ~(1);
-			goto out_drop;
-		}
-		i++;
-	RRR_LL_ITERATE_END();
+	// Values are converted in place, also those in the arena
+	if ((ret = rrr_type_convert_array_using_plan_cache (
+			&array_from_message,
+			data->plan_cache
+	)) != 0) {
+		RRR_MSG_0("mangler instance %s dropping message following error %i\n",
+				INSTANCE_D_NAME(thread_data), ret);
+		// Let only hard error propagate
+		ret &= ~(1);
+		goto out_drop;
+	}
 
 	if ((ret = rrr_array_new_message_from_collection (
 			&message_new,
-			&array_new,
+			&array_from_message,
 			rrr_time_get_64(),
 			MSG_TOPIC_PTR((const struct rrr_msg_msg *) entry->message),
 			MSG_TOPIC_LENGTH((const struct rrr_msg_msg *) entry->message)
@@ -188,7 +145,6 @@ static int mangler_poll_callback (RRR_MODULE_POLL_CALLBACK_SIGNATURE) {
 	);
 
 	out_drop:
-	rrr_array_clear(&array_new);
 	rrr_array_clear(&array_from_message);
 	rrr_msg_holder_unlock(entry);
 	return ret;
@@ -222,10 +178,41 @@ static int mangler_parse_config (struct mangler_data *data, struct rrr_instance_
 		goto out;
 	}
 
+	const int convert_flags =
+			RRR_TYPE_CONVERT_F_ON_ERROR_TRY_NEXT |
+			(data->do_convert_tolerant_blobs ? 0 : RRR_TYPE_CONVERT_F_STRICT_BLOBS) |
+			(data->do_convert_tolerant_strings ? 0 : RRR_TYPE_CONVERT_F_STRICT_STRINGS);
+
+	if ((ret = rrr_type_conversion_plan_cache_new(&data->plan_cache, data->conversions, convert_flags)) != 0) {
+		RRR_MSG_0("Failed to create conversion plan cache in mangler instance %s\n",
+				config->name);
+		goto out;
+	}
+
 	out:
 	return ret;
 }
 
+static int mangler_event_periodic (RRR_EVENT_FUNCTION_PERIODIC_ARGS) {
+	struct rrr_thread *thread = arg;
+	struct rrr_instance_runtime_data *thread_data = thread->private_data;
+
+	struct mangler_data *data = thread_data->private_data;
+
+	rrr_instance_default_post_broker_stats(thread_data);
+
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	rrr_type_conversion_plan_cache_get_stats(&hits, &misses, data->plan_cache);
+
+	rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "plan_cache_hits", 0, hits);
+	rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "plan_cache_misses", 0, misses);
+	rrr_stats_instance_post_unsigned_base10_text(INSTANCE_D_STATS(thread_data), "plan_cache_hit_percent", 0,
+			hits + misses > 0 ? (hits * 100) / (hits + misses) : 0);
+
+	return rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer_void(thread);
+}
+
 static void *thread_entry_mangler (struct rrr_thread *thread) {
 	struct rrr_instance_runtime_data *thread_data = thread->private_data;
 	struct mangler_data *data = thread_data->private_data = thread_data->private_memory;
@@ -250,7 +237,7 @@ static void *thread_entry_mangler (struct rrr_thread *thread) {
 	rrr_event_dispatch (
 			INSTANCE_D_EVENTS(thread_data),
 			1 * 1000 * 1000,
-			rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer_void,
+			mangler_event_periodic,
 			thread
 	);
 
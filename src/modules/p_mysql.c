@@ -41,6 +41,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/settings.h"
 #include "../lib/map.h"
 #include "../lib/array.h"
+#include "../lib/array_tag_index.h"
 #include "../lib/rrr_mysql.h"
 #include "../lib/string_builder.h"
 #include "../lib/message_broker.h"
@@ -86,6 +87,7 @@ struct mysql_data {
 
 	struct rrr_map columns;
 	struct rrr_map column_tags;
+	struct rrr_array_tag_plan *column_tags_plan;
 	struct rrr_map special_columns;
 	struct rrr_map blob_write_columns;
 
@@ -134,6 +136,11 @@ void data_cleanup(void *arg) {
 	rrr_map_clear(&data->column_tags);
 	rrr_map_clear(&data->blob_write_columns);
 
+	if (data->column_tags_plan != NULL) {
+		rrr_array_tag_plan_destroy(data->column_tags_plan);
+		data->column_tags_plan = NULL;
+	}
+
 	rrr_msg_holder_collection_clear(&data->input_buffer);
 
 	RRR_FREE_IF_NOT_NULL(data->mysql_server);
@@ -296,7 +303,7 @@ void free_collection(void *arg) {
 static int bind_value (
 		MYSQL_BIND *bind,
 		int bind_pos,
-		struct rrr_type_value *definition,
+		const struct rrr_type_value *definition,
 		const char *column_name,
 		struct mysql_data *data
 ) {
@@ -338,6 +345,8 @@ int colplan_array_bind_execute (
 
 	uint16_t array_version = 0;
 
+	rrr_array_arena_enable(&collection);
+
 	if (rrr_array_message_append_to_collection(&array_version, &collection, entry->message) != 0) {
 		RRR_MSG_0("Could not convert array message to data collection in mysql\n");
 		ret = 1;
@@ -369,8 +378,15 @@ int colplan_array_bind_execute (
 	int bind_pos = 0;
 
 	if (RRR_MAP_COUNT(&mysql_data->column_tags) > 0) {
+		const struct rrr_type_value **array_values = NULL;
+		if (rrr_array_tag_plan_resolve(&array_values, mysql_data->column_tags_plan, &collection) != 0) {
+			ret = 1;
+			goto out_cleanup;
+		}
+
+		int tag_pos = 0;
 		RRR_MAP_ITERATE_BEGIN(&mysql_data->column_tags);
-			struct rrr_type_value *array_value = rrr_array_value_get_by_tag(&collection, node_tag);
+			const struct rrr_type_value *array_value = array_values[tag_pos++];
 
 			if (array_value == NULL) {
 				RRR_MSG_0("Array tag '%s' not found when binding with MySQL\n", node_tag);
@@ -605,6 +621,11 @@ int mysql_parse_column_plan (struct mysql_data *data, struct rrr_instance_config
 			ret = 1;
 			goto out;
 		}
+
+		if (RRR_MAP_COUNT(&data->column_tags) > 0 && rrr_array_tag_plan_new(&data->column_tags_plan, &data->column_tags) != 0) {
+			ret = 1;
+			goto out;
+		}
 	}
 	else {
 		RRR_MSG_0("BUG: Reached end of colplan name tests in mysql for instance %s\n", config->name);
@@ -255,6 +255,8 @@ static int dummy_event_periodic (RRR_EVENT_FUNCTION_PERIODIC_ARGS) {
 	rrr_stats_instance_update_rate (INSTANCE_D_STATS(thread_data), 0, "generated", data->generated_count_to_stats);
 	data->generated_count_to_stats = 0;
 
+	rrr_instance_default_post_broker_stats(thread_data);
+
 	data->last_periodic_time = 0;
 
 	return rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer(thread);
@@ -282,15 +284,10 @@ static void *thread_entry_dummy (struct rrr_thread *thread) {
 
 	rrr_instance_config_check_all_settings_used(thread_data->init_data.instance_config);
 
-	// If we are not sleeping we need to enable automatic rate limiting on our output buffer
-	if (data->no_sleeping == 1) {
-		if (data->no_ratelimit) {
-			RRR_DBG_1("dummy instance %s both sleeping and ratelimit disabled\n", INSTANCE_D_NAME(thread_data));
-		}
-		else {
-			RRR_DBG_1("dummy instance %s enabling ratelimit on output buffer as sleeping is disabled\n", INSTANCE_D_NAME(thread_data));
-			rrr_message_broker_set_ratelimit(INSTANCE_D_BROKER_ARGS(thread_data), 1);
-		}
+	// Writes are otherwise held back when readers cannot keep up
+	if (data->no_ratelimit) {
+		RRR_DBG_1("dummy instance %s disabling backpressure on output buffer\n", INSTANCE_D_NAME(thread_data));
+		rrr_message_broker_watermarks_set(INSTANCE_D_BROKER_ARGS(thread_data), 0, 0);
 	}
 
 	if (data->no_generation == 0) {
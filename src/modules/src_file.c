@@ -601,6 +601,7 @@ static int file_read_array_write_callback (struct rrr_msg_holder *entry, void *a
 struct file_read_callback_data {
 	struct file_data *file_data;
 	struct file *file;
+	struct rrr_message_broker_write_batch *batch;
 };
 
 static int file_read_array_callback (struct rrr_read_session *read_session, struct rrr_array *array_final, void *arg) {
@@ -619,14 +620,13 @@ static int file_read_array_callback (struct rrr_read_session *read_session, stru
 		rrr_array_strip_type(array_final, &rrr_type_definition_sep);
 	}
 
-	if ((ret = rrr_message_broker_write_entry (
-			INSTANCE_D_BROKER_ARGS(callback_data->file_data->thread_data),
+	if ((ret = rrr_message_broker_write_batch_entry (
+			callback_data->batch,
 			NULL,
 			0,
 			0,
 			file_read_array_write_callback,
-			&write_callback_data,
-			INSTANCE_D_CANCEL_CHECK_ARGS(callback_data->file_data->thread_data)
+			&write_callback_data
 	)) != 0) {
 		RRR_MSG_0("Could not create new array message in file instance %s, return was %i\n",
 				INSTANCE_D_NAME(callback_data->file_data->thread_data), ret);
@@ -833,14 +833,13 @@ static int file_read_all_to_message_complete_callback (
 			read_session
 	};
 
-	if ((ret = rrr_message_broker_write_entry (
-			INSTANCE_D_BROKER_ARGS(data->thread_data),
+	if ((ret = rrr_message_broker_write_batch_entry (
+			callback_data->batch,
 			NULL,
 			0,
 			0,
 			file_read_all_to_message_write_callback,
-			&write_callback_data,
-			INSTANCE_D_CANCEL_CHECK_ARGS(data->thread_data)
+			&write_callback_data
 	)) != 0) {
 		RRR_MSG_0("Could not create new message in file instance %s, return was %i\n",
 				INSTANCE_D_NAME(data->thread_data), ret);
@@ -857,6 +856,14 @@ static int file_read (uint64_t *bytes_read, struct file_data *data, struct file
 	int ret = 0;
 
 	struct rrr_array array_final = {0};
+	struct rrr_message_broker_write_batch batch;
+
+	// Messages from one read are written to the output buffer together
+	rrr_message_broker_write_batch_init (
+			&batch,
+			INSTANCE_D_BROKER_ARGS(data->thread_data),
+			INSTANCE_D_CANCEL_CHECK_ARGS(data->thread_data)
+	);
 
 	if (data->timeout_s != 0) {
 		uint64_t time_min = rrr_time_get_64() - (data->timeout_s * 1000 * 1000);
@@ -888,7 +895,8 @@ static int file_read (uint64_t *bytes_read, struct file_data *data, struct file
 
 	struct file_read_callback_data read_callback_data = {
 		data,
-		file
+		file,
+		&batch
 	};
 
 	if (data->read_method == FILE_READ_METHOD_TELEGRAMS) {
@@ -968,6 +976,11 @@ static int file_read (uint64_t *bytes_read, struct file_data *data, struct file
 	file->last_read_time = rrr_time_get_64();
 
 	out:
+	if (rrr_message_broker_write_batch_flush(&batch) != 0) {
+		RRR_MSG_0("Could not write messages to output buffer in file instance %s\n",
+				INSTANCE_D_NAME(data->thread_data));
+		ret = RRR_READ_HARD_ERROR;
+	}
 	rrr_array_clear(&array_final);
 	return ret;
 }
@@ -1085,6 +1098,7 @@ static void *thread_entry_file (struct rrr_thread *thread) {
 			rrr_stats_instance_update_rate (INSTANCE_D_STATS(thread_data), 0, "generated", data->message_count - messages_count_prev_stats);
 			rrr_stats_instance_update_rate (INSTANCE_D_STATS(thread_data), 1, "bytes", bytes_read_accumulator);
 			rrr_stats_instance_update_rate (INSTANCE_D_STATS(thread_data), 2, "ticks", ticks);
+			rrr_instance_default_post_broker_stats(thread_data);
 
 			bytes_read_accumulator = 0;
 			messages_count_prev_stats = data->message_count;
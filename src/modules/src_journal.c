@@ -448,16 +448,16 @@ static void *thread_entry_journal (struct rrr_thread *thread) {
 
 		if (time_now - time_start > 1000000) {
 			int output_buffer_count = 0;
-			int delivery_ratelimit_active = 0;
+			int backpressure_active = 0;
 			uint64_t delivery_queue_sleep_event_count = 0;
 			int delivery_queue_count = 0;
 
-			if (rrr_instance_default_set_output_buffer_ratelimit_when_needed (
+			if (rrr_message_broker_get_entry_count_and_backpressure (
 					&output_buffer_count,
-					&delivery_ratelimit_active,
-					thread_data
+					&backpressure_active,
+					INSTANCE_D_BROKER_ARGS(thread_data)
 			) != 0) {
-				RRR_MSG_0("Error while setting ratelimit in journal instance %s\n",
+				RRR_MSG_0("Error while getting output buffer size in journal instance %s\n",
 						INSTANCE_D_NAME(thread_data));
 				break;
 			}
@@ -484,6 +484,7 @@ static void *thread_entry_journal (struct rrr_thread *thread) {
 					0,
 					delivery_queue_count
 			);
+			rrr_instance_default_post_broker_stats(thread_data);
 
 			prev_delivery_queue_sleep_event_count = delivery_queue_sleep_event_count;
 			prev_processed = data->count_processed;
@@ -59,6 +59,7 @@ struct socket_data {
 	struct rrr_socket_client_collection *clients;
 	uint64_t message_count;
 	struct rrr_array array_tmp;
+	struct rrr_message_broker_write_batch write_batch;
 };
 
 void data_cleanup(void *arg) {
@@ -72,6 +73,7 @@ void data_cleanup(void *arg) {
 	RRR_FREE_IF_NOT_NULL(data->socket_path);
 	RRR_FREE_IF_NOT_NULL(data->default_topic);
 	rrr_array_clear(&data->array_tmp);
+	rrr_message_broker_write_batch_clear(&data->write_batch);
 }
 
 int data_init(struct socket_data *data, struct rrr_instance_runtime_data *thread_data) {
@@ -79,6 +81,8 @@ int data_init(struct socket_data *data, struct rrr_instance_runtime_data *thread
 
 	data->thread_data = thread_data;
 
+	rrr_message_broker_write_batch_init(&data->write_batch, INSTANCE_D_BROKER_ARGS(thread_data), INSTANCE_D_CANCEL_CHECK_ARGS(thread_data));
+
 	return 0;
 }
 
@@ -212,14 +216,13 @@ static int socket_read_raw_data_callback (struct rrr_read_session *read_session,
 	(void)(private_data);
 	(void)(read_session);
 
-	return rrr_message_broker_write_entry (
-			INSTANCE_D_BROKER_ARGS(data->thread_data),
+	return rrr_message_broker_write_batch_entry (
+			&data->write_batch,
 			NULL,
 			0,
 			0,
 			socket_read_raw_data_broker_callback,
-			data,
-			INSTANCE_D_CANCEL_CHECK_ARGS(data->thread_data)
+			data
 	);
 }
 
@@ -271,17 +274,29 @@ static int socket_read_rrr_msg_msg_callback (struct rrr_msg_msg **message, void
 		message
 	};
 
-	return rrr_message_broker_write_entry (
-			INSTANCE_D_BROKER_ARGS(data->thread_data),
+	return rrr_message_broker_write_batch_entry (
+			&data->write_batch,
 			NULL,
 			0,
 			0,
 			socket_read_message_broker_callback,
-			&callback_data,
-			INSTANCE_D_CANCEL_CHECK_ARGS(data->thread_data)
+			&callback_data
 	);
 }
 
+// Messages received during one read event are written to the broker together
+static int socket_read_done_callback (void *arg) {
+	struct socket_data *data = arg;
+
+	int ret = 0;
+
+	if ((ret = rrr_message_broker_write_batch_flush(&data->write_batch)) != 0) {
+		RRR_MSG_0("Error while writing messages to broker in socket instance %s\n", INSTANCE_D_NAME(data->thread_data));
+	}
+
+	return ret;
+}
+
 static int socket_start (
 		struct socket_data *data,
 		struct rrr_read_common_get_session_target_length_from_array_tree_data *raw_callback_data
@@ -337,6 +352,12 @@ static int socket_start (
 		);
 	}
 
+	rrr_socket_client_collection_read_done_notify_setup (
+			data->clients,
+			socket_read_done_callback,
+			data
+	);
+
 	if ((ret = rrr_socket_client_collection_listen_fd_push (data->clients, fd)) != 0) {
 		goto out;
 	}
@@ -353,6 +374,15 @@ static void socket_stop (void *arg) {
 	}
 }
 
+static int socket_function_periodic (RRR_EVENT_FUNCTION_PERIODIC_ARGS) {
+	struct rrr_thread *thread = arg;
+	struct rrr_instance_runtime_data *thread_data = thread->private_data;
+
+	rrr_instance_default_post_broker_stats(thread_data);
+
+	return rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer_void(thread);
+}
+
 static void *thread_entry_socket (struct rrr_thread *thread) {
 	struct rrr_instance_runtime_data *thread_data = thread->private_data;
 	struct socket_data *data = thread_data->private_data = thread_data->private_memory;
@@ -398,7 +428,7 @@ static void *thread_entry_socket (struct rrr_thread *thread) {
 	rrr_event_dispatch (
 			INSTANCE_D_EVENTS(thread_data),
 			1 * 1000 * 1000,
-			rrr_thread_signal_encourage_stop_check_and_update_watchdog_timer_void,
+			socket_function_periodic,
 			thread
 	);
 
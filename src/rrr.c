@@ -47,6 +47,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "lib/stats/stats_message.h"
 #include "lib/rrr_strerror.h"
 #include "lib/message_broker.h"
+#include "lib/message_holder/message_holder.h"
 #include "lib/map.h"
 #include "lib/fork.h"
 #include "lib/rrr_umask.h"
@@ -175,6 +176,31 @@ static int main_stats_post_unsigned_message (struct stats_data *stats_data, cons
 	return EXIT_SUCCESS;
 }
 
+static int main_stats_post_double_message (struct stats_data *stats_data, const char *path, double value, uint32_t flags) {
+	struct rrr_msg_stats message;
+
+	char text[125];
+	sprintf(text, "%f", value);
+
+	if (rrr_msg_stats_init (
+			&message,
+			RRR_STATS_MESSAGE_TYPE_DOUBLE_TEXT,
+			flags,
+			path,
+			text,
+			strlen(text) + 1
+	) != 0) {
+		RRR_BUG("Could not initialize main statistics message\n");
+	}
+
+	if (rrr_stats_engine_post_message(&stats_data->engine, stats_data->handle, "main", &message) != 0) {
+		RRR_MSG_0("Could not post main statistics message\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
 static int main_stats_post_sticky_messages (struct stats_data *stats_data, struct rrr_instance_collection *instances) {
 	int ret = 0;
 	if (rrr_stats_engine_handle_obtain(&stats_data->handle, &stats_data->engine) != 0) {
@@ -295,10 +321,76 @@ static int main_loop_threads_restart (
 	return ret;
 }
 
+static const char *main_allocator_group_names[RRR_MMAP_STATS_GROUP_COUNT] = {
+	[RRR_ALLOCATOR_GROUP_MSG_HOLDER] = "msg_holder",
+	[RRR_ALLOCATOR_GROUP_MSG] = "msg"
+};
+
+// Part of free memory not in the largest free chunk, 0 means no fragmentation
+static double main_allocator_fragmentation (uint64_t bytes_free, uint64_t largest_free_chunk) {
+	return bytes_free > 0 ? 1.0 - (double) largest_free_chunk / (double) bytes_free : 0.0;
+}
+
+#define MAIN_ALLOCATOR_POST_UNSIGNED(postfix, value)                                            \
+	do {sprintf(path_end, postfix); ret |= main_stats_post_unsigned_message(stats_data, path, value, 0);} while(0)
+
+#define MAIN_ALLOCATOR_POST_DOUBLE(postfix, value)                                              \
+	do {sprintf(path_end, postfix); ret |= main_stats_post_double_message(stats_data, path, value, 0);} while(0)
+
+static int main_allocator_stats_post (struct stats_data *stats_data, const struct rrr_mmap_stats *mmap_stats) {
+	int ret = 0;
+
+	char path[RRR_STATS_MESSAGE_PATH_MAX_LENGTH + 1];
+
+	for (int i = 0; i < RRR_MMAP_STATS_GROUP_COUNT; i++) {
+		const struct rrr_mmap_stats_group *group = &mmap_stats->groups[i];
+
+		char *path_end = path + sprintf(path, "allocator/%s/", main_allocator_group_names[i]);
+
+		MAIN_ALLOCATOR_POST_UNSIGNED("bytes_in_use", group->bytes_in_use);
+		MAIN_ALLOCATOR_POST_UNSIGNED("bytes_reserved", group->bytes_reserved);
+		MAIN_ALLOCATOR_POST_UNSIGNED("mmap_count", group->mmap_count);
+		MAIN_ALLOCATOR_POST_UNSIGNED("mmap_bytes_free", group->mmap_bytes_free);
+		MAIN_ALLOCATOR_POST_UNSIGNED("mmap_largest_free_chunk", group->mmap_largest_free_chunk);
+		MAIN_ALLOCATOR_POST_DOUBLE("mmap_fragmentation", main_allocator_fragmentation(group->mmap_bytes_free, group->mmap_largest_free_chunk));
+		MAIN_ALLOCATOR_POST_UNSIGNED("mmap_reclaimed_count", group->mmap_reclaimed_count);
+		MAIN_ALLOCATOR_POST_UNSIGNED("mmap_allocation_failure_count", group->mmap_allocation_failure_count);
+		MAIN_ALLOCATOR_POST_UNSIGNED("slab_count", group->slab_count);
+		MAIN_ALLOCATOR_POST_UNSIGNED("slab_released_count", group->slab_released_count);
+		MAIN_ALLOCATOR_POST_UNSIGNED("slab_allocation_failure_count", group->slab_allocation_failure_count);
+
+		for (int j = 0; j < RRR_MMAP_STATS_HISTOGRAM_BUCKETS - 1; j++) {
+			sprintf(path_end, "histogram/%llu", (unsigned long long) 16 << j);
+			ret |= main_stats_post_unsigned_message(stats_data, path, group->histogram[j], 0);
+		}
+		MAIN_ALLOCATOR_POST_UNSIGNED("histogram/larger", group->histogram[RRR_MMAP_STATS_HISTOGRAM_BUCKETS - 1]);
+
+		for (uint64_t j = 0; j < group->mmap_count; j++) {
+			const struct rrr_mmap_stats_heap *heap = &group->heaps[j];
+
+			char *path_end_group = path_end;
+			path_end += sprintf(path_end, "mmap/%" PRIu64 "/", j);
+
+			MAIN_ALLOCATOR_POST_UNSIGNED("heap_size", heap->heap_size);
+			MAIN_ALLOCATOR_POST_UNSIGNED("bytes_in_use", heap->bytes_in_use);
+			MAIN_ALLOCATOR_POST_UNSIGNED("bytes_free", heap->bytes_free);
+			MAIN_ALLOCATOR_POST_UNSIGNED("largest_free_chunk", heap->largest_free_chunk);
+			MAIN_ALLOCATOR_POST_DOUBLE("fragmentation", main_allocator_fragmentation(heap->bytes_free, heap->largest_free_chunk));
+			MAIN_ALLOCATOR_POST_UNSIGNED("allocation_count", heap->allocation_count);
+
+			path_end = path_end_group;
+		}
+	}
+
+	return ret;
+}
+
 static int main_mmap_periodic (struct stats_data *stats_data) {
 	struct rrr_mmap_stats mmap_stats = {0};
+	struct rrr_msg_holder_pool_stats pool_stats = {0};
 
 	rrr_allocator_maintenance(&mmap_stats);
+	rrr_msg_holder_pool_get_stats(&pool_stats);
 
 	int ret = 0;
 
@@ -307,6 +399,15 @@ static int main_mmap_periodic (struct stats_data *stats_data) {
 		ret |= main_stats_post_unsigned_message (stats_data, "mmap/empty_count", mmap_stats.mmap_total_empty_count, 0);
 		ret |= main_stats_post_unsigned_message (stats_data, "mmap/bad_count", mmap_stats.mmap_total_bad_count, 0);
 		ret |= main_stats_post_unsigned_message (stats_data, "mmap/heap_size", mmap_stats.mmap_total_heap_size, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "slab/count", mmap_stats.slab_total_count, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "slab/empty_count", mmap_stats.slab_total_empty_count, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "slab/released_count", mmap_stats.slab_total_released_count, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "slab/bytes_in_use", mmap_stats.slab_total_bytes_in_use, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "msg_holder_pool/hits", pool_stats.total_hits, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "msg_holder_pool/misses", pool_stats.total_misses, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "msg_holder_pool/frees", pool_stats.total_frees, 0);
+		ret |= main_stats_post_unsigned_message (stats_data, "msg_holder_pool/global_count", pool_stats.global_count, 0);
+		ret |= main_allocator_stats_post (stats_data, &mmap_stats);
 	}
 
 	return ret;
@@ -473,6 +574,7 @@ static int main_loop (
 	out_destroy_events:
 		rrr_event_queue_destroy(queue);
 	out:
+		rrr_msg_holder_pool_cleanup();
 		rrr_allocator_cleanup();
 		return ret;
 }
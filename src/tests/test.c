@@ -51,9 +51,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "test_msgdb.h"
 #include "test_nullsafe.h"
 #include "test_increment.h"
+#include "test_buffer.h"
+#include "test_msg_holder.h"
+#include "test_allocator.h"
+#include "test_array.h"
+#include "test_type_scan.h"
+#include "test_crc32.h"
+#include "test_msg.h"
 
 RRR_CONFIG_DEFINE_DEFAULT_LOG_PREFIX("test");
 
+uint32_t rrr_test_random (uint32_t *state) {
+	*state = *state * 1103515245 + 12345;
+	return *state >> 16;
+}
+
 const char *library_paths[] = {
 		RRR_MODULE_PATH,
 		RRR_TEST_MODULE_PATH,
@@ -176,6 +188,60 @@ int rrr_test_library_functions (struct rrr_fork_handler *fork_handler) {
 
 	ret |= ret_tmp;
 
+	TEST_BEGIN("fifo buffer engines") {
+		ret_tmp = rrr_test_buffer();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("message holder pool") {
+		ret_tmp = rrr_test_msg_holder();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("message holder spill") {
+		ret_tmp = rrr_test_msg_holder_spill();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("message holder write-ahead log") {
+		ret_tmp = rrr_test_msg_holder_wal();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("slab allocator") {
+		ret_tmp = rrr_test_allocator();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("array parsing") {
+		ret_tmp = rrr_test_array();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("type scanning") {
+		ret_tmp = rrr_test_type_scan();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("crc32 checksums") {
+		ret_tmp = rrr_test_crc32();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
+	TEST_BEGIN("message batches") {
+		ret_tmp = rrr_test_msg();
+	} TEST_RESULT(ret_tmp == 0);
+
+	ret |= ret_tmp;
+
 	return ret;
 }
 
@@ -22,6 +22,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef RRR_TEST_H
 #define RRR_TEST_H
 
+#include <stdint.h>
+
 #define TEST_MSG(...) \
 	do {printf (__VA_ARGS__);}while(0)
 
@@ -31,4 +33,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define TEST_RESULT(ok) \
 	while(0); printf("%s\n", (ok) ? "passed" : "failed");} while (0)
 
+// Reproducible pseudo random numbers for test data, 16 bits per call. Use
+// rrr_rand() where the sequence need not be the same every run.
+uint32_t rrr_test_random (uint32_t *state);
+
 #endif /* RRR_TEST_H */
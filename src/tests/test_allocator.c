@@ -0,0 +1,460 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "../lib/log.h"
+#include "../lib/allocator.h"
+#include "../lib/rrr_mmap.h"
+#include "../lib/rrr_mmap_stats.h"
+#include "../lib/rrr_slab.h"
+#include "../lib/message_holder/message_holder_struct.h"
+#include "../lib/util/rrr_time.h"
+#include "test.h"
+#include "test_allocator.h"
+
+#define RRR_TEST_ALLOCATOR_ENTRIES            10000
+#define RRR_TEST_ALLOCATOR_BENCHMARK_WINDOW   4096
+#define RRR_TEST_ALLOCATOR_BENCHMARK_OPS      1000000
+#define RRR_TEST_ALLOCATOR_BENCHMARK_THREADS  4
+#define RRR_TEST_ALLOCATOR_MMAP_ENTRIES       64
+#define RRR_TEST_ALLOCATOR_MMAP_ENTRY_SIZE    (1024 * 1024)
+
+struct rrr_test_allocator_thread_data {
+	void *entries[RRR_TEST_ALLOCATOR_ENTRIES];
+	int ret;
+};
+
+// Sizes seen for holders and messages, mostly small messages with
+// some larger ones and a few too large for the slabs
+static size_t __rrr_test_allocator_size (
+		uint32_t *state
+) {
+	const uint32_t pick = rrr_test_random(state) % 100;
+	const uint32_t spread = rrr_test_random(state);
+
+	if (pick < 30) {
+		return sizeof(struct rrr_msg_holder);
+	}
+	if (pick < 70) {
+		return 64 + spread % 192;
+	}
+	if (pick < 90) {
+		return 256 + spread % 1792;
+	}
+	if (pick < 98) {
+		return 2048 + spread % 6144;
+	}
+	return 8192 + spread % 57344;
+}
+
+static void *__rrr_test_allocator_thread (void *arg) {
+	struct rrr_test_allocator_thread_data *data = arg;
+
+	uint32_t state = 1;
+
+	for (int i = 0; i < RRR_TEST_ALLOCATOR_ENTRIES; i++) {
+		const size_t size = __rrr_test_allocator_size(&state);
+		if ((data->entries[i] = rrr_allocate_group(size, RRR_ALLOCATOR_GROUP_MSG)) == NULL) {
+			TEST_MSG("Failed to allocate %llu bytes\n", (unsigned long long) size);
+			data->ret = 1;
+			return NULL;
+		}
+		memset(data->entries[i], i % 256, size);
+	}
+
+	return NULL;
+}
+
+// Objects are allocated in one thread and freed in another, after which
+// the empty slabs must be released by maintenance
+static int __rrr_test_allocator_slab (void) {
+	int ret = 0;
+
+	static struct rrr_test_allocator_thread_data data;
+	struct rrr_mmap_stats stats_before;
+	struct rrr_mmap_stats stats_after;
+	pthread_t thread;
+	uint32_t state = 1;
+
+	memset(&data, '\0', sizeof(data));
+
+	if (pthread_create(&thread, NULL, __rrr_test_allocator_thread, &data) != 0) {
+		TEST_MSG("Failed to start thread\n");
+		return 1;
+	}
+
+	pthread_join(thread, NULL);
+
+	if ((ret = data.ret) != 0) {
+		goto out;
+	}
+
+	rrr_allocator_maintenance(&stats_before);
+
+	for (int i = 0; i < RRR_TEST_ALLOCATOR_ENTRIES; i++) {
+		const size_t size = __rrr_test_allocator_size(&state);
+		const unsigned char *bytes = data.entries[i];
+
+		if (bytes == NULL) {
+			continue;
+		}
+
+		if (size <= RRR_SLAB_OBJECT_MAX && (!rrr_slab_owns(bytes) || rrr_slab_usable_size(bytes) < size)) {
+			TEST_MSG("Allocation %i of %llu bytes was not in a slab of sufficient size\n", i, (unsigned long long) size);
+			ret = 1;
+		}
+
+		for (size_t j = 0; j < size; j++) {
+			if (bytes[j] != i % 256) {
+				TEST_MSG("Allocation %i of %llu bytes was overwritten at position %llu\n",
+						i, (unsigned long long) size, (unsigned long long) j);
+				ret = 1;
+				break;
+			}
+		}
+
+		rrr_free(data.entries[i]);
+	}
+
+	if (ret != 0) {
+		goto out;
+	}
+
+	for (int i = 0; i < RRR_SLAB_MAINTENANCE_CLEANUP_STRIKES; i++) {
+		rrr_allocator_maintenance(&stats_after);
+	}
+
+	if (stats_after.slab_total_released_count <= stats_before.slab_total_released_count ||
+	    stats_after.groups[RRR_ALLOCATOR_GROUP_MSG].slab_released_count <= stats_before.groups[RRR_ALLOCATOR_GROUP_MSG].slab_released_count ||
+	    stats_after.slab_total_count >= stats_before.slab_total_count ||
+	    stats_after.slab_total_bytes_in_use >= stats_before.slab_total_bytes_in_use
+	) {
+		TEST_MSG("Slabs were not released, %" PRIu64 "->%" PRIu64 " slabs %" PRIu64 "->%" PRIu64 " released %" PRIu64 "->%" PRIu64 " bytes in use\n",
+				stats_before.slab_total_count,
+				stats_after.slab_total_count,
+				stats_before.slab_total_released_count,
+				stats_after.slab_total_released_count,
+				stats_before.slab_total_bytes_in_use,
+				stats_after.slab_total_bytes_in_use
+		);
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	return ret;
+}
+
+static int __rrr_test_allocator_reallocate (void) {
+	int ret = 0;
+
+	char *ptr = rrr_allocate_group(100, RRR_ALLOCATOR_GROUP_MSG);
+	char *ptr_new = NULL;
+
+	if (ptr == NULL) {
+		TEST_MSG("Failed to allocate\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(ptr, 'a', 100);
+
+	// Fits in the same size class
+	if ((ptr_new = rrr_reallocate_group(ptr, 100, 110, RRR_ALLOCATOR_GROUP_MSG)) != ptr) {
+		TEST_MSG("Reallocation within size class moved the allocation\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((ptr_new = rrr_reallocate_group(ptr, 110, 5000, RRR_ALLOCATOR_GROUP_MSG)) == NULL) {
+		TEST_MSG("Failed to reallocate\n");
+		ret = 1;
+		goto out;
+	}
+
+	ptr = ptr_new;
+
+	for (int i = 0; i < 100; i++) {
+		if (ptr[i] != 'a') {
+			TEST_MSG("Data was not preserved when reallocating\n");
+			ret = 1;
+			goto out;
+		}
+	}
+
+	out:
+	RRR_ALLOCATOR_FREE_IF_NOT_NULL(ptr);
+	return ret;
+}
+
+// Allocations too large for the slabs spread over several heaps, frees
+// must find their heap and frees of libc memory must not
+static int __rrr_test_allocator_mmap (void) {
+	int ret = 0;
+
+	void *entries[RRR_TEST_ALLOCATOR_MMAP_ENTRIES] = {0};
+	void *entries_libc[RRR_TEST_ALLOCATOR_MMAP_ENTRIES] = {0};
+	struct rrr_mmap_stats stats_before;
+	struct rrr_mmap_stats stats_after;
+
+	for (int i = 0; i < RRR_TEST_ALLOCATOR_MMAP_ENTRIES; i++) {
+		if ((entries[i] = rrr_allocate_group(RRR_TEST_ALLOCATOR_MMAP_ENTRY_SIZE, RRR_ALLOCATOR_GROUP_MSG)) == NULL ||
+		    (entries_libc[i] = rrr_allocate(RRR_TEST_ALLOCATOR_MMAP_ENTRY_SIZE)) == NULL
+		) {
+			TEST_MSG("Failed to allocate\n");
+			ret = 1;
+			goto out;
+		}
+		memset(entries[i], i, RRR_TEST_ALLOCATOR_MMAP_ENTRY_SIZE);
+		memset(entries_libc[i], i, RRR_TEST_ALLOCATOR_MMAP_ENTRY_SIZE);
+	}
+
+	rrr_allocator_maintenance(&stats_before);
+
+	const struct rrr_mmap_stats_group *group = &stats_before.groups[RRR_ALLOCATOR_GROUP_MSG];
+
+	if (group->mmap_count < 2) {
+		TEST_MSG("Allocations did not spread over multiple mmaps\n");
+		ret = 1;
+		goto out;
+	}
+
+	if (group->bytes_in_use < RRR_TEST_ALLOCATOR_MMAP_ENTRIES * RRR_TEST_ALLOCATOR_MMAP_ENTRY_SIZE ||
+	    group->bytes_reserved < group->bytes_in_use ||
+	    group->histogram[RRR_MMAP_STATS_HISTOGRAM_BUCKETS - 1] < RRR_TEST_ALLOCATOR_MMAP_ENTRIES ||
+	    group->heaps[0].bytes_in_use + group->heaps[0].bytes_free > group->heaps[0].heap_size ||
+	    group->heaps[0].largest_free_chunk > group->heaps[0].bytes_free
+	) {
+		TEST_MSG("Incorrect group statistics, %" PRIu64 " bytes in use %" PRIu64 " bytes reserved %" PRIu64 " in largest bucket\n",
+				group->bytes_in_use, group->bytes_reserved, group->histogram[RRR_MMAP_STATS_HISTOGRAM_BUCKETS - 1]);
+		ret = 1;
+		goto out;
+	}
+
+	for (int i = RRR_TEST_ALLOCATOR_MMAP_ENTRIES - 1; i >= 0; i--) {
+		const unsigned char *bytes = entries[i];
+		if (bytes[0] != i || bytes[RRR_TEST_ALLOCATOR_MMAP_ENTRY_SIZE - 1] != i) {
+			TEST_MSG("Allocation %i was overwritten\n", i);
+			ret = 1;
+		}
+		rrr_free(entries[i]);
+		rrr_free(entries_libc[i]);
+		entries[i] = NULL;
+		entries_libc[i] = NULL;
+	}
+
+	// Heaps are counted in the stats of the run which frees them
+	for (int i = 0; i < RRR_MMAP_COLLECTION_MAINTENANCE_CLEANUP_STRIKES + 1; i++) {
+		rrr_allocator_maintenance(&stats_after);
+	}
+
+	if (stats_after.mmap_total_count >= stats_before.mmap_total_count ||
+	    stats_after.groups[RRR_ALLOCATOR_GROUP_MSG].mmap_reclaimed_count <= stats_before.groups[RRR_ALLOCATOR_GROUP_MSG].mmap_reclaimed_count
+	) {
+		TEST_MSG("Mmaps were not freed, %" PRIu64 "->%" PRIu64 "\n",
+				stats_before.mmap_total_count, stats_after.mmap_total_count);
+		ret = 1;
+	}
+
+	out:
+	for (int i = 0; i < RRR_TEST_ALLOCATOR_MMAP_ENTRIES; i++) {
+		RRR_ALLOCATOR_FREE_IF_NOT_NULL(entries[i]);
+		RRR_ALLOCATOR_FREE_IF_NOT_NULL(entries_libc[i]);
+	}
+	return ret;
+}
+
+struct rrr_test_allocator_benchmark_data {
+	void *(*allocate)(size_t bytes);
+	void (*free)(void *ptr);
+	uint32_t seed;
+	int ret;
+};
+
+static void *__rrr_test_allocator_slab_allocate (size_t bytes) {
+	return rrr_allocate_group(bytes, RRR_ALLOCATOR_GROUP_MSG);
+}
+
+static pthread_rwlock_t rrr_test_allocator_mmap_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct rrr_mmap_collection rrr_test_allocator_mmap_collection = {0};
+
+// The group allocator as it was before slabs were added
+static void *__rrr_test_allocator_mmap_allocate (size_t bytes) {
+	return rrr_mmap_collection_allocate (
+			&rrr_test_allocator_mmap_collection,
+			bytes,
+			16 * 1024 * 1024,
+			&rrr_test_allocator_mmap_lock,
+			0
+	);
+}
+
+static void __rrr_test_allocator_mmap_free (void *ptr) {
+	rrr_mmap_collections_free(ptr);
+}
+
+static void *__rrr_test_allocator_libc_allocate (size_t bytes) {
+	return malloc(bytes);
+}
+
+static void __rrr_test_allocator_libc_free (void *ptr) {
+	free(ptr);
+}
+
+// Keeps a window of live allocations, each operation replaces a random one
+static void *__rrr_test_allocator_benchmark_thread (void *arg) {
+	struct rrr_test_allocator_benchmark_data *data = arg;
+
+	void **window = NULL;
+	uint32_t state = data->seed;
+
+	if ((window = malloc(sizeof(*window) * RRR_TEST_ALLOCATOR_BENCHMARK_WINDOW)) == NULL) {
+		data->ret = 1;
+		goto out;
+	}
+
+	memset(window, '\0', sizeof(*window) * RRR_TEST_ALLOCATOR_BENCHMARK_WINDOW);
+
+	for (int i = 0; i < RRR_TEST_ALLOCATOR_BENCHMARK_OPS; i++) {
+		void **slot = &window[rrr_test_random(&state) % RRR_TEST_ALLOCATOR_BENCHMARK_WINDOW];
+		if (*slot != NULL) {
+			data->free(*slot);
+		}
+		const size_t size = __rrr_test_allocator_size(&state);
+		if ((*slot = data->allocate(size)) == NULL) {
+			data->ret = 1;
+			break;
+		}
+		// Touch the memory like a message being written
+		memset(*slot, 0, size < 64 ? size : 64);
+	}
+
+	for (int i = 0; i < RRR_TEST_ALLOCATOR_BENCHMARK_WINDOW; i++) {
+		if (window[i] != NULL) {
+			data->free(window[i]);
+		}
+	}
+
+	out:
+	if (window != NULL) {
+		free(window);
+	}
+	return NULL;
+}
+
+static int __rrr_test_allocator_benchmark (
+		uint64_t *ops_per_second,
+		int thread_count,
+		void *(*allocate)(size_t bytes),
+		void (*free_func)(void *ptr)
+) {
+	int ret = 0;
+
+	pthread_t threads[RRR_TEST_ALLOCATOR_BENCHMARK_THREADS];
+	struct rrr_test_allocator_benchmark_data data[RRR_TEST_ALLOCATOR_BENCHMARK_THREADS];
+	int started = 0;
+
+	uint64_t time_start = rrr_time_get_64();
+
+	for (; started < thread_count; started++) {
+		data[started].allocate = allocate;
+		data[started].free = free_func;
+		data[started].seed = (uint32_t) started + 1;
+		data[started].ret = 0;
+		if (pthread_create(&threads[started], NULL, __rrr_test_allocator_benchmark_thread, &data[started]) != 0) {
+			TEST_MSG("Failed to start thread\n");
+			ret = 1;
+			break;
+		}
+	}
+
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		ret |= data[i].ret;
+	}
+
+	uint64_t time_us = rrr_time_get_64() - time_start;
+
+	*ops_per_second = (uint64_t) started * RRR_TEST_ALLOCATOR_BENCHMARK_OPS * 1000000ULL / (time_us > 0 ? time_us : 1);
+
+	return ret;
+}
+
+int rrr_test_allocator (void) {
+	int ret = 0;
+
+	static const struct {
+		const char *name;
+		void *(*allocate)(size_t bytes);
+		void (*free)(void *ptr);
+		int max_threads;
+	} allocators[] = {
+		{"slab",  __rrr_test_allocator_slab_allocate,  rrr_free,                        RRR_TEST_ALLOCATOR_BENCHMARK_THREADS},
+		// The mmap collection fragments until all mmaps are used up when
+		// several threads churn it, only run it single threaded
+		{"mmap",  __rrr_test_allocator_mmap_allocate,  __rrr_test_allocator_mmap_free,  1},
+		{"libc",  __rrr_test_allocator_libc_allocate,  __rrr_test_allocator_libc_free,  RRR_TEST_ALLOCATOR_BENCHMARK_THREADS}
+	};
+	static const int thread_counts[] = {1, RRR_TEST_ALLOCATOR_BENCHMARK_THREADS};
+
+	if ((ret = __rrr_test_allocator_slab()) != 0) {
+		TEST_MSG("Slab allocator test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_allocator_reallocate()) != 0) {
+		TEST_MSG("Reallocation test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_allocator_mmap()) != 0) {
+		TEST_MSG("Mmap allocation test failed\n");
+		goto out;
+	}
+
+	for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+		for (size_t j = 0; j < sizeof(thread_counts) / sizeof(thread_counts[0]); j++) {
+			uint64_t ops_per_second = 0;
+			if (thread_counts[j] > allocators[i].max_threads) {
+				continue;
+			}
+			if ((ret = __rrr_test_allocator_benchmark (
+					&ops_per_second,
+					thread_counts[j],
+					allocators[i].allocate,
+					allocators[i].free
+			)) != 0) {
+				TEST_MSG("Allocator benchmark failed for %s\n", allocators[i].name);
+				goto out;
+			}
+			TEST_MSG("Allocator %s %i threads: %" PRIu64 " ops/s\n", allocators[i].name, thread_counts[j], ops_per_second);
+		}
+	}
+
+	out:
+	rrr_mmap_collections_clear(&rrr_test_allocator_mmap_collection, 1, &rrr_test_allocator_mmap_lock);
+	return ret;
+}
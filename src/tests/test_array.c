@@ -0,0 +1,1535 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../lib/log.h"
+#include "../lib/allocator.h"
+#include "../lib/array.h"
+#include "../lib/array_flat.h"
+#include "../lib/array_tag_index.h"
+#include "../lib/array_view.h"
+#include "../lib/array_tree.h"
+#include "../lib/parse.h"
+#include "../lib/map.h"
+#include "../lib/string_builder.h"
+#include "../lib/messages/msg_msg.h"
+#include "../lib/http/http_common.h"
+#include "../lib/http/http_query_builder.h"
+#include "../lib/messages/msg_checksum.h"
+#include "../lib/messages/msg_head.h"
+#include "../lib/util/rrr_endian.h"
+#include "../lib/util/rrr_time.h"
+#include "../lib/util/arena.h"
+#include "test.h"
+#include "test_array.h"
+
+#define RRR_TEST_ARRAY_FIELDS            40
+#define RRR_TEST_ARRAY_BENCHMARK_ROUNDS  20000
+#define RRR_TEST_ARRAY_FLAT_BENCHMARK_VALUES 500000
+#define RRR_TEST_ARRAY_TAG_BENCHMARK_ROUNDS  20000
+#define RRR_TEST_ARRAY_TAG_BENCHMARK_TAGS    10
+#define RRR_TEST_ARRAY_VIEW_BENCHMARK_ROUNDS 20000
+#define RRR_TEST_ARRAY_TREE_BENCHMARK_ROUNDS 20000
+#define RRR_TEST_ARRAY_EXPLODE_FIELDS          500
+#define RRR_TEST_ARRAY_EXPLODE_BENCHMARK_ROUNDS 200
+
+static int __rrr_test_array_make_message (
+		struct rrr_msg_msg **target,
+		int fields
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	char tag[32];
+	char value[64];
+
+	for (int i = 0; i < fields; i++) {
+		sprintf(tag, "field_%i", i);
+		sprintf(value, "value of field %i", i);
+		switch (i % 4) {
+			case 0:
+				ret |= rrr_array_push_value_u64_with_tag(&array, tag, (uint64_t) i * 1000);
+				break;
+			case 1:
+				ret |= rrr_array_push_value_i64_with_tag(&array, tag, (int64_t) -i);
+				break;
+			case 2:
+				ret |= rrr_array_push_value_str_with_tag(&array, tag, value);
+				break;
+			default:
+				ret |= rrr_array_push_value_blob_with_tag_with_size(&array, tag, value, strlen(value));
+				break;
+		};
+	}
+
+	if (ret != 0) {
+		TEST_MSG("Failed to push values in __rrr_test_array_make_message\n");
+		goto out;
+	}
+
+	if ((ret = rrr_array_new_message_from_collection (
+			target,
+			&array,
+			rrr_time_get_64(),
+			NULL,
+			0
+	)) != 0) {
+		TEST_MSG("Failed to create message in __rrr_test_array_make_message\n");
+		goto out;
+	}
+
+	out:
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_compare (
+		const struct rrr_array *a,
+		const struct rrr_array *b
+) {
+	if (RRR_LL_COUNT(a) != RRR_LL_COUNT(b)) {
+		TEST_MSG("Value count mismatch %i<>%i\n", RRR_LL_COUNT(a), RRR_LL_COUNT(b));
+		return 1;
+	}
+
+	const struct rrr_type_value *node_b = RRR_LL_FIRST(b);
+	RRR_LL_ITERATE_BEGIN(a, const struct rrr_type_value);
+		if (node->definition != node_b->definition ||
+		    node->element_count != node_b->element_count ||
+		    node->total_stored_length != node_b->total_stored_length ||
+		    node->tag_length != node_b->tag_length
+		) {
+			TEST_MSG("Value mismatch at tag %s\n", node->tag);
+			return 1;
+		}
+		if (memcmp(node->tag, node_b->tag, node->tag_length) != 0 ||
+		    memcmp(node->data, node_b->data, node->total_stored_length) != 0
+		) {
+			TEST_MSG("Tag or data mismatch at tag %s\n", node->tag);
+			return 1;
+		}
+		node_b = node_b->ptr_next;
+	RRR_LL_ITERATE_END();
+
+	return 0;
+}
+
+static int __rrr_test_array_arena (
+		const struct rrr_msg_msg *message
+) {
+	int ret = 0;
+
+	struct rrr_array array_heap = {0};
+	struct rrr_array array_arena = {0};
+	struct rrr_array array_clone = {0};
+	uint16_t array_version_dummy;
+
+	rrr_array_arena_enable(&array_arena);
+
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array_heap, message)) != 0 ||
+	    (ret = rrr_array_message_append_to_collection(&array_version_dummy, &array_arena, message)) != 0
+	) {
+		TEST_MSG("Failed to parse array message\n");
+		goto out;
+	}
+
+	if (array_heap.arena != NULL || array_arena.arena == NULL) {
+		TEST_MSG("Arena was not created as expected\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_compare(&array_heap, &array_arena)) != 0) {
+		goto out;
+	}
+
+	RRR_LL_ITERATE_BEGIN(&array_arena, const struct rrr_type_value);
+		if (!rrr_arena_owns(array_arena.arena, node) ||
+		    !rrr_arena_owns(array_arena.arena, node->tag) ||
+		    !rrr_arena_owns(array_arena.arena, node->data)
+		) {
+			TEST_MSG("Value with tag %s was not allocated in the arena\n", node->tag);
+			ret = 1;
+			goto out;
+		}
+	RRR_LL_ITERATE_END();
+
+	// Parts replaced after parsing are heap allocated and freed as usual
+	if ((ret = rrr_type_value_set_tag(RRR_LL_FIRST(&array_arena), "replaced", strlen("replaced"))) != 0) {
+		TEST_MSG("Failed to replace tag of arena value\n");
+		goto out;
+	}
+	if ((ret = rrr_type_value_set_tag(RRR_LL_FIRST(&array_arena), "field_0", strlen("field_0"))) != 0) {
+		TEST_MSG("Failed to restore tag of arena value\n");
+		goto out;
+	}
+
+	// Clones must not refer to the arena
+	if ((ret = rrr_array_append_from(&array_clone, &array_arena)) != 0) {
+		TEST_MSG("Failed to clone arena array\n");
+		goto out;
+	}
+	if (array_clone.arena != NULL || RRR_LL_FIRST(&array_clone)->arena != NULL) {
+		TEST_MSG("Clone of arena array refers to the arena\n");
+		ret = 1;
+		goto out;
+	}
+
+	// Appending once more goes into overflow blocks of the same arena
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array_arena, message)) != 0) {
+		TEST_MSG("Failed to parse array message a second time\n");
+		goto out;
+	}
+	if (RRR_LL_COUNT(&array_arena) != RRR_TEST_ARRAY_FIELDS * 2 || !rrr_arena_owns(array_arena.arena, RRR_LL_LAST(&array_arena))) {
+		TEST_MSG("Unexpected result after parsing into existing arena\n");
+		ret = 1;
+		goto out;
+	}
+
+	rrr_array_clear(&array_arena);
+	if (array_arena.arena != NULL || !array_arena.do_arena) {
+		TEST_MSG("Arena state not as expected after clearing array\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_compare(&array_heap, &array_clone)) != 0) {
+		goto out;
+	}
+
+	out:
+	rrr_array_clear(&array_heap);
+	rrr_array_clear(&array_arena);
+	rrr_array_clear(&array_clone);
+	return ret;
+}
+
+static int __rrr_test_array_parse_benchmark (
+		uint64_t *messages_per_second,
+		const struct rrr_msg_msg *message,
+		int do_arena
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	uint16_t array_version_dummy;
+
+	if (do_arena) {
+		rrr_array_arena_enable(&array);
+	}
+
+	uint64_t time_start = rrr_time_get_64();
+
+	for (int i = 0; i < RRR_TEST_ARRAY_BENCHMARK_ROUNDS; i++) {
+		if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0) {
+			TEST_MSG("Failed to parse array message in benchmark\n");
+			goto out;
+		}
+		rrr_array_clear(&array);
+	}
+
+	uint64_t time_us = rrr_time_get_64() - time_start;
+
+	*messages_per_second = RRR_TEST_ARRAY_BENCHMARK_ROUNDS * 1000000ULL / (time_us > 0 ? time_us : 1);
+
+	out:
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_flat (
+		const struct rrr_msg_msg *message
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	struct rrr_array array_from_flat = {0};
+	struct rrr_array_flat flat = {0};
+	struct rrr_array_flat flat_from_array = {0};
+	struct rrr_msg_msg *message_from_flat = NULL;
+	uint16_t array_version_dummy;
+
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0 ||
+	    (ret = rrr_array_flat_message_append(&array_version_dummy, &flat, message)) != 0
+	) {
+		TEST_MSG("Failed to parse array message\n");
+		goto out;
+	}
+
+	if ((ret = rrr_array_flat_append_to_array(&array_from_flat, &flat)) != 0) {
+		TEST_MSG("Failed to convert flat array to array\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_compare(&array, &array_from_flat)) != 0) {
+		goto out;
+	}
+
+	for (rrr_length i = 0; i < RRR_ARRAY_FLAT_COUNT(&flat); i++) {
+		const struct rrr_array_flat_value *value = &flat.values[i];
+		if ((uintptr_t) rrr_array_flat_value_data(&flat, value) % RRR_ARRAY_FLAT_ALIGN != 0) {
+			TEST_MSG("Flat array value %" PRIrrrl " was not aligned\n", i);
+			ret = 1;
+			goto out;
+		}
+	}
+
+	const struct rrr_array_flat_value *value = rrr_array_flat_value_get_by_tag(&flat, "field_4");
+	uint64_t value_u64 = 0;
+	if (value == NULL || value->total_stored_length != sizeof(value_u64)) {
+		TEST_MSG("Failed to get flat array value by tag\n");
+		ret = 1;
+		goto out;
+	}
+	memcpy(&value_u64, rrr_array_flat_value_data(&flat, value), sizeof(value_u64));
+	if (value_u64 != 4000) {
+		TEST_MSG("Unexpected value %" PRIu64 " from flat array\n", value_u64);
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = rrr_array_flat_new_message(&message_from_flat, &flat, message->timestamp, NULL, 0)) != 0) {
+		TEST_MSG("Failed to create message from flat array\n");
+		goto out;
+	}
+
+	if (MSG_DATA_LENGTH(message_from_flat) != MSG_DATA_LENGTH(message) ||
+	    memcmp(MSG_DATA_PTR(message_from_flat), MSG_DATA_PTR(message), MSG_DATA_LENGTH(message)) != 0
+	) {
+		TEST_MSG("Message packed from flat array differs from original\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = rrr_array_flat_append_from_array(&flat_from_array, &array)) != 0) {
+		TEST_MSG("Failed to convert array to flat array\n");
+		goto out;
+	}
+
+	if (flat_from_array.value_count != flat.value_count ||
+	    flat_from_array.data_size != flat.data_size ||
+	    memcmp(flat_from_array.data, flat.data, flat.data_size) != 0
+	) {
+		TEST_MSG("Flat array converted from array differs from flat array parsed from message\n");
+		ret = 1;
+		goto out;
+	}
+
+	// Reuse of buffers after reset
+	rrr_array_flat_reset(&flat);
+	if ((ret = rrr_array_flat_message_append(&array_version_dummy, &flat, message)) != 0 ||
+	    RRR_ARRAY_FLAT_COUNT(&flat) != RRR_TEST_ARRAY_FIELDS
+	) {
+		TEST_MSG("Failed to parse array message into reset flat array\n");
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	RRR_FREE_IF_NOT_NULL(message_from_flat);
+	rrr_array_flat_clear(&flat);
+	rrr_array_flat_clear(&flat_from_array);
+	rrr_array_clear(&array);
+	rrr_array_clear(&array_from_flat);
+	return ret;
+}
+
+enum rrr_test_array_flat_benchmark_op {
+	RRR_TEST_ARRAY_FLAT_BENCHMARK_UNPACK,
+	RRR_TEST_ARRAY_FLAT_BENCHMARK_PACK,
+	RRR_TEST_ARRAY_FLAT_BENCHMARK_ITERATE
+};
+
+static int __rrr_test_array_flat_benchmark_run (
+		uint64_t *messages_per_second,
+		const struct rrr_msg_msg *message,
+		enum rrr_test_array_flat_benchmark_op op,
+		int rounds,
+		int do_flat
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	struct rrr_array_flat flat = {0};
+	struct rrr_msg_msg *message_new = NULL;
+	uint16_t array_version_dummy;
+	volatile uint64_t sum = 0;
+
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0 ||
+	    (ret = rrr_array_flat_message_append(&array_version_dummy, &flat, message)) != 0
+	) {
+		TEST_MSG("Failed to parse array message in benchmark\n");
+		goto out;
+	}
+
+	uint64_t time_start = rrr_time_get_64();
+
+	for (int i = 0; i < rounds; i++) {
+		switch (op) {
+			case RRR_TEST_ARRAY_FLAT_BENCHMARK_UNPACK:
+				if (do_flat) {
+					rrr_array_flat_reset(&flat);
+					ret = rrr_array_flat_message_append(&array_version_dummy, &flat, message);
+				}
+				else {
+					rrr_array_clear(&array);
+					ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message);
+				}
+				break;
+			case RRR_TEST_ARRAY_FLAT_BENCHMARK_PACK:
+				if (do_flat) {
+					ret = rrr_array_flat_new_message(&message_new, &flat, 0, NULL, 0);
+				}
+				else {
+					ret = rrr_array_new_message_from_collection(&message_new, &array, 0, NULL, 0);
+				}
+				RRR_FREE_IF_NOT_NULL(message_new);
+				break;
+			case RRR_TEST_ARRAY_FLAT_BENCHMARK_ITERATE:
+				if (do_flat) {
+					for (rrr_length j = 0; j < flat.value_count; j++) {
+						const struct rrr_array_flat_value *value = &flat.values[j];
+						sum += value->total_stored_length + (unsigned char) *rrr_array_flat_value_data(&flat, value);
+					}
+				}
+				else {
+					RRR_LL_ITERATE_BEGIN(&array, const struct rrr_type_value);
+						sum += node->total_stored_length + (unsigned char) *node->data;
+					RRR_LL_ITERATE_END();
+				}
+				break;
+		};
+		if (ret != 0) {
+			TEST_MSG("Operation failed in array benchmark\n");
+			goto out;
+		}
+	}
+
+	uint64_t time_us = rrr_time_get_64() - time_start;
+
+	*messages_per_second = (uint64_t) rounds * 1000000ULL / (time_us > 0 ? time_us : 1);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(message_new);
+	rrr_array_flat_clear(&flat);
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_flat_benchmark (void) {
+	int ret = 0;
+
+	static const int field_counts[] = {10, 100, 1000};
+	static const char *op_names[] = {"unpack", "pack", "iterate"};
+
+	struct rrr_msg_msg *message = NULL;
+
+	for (size_t i = 0; i < sizeof(field_counts) / sizeof(field_counts[0]); i++) {
+		if ((ret = __rrr_test_array_make_message(&message, field_counts[i])) != 0) {
+			goto out;
+		}
+
+		const int rounds = RRR_TEST_ARRAY_FLAT_BENCHMARK_VALUES / field_counts[i];
+
+		for (int op = RRR_TEST_ARRAY_FLAT_BENCHMARK_UNPACK; op <= RRR_TEST_ARRAY_FLAT_BENCHMARK_ITERATE; op++) {
+			uint64_t list_per_second = 0;
+			uint64_t flat_per_second = 0;
+			if ((ret = __rrr_test_array_flat_benchmark_run(&list_per_second, message, op, rounds, 0)) != 0 ||
+			    (ret = __rrr_test_array_flat_benchmark_run(&flat_per_second, message, op, rounds, 1)) != 0
+			) {
+				goto out;
+			}
+			TEST_MSG("Array %s %i fields: list %" PRIu64 " flat %" PRIu64 " messages/s\n",
+					op_names[op], field_counts[i], list_per_second, flat_per_second);
+		}
+
+		RRR_FREE_IF_NOT_NULL(message);
+	}
+
+	out:
+	RRR_FREE_IF_NOT_NULL(message);
+	return ret;
+}
+
+static int __rrr_test_array_tag_index (
+		const struct rrr_msg_msg *message
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	struct rrr_array array_indexed = {0};
+	struct rrr_map tags = {0};
+	struct rrr_array_tag_plan *plan = NULL;
+	uint16_t array_version_dummy;
+	char tag[32];
+
+	rrr_array_tag_index_enable(&array_indexed);
+
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0 ||
+	    (ret = rrr_array_message_append_to_collection(&array_version_dummy, &array_indexed, message)) != 0 ||
+	    (ret = rrr_array_push_value_u64_with_tag(&array_indexed, "field_1", 1)) != 0
+	) {
+		TEST_MSG("Failed to parse array message\n");
+		goto out;
+	}
+
+	// The duplicate tag at the end must not be found before the first value
+	for (int i = 0; i <= RRR_TEST_ARRAY_FIELDS; i++) {
+		sprintf(tag, "field_%i", i);
+		const struct rrr_type_value *value = rrr_array_value_get_by_tag(&array, tag);
+		const struct rrr_type_value *value_indexed = rrr_array_value_get_by_tag(&array_indexed, tag);
+		if ((value == NULL) != (value_indexed == NULL) ||
+		    (value != NULL && (value->total_stored_length != value_indexed->total_stored_length ||
+		                       memcmp(value->data, value_indexed->data, value->total_stored_length) != 0))
+		) {
+			TEST_MSG("Indexed lookup of tag %s differs from list lookup\n", tag);
+			ret = 1;
+			goto out;
+		}
+	}
+
+	if (array_indexed.tag_index == NULL) {
+		TEST_MSG("Tag index was not built\n");
+		ret = 1;
+		goto out;
+	}
+
+	// Removed and added values are detected
+	rrr_array_clear_by_tag(&array_indexed, "field_2");
+	if (rrr_array_value_get_by_tag(&array_indexed, "field_2") != NULL) {
+		TEST_MSG("Removed value still found by index\n");
+		ret = 1;
+		goto out;
+	}
+	if ((ret = rrr_array_push_value_u64_with_tag(&array_indexed, "field_2", 2)) != 0) {
+		goto out;
+	}
+	if (rrr_array_value_get_by_tag(&array_indexed, "field_2") != RRR_LL_LAST(&array_indexed)) {
+		TEST_MSG("Added value not found by index\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = rrr_map_item_add_new(&tags, "field_3", NULL)) != 0 ||
+	    (ret = rrr_map_item_add_new(&tags, "missing", NULL)) != 0 ||
+	    (ret = rrr_map_item_add_new(&tags, "field_1", NULL)) != 0
+	) {
+		goto out;
+	}
+
+	if ((ret = rrr_array_tag_plan_new(&plan, &tags)) != 0) {
+		goto out;
+	}
+
+	// Resolve twice for each layout, the second time uses the cached positions
+	const struct rrr_array *arrays[] = {&array, &array, &array_indexed, &array_indexed};
+	for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+		const struct rrr_type_value **values = NULL;
+		if ((ret = rrr_array_tag_plan_resolve(&values, plan, arrays[i])) != 0) {
+			goto out;
+		}
+		if (values[0] != rrr_array_value_get_by_tag_const(arrays[i], "field_3") ||
+		    values[1] != NULL ||
+		    values[2] != rrr_array_value_get_by_tag_const(arrays[i], "field_1")
+		) {
+			TEST_MSG("Unexpected values from tag plan in round %llu\n", (unsigned long long) i);
+			ret = 1;
+			goto out;
+		}
+	}
+
+	out:
+	if (plan != NULL) {
+		rrr_array_tag_plan_destroy(plan);
+	}
+	rrr_map_clear(&tags);
+	rrr_array_clear(&array);
+	rrr_array_clear(&array_indexed);
+	return ret;
+}
+
+static int __rrr_test_array_tag_benchmark_run (
+		uint64_t *messages_per_second,
+		const struct rrr_msg_msg *message,
+		const struct rrr_map *tags,
+		struct rrr_array_tag_plan *plan,
+		int do_index
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	uint16_t array_version_dummy;
+	volatile uint64_t sum = 0;
+
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0) {
+		goto out;
+	}
+
+	if (do_index) {
+		rrr_array_tag_index_enable(&array);
+	}
+
+	uint64_t time_start = rrr_time_get_64();
+
+	for (int i = 0; i < RRR_TEST_ARRAY_TAG_BENCHMARK_ROUNDS; i++) {
+		// Simulate a new message each round
+		rrr_array_tag_index_invalidate(&array);
+
+		if (plan != NULL) {
+			const struct rrr_type_value **values = NULL;
+			if ((ret = rrr_array_tag_plan_resolve(&values, plan, &array)) != 0) {
+				goto out;
+			}
+			for (int j = 0; j < RRR_MAP_COUNT(tags); j++) {
+				sum += values[j]->total_stored_length;
+			}
+		}
+		else {
+			RRR_MAP_ITERATE_BEGIN_CONST(tags);
+				sum += rrr_array_value_get_by_tag(&array, node_tag)->total_stored_length;
+			RRR_MAP_ITERATE_END();
+		}
+	}
+
+	uint64_t time_us = rrr_time_get_64() - time_start;
+
+	*messages_per_second = RRR_TEST_ARRAY_TAG_BENCHMARK_ROUNDS * 1000000ULL / (time_us > 0 ? time_us : 1);
+
+	out:
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_tag_benchmark (void) {
+	int ret = 0;
+
+	static const int field_counts[] = {10, 24, 100, 1000};
+
+	struct rrr_msg_msg *message = NULL;
+	struct rrr_map tags = {0};
+	struct rrr_array_tag_plan *plan = NULL;
+	char tag[32];
+
+	for (size_t i = 0; i < sizeof(field_counts) / sizeof(field_counts[0]); i++) {
+		if ((ret = __rrr_test_array_make_message(&message, field_counts[i])) != 0) {
+			goto out;
+		}
+
+		// Look up tags spread over the whole array
+		for (int j = 0; j < RRR_TEST_ARRAY_TAG_BENCHMARK_TAGS; j++) {
+			sprintf(tag, "field_%i", field_counts[i] - 1 - j * field_counts[i] / RRR_TEST_ARRAY_TAG_BENCHMARK_TAGS);
+			if ((ret = rrr_map_item_add_new(&tags, tag, NULL)) != 0) {
+				goto out;
+			}
+		}
+
+		if ((ret = rrr_array_tag_plan_new(&plan, &tags)) != 0) {
+			goto out;
+		}
+
+		uint64_t list_per_second = 0;
+		uint64_t index_per_second = 0;
+		uint64_t plan_per_second = 0;
+		if ((ret = __rrr_test_array_tag_benchmark_run(&list_per_second, message, &tags, NULL, 0)) != 0 ||
+		    (ret = __rrr_test_array_tag_benchmark_run(&index_per_second, message, &tags, NULL, 1)) != 0 ||
+		    (ret = __rrr_test_array_tag_benchmark_run(&plan_per_second, message, &tags, plan, 0)) != 0
+		) {
+			TEST_MSG("Tag lookup benchmark failed\n");
+			goto out;
+		}
+
+		TEST_MSG("Array %i tag lookups %i fields: list %" PRIu64 " index %" PRIu64 " plan %" PRIu64 " messages/s\n",
+				RRR_TEST_ARRAY_TAG_BENCHMARK_TAGS, field_counts[i], list_per_second, index_per_second, plan_per_second);
+
+		rrr_array_tag_plan_destroy(plan);
+		plan = NULL;
+		rrr_map_clear(&tags);
+		RRR_FREE_IF_NOT_NULL(message);
+	}
+
+	out:
+	if (plan != NULL) {
+		rrr_array_tag_plan_destroy(plan);
+	}
+	rrr_map_clear(&tags);
+	RRR_FREE_IF_NOT_NULL(message);
+	return ret;
+}
+
+struct rrr_test_array_view_callback_data {
+	const struct rrr_type_value *node;
+	int count;
+};
+
+static int __rrr_test_array_view_type_value_callback (
+		const struct rrr_type_value *value,
+		void *arg
+) {
+	const struct rrr_type_value *node = arg;
+
+	if (value->definition != node->definition ||
+	    value->element_count != node->element_count ||
+	    value->total_stored_length != node->total_stored_length ||
+	    value->tag_length != node->tag_length ||
+	    memcmp(value->tag, node->tag, node->tag_length) != 0 ||
+	    memcmp(value->data, node->data, node->total_stored_length) != 0
+	) {
+		TEST_MSG("View value differs from array value at tag %s\n", node->tag);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __rrr_test_array_view_callback (
+		const struct rrr_array_view_value *value,
+		void *arg
+) {
+	struct rrr_test_array_view_callback_data *callback_data = arg;
+
+	if (callback_data->node == NULL) {
+		TEST_MSG("View has more values than array\n");
+		return 1;
+	}
+
+	if (!rrr_array_view_value_tag_equals(value, callback_data->node->tag)) {
+		TEST_MSG("View tag differs from array tag %s\n", callback_data->node->tag);
+		return 1;
+	}
+
+	int ret = rrr_array_view_value_with_type_value (
+			value,
+			__rrr_test_array_view_type_value_callback,
+			(void *) callback_data->node
+	);
+
+	callback_data->node = callback_data->node->ptr_next;
+	callback_data->count++;
+
+	return ret;
+}
+
+static int __rrr_test_array_view (
+		const struct rrr_msg_msg *message
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	uint16_t array_version_dummy;
+
+	static const char * const tags[] = {"field_4", "missing", "field_0", "field_2"};
+	struct rrr_array_view_value values[sizeof(tags) / sizeof(tags[0])];
+	uint64_t value_u64 = 0;
+
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0) {
+		TEST_MSG("Failed to parse array message\n");
+		goto out;
+	}
+
+	struct rrr_test_array_view_callback_data callback_data = {
+		RRR_LL_FIRST(&array),
+		0
+	};
+
+	if ((ret = rrr_array_view_iterate(message, __rrr_test_array_view_callback, &callback_data)) != 0) {
+		goto out;
+	}
+
+	if (callback_data.count != RRR_LL_COUNT(&array)) {
+		TEST_MSG("View value count %i differs from array value count %i\n",
+				callback_data.count, RRR_LL_COUNT(&array));
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = rrr_array_view_get_by_tags(values, message, tags, sizeof(tags) / sizeof(tags[0]))) != 0) {
+		TEST_MSG("Failed to get values by tags from view\n");
+		goto out;
+	}
+
+	if (values[0].definition == NULL ||
+	    values[1].definition != NULL ||
+	    values[2].definition == NULL ||
+	    values[3].definition == NULL
+	) {
+		TEST_MSG("Unexpected result from view lookup by tags\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = rrr_array_view_value_get_64(&value_u64, &values[0], 0)) != 0 || value_u64 != 4000) {
+		TEST_MSG("Unexpected value %" PRIu64 " from view\n", value_u64);
+		ret = 1;
+		goto out;
+	}
+
+	// String values are not 64 bit
+	if (rrr_array_view_value_get_64(&value_u64, &values[3], 0) == 0) {
+		TEST_MSG("64 bit value returned for string value from view\n");
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_query_builder_build (
+		char **result,
+		const struct rrr_array *array,
+		const struct rrr_msg_msg *message,
+		const struct rrr_map *columns
+) {
+	int ret = 0;
+
+	struct rrr_http_query_builder query_builder;
+
+	*result = NULL;
+
+	if ((ret = rrr_http_query_builder_init(&query_builder)) != 0) {
+		goto out;
+	}
+
+	if (array != NULL) {
+		ret = rrr_http_query_builder_append_values_from_array(&query_builder, array, columns, ",", 1, 1);
+	}
+	else {
+		ret = rrr_http_query_builder_append_values_from_array_view(&query_builder, message, columns, ",", 1, 1);
+	}
+
+	if (ret == 0) {
+		rrr_http_query_builder_buf_takeover(result, &query_builder);
+	}
+
+	rrr_http_query_builder_cleanup(&query_builder);
+
+	out:
+	return ret;
+}
+
+// Queries built from the view must equal those built from the unpacked array
+static int __rrr_test_array_query_builder (
+		const struct rrr_msg_msg *message
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	struct rrr_map columns = {0};
+	char *query_array = NULL;
+	char *query_view = NULL;
+
+	if ((ret = rrr_array_message_append_to_collection(&array.version, &array, message)) != 0) {
+		TEST_MSG("Failed to parse array message\n");
+		goto out;
+	}
+
+	for (int round = 0; round < 2; round++) {
+		RRR_FREE_IF_NOT_NULL(query_array);
+		RRR_FREE_IF_NOT_NULL(query_view);
+
+		if ((ret = __rrr_test_array_query_builder_build(&query_array, &array, message, &columns)) != 0 ||
+		    (ret = __rrr_test_array_query_builder_build(&query_view, NULL, message, &columns)) != 0
+		) {
+			TEST_MSG("Failed to build query with %i columns\n", RRR_MAP_COUNT(&columns));
+			goto out;
+		}
+
+		if (strcmp(query_array, query_view) != 0) {
+			TEST_MSG("Query from view differs from query from array with %i columns: '%s' vs '%s'\n",
+					RRR_MAP_COUNT(&columns), query_view, query_array);
+			ret = 1;
+			goto out;
+		}
+
+		// Columns out of order, with a translation and given twice
+		if (round == 0 && (
+			(ret = rrr_map_item_add_new(&columns, "field_4", NULL)) != 0 ||
+			(ret = rrr_map_item_add_new(&columns, "field_2", "renamed")) != 0 ||
+			(ret = rrr_map_item_add_new(&columns, "field_0", NULL)) != 0 ||
+			(ret = rrr_map_item_add_new(&columns, "field_4", "again")) != 0
+		)) {
+			TEST_MSG("Failed to add columns\n");
+			goto out;
+		}
+	}
+
+	if (strstr(query_view, "renamed=") == NULL || strstr(query_view, "again=") != strrchr(query_view, ',') + 1) {
+		TEST_MSG("Columns missing or out of order in query '%s'\n", query_view);
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = rrr_map_item_add_new(&columns, "missing", NULL)) != 0) {
+		TEST_MSG("Failed to add columns\n");
+		goto out;
+	}
+
+	RRR_FREE_IF_NOT_NULL(query_view);
+	if (__rrr_test_array_query_builder_build(&query_view, NULL, message, &columns) != RRR_HTTP_SOFT_ERROR) {
+		TEST_MSG("Query from view did not fail with soft error for missing column\n");
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	RRR_FREE_IF_NOT_NULL(query_array);
+	RRR_FREE_IF_NOT_NULL(query_view);
+	rrr_map_clear(&columns);
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_view_benchmark (
+		uint64_t *unpack_per_second,
+		uint64_t *view_per_second,
+		const struct rrr_msg_msg *message
+) {
+	int ret = 0;
+
+	static const char * const tags[] = {"field_0", "field_20", "field_36"};
+	struct rrr_array_view_value values[sizeof(tags) / sizeof(tags[0])];
+	struct rrr_array array = {0};
+	uint16_t array_version_dummy;
+	uint64_t sum = 0;
+	uint64_t value_u64;
+
+	uint64_t time_start = rrr_time_get_64();
+	for (int i = 0; i < RRR_TEST_ARRAY_VIEW_BENCHMARK_ROUNDS; i++) {
+		if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0) {
+			goto out;
+		}
+		for (size_t j = 0; j < sizeof(tags) / sizeof(tags[0]); j++) {
+			const struct rrr_type_value *value = rrr_array_value_get_by_tag(&array, tags[j]);
+			if (value == NULL) {
+				ret = 1;
+				goto out;
+			}
+			sum += *((uint64_t *) value->data);
+		}
+		rrr_array_clear(&array);
+	}
+	uint64_t time_unpack = rrr_time_get_64() - time_start;
+
+	time_start = rrr_time_get_64();
+	for (int i = 0; i < RRR_TEST_ARRAY_VIEW_BENCHMARK_ROUNDS; i++) {
+		if ((ret = rrr_array_view_get_by_tags(values, message, tags, sizeof(tags) / sizeof(tags[0]))) != 0) {
+			goto out;
+		}
+		for (size_t j = 0; j < sizeof(tags) / sizeof(tags[0]); j++) {
+			if ((ret = rrr_array_view_value_get_64(&value_u64, &values[j], 0)) != 0) {
+				goto out;
+			}
+			sum -= value_u64;
+		}
+	}
+	uint64_t time_view = rrr_time_get_64() - time_start;
+
+	if (sum != 0) {
+		TEST_MSG("Values from view differ from unpacked values in benchmark\n");
+		ret = 1;
+		goto out;
+	}
+
+	*unpack_per_second = (uint64_t) RRR_TEST_ARRAY_VIEW_BENCHMARK_ROUNDS * 1000000 / (time_unpack > 0 ? time_unpack : 1);
+	*view_per_second = (uint64_t) RRR_TEST_ARRAY_VIEW_BENCHMARK_ROUNDS * 1000000 / (time_view > 0 ? time_view : 1);
+
+	out:
+	rrr_array_clear(&array);
+	return ret;
+}
+
+// Same data and definition as in the type array module tests
+struct rrr_test_array_tree_data {
+	char be4[4];
+	char be3[3];
+	int16_t be2;
+	char be1;
+
+	char sep1;
+
+	char le4[4];
+	char le3[3];
+	int16_t le2;
+	char le1;
+
+	char sep2[2];
+
+	char blob_a[8];
+	char blob_b[8];
+
+	struct rrr_msg_msg msg;
+
+	char empty_string_dummy[2];
+} __attribute__((packed));
+
+static const char rrr_test_array_tree_data_definition[] =
+	"be4#int1,be3#int2,be2s#int3,be1#int4,sep1@1#sep1,le4@1#aaa,le3#bbb,le2s@1#ccc,le1#ddd,"
+	"sep2#sep2,blob8@2#blob,msg#msg,str#emptystr;";
+
+static void __rrr_test_array_tree_data_init (
+		struct rrr_test_array_tree_data *data
+) {
+	memset(data, '\0', sizeof(*data));
+
+	data->be4[0] = 1;
+	data->be4[2] = 2;
+	data->be3[0] = 1;
+	data->be3[1] = 2;
+	data->be2 = (int16_t) rrr_htobe16(-33);
+	data->be1 = 1;
+	data->sep1 = ';';
+	data->le4[1] = 2;
+	data->le4[3] = 1;
+	data->le3[1] = 2;
+	data->le3[2] = 1;
+	data->le2 = (int16_t) rrr_htole16(-33);
+	data->le1 = 1;
+	data->sep2[0] = '|';
+	data->sep2[1] = '|';
+
+	sprintf(data->blob_a, "abcdefg");
+	sprintf(data->blob_b, "gfedcba");
+
+	data->msg.msg_size = sizeof(struct rrr_msg_msg);
+	data->msg.msg_type = RRR_MSG_TYPE_MESSAGE;
+	MSG_SET_TYPE(&data->msg, MSG_TYPE_MSG);
+	MSG_SET_CLASS(&data->msg, MSG_CLASS_DATA);
+	MSG_TO_BE(&data->msg);
+	rrr_msg_checksum_and_to_network_endian((struct rrr_msg *) &data->msg);
+
+	memcpy(data->empty_string_dummy, "\"\"", 2);
+}
+
+struct rrr_test_array_tree_case {
+	const char *definition;
+	const char *input;
+	rrr_length input_length;
+};
+
+#define RRR_TEST_ARRAY_TREE_CASE(definition, input) \
+	{definition, input, sizeof(input) - 1}
+
+static int __rrr_test_array_tree_import_callback (
+		struct rrr_array *array,
+		void *arg
+) {
+	rrr_array_move(arg, array);
+	return 0;
+}
+
+static int __rrr_test_array_tree_import (
+		int *result,
+		ssize_t *parsed_bytes,
+		struct rrr_array *target,
+		const struct rrr_array_tree *tree,
+		const char *input,
+		rrr_length input_length
+) {
+	rrr_array_clear(target);
+
+	*result = rrr_array_tree_import_from_buffer (
+			parsed_bytes,
+			input,
+			(ssize_t) input_length,
+			tree,
+			__rrr_test_array_tree_import_callback,
+			target
+	);
+
+	// Hard errors are not expected from any of the cases
+	return (*result & RRR_ARRAY_TREE_HARD_ERROR) != 0;
+}
+
+// Import every prefix of the input, including the complete input, with
+// both the interpreted and the compiled tree and check that results match
+static int __rrr_test_array_tree_case (
+		const struct rrr_test_array_tree_case *test_case
+) {
+	int ret = 0;
+
+	struct rrr_array_tree *tree_interpreted = NULL;
+	struct rrr_array_tree *tree_compiled = NULL;
+	struct rrr_array array_interpreted = {0};
+	struct rrr_array array_compiled = {0};
+	struct rrr_parse_pos pos;
+
+	rrr_parse_pos_init(&pos, test_case->definition, (int) strlen(test_case->definition));
+
+	if ((ret = rrr_array_tree_interpret(&tree_interpreted, &pos, "interpreted")) != 0 ||
+	    (ret = rrr_array_tree_interpret_raw(&tree_compiled, test_case->definition, (int) strlen(test_case->definition), "compiled")) != 0
+	) {
+		TEST_MSG("Failed to parse array tree '%s'\n", test_case->definition);
+		goto out;
+	}
+
+	if (tree_interpreted->program != NULL || tree_compiled->program == NULL) {
+		TEST_MSG("Array tree program not as expected for '%s'\n", test_case->definition);
+		ret = 1;
+		goto out;
+	}
+
+	for (rrr_length length = 0; length <= test_case->input_length; length++) {
+		int result_interpreted;
+		int result_compiled;
+		ssize_t parsed_bytes_interpreted;
+		ssize_t parsed_bytes_compiled;
+
+		if ((ret = __rrr_test_array_tree_import (
+				&result_interpreted,
+				&parsed_bytes_interpreted,
+				&array_interpreted,
+				tree_interpreted,
+				test_case->input,
+				length
+		)) != 0 || (ret = __rrr_test_array_tree_import (
+				&result_compiled,
+				&parsed_bytes_compiled,
+				&array_compiled,
+				tree_compiled,
+				test_case->input,
+				length
+		)) != 0) {
+			TEST_MSG("Hard error while importing array tree '%s'\n", test_case->definition);
+			goto out;
+		}
+
+		if (result_interpreted != result_compiled || parsed_bytes_interpreted != parsed_bytes_compiled) {
+			TEST_MSG("Compiled array tree '%s' returned %i/%lli while interpreted returned %i/%lli for length %" PRIrrrl "\n",
+					test_case->definition,
+					result_compiled,
+					(long long int) parsed_bytes_compiled,
+					result_interpreted,
+					(long long int) parsed_bytes_interpreted,
+					length
+			);
+			ret = 1;
+			goto out;
+		}
+
+		if ((ret = __rrr_test_array_compare(&array_interpreted, &array_compiled)) != 0) {
+			TEST_MSG("Compiled array tree '%s' produced different values for length %" PRIrrrl "\n",
+					test_case->definition, length);
+			goto out;
+		}
+
+		if (length == test_case->input_length && (result_compiled != 0 || parsed_bytes_compiled != (ssize_t) length)) {
+			TEST_MSG("Complete input was not parsed by array tree '%s'\n", test_case->definition);
+			ret = 1;
+			goto out;
+		}
+	}
+
+	out:
+	if (tree_interpreted != NULL) {
+		rrr_array_tree_destroy(tree_interpreted);
+	}
+	if (tree_compiled != NULL) {
+		rrr_array_tree_destroy(tree_compiled);
+	}
+	rrr_array_clear(&array_interpreted);
+	rrr_array_clear(&array_compiled);
+	return ret;
+}
+
+static const char rrr_test_array_tree_branches_definition[] =
+	"be4#my_tag,fixp,sep1,"
+	"IF ({my_tag}==2)"
+	"	fixp,sep1,be4#my_tag_two,"
+	"	IF ({my_tag_two}>10)"
+	"		be4@{my_tag_two}#my_tag_extra"
+	"		;"
+	"	ELSIF ({my_tag_two}<6)"
+	"		be2@{my_tag_two}#my_tag_extra"
+	"		;"
+	"	ELSE"
+	"		be1@{my_tag_two}#my_tag_extra,"
+	"		be{my_tag_two}s#my_tag_extra_dynamic"
+	"		;"
+	"	IF ({my_tag_extra}>0)"
+	"		be1@{my_tag}#after"
+	"		;"
+	"	;"
+	"ELSE"
+	"	be4#my_tag_not_two;"
+	"be2@{my_tag}#last;";
+
+static const struct rrr_test_array_tree_case rrr_test_array_tree_cases[] = {
+	RRR_TEST_ARRAY_TREE_CASE (
+			"ustr,sep1,istr#istr,IF(1==1&&{istr}==-444)blob1,REWIND1,str,be3,le3,be8,le8;;",
+			"444\r-444\"blablabla\"\r\n\n\n\n\r\n\n\n\n\n\n\n\0\0\n\n\n\n\n\n\n"
+	),
+	RRR_TEST_ARRAY_TREE_CASE (
+			rrr_test_array_tree_branches_definition,
+			"\0\0\0\x02" "1.5;" "2.25," "\0\0\0\x0c" "0123456789abcdef0123456789abcdef0123456789abcdef" "\x01\x02" "abcd"
+	),
+	RRR_TEST_ARRAY_TREE_CASE (
+			rrr_test_array_tree_branches_definition,
+			"\0\0\0\x02" "1.5;" "2.25," "\0\0\0\x04" "\0\x01\0\x02\0\x03\0\x04" "\x01\x02" "abcd"
+	),
+	RRR_TEST_ARRAY_TREE_CASE (
+			rrr_test_array_tree_branches_definition,
+			"\0\0\0\x02" "1.5;" "2.25," "\0\0\0\x07" "\x01\x02\x03\x04\x05\x06\x07" "\0\0\0\0\0\0\x05" "\x01\x02" "abcd"
+	),
+	RRR_TEST_ARRAY_TREE_CASE (
+			rrr_test_array_tree_branches_definition,
+			"\0\0\0\x01" "1.5;" "\0\0\0\x09" "ab"
+	),
+	RRR_TEST_ARRAY_TREE_CASE (
+			"be1#count,be1#a,be1#b,REWIND2,be2#ab,IF({count}>1)blob1@{count}#data;ELSEblob2#data;be1@{count}#end;",
+			"\x02\x01\x02" "xy" "\x03\x04"
+	)
+};
+
+static int __rrr_test_array_tree (void) {
+	int ret = 0;
+
+	struct rrr_test_array_tree_data data;
+	__rrr_test_array_tree_data_init(&data);
+
+	const struct rrr_test_array_tree_case test_case_data = {
+		rrr_test_array_tree_data_definition,
+		(const char *) &data,
+		sizeof(data)
+	};
+
+	if ((ret = __rrr_test_array_tree_case(&test_case_data)) != 0) {
+		goto out;
+	}
+
+	for (size_t i = 0; i < sizeof(rrr_test_array_tree_cases) / sizeof(rrr_test_array_tree_cases[0]); i++) {
+		if ((ret = __rrr_test_array_tree_case(&rrr_test_array_tree_cases[i])) != 0) {
+			goto out;
+		}
+	}
+
+	out:
+	return ret;
+}
+
+static int __rrr_test_array_tree_benchmark_run (
+		uint64_t *messages_per_second,
+		const struct rrr_array_tree *tree,
+		const char *input,
+		rrr_length input_length
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	ssize_t parsed_bytes;
+	int result;
+
+	uint64_t time_start = rrr_time_get_64();
+	for (int i = 0; i < RRR_TEST_ARRAY_TREE_BENCHMARK_ROUNDS; i++) {
+		if ((ret = __rrr_test_array_tree_import(&result, &parsed_bytes, &array, tree, input, input_length)) != 0 || result != 0) {
+			ret = 1;
+			goto out;
+		}
+	}
+	uint64_t time_total = rrr_time_get_64() - time_start;
+
+	*messages_per_second = (uint64_t) RRR_TEST_ARRAY_TREE_BENCHMARK_ROUNDS * 1000000 / (time_total > 0 ? time_total : 1);
+
+	out:
+	rrr_array_clear(&array);
+	return ret;
+}
+
+#define RRR_TEST_ARRAY_EXPLODE_TOPIC_PREFIX "explode/"
+
+// One message per value the way the exploder made them before values
+// were packed directly
+static int __rrr_test_array_explode_value_with_array (
+		struct rrr_msg_msg **target,
+		const struct rrr_type_value *value,
+		uint64_t timestamp
+) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	struct rrr_string_builder topic = {0};
+	struct rrr_type_value *value_new = NULL;
+
+	if ((ret = rrr_string_builder_append(&topic, RRR_TEST_ARRAY_EXPLODE_TOPIC_PREFIX)) != 0 ||
+	    (ret = rrr_string_builder_append(&topic, value->tag)) != 0
+	) {
+		goto out;
+	}
+
+	if ((ret = rrr_type_value_clone(&value_new, value, 1)) != 0) {
+		goto out;
+	}
+
+	RRR_LL_PUSH(&array, value_new);
+
+	if ((ret = rrr_array_new_message_from_collection (
+			target,
+			&array,
+			timestamp,
+			rrr_string_builder_buf(&topic),
+			(rrr_u16) rrr_string_builder_length(&topic)
+	)) != 0) {
+		goto out;
+	}
+
+	out:
+	rrr_string_builder_clear(&topic);
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_explode_value_direct (
+		struct rrr_msg_msg **target,
+		const struct rrr_type_value *value,
+		uint64_t timestamp,
+		char *topic
+) {
+	const rrr_u16 prefix_length = sizeof(RRR_TEST_ARRAY_EXPLODE_TOPIC_PREFIX) - 1;
+
+	memcpy(topic + prefix_length, value->tag, value->tag_length);
+
+	return rrr_array_new_message_from_value (
+			target,
+			value,
+			timestamp,
+			topic,
+			(rrr_u16) (prefix_length + value->tag_length)
+	);
+}
+
+static int __rrr_test_array_explode_run (
+		uint64_t *values_per_second,
+		const struct rrr_array *array,
+		int do_direct,
+		int rounds
+) {
+	int ret = 0;
+
+	struct rrr_msg_msg *msg = NULL;
+	char topic[256] = RRR_TEST_ARRAY_EXPLODE_TOPIC_PREFIX;
+
+	uint64_t time_start = rrr_time_get_64();
+
+	for (int i = 0; i < rounds; i++) {
+		RRR_LL_ITERATE_BEGIN(array, const struct rrr_type_value);
+			if ((ret = (do_direct
+				? __rrr_test_array_explode_value_direct(&msg, node, 0, topic)
+				: __rrr_test_array_explode_value_with_array(&msg, node, 0)
+			)) != 0) {
+				TEST_MSG("Failed to create message in explode benchmark\n");
+				goto out;
+			}
+			rrr_free(msg);
+			msg = NULL;
+		RRR_LL_ITERATE_END();
+	}
+
+	uint64_t time_us = rrr_time_get_64() - time_start;
+
+	*values_per_second = (uint64_t) rounds * (uint64_t) RRR_LL_COUNT(array) * 1000000ULL / (time_us > 0 ? time_us : 1);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(msg);
+	return ret;
+}
+
+static int __rrr_test_array_explode (void) {
+	int ret = 0;
+
+	struct rrr_msg_msg *message = NULL;
+	struct rrr_msg_msg *msg_a = NULL;
+	struct rrr_msg_msg *msg_b = NULL;
+	struct rrr_array array = {0};
+	uint16_t array_version_dummy;
+	char topic[256] = RRR_TEST_ARRAY_EXPLODE_TOPIC_PREFIX;
+
+	if ((ret = __rrr_test_array_make_message(&message, RRR_TEST_ARRAY_EXPLODE_FIELDS)) != 0) {
+		goto out;
+	}
+
+	rrr_array_arena_enable(&array);
+
+	if ((ret = rrr_array_message_append_to_collection(&array_version_dummy, &array, message)) != 0) {
+		TEST_MSG("Failed to parse array message\n");
+		goto out;
+	}
+
+	RRR_LL_ITERATE_BEGIN(&array, const struct rrr_type_value);
+		if ((ret = __rrr_test_array_explode_value_with_array(&msg_a, node, 1)) != 0 ||
+		    (ret = __rrr_test_array_explode_value_direct(&msg_b, node, 1, topic)) != 0
+		) {
+			TEST_MSG("Failed to create message from value\n");
+			goto out;
+		}
+
+		if (MSG_TOTAL_SIZE(msg_a) != MSG_TOTAL_SIZE(msg_b) || memcmp(msg_a, msg_b, MSG_TOTAL_SIZE(msg_a)) != 0) {
+			TEST_MSG("Message created from value %s differs from message created from array\n", node->tag);
+			ret = 1;
+			goto out;
+		}
+
+		RRR_FREE_IF_NOT_NULL(msg_a);
+		RRR_FREE_IF_NOT_NULL(msg_b);
+	RRR_LL_ITERATE_END();
+
+	uint64_t with_array_per_second = 0;
+	uint64_t direct_per_second = 0;
+
+	if ((ret = __rrr_test_array_explode_run(&with_array_per_second, &array, 0, RRR_TEST_ARRAY_EXPLODE_BENCHMARK_ROUNDS)) != 0 ||
+	    (ret = __rrr_test_array_explode_run(&direct_per_second, &array, 1, RRR_TEST_ARRAY_EXPLODE_BENCHMARK_ROUNDS)) != 0
+	) {
+		goto out;
+	}
+
+	TEST_MSG("Array explode %i fields: through array %" PRIu64 " direct %" PRIu64 " values/s\n",
+			RRR_TEST_ARRAY_EXPLODE_FIELDS, with_array_per_second, direct_per_second);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(msg_a);
+	RRR_FREE_IF_NOT_NULL(msg_b);
+	RRR_FREE_IF_NOT_NULL(message);
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_array_tree_benchmark (void) {
+	int ret = 0;
+
+	struct rrr_array_tree *tree_interpreted = NULL;
+	struct rrr_array_tree *tree_compiled = NULL;
+	struct rrr_parse_pos pos;
+	struct rrr_test_array_tree_data data;
+	uint64_t interpreted_per_second = 0;
+	uint64_t compiled_per_second = 0;
+
+	__rrr_test_array_tree_data_init(&data);
+
+	rrr_parse_pos_init(&pos, rrr_test_array_tree_data_definition, (int) strlen(rrr_test_array_tree_data_definition));
+
+	if ((ret = rrr_array_tree_interpret(&tree_interpreted, &pos, "interpreted")) != 0 ||
+	    (ret = rrr_array_tree_clone_without_data(&tree_compiled, tree_interpreted)) != 0
+	) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_tree_benchmark_run(&interpreted_per_second, tree_interpreted, (const char *) &data, sizeof(data))) != 0 ||
+	    (ret = __rrr_test_array_tree_benchmark_run(&compiled_per_second, tree_compiled, (const char *) &data, sizeof(data))) != 0
+	) {
+		goto out;
+	}
+
+	TEST_MSG("Array tree import %i fields: interpreted %" PRIu64 " compiled %" PRIu64 " messages/s\n",
+			13, interpreted_per_second, compiled_per_second);
+
+	out:
+	if (tree_interpreted != NULL) {
+		rrr_array_tree_destroy(tree_interpreted);
+	}
+	if (tree_compiled != NULL) {
+		rrr_array_tree_destroy(tree_compiled);
+	}
+	return ret;
+}
+
+int rrr_test_array (void) {
+	int ret = 0;
+
+	struct rrr_msg_msg *message = NULL;
+
+	if ((ret = __rrr_test_array_make_message(&message, RRR_TEST_ARRAY_FIELDS)) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_arena(message)) != 0) {
+		TEST_MSG("Array arena test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_flat(message)) != 0) {
+		TEST_MSG("Flat array test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_tag_index(message)) != 0) {
+		TEST_MSG("Array tag index test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_view(message)) != 0) {
+		TEST_MSG("Array view test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_query_builder(message)) != 0) {
+		TEST_MSG("Array query builder test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_tree()) != 0) {
+		TEST_MSG("Array tree differential test failed\n");
+		goto out;
+	}
+
+	for (int do_arena = 0; do_arena <= 1; do_arena++) {
+		uint64_t messages_per_second = 0;
+		if ((ret = __rrr_test_array_parse_benchmark(&messages_per_second, message, do_arena)) != 0) {
+			goto out;
+		}
+		TEST_MSG("Array parse %s %i fields: %" PRIu64 " messages/s\n",
+				(do_arena ? "arena" : "heap"), RRR_TEST_ARRAY_FIELDS, messages_per_second);
+	}
+
+	if ((ret = __rrr_test_array_flat_benchmark()) != 0) {
+		TEST_MSG("Flat array benchmark failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_tag_benchmark()) != 0) {
+		goto out;
+	}
+
+	uint64_t unpack_per_second = 0;
+	uint64_t view_per_second = 0;
+	if ((ret = __rrr_test_array_view_benchmark(&unpack_per_second, &view_per_second, message)) != 0) {
+		TEST_MSG("Array view benchmark failed\n");
+		goto out;
+	}
+	TEST_MSG("Array 3 tag lookups %i fields: unpack %" PRIu64 " view %" PRIu64 " messages/s\n",
+			RRR_TEST_ARRAY_FIELDS, unpack_per_second, view_per_second);
+
+	if ((ret = __rrr_test_array_tree_benchmark()) != 0) {
+		TEST_MSG("Array tree benchmark failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_array_explode()) != 0) {
+		TEST_MSG("Array explode test failed\n");
+		goto out;
+	}
+
+	out:
+	RRR_FREE_IF_NOT_NULL(message);
+	return ret;
+}
@@ -0,0 +1,350 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "../lib/log.h"
+#include "../lib/allocator.h"
+#include "../lib/buffer.h"
+#include "../lib/util/rrr_time.h"
+#include "test.h"
+#include "test_buffer.h"
+
+// More entries than the ring can hold to exercise the overflow path
+#define RRR_TEST_BUFFER_ENTRIES            (RRR_FIFO_RING_DEFAULT_SIZE * 3)
+#define RRR_TEST_BUFFER_BENCHMARK_WRITERS  4
+#define RRR_TEST_BUFFER_BENCHMARK_ENTRIES  100000
+#define RRR_TEST_BUFFER_MIXED_BLOCK        64
+
+struct rrr_test_buffer_write_data {
+	uint64_t next;
+	uint64_t last;
+};
+
+struct rrr_test_buffer_read_data {
+	uint64_t expected[RRR_TEST_BUFFER_BENCHMARK_WRITERS];
+	uint64_t count;
+	uint64_t stop_after;
+	uint64_t search_value;
+	int order_error;
+};
+
+static void __rrr_test_buffer_free (void *arg) {
+	rrr_free(arg);
+}
+
+static int __rrr_test_buffer_write_callback (RRR_FIFO_WRITE_CALLBACK_ARGS) {
+	struct rrr_test_buffer_write_data *write_data = arg;
+
+	uint64_t *value = rrr_allocate(sizeof(*value));
+	if (value == NULL) {
+		return RRR_FIFO_GLOBAL_ERR;
+	}
+
+	*value = write_data->next++;
+
+	*data = (char *) value;
+	*size = sizeof(*value);
+	*order = 0;
+
+	return (write_data->next < write_data->last ? RRR_FIFO_WRITE_AGAIN : 0);
+}
+
+static int __rrr_test_buffer_read_callback (void *callback_data, char *data, unsigned long int size) {
+	struct rrr_test_buffer_read_data *read_data = callback_data;
+
+	(void)(size);
+
+	uint64_t value = *((uint64_t *) data);
+	uint64_t writer = value >> 32;
+
+	if ((value & 0xffffffff) != read_data->expected[writer]) {
+		TEST_MSG("Order error in buffer, expected %" PRIu64 " got %" PRIu64 "\n",
+				read_data->expected[writer], value & 0xffffffff);
+		read_data->order_error = 1;
+	}
+
+	read_data->expected[writer] = (value & 0xffffffff) + 1;
+	read_data->count++;
+
+	if (read_data->stop_after > 0 && read_data->count == read_data->stop_after) {
+		return RRR_FIFO_SEARCH_FREE|RRR_FIFO_SEARCH_STOP;
+	}
+
+	return RRR_FIFO_SEARCH_FREE;
+}
+
+static int __rrr_test_buffer_search_callback (void *callback_data, char *data, unsigned long int size) {
+	struct rrr_test_buffer_read_data *read_data = callback_data;
+
+	(void)(size);
+
+	if (*((uint64_t *) data) == read_data->search_value) {
+		return RRR_FIFO_SEARCH_GIVE|RRR_FIFO_SEARCH_FREE|RRR_FIFO_SEARCH_STOP;
+	}
+
+	return RRR_FIFO_SEARCH_KEEP;
+}
+
+static int __rrr_test_buffer_semantics (
+		int engine
+) {
+	int ret = 0;
+
+	struct rrr_fifo_buffer buffer;
+	struct rrr_test_buffer_write_data write_data = {0};
+	struct rrr_test_buffer_read_data read_data = {0};
+	struct rrr_fifo_buffer_stats stats;
+
+	if (rrr_fifo_buffer_init_custom_free_with_engine(&buffer, __rrr_test_buffer_free, engine) != 0) {
+		TEST_MSG("Failed to initialize buffer\n");
+		return 1;
+	}
+
+	// Mix of ordinary and delayed writes
+	write_data.last = RRR_TEST_BUFFER_ENTRIES / 2;
+	ret |= rrr_fifo_buffer_write(&buffer, __rrr_test_buffer_write_callback, &write_data);
+	write_data.last = RRR_TEST_BUFFER_ENTRIES;
+	ret |= rrr_fifo_buffer_write_delayed(&buffer, __rrr_test_buffer_write_callback, &write_data);
+
+	if (ret != 0) {
+		TEST_MSG("Write to buffer failed\n");
+		goto out;
+	}
+
+	if (rrr_fifo_buffer_get_entry_count_combined(&buffer) != RRR_TEST_BUFFER_ENTRIES) {
+		TEST_MSG("Entry count mismatch after writing, got %i expected %i\n",
+				rrr_fifo_buffer_get_entry_count_combined(&buffer), RRR_TEST_BUFFER_ENTRIES);
+		ret = 1;
+		goto out;
+	}
+
+	// Remove the first entry using search
+	read_data.search_value = 0;
+	if (rrr_fifo_buffer_search(&buffer, __rrr_test_buffer_search_callback, &read_data, 0) != 0) {
+		TEST_MSG("Search in buffer failed\n");
+		ret = 1;
+		goto out;
+	}
+	read_data.expected[0] = 1;
+
+	// Stop after some entries, the rest must be put back in order
+	read_data.stop_after = 10;
+	if ((ret = rrr_fifo_buffer_read_clear_forward(&buffer, __rrr_test_buffer_read_callback, &read_data, 0)) != 0) {
+		TEST_MSG("Read from buffer failed\n");
+		goto out;
+	}
+	if (read_data.count != 10) {
+		TEST_MSG("Read with stop returned %" PRIu64 " entries, expected 10\n", read_data.count);
+		ret = 1;
+		goto out;
+	}
+
+	// Writes after reading must end up after existing entries
+	write_data.last = RRR_TEST_BUFFER_ENTRIES + 10;
+	ret |= rrr_fifo_buffer_write(&buffer, __rrr_test_buffer_write_callback, &write_data);
+	write_data.last = RRR_TEST_BUFFER_ENTRIES + 20;
+	ret |= rrr_fifo_buffer_write_batch(&buffer, __rrr_test_buffer_write_callback, &write_data);
+
+	if (ret != 0) {
+		TEST_MSG("Write to buffer after reading failed\n");
+		goto out;
+	}
+
+	read_data.stop_after = 0;
+	if ((ret = rrr_fifo_buffer_read_clear_forward_all(&buffer, __rrr_test_buffer_read_callback, &read_data)) != 0) {
+		TEST_MSG("Read all from buffer failed\n");
+		goto out;
+	}
+
+	if (read_data.order_error) {
+		ret = 1;
+		goto out;
+	}
+
+	if (read_data.count != RRR_TEST_BUFFER_ENTRIES + 20 - 1) {
+		TEST_MSG("Read %" PRIu64 " entries from buffer, expected %i\n", read_data.count, RRR_TEST_BUFFER_ENTRIES + 20 - 1);
+		ret = 1;
+		goto out;
+	}
+
+	rrr_fifo_buffer_get_stats(&stats, &buffer);
+	if (stats.total_entries_written != RRR_TEST_BUFFER_ENTRIES + 20 || stats.total_entries_deleted != RRR_TEST_BUFFER_ENTRIES + 20) {
+		TEST_MSG("Stats mismatch, written %" PRIu64 " deleted %" PRIu64 "\n",
+				stats.total_entries_written, stats.total_entries_deleted);
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	rrr_fifo_buffer_destroy(&buffer);
+	return ret;
+}
+
+struct rrr_test_buffer_benchmark_writer {
+	struct rrr_fifo_buffer *buffer;
+	struct rrr_test_buffer_write_data write_data;
+	int mixed;
+	int ret;
+};
+
+static int __rrr_test_buffer_benchmark_write_callback (RRR_FIFO_WRITE_CALLBACK_ARGS) {
+	struct rrr_test_buffer_write_data *write_data = arg;
+
+	uint64_t *value = rrr_allocate(sizeof(*value));
+	if (value == NULL) {
+		return RRR_FIFO_GLOBAL_ERR;
+	}
+
+	*value = write_data->next++;
+
+	*data = (char *) value;
+	*size = sizeof(*value);
+	*order = 0;
+
+	return 0;
+}
+
+static void *__rrr_test_buffer_benchmark_writer (void *arg) {
+	struct rrr_test_buffer_benchmark_writer *writer = arg;
+
+	// One message per write to mimic modules producing messages one by one.
+	// Mixed writers alternate between normal and delayed writes per block
+	// of entries, ordering must be preserved when the ring is bypassed.
+	while (writer->write_data.next < writer->write_data.last) {
+		int delayed = writer->mixed && ((writer->write_data.next / RRR_TEST_BUFFER_MIXED_BLOCK) % 2) == 1;
+		if ((writer->ret = (delayed
+				? rrr_fifo_buffer_write_delayed(writer->buffer, __rrr_test_buffer_benchmark_write_callback, &writer->write_data)
+				: rrr_fifo_buffer_write(writer->buffer, __rrr_test_buffer_benchmark_write_callback, &writer->write_data)
+		)) != 0) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int __rrr_test_buffer_benchmark (
+		uint64_t *time_us,
+		int engine,
+		int mixed
+) {
+	int ret = 0;
+
+	struct rrr_fifo_buffer buffer;
+	struct rrr_test_buffer_benchmark_writer writers[RRR_TEST_BUFFER_BENCHMARK_WRITERS];
+	pthread_t threads[RRR_TEST_BUFFER_BENCHMARK_WRITERS];
+	struct rrr_test_buffer_read_data read_data = {0};
+	int threads_started = 0;
+
+	if (rrr_fifo_buffer_init_custom_free_with_engine(&buffer, __rrr_test_buffer_free, engine) != 0) {
+		TEST_MSG("Failed to initialize buffer\n");
+		return 1;
+	}
+
+	uint64_t time_start = rrr_time_get_64();
+
+	for (int i = 0; i < RRR_TEST_BUFFER_BENCHMARK_WRITERS; i++) {
+		memset(&writers[i], '\0', sizeof(writers[i]));
+		writers[i].buffer = &buffer;
+		writers[i].mixed = mixed;
+		writers[i].write_data.next = ((uint64_t) i) << 32;
+		writers[i].write_data.last = writers[i].write_data.next + RRR_TEST_BUFFER_BENCHMARK_ENTRIES;
+		if (pthread_create(&threads[i], NULL, __rrr_test_buffer_benchmark_writer, &writers[i]) != 0) {
+			TEST_MSG("Failed to start writer thread\n");
+			ret = 1;
+			goto out_join;
+		}
+		threads_started++;
+	}
+
+	while (read_data.count < RRR_TEST_BUFFER_BENCHMARK_WRITERS * RRR_TEST_BUFFER_BENCHMARK_ENTRIES) {
+		if ((ret = rrr_fifo_buffer_read_clear_forward(&buffer, __rrr_test_buffer_read_callback, &read_data, 10)) != 0) {
+			TEST_MSG("Read from buffer failed during benchmark\n");
+			goto out_join;
+		}
+		if (read_data.order_error) {
+			ret = 1;
+			goto out_join;
+		}
+	}
+
+	*time_us = rrr_time_get_64() - time_start;
+
+	out_join:
+	for (int i = 0; i < threads_started; i++) {
+		pthread_join(threads[i], NULL);
+		ret |= writers[i].ret;
+	}
+	rrr_fifo_buffer_destroy(&buffer);
+	return ret;
+}
+
+int rrr_test_buffer (void) {
+	int ret = 0;
+
+	uint64_t time_list = 0;
+	uint64_t time_ring = 0;
+	uint64_t time_mixed = 0;
+
+	if (__rrr_test_buffer_semantics(RRR_FIFO_BUFFER_ENGINE_LIST) != 0) {
+		TEST_MSG("Buffer test failed for list engine\n");
+		ret = 1;
+	}
+
+	if (__rrr_test_buffer_semantics(RRR_FIFO_BUFFER_ENGINE_RING) != 0) {
+		TEST_MSG("Buffer test failed for ring engine\n");
+		ret = 1;
+	}
+
+	if (ret != 0) {
+		goto out;
+	}
+
+	if (__rrr_test_buffer_benchmark(&time_list, RRR_FIFO_BUFFER_ENGINE_LIST, 0) != 0) {
+		TEST_MSG("Buffer benchmark failed for list engine\n");
+		ret = 1;
+	}
+
+	if (__rrr_test_buffer_benchmark(&time_ring, RRR_FIFO_BUFFER_ENGINE_RING, 0) != 0) {
+		TEST_MSG("Buffer benchmark failed for ring engine\n");
+		ret = 1;
+	}
+
+	if (__rrr_test_buffer_benchmark(&time_mixed, RRR_FIFO_BUFFER_ENGINE_RING, 1) != 0) {
+		TEST_MSG("Buffer benchmark failed for ring engine with mixed normal and delayed writes\n");
+		ret = 1;
+	}
+
+	TEST_MSG("%i writers x %i entries, list engine %" PRIu64 " ms, ring engine %" PRIu64 " ms, ring engine mixed writes %" PRIu64 " ms... ",
+			RRR_TEST_BUFFER_BENCHMARK_WRITERS,
+			RRR_TEST_BUFFER_BENCHMARK_ENTRIES,
+			time_list / 1000,
+			time_ring / 1000,
+			time_mixed / 1000
+	);
+
+	out:
+	return ret;
+}
@@ -27,6 +27,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/array_tree.h"
 #include "../lib/parse.h"
 #include "../lib/util/rrr_endian.h"
+#include "../lib/util/rrr_time.h"
 #include "test.h"
 #include "test_condition.h"
 
@@ -222,6 +223,229 @@ static int __rrr_test_condition_misc_values (void) {
 	return ret;
 }
 
+#define RRR_TEST_CONDITION_RANDOM_ROUNDS      5000
+#define RRR_TEST_CONDITION_BENCHMARK_ROUNDS   1000000
+
+static int __rrr_test_condition_name_evaluate_callback (
+		RRR_CONDITION_NAME_EVALUATE_CALLBACK_ARGS
+) {
+	(void)(name_index);
+	(void)(arg);
+
+	if (strcmp(name, "a") == 0) {
+		*result = 7;
+	}
+	else if (strcmp(name, "b") == 0) {
+		int64_t value = -3;
+		memcpy(result, &value, sizeof(*result));
+		*is_signed = 1;
+	}
+	else if (strcmp(name, "c") == 0) {
+		*result = 1000;
+	}
+	else {
+		TEST_MSG("Unknown name '%s' in condition\n", name);
+		return RRR_CONDITION_SOFT_ERROR;
+	}
+
+	return RRR_CONDITION_OK;
+}
+
+static int __rrr_test_condition_compare (
+		const char *expression
+) {
+	int ret = 0;
+
+	struct rrr_condition condition = {0};
+
+	if (rrr_condition_interpret_raw(&condition, expression, strlen(expression)) != 0) {
+		TEST_MSG("Condition parse failed for expression '%s'\n", expression);
+		ret = 1;
+		goto out;
+	}
+
+	if (condition.program == NULL) {
+		TEST_MSG("Condition was not compiled for expression '%s'\n", expression);
+		ret = 1;
+		goto out;
+	}
+
+	// Without the program, the shunting yard is evaluated directly
+	struct rrr_condition condition_uncompiled = condition;
+	condition_uncompiled.program = NULL;
+
+	uint64_t result = 0;
+	uint64_t result_uncompiled = 0;
+
+	int ret_compiled = rrr_condition_evaluate(&result, &condition, __rrr_test_condition_name_evaluate_callback, NULL);
+	int ret_uncompiled = rrr_condition_evaluate(&result_uncompiled, &condition_uncompiled, __rrr_test_condition_name_evaluate_callback, NULL);
+
+	if (ret_compiled != ret_uncompiled || result != result_uncompiled) {
+		TEST_MSG("Evaluation mismatch for expression '%s': return %i<>%i result %" PRIu64 "<>%" PRIu64 "\n",
+				expression, ret_compiled, ret_uncompiled, result, result_uncompiled);
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	rrr_condition_clear(&condition);
+	return ret;
+}
+
+// Operands are kept small and operators which may divide by zero, shift
+// too far or wrap around are left out
+static void __rrr_test_condition_random_expression (
+		char **wpos,
+		uint32_t *random,
+		int depth
+) {
+	static const char *operators[] = {
+		"<=", ">=", "<", ">", "==", "!=", "&&", "||", "AND", "OR", "&", "^", "|", "+", "*"
+	};
+	static const char *names[] = {
+		"{a}", "{b}"
+	};
+
+	if (depth == 0 || rrr_test_random(random) % 4 == 0) {
+		switch (rrr_test_random(random) % 4) {
+			case 0:
+				*wpos += sprintf(*wpos, "%s", names[rrr_test_random(random) % 2]);
+				break;
+			case 1:
+				*wpos += sprintf(*wpos, "-%" PRIu32, rrr_test_random(random) % 100);
+				break;
+			case 2:
+				*wpos += sprintf(*wpos, "0x%" PRIx32, rrr_test_random(random) % 100);
+				break;
+			default:
+				*wpos += sprintf(*wpos, "%" PRIu32, rrr_test_random(random) % 100);
+				break;
+		}
+		return;
+	}
+
+	const int use_parenthesis = (int) (rrr_test_random(random) % 2);
+
+	if (use_parenthesis) {
+		*wpos += sprintf(*wpos, "(");
+	}
+	__rrr_test_condition_random_expression(wpos, random, depth - 1);
+	*wpos += sprintf(*wpos, " %s ", operators[rrr_test_random(random) % (sizeof(operators) / sizeof(*operators))]);
+	__rrr_test_condition_random_expression(wpos, random, depth - 1);
+	if (use_parenthesis) {
+		*wpos += sprintf(*wpos, ")");
+	}
+}
+
+static int __rrr_test_condition_evaluation (void) {
+	int ret = 0;
+
+	static const char *expressions[] = {
+		"(1 == 1)",
+		"(5)",
+		"(0)",
+		"()",
+		"({a} + {b} * 2 > 0 AND {c} / 10 == 100)",
+		"(~{a} & 0xff)",
+		"(~0 == 0xffffffffffffffff)",
+		"(1 << 4 | 0x0F ^ 3)",
+		"({c} >> 3 == 125)",
+		"({b} < 0 || {a} >> 1 == 3)",
+		"(0xffffffffffffffff + 1)",
+		"(-1 < 0)",
+		"({a} - {c} > 0)",
+		"({b} - {c} > 0)",
+		"({b} / 2 * -1)",
+		"({c} 2 ==)"
+	};
+
+	for (size_t i = 0; i < sizeof(expressions) / sizeof(*expressions); i++) {
+		ret |= __rrr_test_condition_compare(expressions[i]);
+	}
+
+	uint32_t random = 1;
+	for (int i = 0; i < RRR_TEST_CONDITION_RANDOM_ROUNDS; i++) {
+		char expression[1024];
+		char *wpos = expression;
+
+		wpos += sprintf(wpos, "(");
+		__rrr_test_condition_random_expression(&wpos, &random, 3);
+		wpos += sprintf(wpos, ")");
+
+		if ((ret |= __rrr_test_condition_compare(expression)) != 0) {
+			break;
+		}
+	}
+
+	// Operators must have values available when evaluated
+	{
+		struct rrr_condition condition = {0};
+
+		static const char *condition_bad = "((+) 1 2)";
+		if (rrr_condition_interpret_raw(&condition, condition_bad, strlen(condition_bad)) == 0) {
+			TEST_MSG("Condition parse test did not fail as expected for expression '%s'\n", condition_bad);
+			ret |= 1;
+		}
+
+		rrr_condition_clear(&condition);
+	}
+
+	return ret;
+}
+
+static int __rrr_test_condition_benchmark (void) {
+	int ret = 0;
+
+	struct rrr_condition condition = {0};
+
+	static const char *expression = "({a} + {b} * 2 > 0 AND {c} / 10 == 100 OR {a} & 0x1)";
+	if (rrr_condition_interpret_raw(&condition, expression, strlen(expression)) != 0) {
+		TEST_MSG("Condition parse failed for expression '%s'\n", expression);
+		ret = 1;
+		goto out;
+	}
+
+	struct rrr_condition condition_uncompiled = condition;
+	condition_uncompiled.program = NULL;
+
+	uint64_t per_second[2];
+	const struct rrr_condition *conditions[2] = {
+		&condition,
+		&condition_uncompiled
+	};
+
+	for (int i = 0; i < 2; i++) {
+		uint64_t sum = 0;
+		uint64_t time_start = rrr_time_get_64();
+		for (int j = 0; j < RRR_TEST_CONDITION_BENCHMARK_ROUNDS; j++) {
+			uint64_t result = 0;
+			if ((ret = rrr_condition_evaluate(&result, conditions[i], __rrr_test_condition_name_evaluate_callback, NULL)) != 0) {
+				TEST_MSG("Evaluation failed in condition benchmark\n");
+				goto out;
+			}
+			sum += result;
+		}
+		uint64_t time_total = rrr_time_get_64() - time_start;
+
+		if (sum != RRR_TEST_CONDITION_BENCHMARK_ROUNDS) {
+			TEST_MSG("Unexpected sum %" PRIu64 " in condition benchmark\n", sum);
+			ret = 1;
+			goto out;
+		}
+
+		per_second[i] = (uint64_t) RRR_TEST_CONDITION_BENCHMARK_ROUNDS * 1000000 / (time_total > 0 ? time_total : 1);
+	}
+
+	TEST_MSG("Condition evaluation: %" PRIu64 " per second, without compilation %" PRIu64 " per second\n",
+			per_second[0],
+			per_second[1]
+	);
+
+	out:
+	rrr_condition_clear(&condition);
+	return ret;
+}
+
 int rrr_test_condition (void) {
 	int ret = 0;
 
@@ -229,6 +453,8 @@ int rrr_test_condition (void) {
 
 	ret |= __rrr_test_condition_parsing();
 	ret |= __rrr_test_condition_misc_values();
+	ret |= __rrr_test_condition_evaluation();
+	ret |= __rrr_test_condition_benchmark();
 
 	return ret;
 }
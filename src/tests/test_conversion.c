@@ -30,6 +30,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../lib/type.h"
 #include "../lib/type_conversion.h"
 #include "../lib/map.h"
+#include "../lib/messages/msg_msg.h"
+#include "../lib/util/rrr_time.h"
 
 static int __rrr_test_conversion_convert (
 		struct rrr_array *target,
@@ -159,6 +161,514 @@ static int __rrr_test_conversion_validate_str (
 	return ret;
 }
 
+#define RRR_TEST_CONVERSION_NUMERIC_RANDOM_ROUNDS   100000
+#define RRR_TEST_CONVERSION_NUMERIC_BENCHMARK_COUNT   1000
+#define RRR_TEST_CONVERSION_NUMERIC_BENCHMARK_ROUNDS  1000
+
+// Conversion as it was done before digits were parsed in blocks
+static int __rrr_test_conversion_numeric_str_reference (
+		uint64_t *target,
+		rrr_length *parsed_bytes,
+		const char *start,
+		const char *end,
+		int is_signed
+) {
+	char tmp[64];
+	rrr_length total_length = 0;
+	int found_end_char = 0;
+
+	if (start >= end) {
+		return RRR_TYPE_PARSE_INCOMPLETE;
+	}
+
+	for (const char *pos = start; pos < end; pos++) {
+		if ((*pos >= '0' && *pos <= '9') || *pos == '+' || *pos == ' ' || *pos == '\t' || (is_signed && *pos == '-')) {
+			tmp[total_length++] = *pos;
+			if (total_length > sizeof(tmp) - 1) {
+				return RRR_TYPE_PARSE_SOFT_ERR;
+			}
+			continue;
+		}
+		found_end_char = 1;
+		break;
+	}
+
+	if (!found_end_char) {
+		return RRR_TYPE_PARSE_INCOMPLETE;
+	}
+
+	if (total_length == 0) {
+		return RRR_TYPE_PARSE_SOFT_ERR;
+	}
+
+	tmp[total_length] = '\0';
+
+	char *convert_end = NULL;
+	if (is_signed) {
+		long long int result = strtoll(tmp, &convert_end, 10);
+		memcpy(target, &result, sizeof(*target));
+	}
+	else {
+		unsigned long long int result = strtoull(tmp, &convert_end, 10);
+		memcpy(target, &result, sizeof(*target));
+	}
+
+	if (convert_end == tmp || convert_end - tmp != total_length) {
+		return RRR_TYPE_PARSE_SOFT_ERR;
+	}
+
+	*parsed_bytes = total_length;
+
+	return RRR_TYPE_PARSE_OK;
+}
+
+static int __rrr_test_conversion_numeric_str_import (
+		uint64_t *target,
+		rrr_length *parsed_bytes,
+		const char *start,
+		const char *end,
+		int is_signed
+) {
+	return (is_signed
+		? rrr_type_import_istr_raw((int64_t *) target, parsed_bytes, start, end)
+		: rrr_type_import_ustr_raw(target, parsed_bytes, start, end)
+	);
+}
+
+static int __rrr_test_conversion_numeric_str_compare (
+		const char *str,
+		rrr_length str_length,
+		int is_signed
+) {
+	uint64_t result = 0;
+	uint64_t result_reference = 0;
+	rrr_length parsed_bytes = 0;
+	rrr_length parsed_bytes_reference = 0;
+
+	int ret = __rrr_test_conversion_numeric_str_import(&result, &parsed_bytes, str, str + str_length, is_signed);
+	int ret_reference = __rrr_test_conversion_numeric_str_reference(&result_reference, &parsed_bytes_reference, str, str + str_length, is_signed);
+
+	if (ret != ret_reference || (ret == RRR_TYPE_PARSE_OK && (result != result_reference || parsed_bytes != parsed_bytes_reference))) {
+		TEST_MSG("Mismatch for %s input '%.*s': return %i<>%i value %" PRIu64 "<>%" PRIu64 " parsed %" PRIrrrl "<>%" PRIrrrl "\n",
+				(is_signed ? "signed" : "unsigned"),
+				(int) str_length,
+				str,
+				ret,
+				ret_reference,
+				result,
+				result_reference,
+				parsed_bytes,
+				parsed_bytes_reference
+		);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __rrr_test_conversion_numeric_str (void) {
+	int ret = 0;
+
+	const char *fixed_inputs[] = {
+		"0;",
+		"-0;",
+		"  \t+12345678;",
+		"12345678",
+		"18446744073709551615;",
+		"18446744073709551616;",
+		"99999999999999999999;",
+		"100000000000000000000;",
+		"9223372036854775807;",
+		"9223372036854775808;",
+		"-9223372036854775808;",
+		"-9223372036854775809;",
+		"000000000000000000000000000000000000000001;",
+		"123456789012345678901234567890123456789012345678901234567890123;",
+		"1234567890123456789012345678901234567890123456789012345678901234;",
+		";",
+		"+;",
+		"1 ;",
+		"- 1;",
+		"+-1;",
+		"1-;"
+	};
+
+	for (size_t i = 0; i < sizeof(fixed_inputs) / sizeof(*fixed_inputs); i++) {
+		ret |= __rrr_test_conversion_numeric_str_compare(fixed_inputs[i], (rrr_length) strlen(fixed_inputs[i]), 0);
+		ret |= __rrr_test_conversion_numeric_str_compare(fixed_inputs[i], (rrr_length) strlen(fixed_inputs[i]), 1);
+	}
+
+	if (ret != 0) {
+		goto out;
+	}
+
+	// Random valid numbers, some of which overflow and some of which are
+	// not terminated
+	uint32_t random = 1;
+	for (int i = 0; i < RRR_TEST_CONVERSION_NUMERIC_RANDOM_ROUNDS; i++) {
+		char buf[64];
+		rrr_length wpos = 0;
+
+		const int is_signed = (int) (rrr_test_random(&random) % 2);
+
+		for (uint32_t j = rrr_test_random(&random) % 3; j > 0; j--) {
+			buf[wpos++] = rrr_test_random(&random) % 2 ? ' ' : '\t';
+		}
+		switch (rrr_test_random(&random) % 4) {
+			case 0:
+				buf[wpos++] = '+';
+				break;
+			case 1:
+				buf[wpos++] = (is_signed ? '-' : '+');
+				break;
+			default:
+				break;
+		}
+		// Leading zeros
+		if (rrr_test_random(&random) % 4 == 0) {
+			for (uint32_t j = rrr_test_random(&random) % 4; j > 0; j--) {
+				buf[wpos++] = '0';
+			}
+		}
+		for (uint32_t j = rrr_test_random(&random) % 24 + 1; j > 0; j--) {
+			buf[wpos++] = (char) ('0' + rrr_test_random(&random) % 10);
+		}
+		if (rrr_test_random(&random) % 8 != 0) {
+			buf[wpos++] = ';';
+		}
+
+		if ((ret = __rrr_test_conversion_numeric_str_compare(buf, wpos, is_signed)) != 0) {
+			goto out;
+		}
+	}
+
+	out:
+	return ret;
+}
+
+static int __rrr_test_conversion_numeric_str_benchmark_run (
+		uint64_t *bytes_per_second,
+		const char *input,
+		rrr_length input_length,
+		int use_reference
+) {
+	uint64_t sum = 0;
+
+	uint64_t time_start = rrr_time_get_64();
+	for (int i = 0; i < RRR_TEST_CONVERSION_NUMERIC_BENCHMARK_ROUNDS; i++) {
+		for (rrr_length pos = 0; pos < input_length; ) {
+			uint64_t result = 0;
+			rrr_length parsed_bytes = 0;
+			if ((use_reference
+				? __rrr_test_conversion_numeric_str_reference(&result, &parsed_bytes, input + pos, input + input_length, 1)
+				: rrr_type_import_istr_raw((int64_t *) &result, &parsed_bytes, input + pos, input + input_length)
+			) != RRR_TYPE_PARSE_OK) {
+				TEST_MSG("Import failed at position %" PRIrrrl " in numeric str benchmark\n", pos);
+				return 1;
+			}
+			sum += result;
+			pos += parsed_bytes + 1;
+		}
+	}
+	uint64_t time_total = rrr_time_get_64() - time_start;
+
+	if (sum == 0) {
+		TEST_MSG("Unexpected sum in numeric str benchmark\n");
+		return 1;
+	}
+
+	*bytes_per_second = (uint64_t) input_length * RRR_TEST_CONVERSION_NUMERIC_BENCHMARK_ROUNDS * 1000000 / (time_total > 0 ? time_total : 1);
+
+	return 0;
+}
+
+static int __rrr_test_conversion_numeric_str_benchmark (void) {
+	int ret = 0;
+
+	char input[RRR_TEST_CONVERSION_NUMERIC_BENCHMARK_COUNT * 24];
+	rrr_length input_length = 0;
+
+	// Sensor style readings of varying length
+	uint64_t random = 1;
+	for (int i = 0; i < RRR_TEST_CONVERSION_NUMERIC_BENCHMARK_COUNT; i++) {
+		random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+		const int64_t value = (int64_t) (random >> (i % 48 + 1)) * (i % 2 ? 1 : -1);
+		input_length += (rrr_length) sprintf(input + input_length, "%" PRIi64 ";", value);
+	}
+
+	uint64_t bytes_per_second = 0;
+	uint64_t bytes_per_second_reference = 0;
+
+	if ((ret = __rrr_test_conversion_numeric_str_benchmark_run(&bytes_per_second, input, input_length, 0)) != 0 ||
+	    (ret = __rrr_test_conversion_numeric_str_benchmark_run(&bytes_per_second_reference, input, input_length, 1)) != 0
+	) {
+		goto out;
+	}
+
+	TEST_MSG("Import of istr values: %" PRIu64 " MB/s, previous implementation %" PRIu64 " MB/s\n",
+			bytes_per_second / 1000000,
+			bytes_per_second_reference / 1000000
+	);
+
+	out:
+	return ret;
+}
+
+static int __rrr_test_conversion_push_field_data (
+		struct rrr_array *target,
+		const struct rrr_type_definition *definition,
+		const char *tag,
+		const char *str
+) {
+	int ret = 0;
+
+	struct rrr_type_value *value_new = NULL;
+
+	if ((ret = rrr_type_value_new (
+			&value_new,
+			definition,
+			0,
+			(rrr_length) strlen(tag),
+			tag,
+			0,
+			NULL,
+			1,
+			NULL,
+			strlen(str)
+	)) != 0) {
+		goto out;
+	}
+
+	memcpy(value_new->data, str, strlen(str));
+
+	RRR_LL_APPEND(target, value_new);
+	value_new = NULL;
+
+	out:
+	rrr_type_value_destroy(value_new);
+	return ret;
+}
+
+static int __rrr_test_conversion_array_from_message (
+		struct rrr_array *target,
+		const struct rrr_msg_msg *message
+) {
+	uint16_t array_version_dummy;
+
+	rrr_array_arena_enable(target);
+
+	return rrr_array_message_append_to_collection(&array_version_dummy, target, message);
+}
+
+// Conversion the way the mangler did it before the plan cache
+static int __rrr_test_conversion_plan_cache_reference (
+		struct rrr_array *target,
+		const struct rrr_array *source,
+		const struct rrr_type_conversion_collection *list,
+		const int flags
+) {
+	int ret = 0;
+
+	struct rrr_type_value *value_new = NULL;
+
+	RRR_LL_ITERATE_BEGIN(source, const struct rrr_type_value);
+		if ((ret = rrr_type_convert_using_list(&value_new, node, list, flags)) != 0) {
+			if (ret != RRR_TYPE_CONVERSION_NOT_POSSIBLE) {
+				goto out;
+			}
+			if ((ret = rrr_type_value_clone(&value_new, node, 1)) != 0) {
+				goto out;
+			}
+		}
+		RRR_LL_APPEND(target, value_new);
+		value_new = NULL;
+	RRR_LL_ITERATE_END();
+
+	out:
+	rrr_type_value_destroy(value_new);
+	return ret;
+}
+
+static int __rrr_test_conversion_plan_cache_compare (
+		const struct rrr_array *a,
+		const struct rrr_array *b
+) {
+	if (RRR_LL_COUNT(a) != RRR_LL_COUNT(b)) {
+		TEST_MSG("Value count mismatch %i<>%i\n", RRR_LL_COUNT(a), RRR_LL_COUNT(b));
+		return 1;
+	}
+
+	const struct rrr_type_value *value_b = RRR_LL_FIRST(b);
+	RRR_LL_ITERATE_BEGIN(a, const struct rrr_type_value);
+		if (node->definition != value_b->definition ||
+		    node->flags != value_b->flags ||
+		    node->element_count != value_b->element_count ||
+		    node->total_stored_length != value_b->total_stored_length ||
+		    node->tag_length != value_b->tag_length ||
+		    memcmp(node->data, value_b->data, node->total_stored_length) != 0 ||
+		    (node->tag_length > 0 && memcmp(node->tag, value_b->tag, node->tag_length) != 0)
+		) {
+			TEST_MSG("Value mismatch, type %s<>%s length %" PRIrrrl "<>%" PRIrrrl "\n",
+					node->definition->identifier,
+					value_b->definition->identifier,
+					node->total_stored_length,
+					value_b->total_stored_length
+			);
+			return 1;
+		}
+		value_b = value_b->ptr_next;
+	RRR_LL_ITERATE_END();
+
+	return 0;
+}
+
+static int __rrr_test_conversion_plan_cache_run (
+		const struct rrr_msg_msg *message,
+		const char * const *conversions,
+		const int flags
+) {
+	int ret = 0;
+
+	struct rrr_map conversion_map = {0};
+	struct rrr_type_conversion_collection *list = NULL;
+	struct rrr_type_conversion_plan_cache *cache = NULL;
+	struct rrr_array array_reference_source = {0};
+	struct rrr_array array_reference = {0};
+	struct rrr_array array_plan = {0};
+
+	for (const char * const *conversion = conversions; *conversion != NULL; conversion++) {
+		if ((ret = rrr_map_item_add_new(&conversion_map, *conversion, NULL)) != 0) {
+			goto out;
+		}
+	}
+
+	if ((ret = rrr_type_conversion_collection_new_from_map(&list, &conversion_map)) != 0) {
+		goto out;
+	}
+
+	if ((ret = rrr_type_conversion_plan_cache_new(&cache, list, flags)) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_conversion_array_from_message(&array_reference_source, message)) != 0) {
+		goto out;
+	}
+
+	const int ret_reference = __rrr_test_conversion_plan_cache_reference (
+			&array_reference,
+			&array_reference_source,
+			list,
+			flags
+	);
+
+	// Second round must use the cached plan
+	for (int round = 0; round < 2; round++) {
+		rrr_array_clear(&array_plan);
+
+		if ((ret = __rrr_test_conversion_array_from_message(&array_plan, message)) != 0) {
+			goto out;
+		}
+
+		const int ret_plan = rrr_type_convert_array_using_plan_cache(&array_plan, cache);
+
+		if (ret_plan != ret_reference) {
+			TEST_MSG("Return value mismatch %i<>%i for conversions starting with %s flags %i\n",
+					ret_plan, ret_reference, conversions[0], flags);
+			ret = 1;
+			goto out;
+		}
+
+		if (ret_plan == 0 && __rrr_test_conversion_plan_cache_compare(&array_reference, &array_plan) != 0) {
+			TEST_MSG("Result mismatch for conversions starting with %s flags %i\n", conversions[0], flags);
+			ret = 1;
+			goto out;
+		}
+	}
+
+	uint64_t hits, misses;
+	rrr_type_conversion_plan_cache_get_stats(&hits, &misses, cache);
+	if (hits != 1 || misses != 1) {
+		TEST_MSG("Unexpected plan cache stats hits %" PRIu64 " misses %" PRIu64 "\n", hits, misses);
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	rrr_array_clear(&array_plan);
+	rrr_array_clear(&array_reference);
+	rrr_array_clear(&array_reference_source);
+	if (cache != NULL) {
+		rrr_type_conversion_plan_cache_destroy(cache);
+	}
+	if (list != NULL) {
+		rrr_type_conversion_collection_destroy(list);
+	}
+	rrr_map_clear(&conversion_map);
+	return ret;
+}
+
+static int __rrr_test_conversion_plan_cache (void) {
+	int ret = 0;
+
+	struct rrr_array array = {0};
+	struct rrr_msg_msg *message = NULL;
+
+	int64_t values_multi[] = { 12345, -12345 };
+	uint64_t values_single[] = { 1 };
+	uint64_t values_zero[] = { 0 };
+
+	const char *conversions[][10] = {
+		{"h2str", "str2blob", "blob2str", "str2h", "h2vain", "vain2h", "h2str", "str2vain", "vain2str", NULL},
+		{"str2str", "str2blob", "blob2str", "msg2blob", NULL},
+		{"blob2str", "str2blob", "blob2blob", NULL},
+		{"str2blob", "blob2hex", NULL},
+		{"h2vain", "str2vain", NULL},
+		{"str2h", NULL}
+	};
+
+	const int flags[] = {
+		RRR_TYPE_CONVERT_F_ON_ERROR_TRY_NEXT,
+		RRR_TYPE_CONVERT_F_ON_ERROR_TRY_NEXT | RRR_TYPE_CONVERT_F_STRICT_BLOBS | RRR_TYPE_CONVERT_F_STRICT_STRINGS,
+		RRR_TYPE_CONVERT_F_STRICT_BLOBS,
+		0
+	};
+
+	ret |= __rrr_test_conversion_push_field_h(&array, (uint64_t *) values_multi, sizeof(values_multi) / sizeof(*values_multi), 1);
+	ret |= __rrr_test_conversion_push_field_h(&array, values_single, sizeof(values_single) / sizeof(*values_single), 0);
+	ret |= __rrr_test_conversion_push_field_h(&array, values_zero, sizeof(values_zero) / sizeof(*values_zero), 0);
+	ret |= __rrr_test_conversion_push_field_data(&array, &rrr_type_definition_str, "empty", "");
+	ret |= __rrr_test_conversion_push_field_data(&array, &rrr_type_definition_str, "str", "abc");
+	ret |= __rrr_test_conversion_push_field_data(&array, &rrr_type_definition_str, "num", "42");
+	ret |= __rrr_test_conversion_push_field_data(&array, &rrr_type_definition_nsep, "nsep", "xyz");
+	ret |= __rrr_test_conversion_push_field_data(&array, &rrr_type_definition_blob, "blob", "\x01\x02\x03");
+
+	if (ret != 0) {
+		TEST_MSG("Failed to create values in __rrr_test_conversion_plan_cache\n");
+		goto out;
+	}
+
+	if ((ret = rrr_array_new_message_from_collection(&message, &array, 0, NULL, 0)) != 0) {
+		TEST_MSG("Failed to create message in __rrr_test_conversion_plan_cache\n");
+		goto out;
+	}
+
+	for (size_t i = 0; i < sizeof(conversions) / sizeof(*conversions); i++) {
+		for (size_t j = 0; j < sizeof(flags) / sizeof(*flags); j++) {
+			if ((ret = __rrr_test_conversion_plan_cache_run(message, conversions[i], flags[j])) != 0) {
+				goto out;
+			}
+		}
+	}
+
+	TEST_MSG("Plan cache conversion matched per-value conversion for %llu lists\n",
+			(unsigned long long) (sizeof(conversions) / sizeof(*conversions)));
+
+	out:
+	RRR_FREE_IF_NOT_NULL(message);
+	rrr_array_clear(&array);
+	return ret;
+}
+
 int rrr_test_conversion(void) {
 	int ret = 0;
 
@@ -244,6 +754,18 @@ int rrr_test_conversion(void) {
 		goto out;
 	}
 
+	if ((ret = __rrr_test_conversion_numeric_str()) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_conversion_numeric_str_benchmark()) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_conversion_plan_cache()) != 0) {
+		goto out;
+	}
+
 	// Return value propagates
 
 	out:
@@ -0,0 +1,176 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../lib/log.h"
+#include "../lib/allocator.h"
+#include "../lib/util/crc32.h"
+#include "../lib/util/rrr_time.h"
+#include "../lib/util/macro_utils.h"
+#include "test.h"
+#include "test_crc32.h"
+
+#define RRR_TEST_CRC32_BUFFER_SIZE        (1024 * 1024)
+#define RRR_TEST_CRC32_RANDOM_ROUNDS      2000
+#define RRR_TEST_CRC32_BENCHMARK_BYTES    (32 * 1024 * 1024)
+
+static const char *rrr_test_crc32_level_names[] = {"byte", "slice8", "pclmul"};
+
+static int __rrr_test_crc32_check (
+		const char *buf,
+		rrr_biglength len,
+		uint32_t expected
+) {
+	uint32_t result = rrr_crc32buf(buf, len);
+
+	if (result != expected) {
+		TEST_MSG("CRC32 at level %s was %08" PRIx32 " while %08" PRIx32 " was expected for length %llu\n",
+				rrr_test_crc32_level_names[rrr_crc32_level_get()],
+				result,
+				expected,
+				(unsigned long long) len
+		);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Every level is compared with the byte-at-a-time implementation for
+// all short lengths and random longer lengths at unaligned positions
+static int __rrr_test_crc32_level (
+		const char *buf,
+		int level
+) {
+	uint32_t random = 1;
+
+	if (__rrr_test_crc32_check("123456789", 9, 0xcbf43926) != 0) {
+		return 1;
+	}
+
+	for (rrr_biglength len = 0; len <= 600; len++) {
+		const rrr_biglength offset = rrr_test_random(&random) % 16;
+
+		rrr_crc32_level_set(RRR_CRC32_LEVEL_BYTE);
+		const uint32_t expected = rrr_crc32buf(buf + offset, len);
+		rrr_crc32_level_set(level);
+
+		if (__rrr_test_crc32_check(buf + offset, len, expected) != 0) {
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < RRR_TEST_CRC32_RANDOM_ROUNDS; i++) {
+		const rrr_biglength offset = rrr_test_random(&random) % 16;
+		const rrr_biglength len = rrr_test_random(&random) % (RRR_TEST_CRC32_BUFFER_SIZE / 64);
+
+		rrr_crc32_level_set(RRR_CRC32_LEVEL_BYTE);
+		const uint32_t expected = rrr_crc32buf(buf + offset, len);
+		rrr_crc32_level_set(level);
+
+		if (__rrr_test_crc32_check(buf + offset, len, expected) != 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int __rrr_test_crc32_benchmark (
+		const char *buf,
+		int level_max
+) {
+	const rrr_biglength sizes[] = {64, 1024, 16 * 1024, RRR_TEST_CRC32_BUFFER_SIZE};
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		uint64_t mb_per_second[RRR_CRC32_LEVEL_PCLMUL + 1] = {0};
+		uint32_t results[RRR_CRC32_LEVEL_PCLMUL + 1] = {0};
+
+		const int rounds = (int) (RRR_TEST_CRC32_BENCHMARK_BYTES / sizes[i]);
+
+		for (int level = RRR_CRC32_LEVEL_BYTE; level <= level_max; level++) {
+			rrr_crc32_level_set(level);
+
+			uint32_t sum = 0;
+			uint64_t time_start = rrr_time_get_64();
+			for (int j = 0; j < rounds; j++) {
+				sum += rrr_crc32buf(buf, sizes[i]);
+			}
+			uint64_t time_us = rrr_time_get_64() - time_start;
+
+			results[level] = sum;
+			mb_per_second[level] = (uint64_t) RRR_TEST_CRC32_BENCHMARK_BYTES / (time_us > 0 ? time_us : 1);
+
+			if (sum != results[RRR_CRC32_LEVEL_BYTE]) {
+				TEST_MSG("Unexpected checksum sum in CRC32 benchmark at level %s\n", rrr_test_crc32_level_names[level]);
+				return 1;
+			}
+		}
+
+		TEST_MSG("CRC32 of %llu byte buffers: byte %" PRIu64 " slice8 %" PRIu64 " pclmul %" PRIu64 " MB/s\n",
+				(unsigned long long) sizes[i],
+				mb_per_second[RRR_CRC32_LEVEL_BYTE],
+				mb_per_second[RRR_CRC32_LEVEL_SLICE8],
+				mb_per_second[RRR_CRC32_LEVEL_PCLMUL]
+		);
+	}
+
+	return 0;
+}
+
+int rrr_test_crc32 (void) {
+	int ret = 0;
+
+	const int level_orig = rrr_crc32_level_get();
+
+	char *buf = NULL;
+	uint32_t random = 1;
+
+	if ((buf = rrr_allocate(RRR_TEST_CRC32_BUFFER_SIZE + 16)) == NULL) {
+		TEST_MSG("Could not allocate memory in rrr_test_crc32\n");
+		ret = 1;
+		goto out;
+	}
+
+	for (rrr_biglength i = 0; i < RRR_TEST_CRC32_BUFFER_SIZE + 16; i++) {
+		buf[i] = (char) rrr_test_random(&random);
+	}
+
+	for (int level = RRR_CRC32_LEVEL_BYTE; level <= level_orig; level++) {
+		if ((ret = __rrr_test_crc32_level(buf, level)) != 0) {
+			goto out;
+		}
+	}
+
+	if ((ret = __rrr_test_crc32_benchmark(buf, level_orig)) != 0) {
+		goto out;
+	}
+
+	out:
+	rrr_crc32_level_set(level_orig);
+	RRR_FREE_IF_NOT_NULL(buf);
+	return ret;
+}
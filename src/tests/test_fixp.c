@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 
 #include "../lib/log.h"
 #include "../lib/allocator.h"
@@ -29,6 +30,175 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "test_fixp.h"
 #include "../lib/fixed_point.h"
 #include "../lib/util/macro_utils.h"
+#include "../lib/util/rrr_time.h"
+
+#define RRR_TEST_FIXP_RANDOM_ROUNDS     100000
+#define RRR_TEST_FIXP_BENCHMARK_COUNT   1000
+#define RRR_TEST_FIXP_BENCHMARK_ROUNDS  1000
+
+// Integer conversion as it was done before digits were parsed in blocks
+static rrr_fixp __rrr_test_fixp_integer_reference (
+		const char *start,
+		const char *end,
+		int base
+) {
+	uint64_t result = 0;
+	long double factor = 1.0;
+
+	for (const char *pos = end - 1; pos >= start; pos--) {
+		char c = *pos;
+		int digit = (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+		result += digit * factor;
+		factor *= base;
+	}
+
+	result <<= RRR_FIXED_POINT_BASE2_EXPONENT;
+	result &= ~((uint64_t) 1 << 63);
+
+	return (rrr_fixp) result;
+}
+
+static int __rrr_test_fixp_parse (
+		rrr_fixp *result,
+		const char *str
+) {
+	const char *endptr = NULL;
+
+	if (rrr_fixp_str_to_fixp(result, str, (ssize_t) strlen(str), &endptr) != 0) {
+		TEST_MSG("Conversion of '%s' failed\n", str);
+		return 1;
+	}
+
+	if (*endptr != ';' && *endptr != '\0') {
+		TEST_MSG("End pointer position was incorrect for '%s'\n", str);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __rrr_test_fixp_random_numbers (void) {
+	int ret = 0;
+
+	uint32_t random = 1;
+	uint64_t random_64 = 1;
+
+	for (int i = 0; i < RRR_TEST_FIXP_RANDOM_ROUNDS; i++) {
+		char buf[64];
+		char digits[32];
+		rrr_fixp fixp = 0;
+		rrr_fixp fixp_tmp = 0;
+
+		// Hexadecimal round trip
+		random_64 = random_64 * 6364136223846793005ULL + 1442695040888963407ULL;
+		const rrr_fixp value = (rrr_fixp) (random_64 >> (i % 40 + 1));
+		if ((ret = rrr_fixp_to_str_16(buf, sizeof(buf), value)) != 0) {
+			TEST_MSG("Conversion from fixed point to hex string failed\n");
+			goto out;
+		}
+		if ((ret = __rrr_test_fixp_parse(&fixp, buf)) != 0) {
+			goto out;
+		}
+		if (fixp != value) {
+			TEST_MSG("Hexadecimal round trip mismatch for '%s': %" PRIi64 "<>%" PRIi64 "\n", buf, fixp, value);
+			ret = 1;
+			goto out;
+		}
+
+		// Integers, also longer ones which use the generic conversion
+		const int base = (rrr_test_random(&random) % 2 ? 16 : 10);
+		const uint32_t digit_count = rrr_test_random(&random) % (base == 16 ? 15 : 19) + 1;
+		for (uint32_t j = 0; j < digit_count; j++) {
+			const uint32_t digit = rrr_test_random(&random) % (uint32_t) base;
+			digits[j] = (char) (digit < 10 ? '0' + digit : (rrr_test_random(&random) % 2 ? 'a' : 'A') + digit - 10);
+		}
+		digits[digit_count] = '\0';
+
+		const rrr_fixp expected = __rrr_test_fixp_integer_reference(digits, digits + digit_count, base);
+
+		sprintf(buf, "%s%s;", (base == 16 ? "16#" : (rrr_test_random(&random) % 2 ? "10#" : "")), digits);
+		if ((ret = __rrr_test_fixp_parse(&fixp, buf)) != 0) {
+			goto out;
+		}
+		if (fixp != expected) {
+			TEST_MSG("Integer mismatch for '%s': %" PRIi64 "<>%" PRIi64 "\n", buf, fixp, expected);
+			ret = 1;
+			goto out;
+		}
+
+		sprintf(buf, "%s-%s;", (base == 16 ? "16#" : ""), digits);
+		if ((ret = __rrr_test_fixp_parse(&fixp, buf)) != 0) {
+			goto out;
+		}
+		if (fixp != (rrr_fixp) (0 - (uint64_t) expected)) {
+			TEST_MSG("Negative integer mismatch for '%s'\n", buf);
+			ret = 1;
+			goto out;
+		}
+
+		// Integer and fraction must be converted independently
+		const uint32_t fraction = rrr_test_random(&random) % 1000000;
+		sprintf(buf, "%s%s.%06" PRIu32, (base == 16 ? "16#" : ""), digits, fraction);
+		if ((ret = __rrr_test_fixp_parse(&fixp, buf)) != 0) {
+			goto out;
+		}
+		sprintf(buf, "%s0.%06" PRIu32, (base == 16 ? "16#" : ""), fraction);
+		if ((ret = __rrr_test_fixp_parse(&fixp_tmp, buf)) != 0) {
+			goto out;
+		}
+		if (fixp != (expected | fixp_tmp)) {
+			TEST_MSG("Fraction mismatch for '%s.%06" PRIu32 "'\n", digits, fraction);
+			ret = 1;
+			goto out;
+		}
+	}
+
+	out:
+	return ret;
+}
+
+static int __rrr_test_fixp_benchmark (void) {
+	int ret = 0;
+
+	char input[RRR_TEST_FIXP_BENCHMARK_COUNT * 32];
+	ssize_t input_length = 0;
+
+	// Sensor style readings with varying precision
+	uint32_t random = 1;
+	for (int i = 0; i < RRR_TEST_FIXP_BENCHMARK_COUNT; i++) {
+		input_length += sprintf(input + input_length, "%s%" PRIu32 ".%0*" PRIu32 ";",
+				(i % 2 ? "-" : ""),
+				rrr_test_random(&random) % 100000,
+				(int) (i % 4 + 1),
+				rrr_test_random(&random) % 10
+		);
+	}
+
+	uint64_t sum = 0;
+
+	uint64_t time_start = rrr_time_get_64();
+	for (int i = 0; i < RRR_TEST_FIXP_BENCHMARK_ROUNDS; i++) {
+		for (const char *pos = input; pos < input + input_length; ) {
+			rrr_fixp fixp = 0;
+			const char *endptr = NULL;
+			if ((ret = rrr_fixp_str_to_fixp(&fixp, pos, input + input_length - pos, &endptr)) != 0) {
+				TEST_MSG("Conversion failed at position %li in benchmark\n", (long) (pos - input));
+				goto out;
+			}
+			sum += (uint64_t) fixp;
+			pos = endptr + 1;
+		}
+	}
+	uint64_t time_total = rrr_time_get_64() - time_start;
+
+	TEST_MSG("Conversion of decimal fixed point strings: %" PRIu64 " MB/s (sum %" PRIu64 ")\n",
+			(uint64_t) input_length * RRR_TEST_FIXP_BENCHMARK_ROUNDS / (time_total > 0 ? time_total : 1),
+			sum
+	);
+
+	out:
+	return ret;
+}
 
 int rrr_test_fixp(void) {
 	int ret = 0;
@@ -159,6 +329,14 @@ int rrr_test_fixp(void) {
 		goto out;
 	}
 
+	if ((ret = __rrr_test_fixp_random_numbers()) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_fixp_benchmark()) != 0) {
+		goto out;
+	}
+
 	out:
 	RRR_FREE_IF_NOT_NULL(tmp);
 	return (ret != 0);
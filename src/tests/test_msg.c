@@ -0,0 +1,471 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../lib/log.h"
+#include "../lib/allocator.h"
+#include "../lib/array.h"
+#include "../lib/array_tree.h"
+#include "../lib/type.h"
+#include "../lib/messages/msg.h"
+#include "../lib/messages/msg_msg.h"
+#include "../lib/messages/msg_checksum.h"
+#include "../lib/util/rrr_time.h"
+#include "../lib/util/macro_utils.h"
+#include "test.h"
+#include "test_msg.h"
+
+#define RRR_TEST_MSG_BATCH_COUNT             50
+#define RRR_TEST_MSG_BENCHMARK_COUNT         200000
+#define RRR_TEST_MSG_BENCHMARK_BATCH_COUNT   64
+
+static int __rrr_test_msg_make_messages (
+		struct rrr_msg_msg **messages,
+		int count,
+		uint32_t *random
+) {
+	char topic[64];
+	char data[256];
+
+	for (int i = 0; i < count; i++) {
+		const rrr_u16 topic_length = (rrr_u16) (rrr_test_random(random) % sizeof(topic));
+		const rrr_u32 data_length = rrr_test_random(random) % sizeof(data);
+
+		for (size_t j = 0; j < sizeof(topic); j++) {
+			topic[j] = (char) ('a' + rrr_test_random(random) % 26);
+		}
+		for (size_t j = 0; j < sizeof(data); j++) {
+			data[j] = (char) rrr_test_random(random);
+		}
+
+		if (rrr_msg_msg_new_with_data (
+				&messages[i],
+				MSG_TYPE_MSG,
+				MSG_CLASS_DATA,
+				rrr_time_get_64(),
+				topic,
+				topic_length,
+				data,
+				data_length
+		) != 0) {
+			TEST_MSG("Failed to create message in __rrr_test_msg_make_messages\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// The header fields of the messages differ after a round trip, only
+// the size and the message body are compared
+static int __rrr_test_msg_compare (
+		const struct rrr_msg_msg *a,
+		const struct rrr_msg_msg *b
+) {
+	if (MSG_TOTAL_SIZE(a) != MSG_TOTAL_SIZE(b)) {
+		TEST_MSG("Message size mismatch %" PRIu32 "<>%" PRIu32 "\n", MSG_TOTAL_SIZE(a), MSG_TOTAL_SIZE(b));
+		return 1;
+	}
+
+	if (memcmp (
+			((const char *) a) + sizeof(struct rrr_msg),
+			((const char *) b) + sizeof(struct rrr_msg),
+			MSG_TOTAL_SIZE(a) - sizeof(struct rrr_msg)
+	) != 0) {
+		TEST_MSG("Message contents mismatch\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __rrr_test_msg_batch_make (
+		struct rrr_msg **result,
+		rrr_length *result_size,
+		struct rrr_msg_msg **messages,
+		int count
+) {
+	int ret = 0;
+
+	struct rrr_msg_batch batch = {0};
+
+	for (int i = 0; i < count; i++) {
+		if ((ret = rrr_msg_batch_append_msg_msg(&batch, messages[i])) != 0) {
+			TEST_MSG("Failed to append message to batch\n");
+			goto out;
+		}
+	}
+
+	rrr_msg_batch_finalize(result, result_size, &batch);
+
+	out:
+	rrr_msg_batch_clear(&batch);
+	return ret;
+}
+
+struct rrr_test_msg_batch_callback_data {
+	struct rrr_msg_msg **messages;
+	int pos;
+	int count;
+	int mismatch;
+};
+
+static int __rrr_test_msg_batch_callback (
+		struct rrr_msg_msg **message,
+		void *arg1,
+		void *arg2
+) {
+	struct rrr_test_msg_batch_callback_data *callback_data = arg1;
+
+	(void)(arg2);
+
+	if (callback_data->pos >= callback_data->count ||
+	    __rrr_test_msg_compare(callback_data->messages[callback_data->pos], *message) != 0
+	) {
+		callback_data->mismatch = 1;
+	}
+
+	// Take control of every second message like readers storing the messages do
+	if (callback_data->pos % 2 == 0) {
+		rrr_free(*message);
+		*message = NULL;
+	}
+
+	callback_data->pos++;
+
+	return 0;
+}
+
+static int __rrr_test_msg_batch_verify (
+		int *callback_count,
+		const struct rrr_msg *batch,
+		rrr_length batch_size,
+		struct rrr_msg_msg **messages,
+		int count
+) {
+	int ret = 0;
+
+	struct rrr_msg *batch_copy = NULL;
+
+	*callback_count = 0;
+
+	if ((batch_copy = rrr_allocate(batch_size)) == NULL) {
+		TEST_MSG("Could not allocate memory in __rrr_test_msg_batch_verify\n");
+		ret = 1;
+		goto out;
+	}
+
+	memcpy(batch_copy, batch, batch_size);
+
+	struct rrr_test_msg_batch_callback_data callback_data = {
+		messages,
+		0,
+		count,
+		0
+	};
+
+	ret = rrr_msg_to_host_and_verify_with_callback (
+			&batch_copy,
+			batch_size,
+			__rrr_test_msg_batch_callback,
+			NULL,
+			NULL,
+			NULL,
+			NULL,
+			&callback_data,
+			NULL
+	);
+
+	if (callback_data.mismatch) {
+		TEST_MSG("Mismatch of messages unpacked from batch\n");
+		ret = 1;
+	}
+
+	*callback_count = callback_data.pos;
+
+	out:
+	RRR_FREE_IF_NOT_NULL(batch_copy);
+	return ret;
+}
+
+static int __rrr_test_msg_batch_array_callback (
+		struct rrr_array *array,
+		void *arg
+) {
+	rrr_array_move(arg, array);
+	return 0;
+}
+
+// The msg array type used by the ip module unpacks batches into one
+// value holding all the members
+static int __rrr_test_msg_batch_array (
+		const struct rrr_msg *batch,
+		rrr_length batch_size,
+		struct rrr_msg_msg **messages,
+		int count
+) {
+	int ret = 0;
+
+	const char definition[] = "msg#msg;";
+
+	struct rrr_array_tree *tree = NULL;
+	struct rrr_array array = {0};
+
+	if ((ret = rrr_array_tree_interpret_raw(&tree, definition, (int) strlen(definition), "batch")) != 0) {
+		TEST_MSG("Failed to parse array tree '%s'\n", definition);
+		goto out;
+	}
+
+	ssize_t parsed_bytes = 0;
+	if ((ret = rrr_array_tree_import_from_buffer (
+			&parsed_bytes,
+			(const char *) batch,
+			(ssize_t) batch_size,
+			tree,
+			__rrr_test_msg_batch_array_callback,
+			&array
+	)) != 0) {
+		TEST_MSG("Failed to import batch using array definition, return was %i\n", ret);
+		goto out;
+	}
+
+	if (parsed_bytes != (ssize_t) batch_size) {
+		TEST_MSG("Not all bytes of the batch were parsed %lli<>%lli\n", (long long int) parsed_bytes, (long long int) batch_size);
+		ret = 1;
+		goto out;
+	}
+
+	const struct rrr_type_value *value = rrr_array_value_get_by_tag_const(&array, "msg");
+	if (value == NULL || value->element_count != (rrr_length) count) {
+		TEST_MSG("Unexpected element count of msg value after import of batch\n");
+		ret = 1;
+		goto out;
+	}
+
+	rrr_length pos = 0;
+	for (int i = 0; i < count; i++) {
+		const struct rrr_msg_msg *message = (const struct rrr_msg_msg *) (value->data + pos);
+
+		if (pos >= value->total_stored_length || (ret = __rrr_test_msg_compare(messages[i], message)) != 0) {
+			TEST_MSG("Mismatch of message %i after import of batch\n", i);
+			ret = 1;
+			goto out;
+		}
+
+		pos += MSG_TOTAL_SIZE(message);
+	}
+
+	if (pos != value->total_stored_length) {
+		TEST_MSG("Unexpected length of msg value after import of batch\n");
+		ret = 1;
+		goto out;
+	}
+
+	out:
+	if (tree != NULL) {
+		rrr_array_tree_destroy(tree);
+	}
+	rrr_array_clear(&array);
+	return ret;
+}
+
+static int __rrr_test_msg_benchmark_callback (
+		struct rrr_msg_msg **message,
+		void *arg1,
+		void *arg2
+) {
+	int *count = arg1;
+
+	(void)(message);
+	(void)(arg2);
+
+	(*count)++;
+
+	return 0;
+}
+
+// Compare the cost of framing and checksumming messages one by one with
+// packing them into batches, both for the sender and the receiver
+static int __rrr_test_msg_benchmark (
+		struct rrr_msg_msg **messages,
+		int count
+) {
+	int ret = 0;
+
+	char *buf = NULL;
+	struct rrr_msg *batch = NULL;
+	rrr_length batch_size = 0;
+
+	rrr_length size_max = 0;
+	for (int i = 0; i < count; i++) {
+		if (MSG_TOTAL_SIZE(messages[i]) > size_max) {
+			size_max = MSG_TOTAL_SIZE(messages[i]);
+		}
+	}
+
+	if ((buf = rrr_allocate(size_max)) == NULL) {
+		TEST_MSG("Could not allocate memory in __rrr_test_msg_benchmark\n");
+		ret = 1;
+		goto out;
+	}
+
+	int received_single = 0;
+	uint64_t time_start = rrr_time_get_64();
+	for (int i = 0; i < RRR_TEST_MSG_BENCHMARK_COUNT; i++) {
+		const struct rrr_msg_msg *message = messages[i % count];
+		struct rrr_msg *msg = (struct rrr_msg *) buf;
+
+		memcpy(buf, message, MSG_TOTAL_SIZE(message));
+		rrr_msg_msg_prepare_for_network((struct rrr_msg_msg *) msg);
+		rrr_msg_populate_head(msg, RRR_MSG_TYPE_MESSAGE, MSG_TOTAL_SIZE(message), 0);
+		rrr_msg_checksum_and_to_network_endian(msg);
+
+		rrr_length target_size = 0;
+		if ((ret = rrr_msg_get_target_size_and_check_checksum(&target_size, msg, size_max)) != 0 ||
+		    (ret = rrr_msg_to_host_and_verify_with_callback (
+				&msg,
+				target_size,
+				__rrr_test_msg_benchmark_callback,
+				NULL,
+				NULL,
+				NULL,
+				NULL,
+				&received_single,
+				NULL
+		)) != 0) {
+			TEST_MSG("Failed to verify single message in benchmark\n");
+			goto out;
+		}
+	}
+	const uint64_t time_single = rrr_time_get_64() - time_start;
+
+	int received_batch = 0;
+	time_start = rrr_time_get_64();
+	for (int i = 0; i < RRR_TEST_MSG_BENCHMARK_COUNT; i += RRR_TEST_MSG_BENCHMARK_BATCH_COUNT) {
+		struct rrr_msg_msg *batch_messages[RRR_TEST_MSG_BENCHMARK_BATCH_COUNT];
+		int batch_count = 0;
+		for (int j = i; j < i + RRR_TEST_MSG_BENCHMARK_BATCH_COUNT && j < RRR_TEST_MSG_BENCHMARK_COUNT; j++) {
+			batch_messages[batch_count++] = messages[j % count];
+		}
+
+		if ((ret = __rrr_test_msg_batch_make(&batch, &batch_size, batch_messages, batch_count)) != 0) {
+			goto out;
+		}
+
+		rrr_length target_size = 0;
+		if ((ret = rrr_msg_get_target_size_and_check_checksum(&target_size, batch, batch_size)) != 0 ||
+		    (ret = rrr_msg_to_host_and_verify_with_callback (
+				&batch,
+				target_size,
+				__rrr_test_msg_benchmark_callback,
+				NULL,
+				NULL,
+				NULL,
+				NULL,
+				&received_batch,
+				NULL
+		)) != 0) {
+			TEST_MSG("Failed to verify batch in benchmark\n");
+			goto out;
+		}
+
+		RRR_FREE_IF_NOT_NULL(batch);
+	}
+	const uint64_t time_batch = rrr_time_get_64() - time_start;
+
+	if (received_single != RRR_TEST_MSG_BENCHMARK_COUNT || received_batch != RRR_TEST_MSG_BENCHMARK_COUNT) {
+		TEST_MSG("Unexpected message count in benchmark %i/%i<>%i\n",
+				received_single, received_batch, RRR_TEST_MSG_BENCHMARK_COUNT);
+		ret = 1;
+		goto out;
+	}
+
+	TEST_MSG("Framing and verifying %i messages: single %" PRIu64 " batch of %i %" PRIu64 " messages/s\n",
+			RRR_TEST_MSG_BENCHMARK_COUNT,
+			(uint64_t) RRR_TEST_MSG_BENCHMARK_COUNT * 1000000 / (time_single > 0 ? time_single : 1),
+			RRR_TEST_MSG_BENCHMARK_BATCH_COUNT,
+			(uint64_t) RRR_TEST_MSG_BENCHMARK_COUNT * 1000000 / (time_batch > 0 ? time_batch : 1)
+	);
+
+	out:
+	RRR_FREE_IF_NOT_NULL(batch);
+	RRR_FREE_IF_NOT_NULL(buf);
+	return ret;
+}
+
+int rrr_test_msg (void) {
+	int ret = 0;
+
+	struct rrr_msg_msg *messages[RRR_TEST_MSG_BATCH_COUNT] = {0};
+	struct rrr_msg *batch = NULL;
+	rrr_length batch_size = 0;
+	uint32_t random = 1;
+	int callback_count = 0;
+
+	if ((ret = __rrr_test_msg_make_messages(messages, RRR_TEST_MSG_BATCH_COUNT, &random)) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_batch_make(&batch, &batch_size, messages, RRR_TEST_MSG_BATCH_COUNT)) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_batch_verify(&callback_count, batch, batch_size, messages, RRR_TEST_MSG_BATCH_COUNT)) != 0) {
+		TEST_MSG("Failed to verify batch\n");
+		goto out;
+	}
+
+	if (callback_count != RRR_TEST_MSG_BATCH_COUNT) {
+		TEST_MSG("Callback count mismatch after batch verification %i<>%i\n", callback_count, RRR_TEST_MSG_BATCH_COUNT);
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_batch_array(batch, batch_size, messages, RRR_TEST_MSG_BATCH_COUNT)) != 0) {
+		goto out;
+	}
+
+	// A corrupt member must cause the whole batch to be rejected
+	((char *) batch)[batch_size / 2] ^= 1;
+
+	TEST_MSG("Verifying corrupted batch, an error is expected\n");
+	if (__rrr_test_msg_batch_verify(&callback_count, batch, batch_size, messages, RRR_TEST_MSG_BATCH_COUNT) == 0 || callback_count != 0) {
+		TEST_MSG("Corrupted batch was not rejected\n");
+		ret = 1;
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_benchmark(messages, RRR_TEST_MSG_BATCH_COUNT)) != 0) {
+		goto out;
+	}
+
+	out:
+	for (int i = 0; i < RRR_TEST_MSG_BATCH_COUNT; i++) {
+		RRR_FREE_IF_NOT_NULL(messages[i]);
+	}
+	RRR_FREE_IF_NOT_NULL(batch);
+	return ret;
+}
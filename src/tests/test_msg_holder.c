@@ -0,0 +1,848 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+#include "../lib/log.h"
+#include "../lib/allocator.h"
+#include "../lib/message_holder/message_holder.h"
+#include "../lib/message_holder/message_holder_struct.h"
+#include "../lib/message_holder/message_holder_spill.h"
+#include "../lib/message_holder/message_holder_wal.h"
+#include "../lib/message_holder/message_holder_collection.h"
+#include "../lib/util/rrr_time.h"
+#include "test.h"
+#include "test_msg_holder.h"
+
+// More holders than a thread keeps in its local pool to exercise the global pool
+#define RRR_TEST_MSG_HOLDER_ENTRIES            1000
+#define RRR_TEST_MSG_HOLDER_BENCHMARK_ROUNDS   1000
+
+// Small segments to make the spill use many of them
+#define RRR_TEST_MSG_HOLDER_SPILL_SEGMENT_SIZE 4096
+
+#define RRR_TEST_MSG_HOLDER_WAL_DIRECTORY      "/tmp"
+#define RRR_TEST_MSG_HOLDER_WAL_NAME           "test_msg_holder"
+#define RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY   10
+#define RRR_TEST_MSG_HOLDER_WAL_FILE_LIMIT     100
+#define RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_MSGS 2000
+#define RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_SIZE 100
+
+struct rrr_test_msg_holder_thread_data {
+	struct rrr_msg_holder *entries[RRR_TEST_MSG_HOLDER_ENTRIES];
+	int do_decref;
+	int ret;
+};
+
+static int __rrr_test_msg_holder_new_many (
+		struct rrr_msg_holder **entries,
+		int count
+) {
+	struct sockaddr_in addr = {0};
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(1234);
+
+	for (int i = 0; i < count; i++) {
+		if (rrr_msg_holder_new (
+				&entries[i],
+				0,
+				(struct sockaddr *) &addr,
+				sizeof(addr),
+				0,
+				NULL
+		) != 0) {
+			TEST_MSG("Failed to create message holder\n");
+			for (int j = 0; j < i; j++) {
+				rrr_msg_holder_decref(entries[j]);
+			}
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void __rrr_test_msg_holder_decref_many (
+		struct rrr_msg_holder **entries,
+		int count
+) {
+	for (int i = 0; i < count; i++) {
+		rrr_msg_holder_decref(entries[i]);
+	}
+}
+
+static void *__rrr_test_msg_holder_thread (void *arg) {
+	struct rrr_test_msg_holder_thread_data *data = arg;
+
+	if ((data->ret = __rrr_test_msg_holder_new_many(data->entries, RRR_TEST_MSG_HOLDER_ENTRIES)) != 0) {
+		return NULL;
+	}
+
+	if (data->do_decref) {
+		data->entries[0]->send_time = 1;
+		data->entries[0]->endian_indicator = 1;
+		data->entries[0]->private_data = data->entries[0];
+
+		__rrr_test_msg_holder_decref_many(data->entries, RRR_TEST_MSG_HOLDER_ENTRIES);
+	}
+
+	return NULL;
+}
+
+static int __rrr_test_msg_holder_thread_run (
+		struct rrr_test_msg_holder_thread_data *data
+) {
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, __rrr_test_msg_holder_thread, data) != 0) {
+		TEST_MSG("Failed to start thread\n");
+		return 1;
+	}
+
+	pthread_join(thread, NULL);
+
+	return data->ret;
+}
+
+static int __rrr_test_msg_holder_reuse (void) {
+	int ret = 0;
+
+	struct rrr_test_msg_holder_thread_data data = {0};
+	struct rrr_msg_holder_pool_stats stats_before;
+	struct rrr_msg_holder_pool_stats stats_after;
+
+	// Holders destroyed in a thread must be given to the global
+	// pool when the thread exits and be reusable by other threads
+	data.do_decref = 1;
+	if ((ret = __rrr_test_msg_holder_thread_run(&data)) != 0) {
+		goto out;
+	}
+
+	rrr_msg_holder_pool_get_stats(&stats_before);
+
+	data.do_decref = 0;
+	if ((ret = __rrr_test_msg_holder_thread_run(&data)) != 0) {
+		goto out;
+	}
+
+	rrr_msg_holder_pool_get_stats(&stats_after);
+
+	for (int i = 0; i < RRR_TEST_MSG_HOLDER_ENTRIES; i++) {
+		struct rrr_msg_holder *entry = data.entries[i];
+		if (entry->usercount != 1 || entry->send_time != 0 || entry->endian_indicator != 0 || entry->private_data != NULL) {
+			TEST_MSG("Reused message holder was not reset\n");
+			ret = 1;
+		}
+		if (entry->addr_len != sizeof(struct sockaddr_in) || ((struct sockaddr_in *) entry->addr)->sin_port != htons(1234)) {
+			TEST_MSG("Address not set in reused message holder\n");
+			ret = 1;
+		}
+		if (ret != 0) {
+			goto out_decref;
+		}
+	}
+
+	if (stats_after.total_misses != stats_before.total_misses) {
+		TEST_MSG("%" PRIu64 " pool misses after warmup, expected none\n",
+				stats_after.total_misses - stats_before.total_misses);
+		ret = 1;
+		goto out_decref;
+	}
+
+	out_decref:
+		__rrr_test_msg_holder_decref_many(data.entries, RRR_TEST_MSG_HOLDER_ENTRIES);
+	out:
+		return ret;
+}
+
+static int __rrr_test_msg_holder_benchmark_pool (
+		uint64_t *time_us,
+		int pool_enabled
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder *entries[RRR_TEST_MSG_HOLDER_ENTRIES];
+
+	rrr_msg_holder_pool_set_enabled(pool_enabled);
+
+	uint64_t time_start = rrr_time_get_64();
+
+	for (int i = 0; i < RRR_TEST_MSG_HOLDER_BENCHMARK_ROUNDS; i++) {
+		if ((ret = __rrr_test_msg_holder_new_many(entries, RRR_TEST_MSG_HOLDER_ENTRIES)) != 0) {
+			goto out;
+		}
+		__rrr_test_msg_holder_decref_many(entries, RRR_TEST_MSG_HOLDER_ENTRIES);
+	}
+
+	*time_us = rrr_time_get_64() - time_start;
+
+	out:
+	rrr_msg_holder_pool_set_enabled(1);
+	return ret;
+}
+
+// Data, address and protocol are made from the number i to be checked
+// by __rrr_test_msg_holder_check_numbered
+static int __rrr_test_msg_holder_new_numbered (
+		struct rrr_msg_holder **target,
+		int i
+) {
+	struct sockaddr_in addr = {0};
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t) i);
+
+	// Sizes vary and some are larger than the segment size
+	size_t data_size = (size_t) (i % 100) * 50 + 1;
+	char *data = NULL;
+
+	if ((data = rrr_allocate(data_size)) == NULL) {
+		TEST_MSG("Failed to allocate memory\n");
+		return 1;
+	}
+
+	memset(data, i % 256, data_size);
+
+	if (rrr_msg_holder_new (
+			target,
+			(ssize_t) data_size,
+			(i % 2 == 0 ? (struct sockaddr *) &addr : NULL),
+			(i % 2 == 0 ? sizeof(addr) : 0),
+			i,
+			data
+	) != 0) {
+		TEST_MSG("Failed to create message holder\n");
+		rrr_free(data);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __rrr_test_msg_holder_spill_write (
+		struct rrr_msg_holder_spill *spill,
+		int count
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder *entry = NULL;
+
+	for (int i = 0; i < count; i++) {
+		if ((ret = __rrr_test_msg_holder_new_numbered(&entry, i)) != 0) {
+			goto out;
+		}
+
+		rrr_msg_holder_lock(entry);
+		ret = rrr_msg_holder_spill_write(spill, entry);
+		rrr_msg_holder_unlock(entry);
+		rrr_msg_holder_decref(entry);
+
+		if (ret != 0) {
+			TEST_MSG("Failed to write to spill\n");
+			goto out;
+		}
+	}
+
+	out:
+	return ret;
+}
+
+static int __rrr_test_msg_holder_check_numbered (
+		const void *data,
+		size_t data_size,
+		const struct sockaddr *addr,
+		socklen_t addr_len,
+		int protocol,
+		int i
+) {
+	const unsigned char *bytes = data;
+
+	if (protocol != i || data_size != (size_t) (i % 100) * 50 + 1) {
+		TEST_MSG("Entry %i had wrong protocol or size\n", i);
+		return 1;
+	}
+
+	for (size_t j = 0; j < data_size; j++) {
+		if (bytes[j] != i % 256) {
+			TEST_MSG("Entry %i had wrong data\n", i);
+			return 1;
+		}
+	}
+
+	if (i % 2 == 0) {
+		if (addr_len != sizeof(struct sockaddr_in) || ((const struct sockaddr_in *) addr)->sin_port != htons((uint16_t) i)) {
+			TEST_MSG("Entry %i had wrong address\n", i);
+			return 1;
+		}
+	}
+	else if (addr_len != 0) {
+		TEST_MSG("Entry %i had address, expected none\n", i);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __rrr_test_msg_holder_spill_read_callback (
+		const void *data,
+		size_t data_size,
+		const struct sockaddr *addr,
+		socklen_t addr_len,
+		int protocol,
+		void *arg
+) {
+	int *pos = arg;
+
+	if (__rrr_test_msg_holder_check_numbered(data, data_size, addr, addr_len, protocol, *pos) != 0) {
+		TEST_MSG("Entry read from spill was invalid\n");
+		return 1;
+	}
+
+	(*pos)++;
+
+	return 0;
+}
+
+static int __rrr_test_msg_holder_spill (void) {
+	int ret = 0;
+
+	struct rrr_msg_holder_spill *spill = NULL;
+	struct rrr_msg_holder_spill_stats stats;
+	int pos = 0;
+
+	if ((ret = rrr_msg_holder_spill_new(&spill, "/tmp", "test", RRR_TEST_MSG_HOLDER_SPILL_SEGMENT_SIZE)) != 0) {
+		TEST_MSG("Failed to create spill\n");
+		goto out;
+	}
+
+	// Reads are done in between writes to have the first segment
+	// read from while the others are written to
+	if ((ret = __rrr_test_msg_holder_spill_write(spill, RRR_TEST_MSG_HOLDER_ENTRIES / 2)) != 0) {
+		goto out_destroy;
+	}
+
+	if ((ret = rrr_msg_holder_spill_read(spill, 10, __rrr_test_msg_holder_spill_read_callback, &pos)) != 0) {
+		goto out_destroy;
+	}
+
+	if ((ret = __rrr_test_msg_holder_spill_write(spill, RRR_TEST_MSG_HOLDER_ENTRIES / 2)) != 0) {
+		goto out_destroy;
+	}
+
+	// The second half was written with the same sequence as the first
+	// half, check it separately
+	if ((ret = rrr_msg_holder_spill_read(spill, RRR_TEST_MSG_HOLDER_ENTRIES / 2 - 10, __rrr_test_msg_holder_spill_read_callback, &pos)) != 0) {
+		goto out_destroy;
+	}
+
+	pos = 0;
+	if ((ret = rrr_msg_holder_spill_read(spill, RRR_TEST_MSG_HOLDER_ENTRIES, __rrr_test_msg_holder_spill_read_callback, &pos)) != 0) {
+		goto out_destroy;
+	}
+
+	rrr_msg_holder_spill_get_stats(&stats, spill);
+
+	if (pos != RRR_TEST_MSG_HOLDER_ENTRIES / 2 || rrr_msg_holder_spill_count(spill) != 0) {
+		TEST_MSG("%" PRIu64 " entries left in spill after reading, expected none\n", rrr_msg_holder_spill_count(spill));
+		ret = 1;
+		goto out_destroy;
+	}
+
+	if (stats.total_segments < 2 || stats.total_written != RRR_TEST_MSG_HOLDER_ENTRIES || stats.total_read != RRR_TEST_MSG_HOLDER_ENTRIES) {
+		TEST_MSG("Unexpected spill stats, %" PRIu64 " segments %" PRIu64 " written %" PRIu64 " read\n",
+				stats.total_segments, stats.total_written, stats.total_read);
+		ret = 1;
+		goto out_destroy;
+	}
+
+	out_destroy:
+		rrr_msg_holder_spill_destroy(spill);
+	out:
+		return ret;
+}
+
+static int __rrr_test_msg_holder_wal_open (
+		struct rrr_msg_holder_wal **wal,
+		struct rrr_msg_holder_collection *replayed,
+		uint64_t sync_interval_us
+) {
+	if (rrr_msg_holder_wal_new (
+			wal,
+			replayed,
+			RRR_TEST_MSG_HOLDER_WAL_DIRECTORY,
+			RRR_TEST_MSG_HOLDER_WAL_NAME,
+			RRR_TEST_MSG_HOLDER_SPILL_SEGMENT_SIZE,
+			sync_interval_us
+	) != 0) {
+		TEST_MSG("Failed to create write-ahead log\n");
+		return 1;
+	}
+	return 0;
+}
+
+static void __rrr_test_msg_holder_wal_ack_all (
+		struct rrr_msg_holder_wal *wal,
+		struct rrr_msg_holder_collection *replayed
+) {
+	RRR_LL_ITERATE_BEGIN(replayed, struct rrr_msg_holder);
+		rrr_msg_holder_wal_ack(wal, node->wal_seq);
+	RRR_LL_ITERATE_END();
+	rrr_msg_holder_collection_clear(replayed);
+}
+
+// Acknowledges all entries left by previous runs, which deletes the files
+static int __rrr_test_msg_holder_wal_clear (void) {
+	struct rrr_msg_holder_wal *wal = NULL;
+	struct rrr_msg_holder_collection replayed = {0};
+
+	if (__rrr_test_msg_holder_wal_open(&wal, &replayed, 0) != 0) {
+		return 1;
+	}
+
+	__rrr_test_msg_holder_wal_ack_all(wal, &replayed);
+	rrr_msg_holder_wal_destroy(wal);
+
+	return 0;
+}
+
+// Entries in the first half are acknowledged before the log is closed, all entries
+// in the second half must be replayed when it is opened again.
+static int __rrr_test_msg_holder_wal (void) {
+	int ret = 0;
+
+	struct rrr_msg_holder_wal *wal = NULL;
+	struct rrr_msg_holder_collection replayed = {0};
+	struct rrr_msg_holder *entry = NULL;
+	struct rrr_msg_holder_wal_stats stats;
+	uint64_t seqs[RRR_TEST_MSG_HOLDER_ENTRIES];
+	int found[RRR_TEST_MSG_HOLDER_ENTRIES] = {0};
+
+	if ((ret = __rrr_test_msg_holder_wal_clear()) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_holder_wal_open(&wal, &replayed, 0)) != 0) {
+		goto out;
+	}
+
+	if (RRR_LL_COUNT(&replayed) != 0) {
+		TEST_MSG("%i entries replayed from empty write-ahead log\n", RRR_LL_COUNT(&replayed));
+		ret = 1;
+		goto out_destroy;
+	}
+
+	for (int i = 0; i < RRR_TEST_MSG_HOLDER_ENTRIES; i++) {
+		if ((ret = __rrr_test_msg_holder_new_numbered(&entry, i)) != 0) {
+			goto out_destroy;
+		}
+
+		rrr_msg_holder_lock(entry);
+		ret = rrr_msg_holder_wal_append(wal, entry);
+		seqs[i] = entry->wal_seq;
+		rrr_msg_holder_unlock(entry);
+		rrr_msg_holder_decref(entry);
+
+		if (ret != 0) {
+			TEST_MSG("Failed to append to write-ahead log\n");
+			goto out_destroy;
+		}
+
+		if ((i + 1) % RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY == 0 && (ret = rrr_msg_holder_wal_commit(wal)) != 0) {
+			TEST_MSG("Failed to commit write-ahead log\n");
+			goto out_destroy;
+		}
+	}
+
+	for (int i = 0; i < RRR_TEST_MSG_HOLDER_ENTRIES / 2; i++) {
+		rrr_msg_holder_wal_ack(wal, seqs[i]);
+	}
+
+	rrr_msg_holder_wal_get_stats(&stats, wal);
+
+	if (stats.total_appended != RRR_TEST_MSG_HOLDER_ENTRIES || stats.total_acked != RRR_TEST_MSG_HOLDER_ENTRIES / 2 || stats.segments < 2) {
+		TEST_MSG("Unexpected write-ahead log stats, %" PRIu64 " appended %" PRIu64 " acked %" PRIu64 " segments\n",
+				stats.total_appended, stats.total_acked, stats.segments);
+		ret = 1;
+		goto out_destroy;
+	}
+
+	rrr_msg_holder_wal_destroy(wal);
+
+	if ((ret = __rrr_test_msg_holder_wal_open(&wal, &replayed, 0)) != 0) {
+		goto out;
+	}
+
+	RRR_LL_ITERATE_BEGIN(&replayed, struct rrr_msg_holder);
+		const int i = node->protocol;
+		if (i < 0 || i >= RRR_TEST_MSG_HOLDER_ENTRIES || found[i]) {
+			TEST_MSG("Unexpected entry %i replayed from write-ahead log\n", i);
+			ret = 1;
+			goto out_destroy;
+		}
+		if ((ret = __rrr_test_msg_holder_check_numbered (
+				node->message,
+				(size_t) node->data_length,
+				(const struct sockaddr *) node->addr,
+				node->addr_len,
+				node->protocol,
+				i
+		)) != 0) {
+			TEST_MSG("Entry replayed from write-ahead log was invalid\n");
+			goto out_destroy;
+		}
+		found[i] = 1;
+	RRR_LL_ITERATE_END();
+
+	for (int i = RRR_TEST_MSG_HOLDER_ENTRIES / 2; i < RRR_TEST_MSG_HOLDER_ENTRIES; i++) {
+		if (!found[i]) {
+			TEST_MSG("Entry %i not acknowledged was not replayed from write-ahead log\n", i);
+			ret = 1;
+			goto out_destroy;
+		}
+	}
+
+	// Fully acknowledged segments must have been deleted
+	if (RRR_LL_COUNT(&replayed) == RRR_TEST_MSG_HOLDER_ENTRIES) {
+		TEST_MSG("All entries were replayed from write-ahead log, none were deleted\n");
+		ret = 1;
+		goto out_destroy;
+	}
+
+	__rrr_test_msg_holder_wal_ack_all(wal, &replayed);
+	rrr_msg_holder_wal_destroy(wal);
+
+	if ((ret = __rrr_test_msg_holder_wal_open(&wal, &replayed, 0)) != 0) {
+		goto out;
+	}
+
+	if (RRR_LL_COUNT(&replayed) != 0) {
+		TEST_MSG("%i entries replayed after all were acknowledged\n", RRR_LL_COUNT(&replayed));
+		ret = 1;
+		goto out_destroy;
+	}
+
+	out_destroy:
+		__rrr_test_msg_holder_wal_ack_all(wal, &replayed);
+		rrr_msg_holder_wal_destroy(wal);
+	out:
+		return ret;
+}
+
+static int __rrr_test_msg_holder_wal_append_numbered (
+		struct rrr_msg_holder_wal *wal,
+		int from,
+		int to
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder *entry = NULL;
+
+	for (int i = from; i < to; i++) {
+		if ((ret = __rrr_test_msg_holder_new_numbered(&entry, i)) != 0) {
+			break;
+		}
+
+		rrr_msg_holder_lock(entry);
+		ret = rrr_msg_holder_wal_append(wal, entry);
+		rrr_msg_holder_unlock(entry);
+		rrr_msg_holder_decref(entry);
+
+		if (ret != 0) {
+			TEST_MSG("Failed to append to write-ahead log\n");
+			break;
+		}
+	}
+
+	return ret;
+}
+
+// The file size limit makes the first commit fail after writing part of the
+// records. All records must be replayed after they are committed again.
+static int __rrr_test_msg_holder_wal_failed_commit (void) {
+	int ret = 0;
+
+	struct rrr_msg_holder_wal *wal = NULL;
+	struct rrr_msg_holder_collection replayed = {0};
+	int found[RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY * 2] = {0};
+
+	if ((ret = __rrr_test_msg_holder_wal_clear()) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_holder_wal_open(&wal, &replayed, 0)) != 0) {
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_holder_wal_append_numbered(wal, 0, RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY)) != 0) {
+		goto out_destroy;
+	}
+
+	{
+		struct rlimit limit_orig;
+		struct sigaction action_orig;
+		struct sigaction action = {0};
+
+		if (getrlimit(RLIMIT_FSIZE, &limit_orig) != 0) {
+			TEST_MSG("Failed to get file size limit\n");
+			ret = 1;
+			goto out_destroy;
+		}
+
+		struct rlimit limit = limit_orig;
+		limit.rlim_cur = RRR_TEST_MSG_HOLDER_WAL_FILE_LIMIT;
+
+		// Writes beyond the limit fail with EFBIG instead of raising the signal
+		action.sa_handler = SIG_IGN;
+		sigaction(SIGXFSZ, &action, &action_orig);
+
+		if (setrlimit(RLIMIT_FSIZE, &limit) != 0) {
+			TEST_MSG("Failed to set file size limit\n");
+			ret = 1;
+		}
+		else {
+			ret = rrr_msg_holder_wal_commit(wal) == 0;
+			setrlimit(RLIMIT_FSIZE, &limit_orig);
+		}
+
+		sigaction(SIGXFSZ, &action_orig, NULL);
+
+		if (ret != 0) {
+			TEST_MSG("Commit to write-ahead log did not fail with file size limit set\n");
+			goto out_destroy;
+		}
+	}
+
+	if ((ret = rrr_msg_holder_wal_commit(wal)) != 0) {
+		TEST_MSG("Commit to write-ahead log failed after failed commit\n");
+		goto out_destroy;
+	}
+
+	if ((ret = __rrr_test_msg_holder_wal_append_numbered(wal, RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY, RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY * 2)) != 0) {
+		goto out_destroy;
+	}
+
+	if ((ret = rrr_msg_holder_wal_commit(wal)) != 0) {
+		TEST_MSG("Failed to commit write-ahead log\n");
+		goto out_destroy;
+	}
+
+	rrr_msg_holder_wal_destroy(wal);
+
+	if ((ret = __rrr_test_msg_holder_wal_open(&wal, &replayed, 0)) != 0) {
+		goto out;
+	}
+
+	RRR_LL_ITERATE_BEGIN(&replayed, struct rrr_msg_holder);
+		const int i = node->protocol;
+		if (i < 0 || i >= RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY * 2 || found[i]) {
+			TEST_MSG("Unexpected entry %i replayed from write-ahead log after failed commit\n", i);
+			ret = 1;
+			goto out_destroy;
+		}
+		if ((ret = __rrr_test_msg_holder_check_numbered (
+				node->message,
+				(size_t) node->data_length,
+				(const struct sockaddr *) node->addr,
+				node->addr_len,
+				node->protocol,
+				i
+		)) != 0) {
+			TEST_MSG("Entry replayed from write-ahead log after failed commit was invalid\n");
+			goto out_destroy;
+		}
+		found[i] = 1;
+	RRR_LL_ITERATE_END();
+
+	if (RRR_LL_COUNT(&replayed) != RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY * 2) {
+		TEST_MSG("%i of %i entries replayed from write-ahead log after failed commit\n",
+				RRR_LL_COUNT(&replayed), RRR_TEST_MSG_HOLDER_WAL_COMMIT_EVERY * 2);
+		ret = 1;
+		goto out_destroy;
+	}
+
+	out_destroy:
+		__rrr_test_msg_holder_wal_ack_all(wal, &replayed);
+		rrr_msg_holder_wal_destroy(wal);
+	out:
+		return ret;
+}
+
+// Commit per batch of entries with sync in the committing thread or in the background
+static int __rrr_test_msg_holder_wal_benchmark (
+		uint64_t *msgs_per_second,
+		int batch_size,
+		uint64_t sync_interval_us
+) {
+	int ret = 0;
+
+	struct rrr_msg_holder_wal *wal = NULL;
+	struct rrr_msg_holder_collection replayed = {0};
+	struct rrr_msg_holder *entry = NULL;
+	uint64_t seqs[RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_MSGS];
+	char *data = NULL;
+
+	if ((data = rrr_allocate(RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_SIZE)) == NULL) {
+		TEST_MSG("Failed to allocate memory\n");
+		ret = 1;
+		goto out;
+	}
+
+	memset(data, 'a', RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_SIZE);
+
+	if ((ret = rrr_msg_holder_new(&entry, RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_SIZE, NULL, 0, 0, data)) != 0) {
+		TEST_MSG("Failed to create message holder\n");
+		rrr_free(data);
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_holder_wal_open(&wal, &replayed, sync_interval_us)) != 0) {
+		goto out_decref;
+	}
+
+	uint64_t time_start = rrr_time_get_64();
+
+	rrr_msg_holder_lock(entry);
+	for (int i = 0; i < RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_MSGS; i++) {
+		if ((ret = rrr_msg_holder_wal_append(wal, entry)) != 0) {
+			break;
+		}
+		seqs[i] = entry->wal_seq;
+		if (((i + 1) % batch_size == 0 || i + 1 == RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_MSGS) &&
+		    (ret = rrr_msg_holder_wal_commit(wal)) != 0
+		) {
+			break;
+		}
+	}
+	rrr_msg_holder_unlock(entry);
+
+	if (ret != 0) {
+		TEST_MSG("Failed to write to write-ahead log\n");
+		goto out_destroy;
+	}
+
+	uint64_t time_us = rrr_time_get_64() - time_start;
+	*msgs_per_second = RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_MSGS * 1000000ULL / (time_us > 0 ? time_us : 1);
+
+	for (int i = 0; i < RRR_TEST_MSG_HOLDER_WAL_BENCHMARK_MSGS; i++) {
+		rrr_msg_holder_wal_ack(wal, seqs[i]);
+	}
+
+	out_destroy:
+		__rrr_test_msg_holder_wal_ack_all(wal, &replayed);
+		rrr_msg_holder_wal_destroy(wal);
+	out_decref:
+		rrr_msg_holder_decref(entry);
+	out:
+		return ret;
+}
+
+int rrr_test_msg_holder_spill (void) {
+	int ret = 0;
+
+	if ((ret = __rrr_test_msg_holder_spill()) != 0) {
+		TEST_MSG("Message holder spill test failed\n");
+	}
+
+	rrr_msg_holder_pool_cleanup();
+	return ret;
+}
+
+int rrr_test_msg_holder_wal (void) {
+	int ret = 0;
+
+	if ((ret = __rrr_test_msg_holder_wal()) != 0) {
+		TEST_MSG("Message holder write-ahead log test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_holder_wal_failed_commit()) != 0) {
+		TEST_MSG("Message holder write-ahead log failed commit test failed\n");
+		goto out;
+	}
+
+	{
+		static const int batch_sizes[] = {1, 16, 255};
+		static const uint64_t sync_intervals_us[] = {0, 10000};
+
+		for (size_t i = 0; i < sizeof(sync_intervals_us) / sizeof(sync_intervals_us[0]); i++) {
+			for (size_t j = 0; j < sizeof(batch_sizes) / sizeof(batch_sizes[0]); j++) {
+				uint64_t msgs_per_second = 0;
+				if ((ret = __rrr_test_msg_holder_wal_benchmark(&msgs_per_second, batch_sizes[j], sync_intervals_us[i])) != 0) {
+					TEST_MSG("Message holder write-ahead log benchmark failed\n");
+					goto out;
+				}
+				TEST_MSG("Write-ahead log sync interval %" PRIu64 " ms batch size %i: %" PRIu64 " msgs/s\n",
+						sync_intervals_us[i] / 1000, batch_sizes[j], msgs_per_second);
+			}
+		}
+	}
+
+	out:
+	rrr_msg_holder_pool_cleanup();
+	return ret;
+}
+
+int rrr_test_msg_holder (void) {
+	int ret = 0;
+
+	uint64_t time_pool = 0;
+	uint64_t time_no_pool = 0;
+	struct rrr_msg_holder_pool_stats stats_before;
+	struct rrr_msg_holder_pool_stats stats_after;
+
+	if ((ret = __rrr_test_msg_holder_reuse()) != 0) {
+		TEST_MSG("Message holder reuse test failed\n");
+		goto out;
+	}
+
+	if ((ret = __rrr_test_msg_holder_benchmark_pool(&time_no_pool, 0)) != 0) {
+		TEST_MSG("Message holder benchmark failed without pool\n");
+		goto out;
+	}
+
+	rrr_msg_holder_pool_get_stats(&stats_before);
+
+	if ((ret = __rrr_test_msg_holder_benchmark_pool(&time_pool, 1)) != 0) {
+		TEST_MSG("Message holder benchmark failed with pool\n");
+		goto out;
+	}
+
+	rrr_msg_holder_pool_get_stats(&stats_after);
+
+	TEST_MSG("%i x %i holders, without pool %" PRIu64 " ms, with pool %" PRIu64 " ms and %" PRIu64 " allocations... ",
+			RRR_TEST_MSG_HOLDER_BENCHMARK_ROUNDS,
+			RRR_TEST_MSG_HOLDER_ENTRIES,
+			time_no_pool / 1000,
+			time_pool / 1000,
+			stats_after.total_misses - stats_before.total_misses
+	);
+
+	out:
+	rrr_msg_holder_pool_cleanup();
+	return ret;
+}
@@ -0,0 +1,276 @@
+/*
+
+Read Route Record
+
+Copyright (C) 2021 Atle Solbakken atle@goliathdns.no
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "../lib/log.h"
+#include "../lib/allocator.h"
+#include "../lib/type.h"
+#include "../lib/type_scan.h"
+#include "../lib/array.h"
+#include "../lib/array_tree.h"
+#include "../lib/util/rrr_time.h"
+#include "../lib/util/macro_utils.h"
+#include "test.h"
+#include "test_type_scan.h"
+
+#define RRR_TEST_TYPE_SCAN_MAX_LENGTH      100
+#define RRR_TEST_TYPE_SCAN_RANDOM_ROUNDS   20000
+#define RRR_TEST_TYPE_SCAN_BENCHMARK_SIZE  (4 * 1024 * 1024)
+#define RRR_TEST_TYPE_SCAN_LINE_LENGTH     160
+
+static const char *rrr_test_type_scan_level_names[] = {"scalar", "sse2", "avx2"};
+
+static rrr_length __rrr_test_type_scan_not_sep_reference (const char *buf, rrr_length len) {
+	rrr_length pos = 0;
+	for (; pos < len && RRR_TYPE_CHAR_IS_SEP(buf[pos]); pos++) {
+	}
+	return pos;
+}
+
+static rrr_length __rrr_test_type_scan_nsep_end_reference (const char *buf, rrr_length len) {
+	rrr_length pos = 0;
+	for (; pos < len && !(RRR_TYPE_CHAR_IS_SEP_A(buf[pos]) || RRR_TYPE_CHAR_IS_SEP_F(buf[pos])); pos++) {
+	}
+	return pos;
+}
+
+static rrr_length __rrr_test_type_scan_quote_or_escape_reference (const char *buf, rrr_length len) {
+	rrr_length pos = 0;
+	for (; pos < len && buf[pos] != '"' && buf[pos] != '\\'; pos++) {
+	}
+	return pos;
+}
+
+struct rrr_test_type_scan_function {
+	const char *name;
+	rrr_length (*scan)(const char *buf, rrr_length len);
+	rrr_length (*reference)(const char *buf, rrr_length len);
+	char filler;
+};
+
+static const struct rrr_test_type_scan_function rrr_test_type_scan_functions[] = {
+	{"not_sep",         rrr_type_scan_not_sep,         __rrr_test_type_scan_not_sep_reference,         ';'},
+	{"nsep_end",        rrr_type_scan_nsep_end,        __rrr_test_type_scan_nsep_end_reference,        'a'},
+	{"quote_or_escape", rrr_type_scan_quote_or_escape, __rrr_test_type_scan_quote_or_escape_reference, 'a'}
+};
+
+static int __rrr_test_type_scan_check (
+		const struct rrr_test_type_scan_function *function,
+		const char *buf,
+		rrr_length len
+) {
+	rrr_length result = function->scan(buf, len);
+	rrr_length expected = function->reference(buf, len);
+
+	if (result != expected) {
+		TEST_MSG("Scan %s at level %s returned %" PRIrrrl " while %" PRIrrrl " was expected for length %" PRIrrrl "\n",
+				function->name,
+				rrr_test_type_scan_level_names[rrr_type_scan_level_get()],
+				result,
+				expected,
+				len
+		);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int __rrr_test_type_scan_level (
+		const struct rrr_test_type_scan_function *function
+) {
+	// Unaligned start and data beyond the length must not affect results
+	char buf[RRR_TEST_TYPE_SCAN_MAX_LENGTH + 64];
+	uint32_t random = 1;
+
+	// Every byte value at every position
+	for (int c = 0; c < 256; c++) {
+		for (rrr_length pos = 0; pos < 70; pos++) {
+			memset(buf, function->filler, sizeof(buf));
+			buf[pos + 1] = (char) c;
+			for (rrr_length len = pos; len <= pos + 1; len++) {
+				if (__rrr_test_type_scan_check(function, buf + 1, len) != 0) {
+					return 1;
+				}
+			}
+		}
+	}
+
+	// Random data where most bytes are filler
+	for (int i = 0; i < RRR_TEST_TYPE_SCAN_RANDOM_ROUNDS; i++) {
+		for (size_t j = 0; j < sizeof(buf); j++) {
+			const uint32_t r = rrr_test_random(&random);
+			buf[j] = (r % 32 == 0) ? (char) (r >> 5) : function->filler;
+		}
+		const rrr_length offset = rrr_test_random(&random) % 32;
+		const rrr_length len = rrr_test_random(&random) % RRR_TEST_TYPE_SCAN_MAX_LENGTH;
+		if (__rrr_test_type_scan_check(function, buf + offset, len) != 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int __rrr_test_type_scan_import_callback (
+		struct rrr_array *array,
+		void *arg
+) {
+	(void)(array);
+	(void)(arg);
+	return 0;
+}
+
+static int __rrr_test_type_scan_import_benchmark (
+		uint64_t *bytes_per_second,
+		const char *definition,
+		const char *input,
+		rrr_length input_length,
+		int expected_values
+) {
+	int ret = 0;
+
+	struct rrr_array_tree *tree = NULL;
+	int value_count = 0;
+
+	if ((ret = rrr_array_tree_interpret_raw(&tree, definition, (int) strlen(definition), "benchmark")) != 0) {
+		TEST_MSG("Failed to parse array tree in benchmark\n");
+		goto out;
+	}
+
+	uint64_t time_start = rrr_time_get_64();
+	for (rrr_length pos = 0; pos < input_length; ) {
+		ssize_t parsed_bytes = 0;
+		if ((ret = rrr_array_tree_import_from_buffer (
+				&parsed_bytes,
+				input + pos,
+				(ssize_t) (input_length - pos),
+				tree,
+				__rrr_test_type_scan_import_callback,
+				NULL
+		)) != 0) {
+			TEST_MSG("Import failed at position %" PRIrrrl " in benchmark\n", pos);
+			goto out;
+		}
+		pos += (rrr_length) parsed_bytes;
+		value_count++;
+	}
+	uint64_t time_total = rrr_time_get_64() - time_start;
+
+	if (value_count != expected_values) {
+		TEST_MSG("Expected %i values in benchmark, got %i\n", expected_values, value_count);
+		ret = 1;
+		goto out;
+	}
+
+	*bytes_per_second = (uint64_t) input_length * 1000000 / (time_total > 0 ? time_total : 1);
+
+	out:
+	if (tree != NULL) {
+		rrr_array_tree_destroy(tree);
+	}
+	return ret;
+}
+
+static int __rrr_test_type_scan_benchmark (void) {
+	int ret = 0;
+
+	char *nsep_input = NULL;
+	char *str_input = NULL;
+
+	const int line_count = RRR_TEST_TYPE_SCAN_BENCHMARK_SIZE / RRR_TEST_TYPE_SCAN_LINE_LENGTH;
+	const rrr_length input_length = (rrr_length) line_count * RRR_TEST_TYPE_SCAN_LINE_LENGTH;
+
+	if ((nsep_input = rrr_allocate(input_length)) == NULL || (str_input = rrr_allocate(input_length)) == NULL) {
+		TEST_MSG("Could not allocate memory in __rrr_test_type_scan_benchmark\n");
+		ret = 1;
+		goto out;
+	}
+
+	// Lines of text ending with CRLF and quoted strings followed by LF
+	for (int i = 0; i < line_count; i++) {
+		char *nsep_line = nsep_input + i * RRR_TEST_TYPE_SCAN_LINE_LENGTH;
+		char *str_line = str_input + i * RRR_TEST_TYPE_SCAN_LINE_LENGTH;
+		for (int j = 0; j < RRR_TEST_TYPE_SCAN_LINE_LENGTH; j++) {
+			nsep_line[j] = str_line[j] = (char) ('a' + (i + j) % 26);
+		}
+		nsep_line[RRR_TEST_TYPE_SCAN_LINE_LENGTH - 2] = '\r';
+		nsep_line[RRR_TEST_TYPE_SCAN_LINE_LENGTH - 1] = '\n';
+		str_line[0] = '"';
+		str_line[RRR_TEST_TYPE_SCAN_LINE_LENGTH - 2] = '"';
+		str_line[RRR_TEST_TYPE_SCAN_LINE_LENGTH - 1] = '\n';
+	}
+
+	for (int level = RRR_TYPE_SCAN_LEVEL_SCALAR; level <= RRR_TYPE_SCAN_LEVEL_AVX2; level++) {
+		if (rrr_type_scan_level_set(level) != level) {
+			break;
+		}
+
+		uint64_t nsep_per_second = 0;
+		uint64_t str_per_second = 0;
+
+		if ((ret = __rrr_test_type_scan_import_benchmark(&nsep_per_second, "nsep#line,sep2;", nsep_input, input_length, line_count)) != 0 ||
+		    (ret = __rrr_test_type_scan_import_benchmark(&str_per_second, "str#line,sep1;", str_input, input_length, line_count)) != 0
+		) {
+			goto out;
+		}
+
+		TEST_MSG("Import of %i byte lines at level %s: nsep %" PRIu64 " str %" PRIu64 " MB/s\n",
+				RRR_TEST_TYPE_SCAN_LINE_LENGTH,
+				rrr_test_type_scan_level_names[level],
+				nsep_per_second / 1000000,
+				str_per_second / 1000000
+		);
+	}
+
+	out:
+	RRR_FREE_IF_NOT_NULL(nsep_input);
+	RRR_FREE_IF_NOT_NULL(str_input);
+	return ret;
+}
+
+int rrr_test_type_scan (void) {
+	int ret = 0;
+
+	const int level_orig = rrr_type_scan_level_get();
+
+	for (int level = RRR_TYPE_SCAN_LEVEL_SCALAR; level <= level_orig; level++) {
+		rrr_type_scan_level_set(level);
+		for (size_t i = 0; i < sizeof(rrr_test_type_scan_functions) / sizeof(rrr_test_type_scan_functions[0]); i++) {
+			if ((ret = __rrr_test_type_scan_level(&rrr_test_type_scan_functions[i])) != 0) {
+				goto out;
+			}
+		}
+	}
+
+	if ((ret = __rrr_test_type_scan_benchmark()) != 0) {
+		goto out;
+	}
+
+	out:
+	rrr_type_scan_level_set(level_orig);
+	return ret;
+}